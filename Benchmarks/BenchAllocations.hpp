@@ -0,0 +1,121 @@
+/******************************************************************************\
+* BenchAllocations.hpp                                                         *
+* Counting of heap allocations, for the benchmarks.                            *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#ifndef _DILUCULUM_BENCH_ALLOCATIONS_HPP_
+#define _DILUCULUM_BENCH_ALLOCATIONS_HPP_
+
+// This replaces the global 'operator new' and 'operator delete', so it must be
+// included by a single source file of each benchmark program.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+
+
+namespace Bench
+{
+   /// Statistics about the heap allocations done by the program.
+   struct AllocationStats
+   {
+      /// The number of allocations done so far.
+      std::atomic<std::size_t> count;
+
+      /// The number of bytes currently allocated.
+      std::atomic<std::size_t> bytesInUse;
+
+      /** The largest value of \c bytesInUse since the program started (or
+       *  since the last call to \c ResetPeak()).
+       */
+      std::atomic<std::size_t> peakBytesInUse;
+   };
+
+   /// Returns the allocation statistics for this program.
+   inline AllocationStats& Allocations()
+   {
+      static AllocationStats stats;
+      return stats;
+   }
+
+   /// Makes the peak memory usage equal to the current memory usage.
+   inline void ResetPeak()
+   {
+      Allocations().peakBytesInUse = Allocations().bytesInUse.load();
+   }
+
+   /// Prints a line with the memory used by something.
+   inline void ReportMemory (const std::string& what, std::size_t bytes,
+                             std::size_t items)
+   {
+      std::cout << std::left << std::setw (48) << what << std::right
+                << std::fixed << std::setprecision (1)
+                << std::setw (10) << bytes / (1024.0 * 1024.0) << " MB"
+                << std::setw (12) << static_cast<double>(bytes) / items
+                << " B/item\n";
+   }
+
+   /// The space reserved before each block, to store its size.
+   const std::size_t AllocationHeaderSize = alignof(std::max_align_t);
+
+} // namespace Bench
+
+
+void* operator new (std::size_t size)
+{
+   void* p = std::malloc (size + Bench::AllocationHeaderSize);
+   if (p == 0)
+      throw std::bad_alloc();
+
+   *static_cast<std::size_t*>(p) = size;
+   Bench::AllocationStats& stats = Bench::Allocations();
+   stats.count.fetch_add (1, std::memory_order_relaxed);
+   const std::size_t inUse =
+      stats.bytesInUse.fetch_add (size, std::memory_order_relaxed) + size;
+
+   std::size_t peak = stats.peakBytesInUse.load (std::memory_order_relaxed);
+   while (inUse > peak
+          && !stats.peakBytesInUse.compare_exchange_weak (peak, inUse))
+   { }
+
+   return static_cast<char*>(p) + Bench::AllocationHeaderSize;
+}
+
+
+void operator delete (void* p) noexcept
+{
+   if (p == 0)
+      return;
+
+   p = static_cast<char*>(p) - Bench::AllocationHeaderSize;
+   Bench::Allocations().bytesInUse.fetch_sub (*static_cast<std::size_t*>(p),
+                                              std::memory_order_relaxed);
+   std::free (p);
+}
+
+#endif // _DILUCULUM_BENCH_ALLOCATIONS_HPP_
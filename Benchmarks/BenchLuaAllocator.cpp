@@ -0,0 +1,134 @@
+/******************************************************************************\
+* BenchLuaAllocator.cpp                                                        *
+* Benchmarks for the Lua allocators.                                           *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <memory>
+#include <string>
+#include <Diluculum/LuaState.hpp>
+#include "BenchUtils.hpp"
+
+
+namespace
+{
+   using namespace Diluculum;
+
+   /// The allocation policies benchmarked.
+   enum Policy { DEFAULT, MALLOC, POOL, ARENA };
+
+   /// The names of the policies.
+   const char* ThePolicyNames[] = {
+      "luaL_newstate()", "MallocLuaAllocator", "PoolLuaAllocator",
+      "ArenaLuaAllocator" };
+
+   /// Creates a \c LuaState using the allocation policy \c policy.
+   std::unique_ptr<LuaState> MakeState (Policy policy)
+   {
+      switch (policy)
+      {
+         case MALLOC:
+            return std::unique_ptr<LuaState> (new LuaState (
+               std::unique_ptr<LuaAllocator> (new MallocLuaAllocator())));
+         case POOL:
+            return std::unique_ptr<LuaState> (new LuaState (
+               std::unique_ptr<LuaAllocator> (new PoolLuaAllocator())));
+         case ARENA:
+            return std::unique_ptr<LuaState> (new LuaState (
+               std::unique_ptr<LuaAllocator> (new ArenaLuaAllocator())));
+         default:
+            return std::unique_ptr<LuaState> (new LuaState());
+      }
+   }
+
+
+
+   /** Runs \c code (which is expected to do \c ops operations) in a fresh
+    *  Lua state using each of the policies, and reports the time taken and
+    *  the peak memory used.
+    */
+   void BenchWorkload (const std::string& code, std::size_t ops)
+   {
+      for (int p = DEFAULT; p <= ARENA; ++p)
+      {
+         std::size_t peak = 0;
+         const double t = Bench::BestOf (5, [&]() {
+            std::unique_ptr<LuaState> ls = MakeState (static_cast<Policy>(p));
+            ls->doString (code);
+            peak = ls->memoryStats().peakBytes;
+         });
+
+         std::string what = ThePolicyNames[p];
+         if (peak > 0)
+            what += " (peak " + std::to_string (peak / 1024) + " KiB)";
+
+         Bench::Report (what, t, ops);
+      }
+   }
+
+
+
+   /** Creates \c count short-lived Lua states (with the standard library)
+    *  using each of the policies, running a small script in each.
+    */
+   void BenchShortLivedStates (std::size_t count)
+   {
+      for (int p = DEFAULT; p <= ARENA; ++p)
+      {
+         const double t = Bench::BestOf (5, [&]() {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+               std::unique_ptr<LuaState> ls =
+                  MakeState (static_cast<Policy>(p));
+               ls->doString ("local t = { } "
+                             "for i = 1, 100 do t[i] = { id = i } end");
+            }
+         });
+
+         Bench::Report (ThePolicyNames[p], t, count);
+      }
+   }
+
+} // (anonymous) namespace
+
+
+
+// - main ----------------------------------------------------------------------
+int main()
+{
+   Bench::Section ("Creating many small tables (1M tables)");
+   BenchWorkload ("for i = 1, 1000000 do local t = { i, x = i } end",
+                  1000000);
+
+   Bench::Section ("Building strings (200k concatenations)");
+   BenchWorkload ("local t = { } "
+                  "for i = 1, 200000 do t[#t + 1] = 'item ' .. i end",
+                  200000);
+
+   Bench::Section ("Growing a large table (1M elements)");
+   BenchWorkload ("local t = { } for i = 1, 1000000 do t[i] = i end",
+                  1000000);
+
+   Bench::Section ("Short-lived states (2k states)");
+   BenchShortLivedStates (2000);
+}
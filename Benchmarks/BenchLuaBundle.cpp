@@ -0,0 +1,131 @@
+/******************************************************************************\
+* BenchLuaBundle.cpp                                                           *
+* Benchmarks for loading modules from bundles.                                 *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include <Diluculum/LuaBundle.hpp>
+#include <Diluculum/LuaState.hpp>
+#include "BenchUtils.hpp"
+
+
+namespace
+{
+   /** Creates the source code of a module with \c n functions, a bit like
+    *  a typical helper module.
+    */
+   std::string MakeModule (int n)
+   {
+      std::string code = "local M = { }\n";
+      for (int i = 0; i < n; ++i)
+      {
+         const std::string name = "f" + std::to_string (i);
+         code += "function M." + name + " (t, x)\n"
+            + "   local r = { }\n"
+            + "   for k, v in pairs (t) do\n"
+            + "      if type (v) == 'number' then r[k] = v * x + "
+            + std::to_string (i) + "\n"
+            + "      elseif type (v) == 'string' then r[k] = v .. '"
+            + name + "'\n"
+            + "      else r[k] = tostring (v) end\n"
+            + "   end\n"
+            + "   return r\n"
+            + "end\n";
+      }
+      return code + "return M\n";
+   }
+
+
+
+   /// Returns the code that requires all the modules.
+   std::string MakeRequires (int numModules)
+   {
+      std::string code;
+      for (int i = 0; i < numModules; ++i)
+         code += "require 'BenchBundleModule" + std::to_string (i) + "'\n";
+      return code;
+   }
+
+} // (anonymous) namespace
+
+
+
+// - main ----------------------------------------------------------------------
+int main()
+{
+   using Diluculum::LuaBundle;
+   using Diluculum::LuaState;
+
+   const int numModules = 40;
+   const int functionsPerModule = 50;
+   const int reps = 20;
+
+   // Write the modules as Lua files and as a bundle
+   std::map<std::string, std::string> modules;
+   std::vector<std::string> fileNames;
+   for (int i = 0; i < numModules; ++i)
+   {
+      const std::string name = "BenchBundleModule" + std::to_string (i);
+      fileNames.push_back (name + ".lua");
+      std::ofstream (fileNames.back().c_str())
+         << MakeModule (functionsPerModule);
+      modules[name] = LuaBundle::compile (fileNames.back());
+   }
+
+   LuaBundle::write ("BenchBundle.bundle", modules);
+
+   const std::string requireAll = MakeRequires (numModules);
+
+   Bench::Section ("Cold start: new LuaState, requiring "
+                   + std::to_string (numModules) + " modules");
+
+   double t = Bench::BestOf (5, [&]() {
+      for (int i = 0; i < reps; ++i)
+      {
+         LuaState ls;
+         ls.doString ("package.path = './?.lua'");
+         ls.doString (requireAll);
+      }
+   });
+   Bench::Report ("from Lua source files", t, reps);
+
+   t = Bench::BestOf (5, [&]() {
+      for (int i = 0; i < reps; ++i)
+      {
+         LuaState ls;
+         ls.addBundle ("BenchBundle.bundle");
+         ls.doString (requireAll);
+      }
+   });
+   Bench::Report ("from a bytecode bundle", t, reps);
+
+   // Clean up
+   for (std::size_t i = 0; i < fileNames.size(); ++i)
+      std::remove (fileNames[i].c_str());
+   std::remove ("BenchBundle.bundle");
+}
@@ -0,0 +1,206 @@
+/******************************************************************************\
+* BenchLuaFunction.cpp                                                         *
+* Benchmarks for converting Lua functions to 'LuaFunction's.                   *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <boost/scoped_array.hpp>
+#include <Diluculum/LuaState.hpp>
+#include "BenchUtils.hpp"
+
+
+namespace Diluculum
+{
+   namespace Impl
+   {
+      // Not part of the public headers; declared here to benchmark it.
+      int LuaFunctionWriter (lua_State* luaState, const void* data,
+                             size_t size, void* func);
+   }
+}
+
+
+
+namespace
+{
+   using Diluculum::LuaFunction;
+
+   /** The \c lua_Writer used by earlier versions of Diluculum. Every chunk
+    *  written causes the whole bytecode to be copied twice, so dumping a
+    *  function takes quadratic time. This is here just to have a baseline to
+    *  compare against.
+    */
+   int LegacyWriter (lua_State*, const void* data, size_t size, void* func)
+   {
+      LuaFunction* f = reinterpret_cast<LuaFunction*>(func);
+
+      size_t newSize = f->getSize() + size;
+      boost::scoped_array<char> buff (new char[newSize]);
+
+      memcpy (buff.get(), f->getData(), f->getSize());
+      memcpy (buff.get() + f->getSize(), data, size);
+
+      f->setData (buff.get(), newSize);
+
+      return 0;
+   }
+
+
+
+   /// Dumps the function on the top of the stack, using a given writer.
+   std::size_t Dump (lua_State* ls, lua_Writer writer)
+   {
+      LuaFunction func ("", 0);
+#if LUA_VERSION_NUM >= 503
+      lua_dump (ls, writer, &func, 0);
+#else
+      lua_dump (ls, writer, &func);
+#endif
+      return func.getSize();
+   }
+
+
+
+   /** Creates the source code of a Lua function with \c n statements (and
+    *  therefore at least as many instructions and constants).
+    */
+   std::string MakeBigFunction (int n)
+   {
+      std::string code = "function big(x)\n   local t = { }\n";
+      for (int i = 0; i < n; ++i)
+      {
+         code += "   t[" + std::to_string (i) + "] = x * "
+            + std::to_string (i) + " + 'k" + std::to_string (i) + "'\n";
+      }
+      return code + "   return t\nend\n";
+   }
+
+
+
+   /** Creates the source code of a Lua module (a table) with \c n functions
+    *  in it.
+    */
+   std::string MakeModule (int n)
+   {
+      std::string code = "module = { }\n";
+      for (int i = 0; i < n; ++i)
+      {
+         const std::string name = "f" + std::to_string (i);
+         code += "function module." + name + "(a, b)\n"
+            + "   if a > b then return a - " + std::to_string (i) + " end\n"
+            + "   return b * " + std::to_string (i) + ", '" + name + "'\n"
+            + "end\n";
+      }
+      return code;
+   }
+
+
+
+   /** Dumps the global function \c name with both the legacy and the current
+    *  writers.
+    */
+   void BenchDump (Diluculum::LuaState& ls, const char* name, int reps)
+   {
+      lua_State* state = ls.getState();
+      lua_getglobal (state, name);
+
+      std::size_t bytes = 0;
+      double t = Bench::BestOf (5, [&]() {
+         for (int i = 0; i < reps; ++i)
+            bytes = Dump (state, LegacyWriter);
+      });
+      Bench::Report ("dump '" + std::string (name) + "', legacy writer ("
+                     + std::to_string (bytes / 1024) + " KiB)", t, reps);
+
+      t = Bench::BestOf (5, [&]() {
+         for (int i = 0; i < reps; ++i)
+            bytes = Dump (state, Diluculum::Impl::LuaFunctionWriter);
+      });
+      Bench::Report ("dump '" + std::string (name) + "', growable buffer ("
+                     + std::to_string (bytes / 1024) + " KiB)", t, reps);
+
+      lua_pop (state, 1);
+   }
+
+
+
+   /** Copies and compares <tt>LuaValue</tt>s holding a large function, which
+    *  used to copy and compare the whole bytecode every time.
+    */
+   void BenchCopyAndCompare (Diluculum::LuaState& ls, const char* name)
+   {
+      const int reps = 100000;
+      const Diluculum::LuaValue func = ls[name].value();
+      const Diluculum::LuaValue sameFunc = ls[name].value();
+      std::size_t equal = 0;
+
+      double t = Bench::BestOf (5, [&]() {
+         for (int i = 0; i < reps; ++i)
+         {
+            Diluculum::LuaValue copy (func);
+            equal += copy == func;
+         }
+      });
+      Bench::Report ("copy '" + std::string (name) + "'", t, reps);
+
+      t = Bench::BestOf (5, [&]() {
+         for (int i = 0; i < reps; ++i)
+            equal += func == sameFunc;
+      });
+      Bench::Report ("compare '" + std::string (name)
+                     + "' with an equal function", t, reps);
+
+      if (equal == 0)
+         std::printf ("(this never happens)\n");
+   }
+
+} // (anonymous) namespace
+
+
+
+// - main ----------------------------------------------------------------------
+int main()
+{
+   Diluculum::LuaState ls;
+
+   Bench::Section ("Dumping functions with lua_dump()");
+   for (int n = 1000; n <= 16000; n *= 4)
+   {
+      ls.doString (MakeBigFunction (n));
+      char name[32];
+      std::sprintf (name, "big%d", n);
+      ls[name] = ls["big"];
+      BenchDump (ls, name, 10);
+   }
+
+   Bench::Section ("Copying and comparing functions");
+   BenchCopyAndCompare (ls, "big16000");
+
+   Bench::Section ("Converting a module with 500 functions (ToLuaValue)");
+   ls.doString (MakeModule (500));
+   const double t = Bench::BestOf (5, [&]() { ls["module"].value(); });
+   Bench::Report ("module to LuaValue", t, 500);
+}
@@ -0,0 +1,126 @@
+/******************************************************************************\
+* BenchLuaProfiler.cpp                                                         *
+* Benchmarks for the profilers.                                                *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <Diluculum/LuaProfiler.hpp>
+#include "BenchUtils.hpp"
+
+
+namespace
+{
+   using namespace Diluculum;
+
+   /// The code profiled: some function calls and table accesses.
+   const char* const TheCode =
+      "local function f(t, i) t[#t + 1] = i * 2 return #t end\n"
+      "local function g(n)\n"
+      "   local t = { }\n"
+      "   for i = 1, n do f(t, i) end\n"
+      "   return t\n"
+      "end\n"
+      "for i = 1, 200 do g(10000) end";
+
+   /// The number of iterations done by \c TheCode.
+   const std::size_t TheIterations = 200 * 10000;
+
+   /** Runs \c TheCode with a profiler sampling every \c period (or without
+    *  a profiler, if \c period is zero).
+    */
+   void BenchSamplingProfiler (std::chrono::microseconds period)
+   {
+      LuaState ls;
+      LuaProfiler profiler (ls, period.count() > 0
+                                ? period
+                                : std::chrono::microseconds (1000));
+      if (period.count() > 0)
+         profiler.start();
+
+      const double t = Bench::BestOf (5, [&]() { ls.doString (TheCode); });
+
+      profiler.stop();
+
+      Bench::Report (period.count() > 0
+                     ? "sampling every " + std::to_string (period.count())
+                       + " us (" + std::to_string (profiler.sampleCount())
+                       + " samples)"
+                     : std::string ("no profiler"),
+                     t, TheIterations);
+   }
+
+
+
+
+   /** Runs \c TheCode with an allocation profiler sampling every
+    *  \c interval bytes (or without a profiler, if \c interval is zero).
+    */
+   void BenchAllocationProfiler (std::size_t interval)
+   {
+      LuaState ls (std::unique_ptr<LuaAllocator> (new PoolLuaAllocator()));
+      LuaAllocationProfiler profiler (ls, interval > 0 ? interval : 1);
+      if (interval > 0)
+         profiler.start();
+
+      const double t = Bench::BestOf (5, [&]() { ls.doString (TheCode); });
+
+      profiler.stop();
+
+      std::size_t samples = 0;
+      for (LuaAllocationSites::const_iterator p = profiler.sites().begin();
+           p != profiler.sites().end(); ++p)
+      {
+         samples += p->second.samples;
+      }
+
+      Bench::Report (interval > 0
+                     ? "sampling every " + std::to_string (interval)
+                       + " bytes (" + std::to_string (samples) + " samples)"
+                     : std::string ("no profiler"),
+                     t, TheIterations);
+   }
+
+} // (anonymous) namespace
+
+
+
+// - main ----------------------------------------------------------------------
+int main()
+{
+   Bench::Section ("Sampling profiler overhead (2M calls)");
+   BenchSamplingProfiler (std::chrono::microseconds (0));
+   BenchSamplingProfiler (std::chrono::microseconds (10000));
+   BenchSamplingProfiler (std::chrono::microseconds (1000)); // the default
+   BenchSamplingProfiler (std::chrono::microseconds (100));
+
+   Bench::Section ("Allocation profiler overhead (2M calls)");
+   BenchAllocationProfiler (0);
+   BenchAllocationProfiler (1024 * 1024);
+   BenchAllocationProfiler (64 * 1024); // the default
+   BenchAllocationProfiler (4 * 1024);
+   BenchAllocationProfiler (1);
+}
@@ -0,0 +1,91 @@
+/******************************************************************************\
+* BenchLuaRef.cpp                                                              *
+* Benchmarks for 'LuaRef'.                                                     *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <Diluculum/LuaState.hpp>
+#include "BenchUtils.hpp"
+
+
+namespace
+{
+   using Diluculum::LuaRef;
+   using Diluculum::LuaState;
+
+   /** Calls a function \c reps times, reached through a \c LuaVariable with
+    *  the given \c keys and through a \c LuaRef created from it.
+    */
+   void BenchCall (const std::string& what, LuaState& ls,
+                   const std::vector<std::string>& keys, int reps)
+   {
+      Diluculum::LuaVariable var = ls[keys[0]];
+      for (std::size_t i = 1; i < keys.size(); ++i)
+         var = var[keys[i]];
+
+      double checksum = 0.0;
+
+      double t = Bench::BestOf (5, [&]() {
+         for (int i = 0; i < reps; ++i)
+            checksum += var (i, 2)[0].asNumber();
+      });
+      Bench::Report (what + ", LuaVariable", t, reps);
+
+      LuaRef ref (var);
+      t = Bench::BestOf (5, [&]() {
+         for (int i = 0; i < reps; ++i)
+            checksum += ref (i, 2)[0].asNumber();
+      });
+      Bench::Report (what + ", LuaRef", t, reps);
+
+      if (checksum == 0.0)
+         std::printf ("(this never happens)\n");
+   }
+
+} // (anonymous) namespace
+
+
+
+// - main ----------------------------------------------------------------------
+int main()
+{
+   LuaState ls;
+   ls.doString ("function add (a, b) return a + b end\n"
+                "app = { handlers = { events = { add = add } } }");
+
+   Bench::Section ("Calling a Lua function in a hot loop (1M calls)");
+
+   std::vector<std::string> keys;
+   keys.push_back ("add");
+   BenchCall ("global function", ls, keys, 1000000);
+
+   keys.clear();
+   keys.push_back ("app");
+   keys.push_back ("handlers");
+   keys.push_back ("events");
+   keys.push_back ("add");
+   BenchCall ("function in nested tables", ls, keys, 1000000);
+}
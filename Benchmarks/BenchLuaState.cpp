@@ -0,0 +1,446 @@
+/******************************************************************************\
+* BenchLuaState.cpp                                                            *
+* Benchmarks for 'LuaState' operations.                                        *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <Diluculum/LuaState.hpp>
+#include "BenchAllocations.hpp"
+#include "BenchUtils.hpp"
+
+
+namespace
+{
+   using Diluculum::LuaFunction;
+   using Diluculum::LuaRef;
+   using Diluculum::LuaState;
+   using Diluculum::LuaValueList;
+
+   /** Calls \c func like earlier versions of Diluculum did: loading its
+    *  bytecode on every call. This is here just to have a baseline to compare
+    *  against.
+    */
+   LuaValueList LegacyCall (LuaState& ls, const LuaFunction& func,
+                            const LuaValueList& params)
+   {
+      lua_State* state = ls.getState();
+      luaL_loadbuffer (state, static_cast<const char*>(func.getData()),
+                       func.getSize(), "Diluculum Lua chunk");
+
+      for (std::size_t i = 0; i < params.size(); ++i)
+         Diluculum::PushLuaValue (state, params[i]);
+
+      lua_pcall (state, static_cast<int>(params.size()), 1, 0);
+
+      LuaValueList results;
+      results.push_back (Diluculum::ToLuaValue (state, -1));
+      lua_pop (state, 1);
+      return results;
+   }
+
+
+
+   /// Calls the global function \c name \c reps times, in both ways.
+   void BenchCall (const std::string& name, int reps)
+   {
+      LuaState ls;
+      ls.doString ("function small(a, b) return a + b end\n"
+                   "function large(a, b)\n"
+                   "   local t = { }\n"
+                   "   for i = 1, 3 do\n"
+                   "      t[#t + 1] = string.format ('%d:%d', a, b)\n"
+                   "      if a > b then a, b = b, a else b = b - 1 end\n"
+                   "      t[#t + 1] = math.max (a, b) + math.min (a, b)\n"
+                   "      t[#t + 1] = tostring (a * b) .. tostring (a - b)\n"
+                   "   end\n"
+                   "   return #table.concat (t, ',')\n"
+                   "end\n");
+
+      LuaFunction func = ls[name].value().asFunction();
+      LuaValueList params;
+      params.push_back (3);
+      params.push_back (4);
+
+      std::size_t checksum = 0;
+
+      double t = Bench::BestOf (5, [&]() {
+         for (int i = 0; i < reps; ++i)
+            checksum += LegacyCall (ls, func, params)[0].asInteger();
+      });
+      Bench::Report ("'" + name + "', loading on every call", t, reps);
+
+      t = Bench::BestOf (5, [&]() {
+         for (int i = 0; i < reps; ++i)
+            checksum += ls.call (func, params)[0].asInteger();
+      });
+      Bench::Report ("'" + name + "', LuaState::call()", t, reps);
+
+      const Diluculum::LuaFunctionCacheStats stats = ls.functionCacheStats();
+      std::printf ("   (function cache: %lu hits, %lu misses)\n",
+                   static_cast<unsigned long>(stats.hits),
+                   static_cast<unsigned long>(stats.misses));
+
+      if (checksum == 0)
+         std::printf ("(this never happens)\n");
+   }
+
+
+
+   /** Runs \c reps snippets with \c doString(), cycling among \c numSnippets
+    *  different snippets, using a chunk cache with the given \c capacity.
+    */
+   void BenchDoString (int numSnippets, std::size_t capacity, int reps)
+   {
+      std::vector<std::string> snippets;
+      for (int i = 0; i < numSnippets; ++i)
+      {
+         snippets.push_back ("local a = " + std::to_string (i) + "\n"
+                             "for i = 1, 3 do a = a * 2 + i end\n"
+                             "return a, request and request.id");
+      }
+
+      LuaState ls;
+      ls.doString ("request = { id = 171 }");
+      ls.setChunkCacheCapacity (capacity);
+
+      double t = Bench::BestOf (5, [&]() {
+         for (int i = 0; i < reps; ++i)
+            ls.doString (snippets[i % numSnippets]);
+      });
+
+      const Diluculum::LuaChunkCacheStats stats = ls.chunkCacheStats();
+      Bench::Report (std::to_string (numSnippets) + " snippets, capacity "
+                     + std::to_string (capacity), t, reps);
+      std::printf ("   (chunk cache: %lu hits, %lu misses, %lu evictions)\n",
+                   static_cast<unsigned long>(stats.hits),
+                   static_cast<unsigned long>(stats.misses),
+                   static_cast<unsigned long>(stats.evictions));
+   }
+
+
+
+   /** A \c lua_Alloc that keeps track of the memory used by Lua. Its \c ud
+    *  parameter must point to an array with two <tt>std::size_t</tt>s: the
+    *  bytes in use and the peak bytes in use.
+    */
+   void* CountingAlloc (void* ud, void* ptr, size_t osize, size_t nsize)
+   {
+      std::size_t* counters = static_cast<std::size_t*>(ud);
+      if (ptr != 0)
+         counters[0] -= osize;
+
+      if (nsize == 0)
+      {
+         std::free (ptr);
+         return 0;
+      }
+
+      void* p = std::realloc (ptr, nsize);
+      if (p != 0)
+      {
+         counters[0] += nsize;
+         counters[1] = std::max (counters[1], counters[0]);
+      }
+      else if (ptr != 0)
+      {
+         counters[0] += osize; // the old block is still there
+      }
+
+      return p;
+   }
+
+
+
+   /** Loads a large data file in one of the possible ways, reporting the
+    *  time taken and the peak memory used by C++ and Lua.
+    */
+   template <class Func>
+   void BenchLoad (const std::string& what, std::size_t records, Func load)
+   {
+      std::size_t luaCounters[2] = { 0, 0 };
+      lua_State* state = lua_newstate (CountingAlloc, luaCounters);
+      double t;
+
+      {
+         LuaState ls (state, true);
+         ls.doString ("n = 0 function add (r) n = n + r.id end");
+
+         luaCounters[1] = luaCounters[0];
+         Bench::ResetPeak();
+         const std::size_t cppBase = Bench::Allocations().bytesInUse;
+
+         Bench::Stopwatch sw;
+         load (ls);
+         t = sw.elapsed();
+
+         Bench::Report (what, t, records);
+         Bench::ReportMemory ("   peak C++ heap",
+                              Bench::Allocations().peakBytesInUse - cppBase,
+                              records);
+         Bench::ReportMemory ("   peak Lua heap", luaCounters[1], records);
+      }
+
+      lua_close (state);
+   }
+
+
+
+
+   /** Runs <tt>func (i)</tt> for \c i from 0 to <tt>reps-1</tt>, reporting
+    *  the time taken and the number of heap allocations per call.
+    */
+   template <class Func>
+   void ReportCalls (const std::string& what, int reps, Func func)
+   {
+      const int runs = 5;
+      const std::size_t before = Bench::Allocations().count;
+      const double t = Bench::BestOf (runs, [&]() {
+         for (int i = 0; i < reps; ++i)
+            func (i);
+      });
+      const std::size_t allocations = Bench::Allocations().count - before;
+
+      Bench::Report (what, t, reps);
+      std::printf ("   (%.1f heap allocations per call)\n",
+                   static_cast<double>(allocations) / (runs * reps));
+   }
+
+
+
+   /** Calls a function taking and returning numbers \c reps times, passing
+    *  and getting the values as <tt>LuaValue</tt>s and with the typed
+    *  <tt>call<R...>()</tt>.
+    */
+   void BenchTypedCall (int reps)
+   {
+      LuaState ls;
+      ls.doString ("function add (a, b) return a + b end");
+      LuaRef add (ls["add"]);
+      double checksum = 0.0;
+
+      ReportCalls ("LuaVariable::operator()", reps, [&](int i) {
+         checksum += ls["add"](i, 0.5)[0].asNumber();
+      });
+
+      ReportCalls ("LuaVariable::call<double>()", reps, [&](int i) {
+         checksum += ls["add"].call<double> (i, 0.5);
+      });
+
+      ReportCalls ("LuaRef::operator()", reps, [&](int i) {
+         checksum += add (i, 0.5)[0].asNumber();
+      });
+
+      ReportCalls ("LuaRef::call<double>()", reps, [&](int i) {
+         checksum += add.call<double> (i, 0.5);
+      });
+
+      ReportCalls ("LuaState::call<double>()", reps, [&](int i) {
+         checksum += ls.call<double> ("add", i, 0.5);
+      });
+
+      LuaValueList params (2);
+      LuaValueList results;
+      params[1] = 0.5;
+      ReportCalls ("LuaRef::callInto(), reusing the lists", reps, [&](int i) {
+         params[0] = i;
+         add.callInto (params, results, 1);
+         checksum += results[0].asNumber();
+      });
+
+      ReportCalls ("LuaRef::callAndDiscard()", reps, [&](int i) {
+         params[0] = i;
+         add.callAndDiscard (params);
+      });
+
+      if (checksum == 0.0)
+         std::printf ("(this never happens)\n");
+   }
+
+
+
+   /** Runs a CPU-bound loop with \c iterations iterations, with no limits
+    *  and with instruction and time limits checked at various intervals, to
+    *  show the overhead of the hook that enforces the limits.
+    */
+   void BenchLimits (int iterations)
+   {
+      const std::string code =
+         "local x = 0 for i = 1, " + std::to_string (iterations)
+         + " do x = x + i % 7 end return x";
+
+      {
+         LuaState ls;
+         Bench::Report ("no limits", Bench::BestOf (5, [&]() {
+            ls.doString (code);
+         }), iterations);
+      }
+
+      const int intervals[] = { 1, 10, 100, 1000, 10000 };
+      for (std::size_t i = 0; i < sizeof (intervals) / sizeof (int); ++i)
+      {
+         LuaState ls;
+         ls.setInstructionLimit (1000000000);
+         ls.setTimeLimit (std::chrono::seconds (60));
+         ls.setLimitCheckInterval (intervals[i]);
+
+         Bench::Report ("instruction and time limits, checked every "
+                        + std::to_string (intervals[i]),
+                        Bench::BestOf (5, [&]() { ls.doString (code); }),
+                        iterations);
+      }
+   }
+
+
+
+   /** Handles \c requests "requests" that create garbage, reporting the
+    *  latency percentiles of the requests. \c mode is 0 for the default
+    *  collector, 1 for calling \c collectFor() between requests and 2 for
+    *  stopping the collector and doing all work in \c collectFor().
+    */
+   void BenchGCLatency (int mode, int requests)
+   {
+      LuaState ls;
+      ls.doString ("cache = { }\n"
+                   "function handle (id)\n"
+                   "   local t = { }\n"
+                   "   for i = 1, 200 do\n"
+                   "      t[i] = { id = id, name = 'item ' .. i }\n"
+                   "   end\n"
+                   "   cache[id % 1000] = t\n"
+                   "   return #t\n"
+                   "end");
+      LuaFunction handle = ls["handle"].value().asFunction();
+
+      if (mode == 2)
+         ls.stopGC();
+
+      std::vector<double> latencies;
+      latencies.reserve (requests);
+      LuaValueList params (1);
+
+      Bench::Stopwatch total;
+      for (int i = 0; i < requests; ++i)
+      {
+         params[0] = i;
+         Bench::Stopwatch sw;
+         ls.call (handle, params);
+         latencies.push_back (sw.elapsed());
+
+         if (mode != 0)
+            ls.collectFor (std::chrono::microseconds (200));
+      }
+      const double t = total.elapsed();
+
+      std::sort (latencies.begin(), latencies.end());
+      const char* names[] = {
+         "default collector",
+         "collectFor(200us) between requests",
+         "stopped collector, collectFor(200us) between requests" };
+
+      Bench::Report (names[mode], t, requests);
+      std::printf ("   p50 %.1f us, p99 %.1f us, max %.1f us, "
+                   "%lu GC cycles, %lu KiB in use\n",
+                   latencies[requests / 2] * 1e6,
+                   latencies[requests * 99 / 100] * 1e6,
+                   latencies.back() * 1e6,
+                   static_cast<unsigned long>(ls.gcStats().cycles),
+                   static_cast<unsigned long>(ls.gcStats().kilobytesInUse));
+   }
+
+} // (anonymous) namespace
+
+
+
+// - main ----------------------------------------------------------------------
+int main()
+{
+   Bench::Section ("Calling a LuaFunction repeatedly (100k calls)");
+   BenchCall ("small", 100000);
+   BenchCall ("large", 100000);
+
+   Bench::Section ("Scalar-in, scalar-out calls (1M calls)");
+   BenchTypedCall (1000000);
+
+   Bench::Section ("Execution limits (10M loop iterations)");
+   BenchLimits (10000000);
+
+   Bench::Section ("Request latency and garbage collection (20k requests)");
+   BenchGCLatency (0, 20000);
+   BenchGCLatency (1, 20000);
+   BenchGCLatency (2, 20000);
+
+   Bench::Section ("Running snippets with doString() (100k runs)");
+   BenchDoString (1, 0, 100000);
+   BenchDoString (1, 16, 100000);
+   BenchDoString (32, 16, 100000);
+   BenchDoString (32, 64, 100000);
+
+   // Write a large data description file
+   const std::size_t records = 100000;
+   const char* dataFile = "BenchLuaStateData.lua";
+   {
+      std::ofstream file (dataFile);
+      for (std::size_t i = 1; i <= records; ++i)
+      {
+         file << "add { id = " << i << ", name = 'item " << i
+              << "', x = " << i * 0.5 << ", tags = { 'a', 'b' } }\n";
+      }
+   }
+
+   Bench::Section ("Loading a data file with "
+                   + std::to_string (records) + " records");
+
+   BenchLoad ("doString() (whole file in memory)", records, [&](LuaState& ls) {
+      std::ifstream file (dataFile, std::ios::binary);
+      std::ostringstream contents;
+      contents << file.rdbuf();
+      ls.doString (contents.str());
+   });
+
+   BenchLoad ("doFile()", records, [&](LuaState& ls) {
+      ls.doFile (dataFile);
+   });
+
+   BenchLoad ("doStream()", records, [&](LuaState& ls) {
+      std::ifstream file (dataFile, std::ios::binary);
+      ls.doStream (file);
+   });
+
+   BenchLoad ("doFileStreamed(), no mmap", records, [&](LuaState& ls) {
+      ls.doFileStreamed (dataFile, false);
+   });
+
+   BenchLoad ("doFileStreamed(), mmap", records, [&](LuaState& ls) {
+      ls.doFileStreamed (dataFile, true);
+   });
+
+   std::remove (dataFile);
+}
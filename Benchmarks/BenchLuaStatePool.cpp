@@ -0,0 +1,113 @@
+/******************************************************************************\
+* BenchLuaStatePool.cpp                                                        *
+* Benchmarks for the pool of Lua states.                                       *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Diluculum/LuaStatePool.hpp>
+#include "BenchUtils.hpp"
+
+
+namespace
+{
+   using namespace Diluculum;
+
+   /// Initializes the states: defines the "request handler".
+   void InitState (LuaState& ls)
+   {
+      ls.doString ("function handle (n)\n"
+                   "   local t = { }\n"
+                   "   for i = 1, 50 do t[i] = (n * i) % 7 end\n"
+                   "   return table.concat (t, ',')\n"
+                   "end");
+   }
+
+
+
+   /** Handles \c requestsPerThread requests in each of \c numThreads
+    *  threads, using a pool with \c poolSize states. Reports the throughput
+    *  and the pool statistics.
+    */
+   void BenchThreads (std::size_t poolSize, std::size_t numThreads,
+                      std::size_t requestsPerThread)
+   {
+      LuaStatePool pool (poolSize, InitState);
+
+      Bench::Stopwatch sw;
+
+      std::vector<std::thread> threads;
+      for (std::size_t i = 0; i < numThreads; ++i)
+      {
+         threads.push_back (std::thread ([&]() {
+            for (std::size_t j = 0; j < requestsPerThread; ++j)
+            {
+               LuaStatePool::Lease lease = pool.acquire();
+               (*lease)["handle"] (static_cast<double>(j));
+            }
+         }));
+      }
+
+      for (std::size_t i = 0; i < threads.size(); ++i)
+         threads[i].join();
+
+      const double t = sw.elapsed();
+      const LuaStatePoolStats stats = pool.stats();
+
+      Bench::Report (std::to_string (numThreads) + " threads, "
+                     + std::to_string (poolSize) + " states",
+                     t, numThreads * requestsPerThread);
+
+      std::printf ("   utilization %.0f%%, %zu waits, "
+                   "mean wait %.1f us, max wait %.1f us\n",
+                   stats.utilization * 100.0, stats.waits,
+                   stats.waits > 0 ? stats.totalWaitTime / stats.waits * 1e6
+                                   : 0.0,
+                   stats.maxWaitTime * 1e6);
+   }
+
+} // (anonymous) namespace
+
+
+
+// - main ----------------------------------------------------------------------
+int main()
+{
+   const std::size_t cores =
+      std::max (1U, std::thread::hardware_concurrency());
+   const std::size_t requests = 20000;
+
+   Bench::Section ("Handling requests, one state per thread ("
+                   + std::to_string (requests) + " requests per thread)");
+   for (std::size_t n = 1; n < cores; n *= 2)
+      BenchThreads (n, n, requests);
+   BenchThreads (cores, cores, requests);
+
+   Bench::Section ("Handling requests, fewer states than threads");
+   BenchThreads (std::max<std::size_t> (1, cores / 2), cores, requests);
+   BenchThreads (1, cores, requests);
+}
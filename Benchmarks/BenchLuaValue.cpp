@@ -0,0 +1,375 @@
+/******************************************************************************\
+* BenchLuaValue.cpp                                                            *
+* Benchmarks for 'LuaValue'.                                                   *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include <Diluculum/LuaState.hpp>
+#include <Diluculum/LuaStringPool.hpp>
+#include <Diluculum/LuaValue.hpp>
+#include "BenchAllocations.hpp"
+#include "BenchUtils.hpp"
+
+
+namespace
+{
+   using Diluculum::LuaValue;
+
+   /** The "less than" operator as implemented by earlier versions of
+    *  Diluculum, which compared type names (as strings) before looking at the
+    *  values. Only the types used in these benchmarks are supported. This is
+    *  here just to have a baseline to compare against.
+    */
+   struct LegacyLess
+   {
+      bool operator() (const LuaValue& lhs, const LuaValue& rhs) const
+      {
+         std::string lhsTypeName = lhs.typeName();
+         std::string rhsTypeName = rhs.typeName();
+
+         if (lhsTypeName < rhsTypeName)
+            return true;
+         else if (lhsTypeName > rhsTypeName)
+            return false;
+         else if (lhsTypeName == "nil")
+            return false;
+         else if (lhsTypeName == "boolean")
+            return lhs.asBoolean() < rhs.asBoolean();
+         else if (lhsTypeName == "number")
+            return lhs.asNumber() < rhs.asNumber();
+         else if (lhsTypeName == "string")
+            return lhs.asString() < rhs.asString();
+         else
+            return lhs < rhs;
+      }
+   };
+
+
+
+   /** Creates the keys used by the map benchmarks: a mix of numbers and
+    *  strings, like the keys found in typical configuration tables.
+    */
+   std::vector<LuaValue> MakeKeys (int n)
+   {
+      std::vector<LuaValue> keys;
+      keys.reserve (n);
+      for (int i = 0; i < n; ++i)
+      {
+         if (i % 2 == 0)
+            keys.push_back (i);
+         else
+         {
+            char buff[32];
+            std::sprintf (buff, "field_%d", i);
+            keys.push_back (buff);
+         }
+      }
+      return keys;
+   }
+
+
+
+   /// Checks whether \c key is in the \c std::map \c m.
+   template <class MapType>
+   bool Contains (const MapType& m, const LuaValue& key)
+   {
+      return m.find (key) != m.end();
+   }
+
+   /// Checks whether \c key is in the \c LuaTable \c t.
+   bool Contains (const Diluculum::LuaTable& t, const LuaValue& key)
+   {
+      return t.find (key) != 0;
+   }
+
+
+
+   /// Inserts \c keys into a map and looks them all up again.
+   template <class MapType>
+   void BenchMap (const std::string& name, const std::vector<LuaValue>& keys)
+   {
+      const int reps = 5;
+      std::size_t found = 0;
+
+      double insertTime = Bench::BestOf (reps, [&]() {
+         MapType m;
+         for (std::size_t i = 0; i < keys.size(); ++i)
+            m[keys[i]] = true;
+      });
+
+      MapType m;
+      for (std::size_t i = 0; i < keys.size(); ++i)
+         m[keys[i]] = true;
+
+      double findTime = Bench::BestOf (reps, [&]() {
+         for (std::size_t i = 0; i < keys.size(); ++i)
+            found += Contains (m, keys[i]);
+      });
+
+      Bench::Report (name + " insert", insertTime, keys.size());
+      Bench::Report (name + " find", findTime, keys.size());
+
+      if (found == 0)
+         std::printf ("(this never happens)\n");
+   }
+
+
+
+   /** Builds a sequence (keys 1..n) in a \c LuaValueMap and in a
+    *  \c LuaTable, and then reads it back, by key and by iteration.
+    */
+   void BenchSequence (int n)
+   {
+      using Diluculum::LuaValueMap;
+      using Diluculum::LuaTable;
+
+      const int reps = 3;
+      double sum = 0.0;
+
+      double mapBuild = Bench::BestOf (reps, [&]() {
+         LuaValueMap m;
+         for (int i = 1; i <= n; ++i)
+            m[i] = i;
+      });
+
+      double tableBuild = Bench::BestOf (reps, [&]() {
+         LuaTable t;
+         for (int i = 1; i <= n; ++i)
+            t[i] = i;
+      });
+
+      LuaValueMap m;
+      LuaTable t;
+      for (int i = 1; i <= n; ++i)
+      {
+         m[i] = i;
+         t[i] = i;
+      }
+
+      double mapFind = Bench::BestOf (reps, [&]() {
+         for (int i = 1; i <= n; ++i)
+            sum += m.find(i)->second.asNumber();
+      });
+
+      double tableFind = Bench::BestOf (reps, [&]() {
+         for (int i = 1; i <= n; ++i)
+            sum += t.find(i)->asNumber();
+      });
+
+      double mapIterate = Bench::BestOf (reps, [&]() {
+         for (LuaValueMap::const_iterator p = m.begin(); p != m.end(); ++p)
+            sum += p->second.asNumber();
+      });
+
+      double tableIterate = Bench::BestOf (reps, [&]() {
+         const LuaTable::const_iterator end = t.end();
+         for (LuaTable::const_iterator p = t.begin(); p != end; ++p)
+            sum += p.value().asNumber();
+      });
+
+      Bench::Report ("LuaValueMap build", mapBuild, n);
+      Bench::Report ("LuaTable build", tableBuild, n);
+      Bench::Report ("LuaValueMap find", mapFind, n);
+      Bench::Report ("LuaTable find", tableFind, n);
+      Bench::Report ("LuaValueMap iterate", mapIterate, n);
+      Bench::Report ("LuaTable iterate", tableIterate, n);
+
+      if (sum == 0.0)
+         std::printf ("(this never happens)\n");
+   }
+
+
+
+   /** Measures the memory used by the C++ side when an array of \c n numbers
+    *  is converted from Lua, in the formats supported by Diluculum.
+    */
+   void BenchMemory (int n)
+   {
+      using Diluculum::LuaValueList;
+      using Diluculum::LuaValueMap;
+
+      Diluculum::LuaState ls;
+      char code[128];
+      std::sprintf (code, "t = { } for i = 1, %d do t[i] = i + 0.5 end", n);
+      ls.doString (code);
+
+      std::printf ("sizeof(LuaValue) = %u bytes\n",
+                   static_cast<unsigned>(sizeof(LuaValue)));
+
+      const std::size_t base = Bench::Allocations().bytesInUse;
+
+      const LuaValue table = ls["t"].value();
+      const std::size_t tableBytes = Bench::Allocations().bytesInUse - base;
+      Bench::ReportMemory ("table (LuaTable)", tableBytes, n);
+
+      const LuaValueMap map = table.asTable();
+      const std::size_t mapBytes =
+         Bench::Allocations().bytesInUse - base - tableBytes;
+      Bench::ReportMemory ("table (LuaValueMap)", mapBytes, n);
+
+      const std::vector<LuaValue>& arrayPart = table.asTableRef().arrayPart();
+      LuaValueList list (arrayPart.begin(), arrayPart.end());
+      const std::size_t listBytes =
+         Bench::Allocations().bytesInUse - base - tableBytes - mapBytes;
+      Bench::ReportMemory ("LuaValueList", listBytes, n);
+   }
+
+
+
+   /** Converts an array of \c n small records from Lua, with and without a
+    *  \c LuaStringPool, and reports the time taken and the memory used.
+    */
+   void BenchRecords (int n)
+   {
+      using Diluculum::LuaStringPool;
+
+      Diluculum::LuaState ls;
+      char code[160];
+      std::sprintf (code, "t = { } for i = 1, %d do "
+                    "t[i] = { id = i, name = 'n' .. (i %% 100), x = i * 0.5 } "
+                    "end", n);
+      ls.doString (code);
+
+      double t = Bench::BestOf (5, [&]() { ls["t"].value(); });
+      Bench::Report ("convert, no pool", t, n);
+
+      std::size_t base = Bench::Allocations().bytesInUse;
+      {
+         const LuaValue records = ls["t"].value();
+         Bench::ReportMemory ("records, no pool",
+                              Bench::Allocations().bytesInUse - base, n);
+      }
+
+      t = Bench::BestOf (5, [&]()
+      {
+         LuaStringPool pool;
+         LuaStringPool::Use usePool (pool);
+         ls["t"].value();
+      });
+      Bench::Report ("convert, pooled", t, n);
+
+      base = Bench::Allocations().bytesInUse;
+      {
+         LuaStringPool pool;
+         LuaStringPool::Use usePool (pool);
+         const LuaValue records = ls["t"].value();
+         Bench::ReportMemory ("records + pool, pooled",
+                              Bench::Allocations().bytesInUse - base, n);
+      }
+   }
+
+
+
+   /** Converts an array of \c n numbers and a table with \c n string keys
+    *  between Lua and C++ containers, through \c LuaValue and directly with
+    *  \c LuaTraits.
+    */
+   void BenchTraits (int n)
+   {
+      using Diluculum::LuaTable;
+
+      Diluculum::LuaState ls;
+      char code[160];
+      std::sprintf (code, "a = { } m = { } for i = 1, %d do "
+                    "a[i] = i * 0.5 m['k' .. i] = i end", n);
+      ls.doString (code);
+
+      std::vector<double> array;
+      double t = Bench::BestOf (5, [&]() {
+         const LuaValue value = ls["a"].value();
+         const std::vector<LuaValue>& arrayPart =
+            value.asTableRef().arrayPart();
+         array.clear();
+         array.reserve (arrayPart.size());
+         for (std::size_t i = 0; i < arrayPart.size(); ++i)
+            array.push_back (arrayPart[i].asNumber());
+      });
+      Bench::Report ("array to std::vector<double>, LuaValue", t, n);
+
+      t = Bench::BestOf (5, [&]() {
+         array = ls["a"].get<std::vector<double> >();
+      });
+      Bench::Report ("array to std::vector<double>, LuaTraits", t, n);
+
+      t = Bench::BestOf (5, [&]() {
+         LuaTable table;
+         table.reserve (array.size(), 0);
+         for (std::size_t i = 0; i < array.size(); ++i)
+            table[static_cast<double>(i + 1)] = array[i];
+         ls["b"] = table;
+      });
+      Bench::Report ("std::vector<double> to array, LuaValue", t, n);
+
+      t = Bench::BestOf (5, [&]() { ls["b"].set (array); });
+      Bench::Report ("std::vector<double> to array, LuaTraits", t, n);
+
+      std::map<std::string, int> map;
+      t = Bench::BestOf (5, [&]() {
+         const LuaValue value = ls["m"].value();
+         const LuaTable& table = value.asTableRef();
+         map.clear();
+         for (LuaTable::const_iterator p = table.begin(); p != table.end();
+              ++p)
+         {
+            map[p.key().asString()] = static_cast<int>(p.value().asInteger());
+         }
+      });
+      Bench::Report ("table to std::map<string, int>, LuaValue", t, n);
+
+      t = Bench::BestOf (5, [&]() {
+         map = ls["m"].get<std::map<std::string, int> >();
+      });
+      Bench::Report ("table to std::map<string, int>, LuaTraits", t, n);
+   }
+
+} // (anonymous) namespace
+
+
+
+// - main ----------------------------------------------------------------------
+int main()
+{
+   const std::vector<LuaValue> keys = MakeKeys (200000);
+
+   Bench::Section ("LuaValueMap insert/find (200k number and string keys)");
+   BenchMap<std::map<LuaValue, LuaValue, LegacyLess> >("type name comparison",
+                                                        keys);
+   BenchMap<Diluculum::LuaValueMap>("type tag comparison", keys);
+   BenchMap<Diluculum::LuaTable>("LuaTable", keys);
+
+   Bench::Section ("Sequences (1M elements)");
+   BenchSequence (1000000);
+
+   Bench::Section ("Memory used by a 1M-number array converted from Lua");
+   BenchMemory (1000000);
+
+   Bench::Section ("Converting 100k records from Lua (string interning)");
+   BenchRecords (100000);
+
+   Bench::Section ("Converting to and from C++ containers (1M elements)");
+   BenchTraits (1000000);
+}
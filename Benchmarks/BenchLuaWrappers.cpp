@@ -0,0 +1,133 @@
+/******************************************************************************\
+* BenchLuaWrappers.cpp                                                         *
+* Benchmarks for the wrappers of C++ functions and methods.                    *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <Diluculum/LuaState.hpp>
+#include <Diluculum/LuaWrappers.hpp>
+#include "BenchAllocations.hpp"
+#include "BenchUtils.hpp"
+
+
+namespace
+{
+   using Diluculum::LuaState;
+   using Diluculum::LuaValue;
+   using Diluculum::LuaValueList;
+
+   /// The function being wrapped: returns the sum of its parameters.
+   LuaValueList Sum (const LuaValueList& params)
+   {
+      double sum = 0.0;
+      for (std::size_t i = 0; i < params.size(); ++i)
+         sum += params[i].asNumber();
+
+      LuaValueList ret;
+      ret.push_back (sum);
+      return ret;
+   }
+
+   DILUCULUM_WRAP_FUNCTION (Sum)
+
+
+
+   /** The same as \c Sum(), but using <tt>std::vector</tt>s, as
+    *  \c LuaValueList was in earlier versions of Diluculum.
+    */
+   std::vector<LuaValue> LegacySum (const std::vector<LuaValue>& params)
+   {
+      double sum = 0.0;
+      for (std::size_t i = 0; i < params.size(); ++i)
+         sum += params[i].asNumber();
+
+      std::vector<LuaValue> ret;
+      ret.push_back (sum);
+      return ret;
+   }
+
+   /** Wraps \c LegacySum() just like \c DILUCULUM_WRAP_FUNCTION() does. This
+    *  is here just to have a baseline to compare against.
+    */
+   int LegacySumWrapper (lua_State* ls)
+   {
+      const int numParams = lua_gettop (ls);
+      std::vector<LuaValue> params;
+      params.reserve (numParams);
+      for (int i = 1; i <= numParams; ++i)
+         params.push_back (Diluculum::ToLuaValue (ls, i));
+      lua_pop (ls, numParams);
+
+      std::vector<LuaValue> ret = LegacySum (params);
+      for (std::size_t i = 0; i < ret.size(); ++i)
+         Diluculum::PushLuaValue (ls, ret[i]);
+
+      return static_cast<int>(ret.size());
+   }
+
+
+
+   /** Calls the global function \c func from Lua \c reps times, passing
+    *  \c args, and reports the time taken and the number of heap allocations
+    *  (on the C++ side) per call.
+    */
+   void BenchWrapped (LuaState& ls, const std::string& func,
+                      const std::string& args, int reps)
+   {
+      const std::string code =
+         "local s = 0 for i = 1, " + std::to_string (reps) + " do s = s + "
+         + func + " (" + args + ") end return s";
+
+      const int runs = 5;
+      const std::size_t before = Bench::Allocations().count;
+      const double t = Bench::BestOf (runs, [&]() { ls.doString (code); });
+      const std::size_t allocations = Bench::Allocations().count - before;
+
+      Bench::Report (func + " (" + args + ")", t, reps);
+      std::printf ("   (%.2f heap allocations per call)\n",
+                   static_cast<double>(allocations) / (runs * reps));
+   }
+
+} // (anonymous) namespace
+
+
+
+// - main ----------------------------------------------------------------------
+int main()
+{
+   LuaState ls;
+   ls["sum"] = DILUCULUM_WRAPPER_FUNCTION (Sum);
+   ls["legacySum"] = LegacySumWrapper;
+
+   Bench::Section ("Calling a wrapped C++ function from Lua (1M calls)");
+
+   const char* args[] = { "i", "i, 1", "i, 1, 2, 3", "i, 1, 2, 3, 4, 5" };
+   for (std::size_t i = 0; i < sizeof (args) / sizeof (args[0]); ++i)
+   {
+      BenchWrapped (ls, "legacySum", args[i], 1000000);
+      BenchWrapped (ls, "sum", args[i], 1000000);
+   }
+}
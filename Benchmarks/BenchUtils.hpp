@@ -0,0 +1,105 @@
+/******************************************************************************\
+* BenchUtils.hpp                                                               *
+* Simple utilities shared by the benchmarks.                                   *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#ifndef _DILUCULUM_BENCH_UTILS_HPP_
+#define _DILUCULUM_BENCH_UTILS_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+
+namespace Bench
+{
+   /// Measures wall-clock time since construction (or since the last reset).
+   class Stopwatch
+   {
+      public:
+         Stopwatch() : start_(std::chrono::steady_clock::now()) { }
+
+         /// Restarts the time measurement.
+         void reset() { start_ = std::chrono::steady_clock::now(); }
+
+         /// Returns the elapsed time, in seconds.
+         double elapsed() const
+         {
+            return std::chrono::duration<double>(
+               std::chrono::steady_clock::now() - start_).count();
+         }
+
+      private:
+         /// The moment when the measurement started.
+         std::chrono::steady_clock::time_point start_;
+   };
+
+
+
+   /** Runs \c func \c reps times and returns the time taken by the fastest
+    *  run, in seconds.
+    */
+   template <class Func>
+   double BestOf (int reps, Func func)
+   {
+      double best = 0.0;
+      for (int i = 0; i < reps; ++i)
+      {
+         Stopwatch sw;
+         func();
+         const double t = sw.elapsed();
+         if (i == 0 || t < best)
+            best = t;
+      }
+      return best;
+   }
+
+
+
+   /** Prints a line with the results of a benchmark.
+    *  @param what The name of the thing measured.
+    *  @param seconds The total time taken.
+    *  @param ops The number of operations done in that time.
+    */
+   inline void Report (const std::string& what, double seconds, std::size_t ops)
+   {
+      std::cout << std::left << std::setw (48) << what << std::right
+                << std::fixed << std::setprecision (3)
+                << std::setw (10) << seconds * 1e3 << " ms"
+                << std::setw (12) << seconds * 1e9 / ops << " ns/op\n";
+   }
+
+
+
+   /// Prints a header line, separating groups of related benchmarks.
+   inline void Section (const std::string& title)
+   {
+      std::cout << "\n== " << title << " ==\n";
+   }
+
+} // namespace Bench
+
+#endif // _DILUCULUM_BENCH_UTILS_HPP_
@@ -27,15 +27,128 @@
 
 #include "InternalUtils.hpp"
 #include <Diluculum/LuaUtils.hpp>
+#include <algorithm>
 #include <cstring>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <type_traits>
 #include <boost/lexical_cast.hpp>
 
+#if defined(__unix__) || defined(__APPLE__)
+#  define DILUCULUM_HAS_MMAP 1
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
 namespace Diluculum
 {
    namespace Impl
    {
+      namespace
+      {
+         /** The address of this variable is used as the key, in the
+          *  registry, of the \c ExecutionControl of a Lua state.
+          */
+         char TheExecutionControlKey;
+
+         static_assert (std::is_trivially_destructible<ExecutionControl>::value,
+                        "ExecutionControl lives in a userdata without __gc");
+
+         void ExecutionHook (lua_State* ls, lua_Debug* ar);
+
+         /// The error messages for each \c ExecutionControl::AbortReason.
+         const char* const TheAbortMessages[] = {
+            "", "instruction limit exceeded", "time limit exceeded",
+            "execution cancelled" };
+
+         /** Aborts the running call because of \c reason. The hook is
+          *  set to run at every instruction, so that the call ends even if
+          *  the Lua code catches the error.
+          */
+         void Abort (lua_State* ls, ExecutionControl* control,
+                     ExecutionControl::AbortReason reason)
+         {
+            control->abortReason = reason;
+            control->hookCount = 1;
+            lua_sethook (ls, ExecutionHook, LUA_MASKCOUNT, 1);
+            luaL_error (ls, TheAbortMessages[reason]);
+         }
+
+         /// Puts back the hook that was set before \c ExecutionHook.
+         void RestoreHook (lua_State* ls, ExecutionControl* control)
+         {
+            lua_sethook (ls, control->savedHook, control->savedHookMask,
+                         control->savedHookCount);
+         }
+
+         /** The hook that enforces the limits and cancellation requests of
+          *  an \c ExecutionControl.
+          */
+         void ExecutionHook (lua_State* ls, lua_Debug*)
+         {
+            ExecutionControl* control = GetExecutionControl (ls, false);
+            if (control == 0)
+               return;
+
+            if (control->abortReason != ExecutionControl::NOT_ABORTED)
+               Abort (ls, control, control->abortReason);
+
+            if (control->cancelRequested.load())
+            {
+               // Not inside a call (the request came too late): ignore it
+               if (control->depth == 0)
+               {
+                  control->cancelRequested = false;
+                  RestoreHook (ls, control);
+                  return;
+               }
+
+               Abort (ls, control, ExecutionControl::CANCELLED);
+            }
+
+            if (control->sampler != 0)
+               control->sampler (ls, control->samplerData);
+
+            if (control->instructionLimit != 0)
+            {
+               control->instructions += control->hookCount;
+               if (control->instructions >= control->instructionLimit)
+                  Abort (ls, control, ExecutionControl::INSTRUCTION_LIMIT);
+
+               // Don't overshoot the limit by up to a whole interval
+               const std::size_t remaining =
+                  control->instructionLimit - control->instructions;
+               if (remaining < static_cast<std::size_t>(control->hookCount))
+               {
+                  control->hookCount = static_cast<int>(remaining);
+                  lua_sethook (ls, ExecutionHook, LUA_MASKCOUNT,
+                               control->hookCount);
+               }
+            }
+
+            if (control->timeLimit.count() != 0
+                && std::chrono::steady_clock::now() >= control->deadline)
+            {
+               Abort (ls, control, ExecutionControl::TIME_LIMIT);
+            }
+         }
+      }
+
+
+
       // - CallFunctionOnTop ---------------------------------------------------
       LuaValueList CallFunctionOnTop (lua_State* ls, const LuaValueList& params)
+      {
+         LuaValueList results;
+         CallFunctionOnTop (ls, params, LUA_MULTRET, &results);
+         return results;
+      }
+
+      void CallFunctionOnTop (lua_State* ls, const LuaValueList& params,
+                              int numResults, LuaValueList* results)
       {
          int topBefore = lua_gettop (ls);
 
@@ -46,20 +159,21 @@ namespace Diluculum
          for (iter_t p = params.begin(); p != params.end(); ++p)
             PushLuaValue (ls, *p);
 
-         int status = lua_pcall (ls, params.size(), LUA_MULTRET, 0);
+         CallProtected (ls, static_cast<int>(params.size()), numResults);
 
-         ThrowOnLuaError (ls, status);
-
-         int numResults = lua_gettop (ls) - topBefore + 1;
+         if (numResults == LUA_MULTRET)
+            numResults = lua_gettop (ls) - topBefore + 1;
 
-         LuaValueList results;
+         PopOnExit popResults (ls, numResults);
 
-         for (int i = numResults; i > 0; --i)
-            results.push_back (ToLuaValue (ls, -i));
-
-         lua_pop (ls, numResults);
+         if (results != 0)
+         {
+            results->clear();
+            results->reserve (numResults);
 
-         return results;
+            for (int i = numResults; i > 0; --i)
+               results->push_back (ToLuaValue (ls, -i));
+         }
       }
 
 
@@ -102,6 +216,134 @@ namespace Diluculum
 
 
 
+      // - ExecutionControl::ExecutionControl ----------------------------------
+      ExecutionControl::ExecutionControl()
+         : instructionLimit(0), timeLimit(0), checkInterval(1000), depth(0),
+           instructions(0), hookCount(0), deadline(),
+           abortReason(NOT_ABORTED), cancelRequested(false), sampler(0),
+           samplerData(0), savedHook(0), savedHookMask(0), savedHookCount(0)
+      { }
+
+
+
+      // - GetExecutionControl -------------------------------------------------
+      ExecutionControl* GetExecutionControl (lua_State* ls, bool create)
+      {
+         lua_rawgetp (ls, LUA_REGISTRYINDEX, &TheExecutionControlKey);
+         ExecutionControl* control =
+            static_cast<ExecutionControl*>(lua_touserdata (ls, -1));
+         lua_pop (ls, 1);
+
+         if (control == 0 && create)
+         {
+            control = new (lua_newuserdata (ls, sizeof (ExecutionControl)))
+               ExecutionControl();
+            lua_rawsetp (ls, LUA_REGISTRYINDEX, &TheExecutionControlKey);
+         }
+
+         return control;
+      }
+
+
+
+      // - CallProtected -------------------------------------------------------
+      void CallProtected (lua_State* ls, int nargs, int nresults)
+      {
+         ExecutionControl* control = GetExecutionControl (ls, false);
+         if (control == 0)
+         {
+            ThrowOnLuaError (ls, lua_pcall (ls, nargs, nresults, 0));
+            return;
+         }
+
+         // Only the outermost call arms the hook; nested calls (made by C++
+         // code called from Lua) count against the limits of the outer one
+         const bool topLevel = control->depth == 0;
+         const bool hooked = topLevel && (control->instructionLimit != 0
+                                          || control->timeLimit.count() != 0
+                                          || control->sampler != 0);
+         if (topLevel)
+         {
+            control->instructions = 0;
+            control->abortReason = ExecutionControl::NOT_ABORTED;
+            control->cancelRequested = false;
+
+            // Save the user's hook, to restore it when the call ends. (If
+            // our own hook is there, left by a late cancel request, the
+            // user's hook was saved before.)
+            if (lua_gethook (ls) != ExecutionHook)
+            {
+               control->savedHook = lua_gethook (ls);
+               control->savedHookMask = lua_gethookmask (ls);
+               control->savedHookCount = lua_gethookcount (ls);
+            }
+            else if (!hooked)
+            {
+               RestoreHook (ls, control);
+            }
+         }
+
+         if (hooked)
+         {
+            control->deadline =
+               std::chrono::steady_clock::now() + control->timeLimit;
+            control->hookCount = control->checkInterval;
+            if (control->instructionLimit != 0)
+            {
+               control->hookCount = static_cast<int>(
+                  std::min (control->instructionLimit,
+                            static_cast<std::size_t>(control->hookCount)));
+            }
+            lua_sethook (ls, ExecutionHook, LUA_MASKCOUNT, control->hookCount);
+         }
+
+         // A cancel request may have come while the hook was being set up
+         if (topLevel && control->cancelRequested.load())
+            lua_sethook (ls, ExecutionHook, LUA_MASKCOUNT, 1);
+
+         ++control->depth;
+         const int status = lua_pcall (ls, nargs, nresults, 0);
+         --control->depth;
+
+         // (If the Lua code replaced our hook, leave its hook alone.)
+         if (topLevel && lua_gethook (ls) == ExecutionHook)
+            RestoreHook (ls, control);
+
+         if (status != 0
+             && control->abortReason != ExecutionControl::NOT_ABORTED)
+         {
+            const std::string message =
+               lua_isstring (ls, -1) ? lua_tostring (ls, -1) : "";
+            lua_pop (ls, 1);
+
+            switch (control->abortReason)
+            {
+               case ExecutionControl::INSTRUCTION_LIMIT:
+                  throw LuaInstructionLimitError (message.c_str());
+               case ExecutionControl::TIME_LIMIT:
+                  throw LuaTimeLimitError (message.c_str());
+               default:
+                  throw LuaCancelledError (message.c_str());
+            }
+         }
+
+         ThrowOnLuaError (ls, status);
+      }
+
+
+
+      // - RequestCancel -------------------------------------------------------
+      void RequestCancel (lua_State* ls, ExecutionControl* control)
+      {
+         // 'lua_sethook()' is designed to be called asynchronously (from
+         // signal handlers, for instance); it just sets a few fields of the
+         // state, which the running code will see at its next instruction
+         control->cancelRequested = true;
+         lua_sethook (ls, ExecutionHook, LUA_MASKCOUNT, 1);
+      }
+
+
+
       // - LuaFunctionWriter ---------------------------------------------------
       int LuaFunctionWriter(lua_State* luaState, const void* data, size_t size,
                             void* func)
@@ -109,14 +351,7 @@ namespace Diluculum
          Diluculum::LuaFunction* f =
             reinterpret_cast<Diluculum::LuaFunction*>(func);
 
-         size_t newSize = f->getSize() + size;
-
-         boost::scoped_array<char> buff (new char[newSize]);
-
-         memcpy (buff.get(), f->getData(), f->getSize());
-         memcpy (buff.get() + f->getSize(), data, size);
-
-         f->setData (buff.get(), newSize);
+         f->appendData (data, size);
 
          return 0;
       }
@@ -124,19 +359,176 @@ namespace Diluculum
 
 
       // - LuaFunctionReader ---------------------------------------------------
-      const char* LuaFunctionReader(lua_State* luaState, void* func,
+      const char* LuaFunctionReader(lua_State* luaState, void* data,
                                     size_t* size)
       {
-         Diluculum::LuaFunction* f =
-            reinterpret_cast<Diluculum::LuaFunction*>(func);
+         LuaFunctionReaderState* rs =
+            reinterpret_cast<LuaFunctionReaderState*>(data);
 
-         if (f->getReaderFlag())
+         if (rs->done)
             return 0;
 
-         f->setReaderFlag (true); // return 0 on the next call
+         rs->done = true; // return 0 on the next call
+
+         *size = rs->func->getSize();
+         return reinterpret_cast<const char*>(rs->func->getData());
+      }
+
+
+
+      // - MemoryReader --------------------------------------------------------
+      const char* MemoryReader (lua_State* luaState, void* data, size_t* size)
+      {
+         MemoryReaderState* rs = reinterpret_cast<MemoryReaderState*>(data);
+
+         if (rs->size == 0)
+            return 0;
+
+         const char* ret = rs->data;
+         *size = rs->size;
+         rs->data += rs->size;
+         rs->size = 0; // return 0 on the next call
+
+         return ret;
+      }
+
+
+
+      // - StreamReader --------------------------------------------------------
+      const char* StreamReader (lua_State* luaState, void* data, size_t* size)
+      {
+         StreamReaderState* rs = reinterpret_cast<StreamReaderState*>(data);
+         std::istream& stream = *rs->stream;
+
+         if (rs->skipFirstLine)
+         {
+            rs->skipFirstLine = false;
+            if (stream.peek() == '#')
+            {
+               stream.ignore (std::numeric_limits<std::streamsize>::max(),
+                              '\n');
+
+               // Keep the line break, so that line numbers are right
+               *size = 1;
+               return "\n";
+            }
+         }
+
+         if (!stream.good())
+            return 0;
+
+         stream.read (&rs->buffer[0], rs->buffer.size());
+         *size = static_cast<size_t>(stream.gcount());
+
+         return *size > 0 ? &rs->buffer[0] : 0;
+      }
+
 
-         *size = f->getSize();
-         return reinterpret_cast<const char*>(f->getData());
+
+      // - MappedFile::MappedFile ----------------------------------------------
+      MappedFile::MappedFile (const std::string& fileName)
+         : data_(0), size_(0), mapped_(false)
+      {
+#ifdef DILUCULUM_HAS_MMAP
+         const int fd = open (fileName.c_str(), O_RDONLY);
+         if (fd < 0)
+            throw LuaFileError (("Cannot open '" + fileName + "'.").c_str());
+
+         struct stat fileInfo;
+         if (fstat (fd, &fileInfo) != 0)
+         {
+            close (fd);
+            throw LuaFileError (("Cannot stat '" + fileName + "'.").c_str());
+         }
+
+         size_ = static_cast<size_t>(fileInfo.st_size);
+         if (size_ > 0)
+         {
+            void* p = mmap (0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+            {
+               close (fd);
+               throw LuaFileError (("Cannot map '" + fileName + "'.").c_str());
+            }
+
+            data_ = static_cast<const char*>(p);
+            mapped_ = true;
+         }
+
+         close (fd); // the mapping stays valid
+#else
+         std::ifstream file (fileName.c_str(), std::ios::binary);
+         if (!file)
+            throw LuaFileError (("Cannot open '" + fileName + "'.").c_str());
+
+         file.seekg (0, std::ios::end);
+         size_ = static_cast<size_t>(file.tellg());
+         file.seekg (0, std::ios::beg);
+
+         char* buffer = new char[size_ > 0 ? size_ : 1];
+         if (!file.read (buffer, size_))
+         {
+            delete[] buffer;
+            throw LuaFileError (("Cannot read '" + fileName + "'.").c_str());
+         }
+
+         data_ = buffer;
+#endif
+      }
+
+
+
+      // - MappedFile::~MappedFile ---------------------------------------------
+      MappedFile::~MappedFile()
+      {
+#ifdef DILUCULUM_HAS_MMAP
+         if (mapped_)
+            munmap (const_cast<char*>(data_), size_);
+#endif
+         if (!mapped_)
+            delete[] data_;
+      }
+
+
+
+      // - MappedFile::supported -----------------------------------------------
+      bool MappedFile::supported()
+      {
+#ifdef DILUCULUM_HAS_MMAP
+         return true;
+#else
+         return false;
+#endif
+      }
+
+
+
+      // - MixHash -------------------------------------------------------------
+      std::size_t MixHash (unsigned long long n)
+      {
+         // The finalizer of the SplitMix64 generator
+         n ^= n >> 30;
+         n *= 0xbf58476d1ce4e5b9ULL;
+         n ^= n >> 27;
+         n *= 0x94d049bb133111ebULL;
+         n ^= n >> 31;
+         return static_cast<std::size_t>(n);
+      }
+
+
+
+      // - HashBytes -----------------------------------------------------------
+      std::size_t HashBytes (const void* data, size_t size)
+      {
+         // 64-bit FNV-1a
+         const unsigned char* p = static_cast<const unsigned char*>(data);
+         unsigned long long hash = 0xcbf29ce484222325ULL;
+         for (size_t i = 0; i < size; ++i)
+         {
+            hash ^= p[i];
+            hash *= 0x100000001b3ULL;
+         }
+         return MixHash (hash);
       }
 
    } // namespace Impl
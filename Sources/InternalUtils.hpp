@@ -27,7 +27,12 @@
 #ifndef _DILUCULUM_INTERNAL_UTILS_HPP_
 #define _DILUCULUM_INTERNAL_UTILS_HPP_
 
+#include <atomic>
+#include <chrono>
+#include <istream>
+#include <vector>
 #include <Diluculum/LuaState.hpp>
+#include <Diluculum/LuaUtils.hpp>
 
 
 namespace Diluculum
@@ -42,6 +47,16 @@ namespace Diluculum
        */
       LuaValueList CallFunctionOnTop (lua_State* ls, const LuaValueList& params);
 
+      /** Calls the function on the top of the stack, passing the given
+       *  parameters and requesting \c numResults results from Lua (or all of
+       *  them, if \c numResults is \c LUA_MULTRET). If \c results is not
+       *  null, the results are stored there (its previous contents are
+       *  discarded, but its capacity is reused); otherwise, they are just
+       *  popped, without being converted.
+       */
+      void CallFunctionOnTop (lua_State* ls, const LuaValueList& params,
+                              int numResults, LuaValueList* results);
+
       /** Throws an exception if the status code passed as parameter corresponds
        *  to an error code from a function from the Lua API.  The exception
        *  thrown is of the proper type, that is, of the subclass of \c LuaError
@@ -64,17 +79,219 @@ namespace Diluculum
        */
       void ThrowOnLuaError (lua_State* ls, int statusCode);
 
+      /** The execution limits of a Lua state, its cancellation requests, and
+       *  the bookkeeping needed to enforce them. This lives in a userdata
+       *  stored in the registry, so that it can be reached from anything that
+       *  has the <tt>lua_State*</tt> (including the hook that enforces the
+       *  limits). Therefore, it must be trivially destructible.
+       */
+      struct ExecutionControl
+      {
+         /// The reasons for aborting a call.
+         enum AbortReason
+         {
+            NOT_ABORTED, INSTRUCTION_LIMIT, TIME_LIMIT, CANCELLED
+         };
+
+         /// Constructs an \c ExecutionControl with no limits.
+         ExecutionControl();
+
+         /// The maximum number of instructions per call (zero: no limit).
+         std::size_t instructionLimit;
+
+         /// The maximum time per call (zero: no limit).
+         std::chrono::microseconds timeLimit;
+
+         /// The number of instructions between checks of the limits.
+         int checkInterval;
+
+         /// The number of nested calls to \c CallProtected() running.
+         int depth;
+
+         /// The instructions executed so far in the current call.
+         std::size_t instructions;
+
+         /// The count passed to \c lua_sethook() the last time.
+         int hookCount;
+
+         /// When the current call must end.
+         std::chrono::steady_clock::time_point deadline;
+
+         /// Why was the current call aborted?
+         AbortReason abortReason;
+
+         /** Was the cancellation of the current call requested? This is the
+          *  only member that can be accessed from other threads.
+          */
+         std::atomic<bool> cancelRequested;
+
+         /** A function called by the hook (every \c checkInterval
+          *  instructions) while calls run, or a null pointer. This is used by
+          *  the profilers. It must not throw, nor raise Lua errors.
+          */
+         void (*sampler)(lua_State* ls, void* data);
+
+         /// The data passed to \c sampler.
+         void* samplerData;
+
+         /** The hook that was set (by the user) when the current or last
+          *  outermost call started, which is restored when it ends.
+          */
+         lua_Hook savedHook;
+
+         /// The mask of \c savedHook.
+         int savedHookMask;
+
+         /// The count of \c savedHook.
+         int savedHookCount;
+      };
+
+      /** Returns the \c ExecutionControl of the Lua state \c ls. If it
+       *  doesn't have one, creates it if \c create is \c true, or returns a
+       *  null pointer otherwise.
+       */
+      ExecutionControl* GetExecutionControl (lua_State* ls, bool create);
+
+      /** Requests the cancellation of the call running in \c ls, whose
+       *  \c ExecutionControl is \c control. Can be called from any thread.
+       */
+      void RequestCancel (lua_State* ls, ExecutionControl* control);
+
       /** The \c lua_Writer used in the calls to \c lua_dump() when converting a
        * function implemented in Lua to a \c LuaFunction.
        */
       int LuaFunctionWriter(lua_State* luaState, const void* data, size_t size,
                             void* func);
 
+      /** The state of a \c LuaFunctionReader while it reads bytecode from a
+       *  \c LuaFunction. This lives on the stack of whoever calls
+       *  \c lua_load(), so that the \c LuaFunction itself is not modified
+       *  (and can safely be shared among threads).
+       */
+      struct LuaFunctionReaderState
+      {
+         /// Constructs a \c LuaFunctionReaderState that will read \c func.
+         explicit LuaFunctionReaderState (const LuaFunction& func)
+            : func(&func), done(false)
+         { }
+
+         /// The function being read.
+         const LuaFunction* func;
+
+         /// Has the whole bytecode been read already?
+         bool done;
+      };
+
       /** The \c lua_Reader used to get Lua bytecode from a \c LuaFunction. This
-       *  is used by \c LuaState::call();
+       *  is used by \c PushLuaValue(). Its \c data parameter must point to a
+       *  \c LuaFunctionReaderState.
        */
-      const char* LuaFunctionReader(lua_State* luaState, void* func,
+      const char* LuaFunctionReader(lua_State* luaState, void* data,
                                     size_t* size);
+
+      /** The state of a \c MemoryReader: a block of memory holding a Lua
+       *  chunk (source code or bytecode).
+       */
+      struct MemoryReaderState
+      {
+         /// Constructs a \c MemoryReaderState that will read the given block.
+         MemoryReaderState (const char* data, size_t size)
+            : data(data), size(size)
+         { }
+
+         /// The data not read yet.
+         const char* data;
+
+         /// The number of bytes not read yet.
+         size_t size;
+      };
+
+      /** A \c lua_Reader that reads a chunk from a block of memory. Its
+       *  \c data parameter must point to a \c MemoryReaderState.
+       */
+      const char* MemoryReader (lua_State* luaState, void* data, size_t* size);
+
+      /** The state of a \c StreamReader: the stream being read and the
+       *  buffer used to read it.
+       */
+      struct StreamReaderState
+      {
+         /** Constructs a \c StreamReaderState that will read \c stream, in
+          *  blocks of \c bufferSize bytes.
+          */
+         StreamReaderState (std::istream& stream, size_t bufferSize)
+            : stream(&stream), buffer(bufferSize), skipFirstLine(false)
+         { }
+
+         /// The stream being read.
+         std::istream* stream;
+
+         /// The buffer, reused for every block read.
+         std::vector<char> buffer;
+
+         /** Skip the first line of the stream if it starts with \c '#'? (Like
+          *  \c luaL_loadfile() does, to support Unix "shebang" lines.)
+          */
+         bool skipFirstLine;
+      };
+
+      /** A \c lua_Reader that reads a chunk from an \c std::istream, one
+       *  block at a time. Its \c data parameter must point to a
+       *  \c StreamReaderState. Regardless of the chunk size, the only memory
+       *  used is the (fixed size) buffer in the \c StreamReaderState.
+       */
+      const char* StreamReader (lua_State* luaState, void* data, size_t* size);
+
+      /** A read-only view of a whole file in memory. Where possible, the file
+       *  is memory-mapped, so that only the parts actually used are read from
+       *  the disk (and the memory is shared with other processes mapping the
+       *  same file). Elsewhere, the file is simply read into memory.
+       */
+      class MappedFile
+      {
+         public:
+            /** Maps the file named \c fileName into memory.
+             *  @throw LuaFileError If the file cannot be opened or mapped.
+             */
+            explicit MappedFile (const std::string& fileName);
+
+            /// Unmaps the file.
+            ~MappedFile();
+
+            /// Returns a pointer to the first byte of the file.
+            const char* data() const { return data_; }
+
+            /// Returns the size of the file, in bytes.
+            size_t size() const { return size_; }
+
+            /** Checks whether files are really memory-mapped in this platform
+             *  (instead of simply read into memory).
+             */
+            static bool supported();
+
+         private:
+            // Not copyable
+            MappedFile (const MappedFile&);
+            MappedFile& operator= (const MappedFile&);
+
+            /// The file contents.
+            const char* data_;
+
+            /// The file size.
+            size_t size_;
+
+            /// Was \c data_ mapped (instead of allocated with \c new[])?
+            bool mapped_;
+      };
+
+      /** Scrambles the bits of an integer, so that it can be used as a hash
+       *  in a hash table whose size is a power of two (that is, one which
+       *  uses only the lowest bits of the hash).
+       */
+      std::size_t MixHash (unsigned long long n);
+
+      /// Returns a hash of the \c size bytes starting at \c data.
+      std::size_t HashBytes (const void* data, size_t size);
    }
 
 } // namespace Diluculum
@@ -0,0 +1,400 @@
+/******************************************************************************\
+* LuaAllocator.cpp                                                             *
+* Memory allocators for Lua states.                                            *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <Diluculum/LuaAllocator.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace Diluculum
+{
+   // - LuaAllocator::LuaAllocator ---------------------------------------------
+   LuaAllocator::LuaAllocator()
+      : bytesInUse_(0), peakBytes_(0), allocations_(0), limit_(0),
+        observer_(0)
+   { }
+
+
+
+   // - LuaAllocator::~LuaAllocator --------------------------------------------
+   LuaAllocator::~LuaAllocator()
+   { }
+
+
+
+   // - LuaAllocator::luaAlloc -------------------------------------------------
+   void* LuaAllocator::luaAlloc (void* ud, void* ptr, std::size_t oldSize,
+                                 std::size_t newSize)
+   {
+      LuaAllocator* self = static_cast<LuaAllocator*>(ud);
+
+      // When 'ptr' is null, Lua 5.2 passes a type tag in 'oldSize'
+      if (ptr == 0)
+         oldSize = 0;
+
+      // Only the state's thread writes the counters, so there is no need for
+      // atomic read-modify-write operations; relaxed loads and stores just
+      // let other threads read them safely.
+      const std::size_t inUse =
+         self->bytesInUse_.load (std::memory_order_relaxed);
+
+      if (newSize == 0)
+      {
+         if (ptr != 0)
+         {
+            if (self->observer_ != 0)
+               self->observer_->freed (ptr, oldSize);
+            self->deallocate (ptr, oldSize);
+            self->bytesInUse_.store (inUse - oldSize,
+                                     std::memory_order_relaxed);
+         }
+         return 0;
+      }
+
+      // Lua assumes shrinking never fails, so the limit is checked only when
+      // growing
+      const std::size_t limit = self->limit_.load (std::memory_order_relaxed);
+      if (newSize > oldSize && limit != 0 && inUse - oldSize + newSize > limit)
+         return 0;
+
+      if (self->observer_ != 0)
+         self->observer_->allocating (newSize);
+
+      void* newPtr = ptr == 0
+         ? self->allocate (newSize)
+         : self->reallocate (ptr, oldSize, newSize);
+
+      if (newPtr == 0)
+         return 0;
+
+      if (self->observer_ != 0)
+      {
+         if (ptr != 0)
+            self->observer_->freed (ptr, oldSize);
+         self->observer_->allocated (newPtr, newSize);
+      }
+
+      const std::size_t newInUse = inUse - oldSize + newSize;
+      self->bytesInUse_.store (newInUse, std::memory_order_relaxed);
+      if (newInUse > self->peakBytes_.load (std::memory_order_relaxed))
+         self->peakBytes_.store (newInUse, std::memory_order_relaxed);
+      if (ptr == 0)
+      {
+         self->allocations_.store (
+            self->allocations_.load (std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+      }
+
+      return newPtr;
+   }
+
+
+
+   // - LuaAllocator::stats ----------------------------------------------------
+   LuaMemoryStats LuaAllocator::stats() const
+   {
+      LuaMemoryStats stats;
+      stats.bytesInUse = bytesInUse_.load (std::memory_order_relaxed);
+      stats.peakBytes = peakBytes_.load (std::memory_order_relaxed);
+      stats.allocations = allocations_.load (std::memory_order_relaxed);
+      stats.limit = limit_.load (std::memory_order_relaxed);
+      return stats;
+   }
+
+
+
+   // - LuaAllocator::reallocate -----------------------------------------------
+   void* LuaAllocator::reallocate (void* ptr, std::size_t oldSize,
+                                   std::size_t newSize)
+   {
+      void* newPtr = allocate (newSize);
+      if (newPtr == 0)
+         return 0;
+
+      std::memcpy (newPtr, ptr, std::min (oldSize, newSize));
+      deallocate (ptr, oldSize);
+      return newPtr;
+   }
+
+
+
+   // - MallocLuaAllocator::allocate -------------------------------------------
+   void* MallocLuaAllocator::allocate (std::size_t size)
+   {
+      return std::malloc (size);
+   }
+
+
+
+   // - MallocLuaAllocator::deallocate -----------------------------------------
+   void MallocLuaAllocator::deallocate (void* ptr, std::size_t)
+   {
+      std::free (ptr);
+   }
+
+
+
+   // - MallocLuaAllocator::reallocate -----------------------------------------
+   void* MallocLuaAllocator::reallocate (void* ptr, std::size_t,
+                                         std::size_t newSize)
+   {
+      return std::realloc (ptr, newSize);
+   }
+
+
+
+   // - PoolLuaAllocator::PoolLuaAllocator -------------------------------------
+   PoolLuaAllocator::PoolLuaAllocator()
+      : largeBlocks_(0)
+   {
+      std::fill (freeLists_, freeLists_ + NumClasses,
+                 static_cast<FreeBlock*>(0));
+   }
+
+
+
+   // - PoolLuaAllocator::~PoolLuaAllocator ------------------------------------
+   PoolLuaAllocator::~PoolLuaAllocator()
+   {
+      for (std::size_t i = 0; i < slabs_.size(); ++i)
+         std::free (slabs_[i]);
+   }
+
+
+
+   // - PoolLuaAllocator::allocate ---------------------------------------------
+   void* PoolLuaAllocator::allocate (std::size_t size)
+   {
+      const std::size_t sc = sizeClass (size);
+      if (sc >= NumClasses)
+      {
+         // Make room in 'slabs_' for the block, in case it is shrunk into a
+         // size class later (see 'reallocate()')
+         if (!reserveSlabEntry())
+            return 0;
+
+         void* block = std::malloc (size);
+         if (block != 0)
+            ++largeBlocks_;
+         return block;
+      }
+
+      if (freeLists_[sc] == 0)
+      {
+         // Carve a new slab into blocks of this size class
+         const std::size_t blockSize = (sc + 1) * Granularity;
+         if (!reserveSlabEntry())
+            return 0;
+
+         char* slab = static_cast<char*>(std::malloc (SlabSize));
+         if (slab == 0)
+            return 0;
+
+         slabs_.push_back (slab); // doesn't allocate, see above
+
+         const std::size_t numBlocks = SlabSize / blockSize;
+         for (std::size_t i = numBlocks; i > 0; --i)
+         {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(
+               slab + (i - 1) * blockSize);
+            block->next = freeLists_[sc];
+            freeLists_[sc] = block;
+         }
+      }
+
+      FreeBlock* block = freeLists_[sc];
+      freeLists_[sc] = block->next;
+      return block;
+   }
+
+
+
+   // - PoolLuaAllocator::deallocate -------------------------------------------
+   void PoolLuaAllocator::deallocate (void* ptr, std::size_t size)
+   {
+      const std::size_t sc = sizeClass (size);
+      if (sc >= NumClasses)
+      {
+         std::free (ptr);
+         --largeBlocks_;
+         return;
+      }
+
+      FreeBlock* block = static_cast<FreeBlock*>(ptr);
+      block->next = freeLists_[sc];
+      freeLists_[sc] = block;
+   }
+
+
+
+   // - PoolLuaAllocator::reallocate -------------------------------------------
+   void* PoolLuaAllocator::reallocate (void* ptr, std::size_t oldSize,
+                                       std::size_t newSize)
+   {
+      const std::size_t oldClass = sizeClass (oldSize);
+      const std::size_t newClass = sizeClass (newSize);
+
+      if (oldClass == newClass)
+         return ptr;
+
+      if (oldClass >= NumClasses && newClass >= NumClasses)
+      {
+         void* newPtr = std::realloc (ptr, newSize);
+         if (newPtr == 0 && newSize < oldSize)
+            return ptr; // shrinking must not fail; keep the larger block
+         return newPtr;
+      }
+
+      void* newPtr = LuaAllocator::reallocate (ptr, oldSize, newSize);
+      if (newPtr != 0 || newSize > oldSize)
+         return newPtr;
+
+      // Shrinking must not fail, so keep the block where it is, and let it
+      // become a block of the new size class (any block is large enough for
+      // the smaller classes). A large block becomes a part of the pools,
+      // which free it when the allocator is destroyed; there is always room
+      // reserved for it in 'slabs_'.
+      if (oldClass >= NumClasses)
+      {
+         slabs_.push_back (ptr);
+         --largeBlocks_;
+      }
+
+      return ptr;
+   }
+
+
+
+   // - PoolLuaAllocator::reserveSlabEntry -------------------------------------
+   bool PoolLuaAllocator::reserveSlabEntry()
+   {
+      const std::size_t needed = slabs_.size() + largeBlocks_ + 1;
+      if (slabs_.capacity() >= needed)
+         return true;
+
+      try
+      {
+         slabs_.reserve (std::max (needed, 2 * slabs_.capacity()));
+         return true;
+      }
+      catch (...)
+      {
+         return false;
+      }
+   }
+
+
+
+   // - ArenaLuaAllocator::ArenaLuaAllocator -----------------------------------
+   ArenaLuaAllocator::ArenaLuaAllocator (std::size_t chunkSize)
+      : chunkSize_(chunkSize), next_(0), end_(0), last_(0), reservedBytes_(0)
+   { }
+
+
+
+   // - ArenaLuaAllocator::~ArenaLuaAllocator ----------------------------------
+   ArenaLuaAllocator::~ArenaLuaAllocator()
+   {
+      for (std::size_t i = 0; i < chunks_.size(); ++i)
+         std::free (chunks_[i]);
+   }
+
+
+
+   // - ArenaLuaAllocator::allocate --------------------------------------------
+   void* ArenaLuaAllocator::allocate (std::size_t size)
+   {
+      const std::size_t rounded = roundUp (size);
+
+      if (static_cast<std::size_t>(end_ - next_) < rounded)
+      {
+         // Large blocks get a chunk of their own; the current chunk remains
+         // current, so that its free space is not wasted
+         const bool ownChunk = rounded > chunkSize_ / 4;
+         const std::size_t bytes = ownChunk ? rounded : chunkSize_;
+         char* chunk = static_cast<char*>(std::malloc (bytes));
+         if (chunk == 0)
+            return 0;
+
+         try
+         {
+            chunks_.push_back (chunk);
+         }
+         catch (...)
+         {
+            std::free (chunk);
+            return 0;
+         }
+
+         reservedBytes_.store (reservedBytes_.load (std::memory_order_relaxed)
+                               + bytes, std::memory_order_relaxed);
+
+         if (ownChunk)
+            return chunk;
+
+         next_ = chunk;
+         end_ = chunk + bytes;
+      }
+
+      last_ = next_;
+      next_ += rounded;
+      return last_;
+   }
+
+
+
+   // - ArenaLuaAllocator::deallocate ------------------------------------------
+   void ArenaLuaAllocator::deallocate (void* ptr, std::size_t)
+   {
+      if (ptr == last_)
+      {
+         next_ = last_;
+         last_ = 0;
+      }
+   }
+
+
+
+   // - ArenaLuaAllocator::reallocate ------------------------------------------
+   void* ArenaLuaAllocator::reallocate (void* ptr, std::size_t oldSize,
+                                        std::size_t newSize)
+   {
+      if (ptr == last_
+          && static_cast<std::size_t>(end_ - last_) >= roundUp (newSize))
+      {
+         next_ = last_ + roundUp (newSize);
+         return ptr;
+      }
+      else if (newSize <= oldSize)
+      {
+         return ptr;
+      }
+
+      return LuaAllocator::reallocate (ptr, oldSize, newSize);
+   }
+
+} // namespace Diluculum
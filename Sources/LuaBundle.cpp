@@ -0,0 +1,339 @@
+/******************************************************************************\
+* LuaBundle.cpp                                                                *
+* A bundle of precompiled Lua modules.                                         *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <Diluculum/LuaBundle.hpp>
+#include <cstring>
+#include <fstream>
+#include <Diluculum/LuaExceptions.hpp>
+#include "InternalUtils.hpp"
+
+
+namespace Diluculum
+{
+   namespace
+   {
+      /// The magic bytes at the beginning of every bundle file.
+      const char TheBundleMagic[] = "DLBUNDL1";
+
+      /// The size of the bundle header, in bytes.
+      const std::size_t TheHeaderSize = 16;
+
+      /// The size of each entry in the bundle index, in bytes.
+      const std::size_t TheIndexEntrySize = 32;
+
+      /// The name of the metatable of the userdata holding bundles.
+      const char* const TheBundleMetatable = "Diluculum.LuaBundle";
+
+      /// Appends \c n to \c out, as a little-endian 64-bit integer.
+      void AppendInteger (std::string& out, unsigned long long n)
+      {
+         for (int i = 0; i < 8; ++i)
+            out += static_cast<char>((n >> (8 * i)) & 0xFF);
+      }
+
+
+
+      /// A \c lua_Writer that appends the data to an \c std::string.
+      int StringWriter (lua_State* luaState, const void* data, size_t size,
+                        void* str)
+      {
+         static_cast<std::string*>(str)->append (
+            static_cast<const char*>(data), size);
+         return 0;
+      }
+
+
+
+      /// Closes a \c lua_State when destroyed.
+      struct LuaStateCloser
+      {
+         explicit LuaStateCloser (lua_State* ls) : ls(ls) { }
+         ~LuaStateCloser() { lua_close (ls); }
+         lua_State* ls;
+      };
+
+
+
+      /// The \c __gc metamethod of the userdata holding bundles.
+      int DestroyBundle (lua_State* ls)
+      {
+         LuaBundle** bundle = static_cast<LuaBundle**>(
+            luaL_checkudata (ls, 1, TheBundleMetatable));
+         delete *bundle;
+         *bundle = 0;
+         return 0;
+      }
+
+
+
+      /** The searcher added to \c package.searchers by \c AddLuaBundle().
+       *  Its first upvalue is the userdata holding the bundle.
+       */
+      int BundleSearcher (lua_State* ls)
+      {
+         const LuaBundle* bundle =
+            *static_cast<LuaBundle**>(lua_touserdata (ls, lua_upvalueindex(1)));
+
+         size_t nameSize;
+         const char* name = luaL_checklstring (ls, 1, &nameSize);
+
+         const char* data;
+         size_t size;
+         if (!bundle->find (std::string (name, nameSize), data, size))
+         {
+            lua_pushfstring (ls, "\n\tno module '%s' in bundle '%s'", name,
+                             bundle->fileName().c_str());
+            return 1;
+         }
+
+         lua_pushfstring (ls, "=%s", name);
+         Impl::MemoryReaderState readerState (data, size);
+         if (lua_load (ls, Impl::MemoryReader, &readerState,
+                       lua_tostring (ls, -1), NULL) != 0)
+         {
+            return luaL_error (ls, "error loading module '%s' from bundle "
+                               "'%s':\n\t%s", name, bundle->fileName().c_str(),
+                               lua_tostring (ls, -1));
+         }
+
+         // Return the loader and, as its extra parameter, the bundle name
+         lua_pushstring (ls, bundle->fileName().c_str());
+         return 2;
+      }
+
+   } // (anonymous) namespace
+
+
+
+   // - LuaBundle::LuaBundle ---------------------------------------------------
+   LuaBundle::LuaBundle (const std::string& fileName)
+      : fileName_(fileName), file_(new Impl::MappedFile (fileName)),
+        numModules_(0)
+   {
+      const std::string invalid = "'" + fileName + "' is not a valid bundle.";
+
+      if (file_->size() < TheHeaderSize
+          || memcmp (file_->data(), TheBundleMagic, 8) != 0)
+      {
+         throw LuaFileError (invalid.c_str());
+      }
+
+      const unsigned long long numModules = readInteger (8);
+      if (numModules > (file_->size() - TheHeaderSize) / TheIndexEntrySize)
+         throw LuaFileError (invalid.c_str());
+
+      numModules_ = static_cast<std::size_t>(numModules);
+
+      // Check all the index entries now, so that 'find()' doesn't have to
+      for (std::size_t i = 0; i < numModules_; ++i)
+      {
+         const std::size_t entry = TheHeaderSize + i * TheIndexEntrySize;
+         for (std::size_t j = 0; j < 2; ++j)
+         {
+            const unsigned long long offset = readInteger (entry + 16 * j);
+            const unsigned long long size = readInteger (entry + 16 * j + 8);
+            if (offset > file_->size() || size > file_->size() - offset)
+               throw LuaFileError (invalid.c_str());
+         }
+      }
+   }
+
+
+
+   // - LuaBundle::~LuaBundle --------------------------------------------------
+   LuaBundle::~LuaBundle()
+   { }
+
+
+
+   // - LuaBundle::find --------------------------------------------------------
+   bool LuaBundle::find (const std::string& moduleName, const char*& data,
+                         std::size_t& size) const
+   {
+      // Binary search on the index, which is sorted by name
+      std::size_t first = 0;
+      std::size_t last = numModules_;
+      while (first < last)
+      {
+         const std::size_t middle = first + (last - first) / 2;
+         const std::size_t entry = TheHeaderSize + middle * TheIndexEntrySize;
+
+         const char* name = file_->data() + readInteger (entry);
+         const std::size_t nameSize = readInteger (entry + 8);
+
+         const int cmp = moduleName.compare (0, std::string::npos,
+                                             name, nameSize);
+         if (cmp == 0)
+         {
+            data = file_->data() + readInteger (entry + 16);
+            size = readInteger (entry + 24);
+            return true;
+         }
+         else if (cmp < 0)
+            last = middle;
+         else
+            first = middle + 1;
+      }
+
+      return false;
+   }
+
+
+
+   // - LuaBundle::write -------------------------------------------------------
+   void LuaBundle::write (const std::string& fileName,
+                          const std::map<std::string, std::string>& modules)
+   {
+      typedef std::map<std::string, std::string>::const_iterator iter_t;
+
+      std::string header (TheBundleMagic, 8);
+      AppendInteger (header, modules.size());
+
+      // The names go right after the index, followed by the bytecode
+      std::string index;
+      std::string names;
+      unsigned long long dataOffset = TheHeaderSize
+         + modules.size() * TheIndexEntrySize;
+
+      for (iter_t p = modules.begin(); p != modules.end(); ++p)
+         dataOffset += p->first.size();
+
+      for (iter_t p = modules.begin(); p != modules.end(); ++p)
+      {
+         AppendInteger (index, TheHeaderSize
+                        + modules.size() * TheIndexEntrySize + names.size());
+         AppendInteger (index, p->first.size());
+         AppendInteger (index, dataOffset);
+         AppendInteger (index, p->second.size());
+
+         names += p->first;
+         dataOffset += p->second.size();
+      }
+
+      std::ofstream file (fileName.c_str(), std::ios::binary);
+      file << header << index << names;
+      for (iter_t p = modules.begin(); p != modules.end(); ++p)
+         file << p->second;
+
+      file.close();
+      if (!file)
+         throw LuaFileError (("Cannot write '" + fileName + "'.").c_str());
+   }
+
+
+
+   // - LuaBundle::compile -----------------------------------------------------
+   std::string LuaBundle::compile (const std::string& scriptFile, bool strip)
+   {
+      lua_State* ls = luaL_newstate();
+      if (ls == 0)
+         throw LuaError ("Error opening Lua state.");
+
+      LuaStateCloser closer (ls);
+
+      Impl::ThrowOnLuaError (ls, luaL_loadfile (ls, scriptFile.c_str()));
+
+      std::string bytecode;
+#if LUA_VERSION_NUM >= 503
+      lua_dump (ls, StringWriter, &bytecode, strip);
+#else
+      lua_dump (ls, StringWriter, &bytecode);
+#endif
+
+      return bytecode;
+   }
+
+
+
+   // - LuaBundle::readInteger -------------------------------------------------
+   unsigned long long LuaBundle::readInteger (std::size_t offset) const
+   {
+      const unsigned char* p =
+         reinterpret_cast<const unsigned char*>(file_->data() + offset);
+
+      unsigned long long n = 0;
+      for (int i = 7; i >= 0; --i)
+         n = (n << 8) | p[i];
+
+      return n;
+   }
+
+
+
+   // - AddLuaBundle -----------------------------------------------------------
+   void AddLuaBundle (lua_State* state, const std::string& fileName)
+   {
+      lua_getglobal (state, "package");
+      if (lua_istable (state, -1))
+         lua_getfield (state, -1, "searchers");
+      else
+         lua_pushnil (state);
+
+      if (!lua_istable (state, -1))
+      {
+         lua_pop (state, 2);
+         throw LuaError ("Cannot add a bundle: 'package.searchers' not found. "
+                         "Is the package library loaded?");
+      }
+
+      std::unique_ptr<LuaBundle> bundle;
+      try
+      {
+         bundle.reset (new LuaBundle (fileName));
+      }
+      catch (...)
+      {
+         lua_pop (state, 2);
+         throw;
+      }
+
+      // Make room for the new searcher, at position 2
+      const int numSearchers = static_cast<int>(lua_rawlen (state, -1));
+      for (int i = numSearchers; i >= 2; --i)
+      {
+         lua_rawgeti (state, -1, i);
+         lua_rawseti (state, -2, i + 1);
+      }
+
+      // Create the searcher, with the bundle as upvalue
+      LuaBundle** ud =
+         static_cast<LuaBundle**>(lua_newuserdata (state, sizeof(LuaBundle*)));
+      *ud = bundle.release();
+
+      if (luaL_newmetatable (state, TheBundleMetatable))
+      {
+         lua_pushcfunction (state, DestroyBundle);
+         lua_setfield (state, -2, "__gc");
+      }
+      lua_setmetatable (state, -2);
+
+      lua_pushcclosure (state, BundleSearcher, 1);
+      lua_rawseti (state, -2, 2);
+
+      lua_pop (state, 2);
+   }
+
+} // namespace Diluculum
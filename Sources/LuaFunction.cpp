@@ -25,39 +25,98 @@
 \******************************************************************************/
 
 #include <Diluculum/LuaFunction.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <cstring>
+#include <boost/scoped_array.hpp>
+#include "InternalUtils.hpp"
 
 
 namespace Diluculum
 {
+   namespace Impl
+   {
+      /** The data of a \c LuaFunction. It is shared among copies of a
+       *  \c LuaFunction, and never changes while shared.
+       */
+      struct LuaFunctionData
+      {
+         /// Constructs a \c LuaFunctionData able to hold \c capacity bytes.
+         explicit LuaFunctionData (size_t capacity)
+            : size(0), capacity(capacity), bytes(new char[capacity]), hash(0),
+              unshareable(false)
+         { }
+
+         /// The number of bytes stored in \c bytes.
+         size_t size;
+
+         /// The number of bytes allocated for \c bytes.
+         size_t capacity;
+
+         /// The data itself.
+         boost::scoped_array<char> bytes;
+
+         /** The hash of the data, computed on the first time it is needed.
+          *  Zero means "not computed yet".
+          */
+         mutable std::atomic<std::size_t> hash;
+
+         /** Is this data unshareable? This is set once a non-\c const
+          *  pointer to \c bytes was handed out, since the data can then
+          *  change at any time. Unshareable data is copied instead of shared,
+          *  and its hash is not cached.
+          */
+         bool unshareable;
+      };
+
+      /** Returns \c data for use by another \c LuaFunction: either \c data
+       *  itself or, if it is unshareable, a copy of it.
+       */
+      std::shared_ptr<LuaFunctionData> ShareData (
+         const std::shared_ptr<LuaFunctionData>& data)
+      {
+         if (!data || !data->unshareable)
+            return data;
+
+         std::shared_ptr<LuaFunctionData> copy (
+            new LuaFunctionData (data->capacity));
+         memcpy (copy->bytes.get(), data->bytes.get(), data->size);
+         copy->size = data->size;
+         return copy;
+      }
+   }
+
+
+
    // - LuaFunction::LuaFunction -----------------------------------------------
    LuaFunction::LuaFunction (const std::string& luaChunk)
-      : functionType_(LUA_LUA_FUNCTION), size_(luaChunk.size()),
-        data_(new char[size_])
+      : functionType_(LUA_LUA_FUNCTION)
    {
-      memcpy(data_.get(), luaChunk.c_str(), size_);
+      appendData (luaChunk.c_str(), luaChunk.size());
    }
 
    LuaFunction::LuaFunction (const void* data, size_t size)
-      : functionType_(LUA_LUA_FUNCTION), size_(size), data_(new char[size_])
+      : functionType_(LUA_LUA_FUNCTION)
    {
-      memcpy(data_.get(), data, size);
+      appendData (data, size);
    }
 
    LuaFunction::LuaFunction (lua_CFunction func)
-      : functionType_(LUA_C_FUNCTION), size_(sizeof(lua_CFunction)),
-        data_(new char[sizeof(lua_CFunction)])
+      : functionType_(LUA_C_FUNCTION)
    {
-      memcpy(data_.get(), reinterpret_cast<lua_CFunction*>(&func),
-             sizeof(lua_CFunction));
+      appendData (reinterpret_cast<lua_CFunction*>(&func),
+                  sizeof(lua_CFunction));
    }
 
    LuaFunction::LuaFunction (const LuaFunction& other)
       : functionType_(other.functionType_),
-        size_(other.getSize()), data_(new char[size_])
-   {
-      memcpy (data_.get(), other.getData(), getSize());
-   }
+        data_(Impl::ShareData (other.data_))
+   { }
+
+   LuaFunction::LuaFunction (LuaFunction&& other) noexcept
+      : functionType_(other.functionType_), data_(std::move (other.data_))
+   { }
 
 
 
@@ -67,7 +126,42 @@ namespace Diluculum
       assert(functionType_ == LUA_C_FUNCTION
              && "Called LuaFunction::getCFunction() for a non-C function.");
 
-      return *reinterpret_cast<lua_CFunction*>(data_.get());
+      return *reinterpret_cast<const lua_CFunction*>(getData());
+   }
+
+
+
+   // - LuaFunction::getSize ---------------------------------------------------
+   size_t LuaFunction::getSize() const
+   {
+      return data_ ? data_->size : 0;
+   }
+
+
+
+   // - LuaFunction::getCapacity -----------------------------------------------
+   size_t LuaFunction::getCapacity() const
+   {
+      return data_ ? data_->capacity : 0;
+   }
+
+
+
+   // - LuaFunction::getData ---------------------------------------------------
+   void* LuaFunction::getData()
+   {
+      if (!data_)
+         return 0;
+
+      // The caller may write through the pointer at any time from now on
+      makeUnique (data_->capacity);
+      data_->unshareable = true;
+      return data_->bytes.get();
+   }
+
+   const void* LuaFunction::getData() const
+   {
+      return data_ ? data_->bytes.get() : 0;
    }
 
 
@@ -75,9 +169,80 @@ namespace Diluculum
    // - LuaFunction::setData ---------------------------------------------------
    void LuaFunction::setData (void* data, size_t size)
    {
-      size_ = size;
-      data_.reset (new char[size]);
-      memcpy(data_.get(), data, size);
+      data_.reset (new Impl::LuaFunctionData (size));
+      memcpy (data_->bytes.get(), data, size);
+      data_->size = size;
+   }
+
+
+
+   // - LuaFunction::appendData ------------------------------------------------
+   void LuaFunction::appendData (const void* data, size_t size)
+   {
+      const size_t oldSize = getSize();
+      if (oldSize + size > getCapacity())
+         makeUnique (std::max (oldSize + size, 2 * getCapacity()));
+      else
+         makeUnique (getCapacity());
+
+      memcpy (data_->bytes.get() + oldSize, data, size);
+      data_->size += size;
+   }
+
+
+
+   // - LuaFunction::reserve ---------------------------------------------------
+   void LuaFunction::reserve (size_t capacity)
+   {
+      if (capacity > getCapacity())
+         makeUnique (capacity);
+   }
+
+
+
+   // - LuaFunction::makeUnique ------------------------------------------------
+   void LuaFunction::makeUnique (size_t capacity)
+   {
+      if (data_ && data_.use_count() == 1 && capacity <= data_->capacity)
+      {
+         data_->hash = 0;
+         return;
+      }
+
+      std::shared_ptr<Impl::LuaFunctionData> newData (
+         new Impl::LuaFunctionData (std::max (capacity, getSize())));
+
+      if (data_)
+      {
+         memcpy (newData->bytes.get(), data_->bytes.get(), data_->size);
+         newData->size = data_->size;
+      }
+
+      data_.swap (newData);
+   }
+
+
+
+   // - LuaFunction::hash ------------------------------------------------------
+   std::size_t LuaFunction::hash() const
+   {
+      if (!data_)
+         return 0;
+
+      std::size_t h = data_->hash.load (std::memory_order_relaxed);
+      if (h == 0)
+      {
+         h = Impl::HashBytes (data_->bytes.get(), data_->size);
+         if (h == 0) // zero means "not computed"
+            h = 1;
+
+         // The data may still change through a pointer returned by
+         // 'getData()', so caching the hash would be unsafe
+         if (!data_->unshareable)
+            data_->hash.store (h, std::memory_order_relaxed);
+      }
+
+      return h;
    }
 
 
@@ -85,26 +250,53 @@ namespace Diluculum
    // - LuaFunction::operator= -------------------------------------------------
    const LuaFunction& LuaFunction::operator= (const LuaFunction& rhs)
    {
-      size_ = rhs.getSize();
       functionType_ = rhs.functionType_;
-      data_.reset (new char[getSize()]);
-      memcpy (getData(), rhs.getData(), getSize());
+      data_ = Impl::ShareData (rhs.data_);
+      return *this;
+   }
+
+
+   const LuaFunction& LuaFunction::operator= (LuaFunction&& rhs) noexcept
+   {
+      if (this != &rhs)
+      {
+         functionType_ = rhs.functionType_;
+         data_ = std::move (rhs.data_);
+      }
       return *this;
    }
 
 
 
+   // - LuaFunction::compare ---------------------------------------------------
+   int LuaFunction::compare (const LuaFunction& rhs) const
+   {
+      if (functionType_ != rhs.functionType_)
+         return functionType_ < rhs.functionType_ ? -1 : 1;
+
+      if (data_ == rhs.data_)
+         return 0;
+
+      if (getSize() != rhs.getSize())
+         return getSize() < rhs.getSize() ? -1 : 1;
+
+      if (getSize() == 0)
+         return 0;
+
+      const std::size_t lhsHash = hash();
+      const std::size_t rhsHash = rhs.hash();
+      if (lhsHash != rhsHash)
+         return lhsHash < rhsHash ? -1 : 1;
+
+      return memcmp (getData(), rhs.getData(), getSize());
+   }
+
+
+
    // - LuaFunction::operator> -------------------------------------------------
    bool LuaFunction::operator> (const LuaFunction& rhs) const
    {
-      if (functionType_ > rhs.functionType_)
-         return true;
-      else if (getSize() > rhs.getSize())
-         return true;
-      else if (getSize() < rhs.getSize())
-         return false;
-      else // getSize() == rhs.getSize()
-         return memcmp (getData(), rhs.getData(), getSize()) > 0;
+      return compare (rhs) > 0;
    }
 
 
@@ -112,14 +304,7 @@ namespace Diluculum
    // - LuaFunction::operator< -------------------------------------------------
    bool LuaFunction::operator< (const LuaFunction& rhs) const
    {
-      if (functionType_ < rhs.functionType_)
-         return true;
-      else if (getSize() < rhs.getSize())
-         return true;
-      else if (getSize() > rhs.getSize())
-         return false;
-      else // getSize() == rhs.getSize()
-         return memcmp (getData(), rhs.getData(), getSize()) < 0;
+      return compare (rhs) < 0;
    }
 
 
@@ -127,9 +312,7 @@ namespace Diluculum
    // - LuaFunction::operator== ------------------------------------------------
    bool LuaFunction::operator== (const LuaFunction& rhs) const
    {
-      return functionType_ == rhs.functionType_
-         && getSize() == rhs.getSize()
-         && memcmp (getData(), rhs.getData(), getSize()) == 0;
+      return compare (rhs) == 0;
    }
 
 
@@ -137,9 +320,7 @@ namespace Diluculum
    // - LuaFunction::operator!= ------------------------------------------------
    bool LuaFunction::operator!= (const LuaFunction& rhs) const
    {
-      return functionType_ != rhs.functionType_
-         || getSize() != rhs.getSize()
-         || memcmp (getData(), rhs.getData(), getSize()) != 0;
+      return compare (rhs) != 0;
    }
 
 } // namespace Diluculum
@@ -0,0 +1,384 @@
+/******************************************************************************\
+* LuaProfiler.cpp                                                              *
+* Profilers for Lua code.                                                      *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <Diluculum/LuaProfiler.hpp>
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <utility>
+#include <vector>
+#include "InternalUtils.hpp"
+
+
+namespace Diluculum
+{
+   namespace
+   {
+      /** Appends to \c str the description of the stack frame described by
+       *  \c ar (which must have been filled with the "Sln" options), in the
+       *  format used in \c LuaFoldedStacks.
+       */
+      void AppendFrame (std::string& str, const lua_Debug& ar)
+      {
+         if (std::strcmp (ar.what, "C") == 0)
+         {
+            str += "[C]";
+         }
+         else
+         {
+            // Semicolons separate frames, so they can't appear in them
+            std::string source (ar.short_src);
+            std::replace (source.begin(), source.end(), ';', ',');
+            str += source;
+            str += ':';
+            str += std::to_string (ar.currentline);
+         }
+
+         str += ':';
+         if (ar.name != 0)
+            str += ar.name;
+         else if (std::strcmp (ar.what, "main") == 0)
+            str += "(main)";
+         else
+            str += '?';
+      }
+
+      /// Compares call sites by the number of bytes allocated, decreasing.
+      bool MoreAllocated (
+         const std::pair<std::string, LuaAllocationSiteStats>& a,
+         const std::pair<std::string, LuaAllocationSiteStats>& b)
+      {
+         return a.second.allocatedBytes > b.second.allocatedBytes;
+      }
+   }
+
+
+
+   // - LuaProfiler::LuaProfiler -----------------------------------------------
+   LuaProfiler::LuaProfiler (LuaState& ls, std::chrono::microseconds period)
+      : state_(ls), period_(period), running_(false), sampleDue_(false),
+        sampleCount_(0), stopTimer_(false)
+   { }
+
+
+
+   // - LuaProfiler::~LuaProfiler ----------------------------------------------
+   LuaProfiler::~LuaProfiler()
+   {
+      stop();
+   }
+
+
+
+   // - LuaProfiler::start -----------------------------------------------------
+   void LuaProfiler::start()
+   {
+      if (running_)
+         return;
+
+      // Through the 'LuaState', so that it can find the block later on
+      Impl::ExecutionControl* control = state_.executionControl();
+
+      if (control->sampler != 0)
+         throw LuaError ("Another profiler is running on this Lua state.");
+
+      stopTimer_ = false;
+      sampleDue_ = false;
+      timer_ = std::thread (&LuaProfiler::timer, this);
+
+      control->sampler = sample;
+      control->samplerData = this;
+      running_ = true;
+   }
+
+
+
+   // - LuaProfiler::stop ------------------------------------------------------
+   void LuaProfiler::stop()
+   {
+      if (!running_)
+         return;
+
+      Impl::ExecutionControl* control = state_.executionControl();
+      control->sampler = 0;
+      control->samplerData = 0;
+
+      {
+         std::lock_guard<std::mutex> lock (timerMutex_);
+         stopTimer_ = true;
+      }
+      timerStopped_.notify_one();
+      timer_.join();
+
+      running_ = false;
+   }
+
+
+
+   // - LuaProfiler::clear -----------------------------------------------------
+   void LuaProfiler::clear()
+   {
+      stacks_.clear();
+      sampleCount_ = 0;
+   }
+
+
+
+   // - LuaProfiler::writeFolded -----------------------------------------------
+   void LuaProfiler::writeFolded (std::ostream& os) const
+   {
+      typedef LuaFoldedStacks::const_iterator iter_t;
+      for (iter_t p = stacks_.begin(); p != stacks_.end(); ++p)
+         os << p->first << ' ' << p->second << '\n';
+   }
+
+
+
+   // - LuaProfiler::sample ----------------------------------------------------
+   void LuaProfiler::sample (lua_State* ls, void* data)
+   {
+      LuaProfiler* self = static_cast<LuaProfiler*>(data);
+      if (!self->sampleDue_.exchange (false))
+         return;
+
+      // This runs inside a Lua hook, so nothing can be thrown from here. If
+      // memory is short, the sample is just lost.
+      try
+      {
+         lua_Debug ar;
+         int depth = 0;
+         while (lua_getstack (ls, depth, &ar))
+            ++depth;
+
+         std::string stack;
+         for (int level = depth - 1; level >= 0; --level)
+         {
+            lua_getstack (ls, level, &ar);
+            lua_getinfo (ls, "Sln", &ar);
+
+            if (!stack.empty())
+               stack += ';';
+
+            AppendFrame (stack, ar);
+         }
+
+         ++self->stacks_[stack];
+         ++self->sampleCount_;
+      }
+      catch (...)
+      { }
+   }
+
+
+
+   // - LuaProfiler::timer -----------------------------------------------------
+   void LuaProfiler::timer()
+   {
+      std::unique_lock<std::mutex> lock (timerMutex_);
+      while (!timerStopped_.wait_for (lock, period_,
+                                      [this]() { return stopTimer_; }))
+      {
+         sampleDue_ = true;
+      }
+   }
+
+
+
+
+   // - LuaAllocationProfiler::LuaAllocationProfiler ---------------------------
+   LuaAllocationProfiler::LuaAllocationProfiler (LuaState& ls,
+                                                 std::size_t sampleInterval)
+      : state_(ls), sampleInterval_(sampleInterval), running_(false),
+        bytesUntilSample_(sampleInterval), pendingSite_(0), pendingWeight_(0)
+   {
+      if (ls.allocator() == 0)
+      {
+         throw LuaError ("Allocation profiling requires a 'LuaState' created "
+                         "with a 'LuaAllocator'.");
+      }
+
+      if (sampleInterval == 0)
+         throw LuaError ("The allocation sampling interval must be positive.");
+   }
+
+
+
+   // - LuaAllocationProfiler::~LuaAllocationProfiler --------------------------
+   LuaAllocationProfiler::~LuaAllocationProfiler()
+   {
+      stop();
+   }
+
+
+
+   // - LuaAllocationProfiler::start -------------------------------------------
+   void LuaAllocationProfiler::start()
+   {
+      if (running_)
+         return;
+
+      LuaAllocator* allocator = state_.allocator();
+      if (allocator->observer() != 0)
+      {
+         throw LuaError ("The allocator of this Lua state is already "
+                         "observed.");
+      }
+
+      allocator->setObserver (this);
+      running_ = true;
+   }
+
+
+
+   // - LuaAllocationProfiler::stop --------------------------------------------
+   void LuaAllocationProfiler::stop()
+   {
+      if (!running_)
+         return;
+
+      state_.allocator()->setObserver (0);
+      pendingSite_ = 0;
+      running_ = false;
+   }
+
+
+
+   // - LuaAllocationProfiler::clear -------------------------------------------
+   void LuaAllocationProfiler::clear()
+   {
+      liveBlocks_.clear();
+      sites_.clear();
+      pendingSite_ = 0;
+   }
+
+
+
+   // - LuaAllocationProfiler::writeReport -------------------------------------
+   void LuaAllocationProfiler::writeReport (std::ostream& os) const
+   {
+      std::vector<std::pair<std::string, LuaAllocationSiteStats> > sites (
+         sites_.begin(), sites_.end());
+      std::stable_sort (sites.begin(), sites.end(), MoreAllocated);
+
+      os << std::setw (14) << "allocated" << std::setw (14) << "retained"
+         << std::setw (10) << "samples" << "  call site\n";
+
+      for (std::size_t i = 0; i < sites.size(); ++i)
+      {
+         os << std::setw (14) << sites[i].second.allocatedBytes
+            << std::setw (14) << sites[i].second.retainedBytes
+            << std::setw (10) << sites[i].second.samples
+            << "  " << sites[i].first << '\n';
+      }
+   }
+
+
+
+   // - LuaAllocationProfiler::allocating --------------------------------------
+   void LuaAllocationProfiler::allocating (std::size_t size)
+   {
+      pendingSite_ = 0;
+
+      if (size < bytesUntilSample_)
+      {
+         bytesUntilSample_ -= size;
+         return;
+      }
+
+      // Sample this one. Small blocks are sampled with a probability
+      // proportional to their size, so they account for the whole interval.
+      pendingWeight_ = std::max (size, sampleInterval_);
+      bytesUntilSample_ =
+         sampleInterval_ - (size - bytesUntilSample_) % sampleInterval_;
+
+      // This runs in the middle of a Lua operation, so nothing can be thrown
+      // from here. If memory is short, the sample is just lost.
+      try
+      {
+         lua_State* ls = state_.getState();
+         lua_Debug ar;
+         std::string site = "(no Lua code)";
+
+         for (int level = 0; lua_getstack (ls, level, &ar); ++level)
+         {
+            lua_getinfo (ls, "Sln", &ar);
+            if (std::strcmp (ar.what, "C") != 0)
+            {
+               site.clear();
+               AppendFrame (site, ar);
+               break;
+            }
+         }
+
+         pendingSite_ = &sites_[site];
+      }
+      catch (...)
+      { }
+   }
+
+
+
+   // - LuaAllocationProfiler::allocated ---------------------------------------
+   void LuaAllocationProfiler::allocated (void* ptr, std::size_t)
+   {
+      if (pendingSite_ == 0)
+         return;
+
+      LuaAllocationSiteStats* site = pendingSite_;
+      pendingSite_ = 0;
+
+      ++site->samples;
+      site->allocatedBytes += pendingWeight_;
+
+      try
+      {
+         const LiveBlock block = { site, pendingWeight_ };
+         liveBlocks_[ptr] = block;
+         site->retainedBytes += pendingWeight_;
+      }
+      catch (...)
+      { }
+   }
+
+
+
+   // - LuaAllocationProfiler::freed -------------------------------------------
+   void LuaAllocationProfiler::freed (void* ptr, std::size_t)
+   {
+      if (liveBlocks_.empty())
+         return;
+
+      const std::unordered_map<void*, LiveBlock>::iterator p =
+         liveBlocks_.find (ptr);
+
+      if (p != liveBlocks_.end())
+      {
+         p->second.site->retainedBytes -= p->second.weight;
+         liveBlocks_.erase (p);
+      }
+   }
+
+} // namespace Diluculum
@@ -0,0 +1,179 @@
+/******************************************************************************\
+* LuaRef.cpp                                                                   *
+* A reference to a value living in a Lua state.                                *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <utility>
+#include <Diluculum/LuaRef.hpp>
+#include <Diluculum/LuaExceptions.hpp>
+#include <Diluculum/LuaUtils.hpp>
+#include "InternalUtils.hpp"
+
+
+namespace Diluculum
+{
+   // - LuaRef::LuaRef ---------------------------------------------------------
+   LuaRef::LuaRef()
+      : state_(0), ref_(LUA_NOREF)
+   { }
+
+   LuaRef::LuaRef (lua_State* ls, int index)
+      : state_(0), ref_(LUA_NOREF)
+   {
+      lua_pushvalue (ls, index);
+      pinTop (ls);
+   }
+
+   LuaRef::LuaRef (const LuaVariable& var)
+      : state_(0), ref_(LUA_NOREF)
+   {
+      var.pushTheReferencedValue();
+      pinTop (var.state_);
+   }
+
+   LuaRef::LuaRef (const LuaRef& other)
+      : state_(0), ref_(LUA_NOREF)
+   {
+      if (!other.empty())
+      {
+         other.push();
+         pinTop (other.state_);
+      }
+   }
+
+   LuaRef::LuaRef (LuaRef&& other) noexcept
+      : state_(other.state_), ref_(other.ref_)
+   {
+      other.state_ = 0;
+      other.ref_ = LUA_NOREF;
+   }
+
+
+
+   // - LuaRef::~LuaRef --------------------------------------------------------
+   LuaRef::~LuaRef()
+   {
+      reset();
+   }
+
+
+
+   // - LuaRef::operator= ------------------------------------------------------
+   LuaRef& LuaRef::operator= (const LuaRef& rhs)
+   {
+      if (this != &rhs)
+      {
+         LuaRef copy (rhs);
+         *this = std::move (copy);
+      }
+
+      return *this;
+   }
+
+   LuaRef& LuaRef::operator= (LuaRef&& rhs) noexcept
+   {
+      if (this != &rhs)
+      {
+         reset();
+         state_ = rhs.state_;
+         ref_ = rhs.ref_;
+         rhs.state_ = 0;
+         rhs.ref_ = LUA_NOREF;
+      }
+
+      return *this;
+   }
+
+
+
+   // - LuaRef::reset ----------------------------------------------------------
+   void LuaRef::reset()
+   {
+      if (state_ != 0)
+         luaL_unref (state_, LUA_REGISTRYINDEX, ref_);
+
+      state_ = 0;
+      ref_ = LUA_NOREF;
+   }
+
+
+
+   // - LuaRef::push -----------------------------------------------------------
+   void LuaRef::push() const
+   {
+      if (empty())
+         throw LuaError ("Trying to use an empty 'LuaRef'.");
+
+      lua_rawgeti (state_, LUA_REGISTRYINDEX, ref_);
+   }
+
+
+
+   // - LuaRef::value ----------------------------------------------------------
+   LuaValue LuaRef::value() const
+   {
+      push();
+      LuaValue ret = ToLuaValue (state_, -1);
+      lua_pop (state_, 1);
+      return ret;
+   }
+
+
+
+   // - LuaRef::operator() -----------------------------------------------------
+   LuaValueList LuaRef::operator() (const LuaValueList& params) const
+   {
+      push();
+      return Impl::CallFunctionOnTop (state_, params);
+   }
+
+
+
+   // - LuaRef::callInto -------------------------------------------------------
+   void LuaRef::callInto (const LuaValueList& params, LuaValueList& results,
+                          int numResults) const
+   {
+      push();
+      Impl::CallFunctionOnTop (state_, params, numResults, &results);
+   }
+
+
+
+   // - LuaRef::callAndDiscard -------------------------------------------------
+   void LuaRef::callAndDiscard (const LuaValueList& params) const
+   {
+      push();
+      Impl::CallFunctionOnTop (state_, params, 0, 0);
+   }
+
+
+
+   // - LuaRef::pinTop ---------------------------------------------------------
+   void LuaRef::pinTop (lua_State* ls)
+   {
+      ref_ = luaL_ref (ls, LUA_REGISTRYINDEX);
+      state_ = ls;
+   }
+
+} // namespace Diluculum
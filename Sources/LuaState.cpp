@@ -25,8 +25,12 @@
 \******************************************************************************/
 
 #include <cassert>
+#include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <memory>
 #include <typeinfo>
+#include <sys/stat.h>
 #include <boost/lexical_cast.hpp>
 #include <Diluculum/LuaState.hpp>
 #include <Diluculum/LuaUtils.hpp>
@@ -35,9 +39,98 @@
 
 namespace Diluculum
 {
+   namespace
+   {
+      /** The size of the buffer used to read streams in \c doStream() and
+       *  \c doFileStreamed().
+       */
+      const std::size_t TheStreamBufferSize = 64 * 1024;
+
+      /** The panic function of Lua states created with a \c LuaAllocator.
+       *  Does the same as the one installed by \c luaL_newstate().
+       */
+      int Panic (lua_State* ls)
+      {
+         std::fprintf (stderr,
+                       "PANIC: unprotected error in call to Lua API (%s)\n",
+                       lua_tostring (ls, -1));
+         return 0;
+      }
+
+      /** Opens the Lua standard libraries. Called in protected mode, so
+       *  that running out of memory doesn't cause a panic.
+       */
+      int OpenLibs (lua_State* ls)
+      {
+         luaL_openlibs (ls);
+         return 0;
+      }
+
+      /** The address of this variable is used as the key, in the registry,
+       *  of the counter of garbage collection cycles (a userdata with a
+       *  \c std::size_t).
+       */
+      char TheGCCycleCounterKey;
+
+      /// The name of the metatable of the "canaries" used to count cycles.
+      const char* const TheGCCanaryMetatable = "Diluculum.GCCanary";
+
+      /** Creates a "canary": an object that is garbage as soon as created,
+       *  so that it is finalized at the end of the next collection cycle.
+       */
+      void CreateGCCanary (lua_State* ls)
+      {
+         lua_newuserdata (ls, 0);
+         luaL_getmetatable (ls, TheGCCanaryMetatable);
+         lua_setmetatable (ls, -2);
+         lua_pop (ls, 1);
+      }
+
+      /** The finalizer of the canaries: counts a cycle (in the counter
+       *  passed as upvalue) and creates a canary for the next one.
+       */
+      int GCCanaryFinalizer (lua_State* ls)
+      {
+         void* counter = lua_touserdata (ls, lua_upvalueindex (1));
+         ++*static_cast<std::size_t*>(counter);
+         CreateGCCanary (ls);
+         return 0;
+      }
+
+      /** Returns the counter of garbage collection cycles of \c ls, first
+       *  installing it (and so starting to count cycles) if necessary.
+       */
+      std::size_t* GCCycleCounter (lua_State* ls)
+      {
+         lua_rawgetp (ls, LUA_REGISTRYINDEX, &TheGCCycleCounterKey);
+         std::size_t* counter =
+            static_cast<std::size_t*>(lua_touserdata (ls, -1));
+         lua_pop (ls, 1);
+         if (counter != 0)
+            return counter; // maybe by another 'LuaState' using 'ls'
+
+         counter = static_cast<std::size_t*>(
+            lua_newuserdata (ls, sizeof (std::size_t)));
+         *counter = 0;
+         lua_pushvalue (ls, -1);
+         lua_rawsetp (ls, LUA_REGISTRYINDEX, &TheGCCycleCounterKey);
+
+         luaL_newmetatable (ls, TheGCCanaryMetatable);
+         lua_insert (ls, -2);
+         lua_pushcclosure (ls, GCCanaryFinalizer, 1);
+         lua_setfield (ls, -2, "__gc");
+         lua_pop (ls, 1);
+
+         CreateGCCanary (ls);
+         return counter;
+      }
+   }
+
+
+
    // - LuaState::LuaState -----------------------------------------------------
    LuaState::LuaState (bool loadStdLib)
-      : state_(0), ownsState_(true)
+      : state_(0), ownsState_(true), chunkCacheStats_(), control_(0)
    {
       state_ = luaL_newstate();
       if (state_ == 0)
@@ -45,17 +138,60 @@ namespace Diluculum
 
       if (loadStdLib)
          luaL_openlibs (state_);
+
+      control_ = Impl::GetExecutionControl (state_, true);
+      GCCycleCounter (state_);
+   }
+
+
+   LuaState::LuaState (std::unique_ptr<LuaAllocator> allocator,
+                       bool loadStdLib)
+      : state_(0), ownsState_(true), chunkCacheStats_(),
+        allocator_(std::move (allocator)), control_(0)
+   {
+      if (!allocator_)
+         throw LuaError ("Constructor of 'LuaState' got a NULL allocator.");
+
+      state_ = lua_newstate (LuaAllocator::luaAlloc, allocator_.get());
+      if (state_ == 0)
+         throw LuaMemoryError ("Not enough memory to open a Lua state.");
+
+      lua_atpanic (state_, Panic);
+
+      if (loadStdLib)
+      {
+         lua_pushcfunction (state_, OpenLibs);
+         const int status = lua_pcall (state_, 0, 0, 0);
+         if (status != 0)
+         {
+            try
+            {
+               Impl::ThrowOnLuaError (state_, status);
+            }
+            catch (...)
+            {
+               lua_close (state_);
+               throw;
+            }
+         }
+      }
+
+      control_ = Impl::GetExecutionControl (state_, true);
+      GCCycleCounter (state_);
    }
 
 
    LuaState::LuaState (lua_State* state, bool loadStdLib)
-      : state_(state), ownsState_(false)
+      : state_(state), ownsState_(false), chunkCacheStats_(), control_(0)
    {
       if (state_ == 0)
          throw LuaError ("Constructor of 'LuaState' got a NULL pointer.");
 
       if (loadStdLib)
          luaL_openlibs (state_);
+
+      // Don't leave anything in a borrowed state until it is needed
+      control_ = Impl::GetExecutionControl (state_, false);
    }
 
 
@@ -65,6 +201,155 @@ namespace Diluculum
    {
       if (ownsState_ && state_ != 0)
          lua_close (state_);
+      else if (state_ != 0)
+         clearChunkCache(); // don't leave references in someone else's state
+   }
+
+
+
+   // - LuaState::memoryStats --------------------------------------------------
+   LuaMemoryStats LuaState::memoryStats() const
+   {
+      if (allocator_)
+         return allocator_->stats();
+
+      LuaMemoryStats stats = { 0, 0, 0, 0 };
+      stats.bytesInUse =
+         static_cast<std::size_t>(lua_gc (state_, LUA_GCCOUNT, 0)) * 1024
+         + lua_gc (state_, LUA_GCCOUNTB, 0);
+      return stats;
+   }
+
+
+
+   // - LuaState::setMemoryLimit -----------------------------------------------
+   void LuaState::setMemoryLimit (std::size_t limit)
+   {
+      if (!allocator_)
+      {
+         throw LuaError ("Memory limits require a 'LuaState' created with a "
+                         "'LuaAllocator'.");
+      }
+
+      allocator_->setLimit (limit);
+   }
+
+
+
+   // - LuaState::setInstructionLimit ------------------------------------------
+   void LuaState::setInstructionLimit (std::size_t maxInstructions)
+   {
+      executionControl()->instructionLimit = maxInstructions;
+   }
+
+
+
+   // - LuaState::setTimeLimit -------------------------------------------------
+   void LuaState::setTimeLimit (std::chrono::microseconds maxTime)
+   {
+      if (maxTime.count() < 0)
+         throw LuaError ("Time limits cannot be negative.");
+
+      executionControl()->timeLimit = maxTime;
+   }
+
+
+
+   // - LuaState::setLimitCheckInterval ----------------------------------------
+   void LuaState::setLimitCheckInterval (int instructions)
+   {
+      if (instructions <= 0)
+         throw LuaError ("The limit check interval must be positive.");
+
+      executionControl()->checkInterval = instructions;
+   }
+
+
+
+   // - LuaState::requestCancel ------------------------------------------------
+   void LuaState::requestCancel()
+   {
+      // This may run in another thread, so don't touch the state to look for
+      // (or create) the control block
+      if (control_ != 0)
+         Impl::RequestCancel (state_, control_);
+   }
+
+
+
+   // - LuaState::gcStats ------------------------------------------------------
+   LuaGCStats LuaState::gcStats()
+   {
+      LuaGCStats stats;
+      stats.kilobytesInUse = lua_gc (state_, LUA_GCCOUNT, 0);
+      stats.bytesInUse = stats.kilobytesInUse * 1024
+         + lua_gc (state_, LUA_GCCOUNTB, 0);
+
+      stats.cycles = *GCCycleCounter (state_);
+
+      stats.running = lua_gc (state_, LUA_GCISRUNNING, 0) != 0;
+
+      return stats;
+   }
+
+
+
+   // - LuaState::setGCPause ---------------------------------------------------
+   int LuaState::setGCPause (int percent)
+   {
+      return lua_gc (state_, LUA_GCSETPAUSE, percent);
+   }
+
+
+
+   // - LuaState::setGCStepMultiplier ------------------------------------------
+   int LuaState::setGCStepMultiplier (int percent)
+   {
+      return lua_gc (state_, LUA_GCSETSTEPMUL, percent);
+   }
+
+
+
+   // - LuaState::setGCMode ----------------------------------------------------
+   bool LuaState::setGCMode (LuaGCMode mode)
+   {
+#if LUA_VERSION_NUM >= 504
+      if (mode == GC_GENERATIONAL)
+         lua_gc (state_, LUA_GCGEN, 0, 0);
+      else
+         lua_gc (state_, LUA_GCINC, 0, 0, 0);
+      return true;
+#elif defined(LUA_GCGEN)
+      lua_gc (state_, mode == GC_GENERATIONAL ? LUA_GCGEN : LUA_GCINC, 0);
+      return true;
+#else
+      return mode == GC_INCREMENTAL;
+#endif
+   }
+
+
+
+   // - LuaState::collectFor ---------------------------------------------------
+   bool LuaState::collectFor (std::chrono::microseconds budget)
+   {
+      typedef std::chrono::steady_clock Clock;
+      const Clock::time_point deadline = Clock::now() + budget;
+
+      const bool wasRunning = lua_gc (state_, LUA_GCISRUNNING, 0) != 0;
+      if (!wasRunning)
+         lua_gc (state_, LUA_GCRESTART, 0);
+
+      bool cycleCompleted;
+      do
+      {
+         cycleCompleted = lua_gc (state_, LUA_GCSTEP, 0) != 0;
+      }
+      while (!cycleCompleted && Clock::now() < deadline);
+
+      if (!wasRunning)
+         lua_gc (state_, LUA_GCSTOP, 0);
+
+      return cycleCompleted;
    }
 
 
@@ -74,21 +359,114 @@ namespace Diluculum
    {
       const int stackSizeAtBeginning = lua_gettop (state_);
 
-      if (isString)
+      loadChunk (isString, str);
+
+      return runChunk (stackSizeAtBeginning);
+   }
+
+
+
+   // - LuaState::doStream -----------------------------------------------------
+   LuaValueList LuaState::doStream (std::istream& stream,
+                                    const std::string& chunkName)
+   {
+      if (stream.fail())
+         throw LuaFileError (("Cannot read '" + chunkName + "'.").c_str());
+
+      const int stackSizeAtBeginning = lua_gettop (state_);
+
+      Impl::StreamReaderState readerState (stream, TheStreamBufferSize);
+      const int status = lua_load (state_, Impl::StreamReader, &readerState,
+                                   chunkName.c_str(), NULL);
+
+      if (stream.bad())
       {
-         Impl::ThrowOnLuaError (state_, luaL_loadbuffer (state_, str.c_str(),
-                                                         str.length(), "line"));
+         lua_settop (state_, stackSizeAtBeginning);
+         throw LuaFileError (("Error reading '" + chunkName + "'.").c_str());
       }
-      else
+
+      Impl::ThrowOnLuaError (state_, status);
+
+      return runChunk (stackSizeAtBeginning);
+   }
+
+
+
+   // - LuaState::doFileStreamed -----------------------------------------------
+   LuaValueList LuaState::doFileStreamed (const std::string& fileName,
+                                          bool allowMmap)
+   {
+      if (allowMmap && Impl::MappedFile::supported())
       {
-         Impl::ThrowOnLuaError (state_, luaL_loadfile (state_, str.c_str()));
+         std::unique_ptr<Impl::MappedFile> file;
+         try
+         {
+            file.reset (new Impl::MappedFile (fileName));
+         }
+         catch (const LuaFileError&)
+         {
+            // Not a regular file, perhaps; try reading it as a stream
+         }
+
+         if (file)
+         {
+            const int stackSizeAtBeginning = lua_gettop (state_);
+
+            // Skip the "shebang" line, but not the line break after it
+            const char* data = file->data();
+            size_t size = file->size();
+            if (size > 0 && data[0] == '#')
+            {
+               const char* eol =
+                  static_cast<const char*>(std::memchr (data, '\n', size));
+               const size_t skip = eol ? eol - data : size;
+               data += skip;
+               size -= skip;
+            }
+
+            Impl::MemoryReaderState readerState (data, size);
+            Impl::ThrowOnLuaError (state_,
+                                   lua_load (state_, Impl::MemoryReader,
+                                             &readerState,
+                                             ("@" + fileName).c_str(), NULL));
+
+            return runChunk (stackSizeAtBeginning);
+         }
+      }
+
+      std::ifstream file (fileName.c_str(), std::ios::binary);
+      if (!file)
+         throw LuaFileError (("Cannot open '" + fileName + "'.").c_str());
+
+      const int stackSizeAtBeginning = lua_gettop (state_);
+
+      Impl::StreamReaderState readerState (file, TheStreamBufferSize);
+      readerState.skipFirstLine = true;
+      const int status = lua_load (state_, Impl::StreamReader, &readerState,
+                                   ("@" + fileName).c_str(), NULL);
+
+      if (file.bad())
+      {
+         lua_settop (state_, stackSizeAtBeginning);
+         throw LuaFileError (("Error reading '" + fileName + "'.").c_str());
       }
 
-      Impl::ThrowOnLuaError (state_, lua_pcall (state_, 0, LUA_MULTRET, 0));
+      Impl::ThrowOnLuaError (state_, status);
+
+      return runChunk (stackSizeAtBeginning);
+   }
+
+
+
+   // - LuaState::runChunk -----------------------------------------------------
+   LuaValueList LuaState::runChunk (int stackSizeAtBeginning)
+   {
+      Impl::CallProtected (state_, 0, LUA_MULTRET);
 
       const int numResults = lua_gettop (state_) - stackSizeAtBeginning;
 
       LuaValueList results;
+      results.reserve (numResults);
 
       for (int i = numResults; i > 0; --i)
          results.push_back (ToLuaValue (state_, -i));
@@ -100,12 +478,150 @@ namespace Diluculum
 
 
 
+   // - LuaState::loadChunk ----------------------------------------------------
+   void LuaState::loadChunk (bool isString, const std::string& str)
+   {
+      if (chunkCacheStats_.capacity == 0)
+      {
+         if (isString)
+         {
+            Impl::ThrowOnLuaError (state_, luaL_loadbuffer (state_,
+                                                            str.c_str(),
+                                                            str.length(),
+                                                            "line"));
+         }
+         else
+         {
+            Impl::ThrowOnLuaError (state_, luaL_loadfile (state_,
+                                                          str.c_str()));
+         }
+
+         return;
+      }
+
+      // Files are identified by their modification times and sizes, too. If
+      // the file cannot be 'stat()'ed, let 'luaL_loadfile()' report the error.
+      struct stat fileInfo;
+      if (!isString && stat (str.c_str(), &fileInfo) != 0)
+      {
+         Impl::ThrowOnLuaError (state_, luaL_loadfile (state_, str.c_str()));
+         return;
+      }
+
+      // Look for the chunk in the cache
+      ChunkCacheIndex& index = isString ? stringChunks_ : fileChunks_;
+      ChunkCacheIndex::iterator p = index.find (str);
+      if (p != index.end())
+      {
+         ChunkCacheList::iterator entry = p->second;
+         if (isString || (entry->mtime == fileInfo.st_mtime
+                          && entry->size == fileInfo.st_size))
+         {
+            ++chunkCacheStats_.hits;
+            chunkCache_.splice (chunkCache_.begin(), chunkCache_, entry);
+            lua_rawgeti (state_, LUA_REGISTRYINDEX, entry->ref);
+            return;
+         }
+
+         // The file changed; forget the old version
+         luaL_unref (state_, LUA_REGISTRYINDEX, entry->ref);
+         chunkCache_.erase (entry);
+         index.erase (p);
+         --chunkCacheStats_.size;
+      }
+
+      // Not there; compile it and add it to the cache
+      ++chunkCacheStats_.misses;
+
+      if (isString)
+      {
+         Impl::ThrowOnLuaError (state_, luaL_loadbuffer (state_, str.c_str(),
+                                                         str.length(), "line"));
+      }
+      else
+      {
+         Impl::ThrowOnLuaError (state_, luaL_loadfile (state_, str.c_str()));
+      }
+
+      shrinkChunkCache (chunkCacheStats_.capacity - 1);
+
+      lua_pushvalue (state_, -1);
+      ChunkCacheEntry entry;
+      entry.isFile = !isString;
+      entry.mtime = isString ? 0 : fileInfo.st_mtime;
+      entry.size = isString ? 0 : fileInfo.st_size;
+      entry.ref = luaL_ref (state_, LUA_REGISTRYINDEX);
+
+      chunkCache_.push_front (entry);
+      p = index.insert (std::make_pair (str, chunkCache_.begin())).first;
+      chunkCache_.front().key = &p->first;
+      ++chunkCacheStats_.size;
+   }
+
+
+
+   // - LuaState::executionControl ---------------------------------------------
+   Impl::ExecutionControl* LuaState::executionControl()
+   {
+      if (control_ == 0)
+         control_ = Impl::GetExecutionControl (state_, true);
+
+      return control_;
+   }
+
+
+
+   // - LuaState::setChunkCacheCapacity ----------------------------------------
+   void LuaState::setChunkCacheCapacity (std::size_t capacity)
+   {
+      shrinkChunkCache (capacity);
+      chunkCacheStats_.capacity = capacity;
+   }
+
+
+
+   // - LuaState::clearChunkCache ----------------------------------------------
+   void LuaState::clearChunkCache()
+   {
+      const std::size_t evictions = chunkCacheStats_.evictions;
+      shrinkChunkCache (0);
+      chunkCacheStats_.evictions = evictions; // clearing is not evicting
+   }
+
+
+
+   // - LuaState::chunkCacheStats ----------------------------------------------
+   LuaChunkCacheStats LuaState::chunkCacheStats() const
+   {
+      return chunkCacheStats_;
+   }
+
+
+
+   // - LuaState::shrinkChunkCache ---------------------------------------------
+   void LuaState::shrinkChunkCache (std::size_t maxSize)
+   {
+      while (chunkCacheStats_.size > maxSize)
+      {
+         const ChunkCacheEntry& entry = chunkCache_.back();
+         luaL_unref (state_, LUA_REGISTRYINDEX, entry.ref);
+
+         ChunkCacheIndex& index = entry.isFile ? fileChunks_ : stringChunks_;
+         index.erase (index.find (*entry.key));
+         chunkCache_.pop_back();
+
+         --chunkCacheStats_.size;
+         ++chunkCacheStats_.evictions;
+      }
+   }
+
+
+
    // - LuaState::call ---------------------------------------------------------
    LuaValueList LuaState::call (LuaFunction& func,
                                 const LuaValueList& params,
                                 const std::string& chunkName)
    {
-      func.setReaderFlag (false);
       PushLuaValue (state_, LuaValue (func));
       return Impl::CallFunctionOnTop (state_, params);
    }
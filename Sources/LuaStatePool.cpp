@@ -0,0 +1,344 @@
+/******************************************************************************\
+* LuaStatePool.cpp                                                             *
+* A thread-safe pool of Lua states.                                            *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <Diluculum/LuaStatePool.hpp>
+#include <algorithm>
+#include <cassert>
+#include "InternalUtils.hpp"
+
+
+namespace Diluculum
+{
+   namespace
+   {
+      /** The address of this variable is used as the key, in the registry,
+       *  of the table with the baseline values of the globals.
+       */
+      char TheBaselineGlobalsKey;
+
+      /** Stores a shallow copy of the globals table in the registry, as the
+       *  baseline to which \c RestoreBaselineGlobals() resets the globals.
+       *  This is a \c lua_CFunction, to be called in protected mode.
+       */
+      int SaveBaselineGlobals (lua_State* ls)
+      {
+         lua_rawgeti (ls, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+         lua_newtable (ls);
+
+         lua_pushnil (ls);
+         while (lua_next (ls, -3) != 0)
+         {
+            lua_pushvalue (ls, -2);
+            lua_insert (ls, -2);
+            lua_rawset (ls, -4);
+         }
+
+         lua_rawsetp (ls, LUA_REGISTRYINDEX, &TheBaselineGlobalsKey);
+         lua_pop (ls, 1);
+         return 0;
+      }
+
+      /** Resets the globals to the baseline stored by
+       *  \c SaveBaselineGlobals(): globals that are not in the baseline are
+       *  removed, and the others get their baseline values back. Metamethods
+       *  of the globals table are bypassed. This is a \c lua_CFunction, to be
+       *  called in protected mode.
+       */
+      int RestoreBaselineGlobals (lua_State* ls)
+      {
+         lua_rawgeti (ls, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+         lua_rawgetp (ls, LUA_REGISTRYINDEX, &TheBaselineGlobalsKey);
+
+         // Remove the new globals (clearing fields while traversing a table
+         // is allowed)
+         lua_pushnil (ls);
+         while (lua_next (ls, -3) != 0)
+         {
+            lua_pop (ls, 1);
+            lua_pushvalue (ls, -1);
+            lua_rawget (ls, -3);
+            if (lua_isnil (ls, -1))
+            {
+               lua_pushvalue (ls, -2);
+               lua_pushnil (ls);
+               lua_rawset (ls, -6);
+            }
+            lua_pop (ls, 1);
+         }
+
+         // Restore the baseline values
+         lua_pushnil (ls);
+         while (lua_next (ls, -2) != 0)
+         {
+            lua_pushvalue (ls, -2);
+            lua_insert (ls, -2);
+            lua_rawset (ls, -5);
+         }
+
+         lua_pop (ls, 2);
+         return 0;
+      }
+
+      /// Creates a \c LuaState with the standard library loaded.
+      std::unique_ptr<LuaState> CreateLuaState()
+      {
+         return std::unique_ptr<LuaState> (new LuaState());
+      }
+   }
+
+
+
+   // - LuaStatePool::Lease::Lease ---------------------------------------------
+   LuaStatePool::Lease::Lease()
+      : pool_(0), state_(0)
+   { }
+
+
+   LuaStatePool::Lease::Lease (Lease&& other)
+      : pool_(other.pool_), state_(other.state_)
+   {
+      other.pool_ = 0;
+      other.state_ = 0;
+   }
+
+
+
+   // - LuaStatePool::Lease::operator= -----------------------------------------
+   LuaStatePool::Lease& LuaStatePool::Lease::operator= (Lease&& other)
+   {
+      if (this != &other)
+      {
+         release();
+         pool_ = other.pool_;
+         state_ = other.state_;
+         other.pool_ = 0;
+         other.state_ = 0;
+      }
+
+      return *this;
+   }
+
+
+
+   // - LuaStatePool::Lease::release -------------------------------------------
+   void LuaStatePool::Lease::release()
+   {
+      if (state_ != 0)
+      {
+         pool_->giveBack (state_);
+         pool_ = 0;
+         state_ = 0;
+      }
+   }
+
+
+
+   // - LuaStatePool::LuaStatePool ---------------------------------------------
+   LuaStatePool::LuaStatePool (std::size_t size, const InitFunction& init,
+                               bool resetGlobals)
+      : resetGlobals_(resetGlobals), stats_(), busyTime_(0.0)
+   {
+      createStates (size, CreateLuaState, init);
+   }
+
+
+   LuaStatePool::LuaStatePool (std::size_t size, const CreateFunction& create,
+                               const InitFunction& init, bool resetGlobals)
+      : resetGlobals_(resetGlobals), stats_(), busyTime_(0.0)
+   {
+      createStates (size, create, init);
+   }
+
+
+
+   // - LuaStatePool::~LuaStatePool --------------------------------------------
+   LuaStatePool::~LuaStatePool()
+   {
+      assert (freeStates_.size() == states_.size()
+              && "All leases must be released before destroying the pool.");
+   }
+
+
+
+   // - LuaStatePool::acquire --------------------------------------------------
+   LuaStatePool::Lease LuaStatePool::acquire()
+   {
+      const Clock::time_point start = Clock::now();
+      std::unique_lock<std::mutex> lock (mutex_);
+
+      const bool waited = freeStates_.empty();
+      stateFreed_.wait (lock, [this]() { return !freeStates_.empty(); });
+
+      return take (start, waited);
+   }
+
+
+   LuaStatePool::Lease LuaStatePool::acquire (std::chrono::microseconds timeout)
+   {
+      const Clock::time_point start = Clock::now();
+      std::unique_lock<std::mutex> lock (mutex_);
+
+      const bool waited = freeStates_.empty();
+      if (!stateFreed_.wait_for (lock, timeout,
+                                 [this]() { return !freeStates_.empty(); }))
+      {
+         return Lease();
+      }
+
+      return take (start, waited);
+   }
+
+
+
+   // - LuaStatePool::tryAcquire -----------------------------------------------
+   LuaStatePool::Lease LuaStatePool::tryAcquire()
+   {
+      const Clock::time_point start = Clock::now();
+      std::lock_guard<std::mutex> lock (mutex_);
+
+      if (freeStates_.empty())
+         return Lease();
+
+      return take (start, false);
+   }
+
+
+
+   // - LuaStatePool::stats ----------------------------------------------------
+   LuaStatePoolStats LuaStatePool::stats() const
+   {
+      std::lock_guard<std::mutex> lock (mutex_);
+
+      const Clock::time_point now = Clock::now();
+      updateBusyTime (now);
+
+      LuaStatePoolStats stats = stats_;
+      const double stateTime =
+         std::chrono::duration<double>(now - creationTime_).count()
+         * static_cast<double>(states_.size());
+      stats.utilization = stateTime > 0.0 ? busyTime_ / stateTime : 0.0;
+
+      return stats;
+   }
+
+
+
+   // - LuaStatePool::createStates ---------------------------------------------
+   void LuaStatePool::createStates (std::size_t size,
+                                    const CreateFunction& create,
+                                    const InitFunction& init)
+   {
+      states_.reserve (size);
+      freeStates_.reserve (size);
+
+      for (std::size_t i = 0; i < size; ++i)
+      {
+         std::unique_ptr<LuaState> state = create();
+         if (!state)
+            throw LuaError ("'LuaStatePool' got a NULL state to manage.");
+
+         init (*state);
+
+         if (resetGlobals_)
+         {
+            lua_State* ls = state->getState();
+            lua_pushcfunction (ls, SaveBaselineGlobals);
+            Impl::ThrowOnLuaError (ls, lua_pcall (ls, 0, 0, 0));
+         }
+
+         freeStates_.push_back (state.get());
+         states_.push_back (std::move (state));
+      }
+
+      stats_.size = size;
+      creationTime_ = lastChange_ = Clock::now();
+   }
+
+
+
+   // - LuaStatePool::take -----------------------------------------------------
+   LuaStatePool::Lease LuaStatePool::take (Clock::time_point start,
+                                           bool waited)
+   {
+      const Clock::time_point now = Clock::now();
+      updateBusyTime (now);
+
+      ++stats_.acquisitions;
+      ++stats_.inUse;
+
+      if (waited)
+      {
+         const double waitTime =
+            std::chrono::duration<double>(now - start).count();
+         ++stats_.waits;
+         stats_.totalWaitTime += waitTime;
+         stats_.maxWaitTime = std::max (stats_.maxWaitTime, waitTime);
+      }
+
+      LuaState* state = freeStates_.back();
+      freeStates_.pop_back();
+      return Lease (this, state);
+   }
+
+
+
+   // - LuaStatePool::giveBack -------------------------------------------------
+   void LuaStatePool::giveBack (LuaState* state)
+   {
+      // Clean up the state before making it available again; errors (which
+      // can only be memory errors) are ignored, because this is called from
+      // destructors
+      lua_State* ls = state->getState();
+      lua_settop (ls, 0);
+
+      if (resetGlobals_)
+      {
+         lua_pushcfunction (ls, RestoreBaselineGlobals);
+         if (lua_pcall (ls, 0, 0, 0) != 0)
+            lua_pop (ls, 1);
+      }
+
+      {
+         std::lock_guard<std::mutex> lock (mutex_);
+         updateBusyTime (Clock::now());
+         --stats_.inUse;
+         freeStates_.push_back (state); // never reallocates (see the ctor)
+      }
+
+      stateFreed_.notify_one();
+   }
+
+
+
+   // - LuaStatePool::updateBusyTime -------------------------------------------
+   void LuaStatePool::updateBusyTime (Clock::time_point now) const
+   {
+      busyTime_ += std::chrono::duration<double>(now - lastChange_).count()
+         * static_cast<double>(stats_.inUse);
+      lastChange_ = now;
+   }
+
+} // namespace Diluculum
@@ -0,0 +1,149 @@
+/******************************************************************************\
+* LuaStringPool.cpp                                                            *
+* A pool of interned strings.                                                  *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <Diluculum/LuaStringPool.hpp>
+#include <cstring>
+#include "InternalUtils.hpp"
+
+
+namespace Diluculum
+{
+   namespace
+   {
+      /// The current pool of each thread.
+      thread_local LuaStringPool* TheCurrentPool = 0;
+
+      /** Returns the hash used in the pool for a string. Zero is used to mark
+       *  empty slots, so it is never returned.
+       */
+      inline std::size_t StringHash (const char* s, std::size_t len)
+      {
+         const std::size_t hash = Impl::HashBytes (s, len);
+         return hash != 0 ? hash : 1;
+      }
+
+   } // (anonymous) namespace
+
+
+
+   // - LuaStringPool::Use::Use ------------------------------------------------
+   LuaStringPool::Use::Use (LuaStringPool& pool)
+      : previous_(TheCurrentPool)
+   {
+      TheCurrentPool = &pool;
+   }
+
+
+
+   // - LuaStringPool::Use::~Use -----------------------------------------------
+   LuaStringPool::Use::~Use()
+   {
+      TheCurrentPool = previous_;
+   }
+
+
+
+   // - LuaStringPool::LuaStringPool -------------------------------------------
+   LuaStringPool::LuaStringPool (std::size_t maxLength)
+      : count_(0), maxLength_(maxLength)
+   { }
+
+
+
+   // - LuaStringPool::intern --------------------------------------------------
+   LuaValue LuaStringPool::intern (const char* s, std::size_t len)
+   {
+      if (len > maxLength_)
+         return LuaValue (std::string (s, len));
+
+      const std::size_t hash = StringHash (s, len);
+
+      // Look for the string, and add it if not found (linear probing,
+      // keeping the load factor below 1/2)
+      if ((count_ + 1) * 2 > slots_.size())
+         grow();
+
+      const std::size_t mask = slots_.size() - 1;
+      std::size_t i = hash & mask;
+      for (/* nothing */; slots_[i].hash != 0; i = (i + 1) & mask)
+      {
+         if (slots_[i].hash == hash)
+         {
+            const std::string& str = slots_[i].value.asString();
+            if (str.size() == len && memcmp (str.data(), s, len) == 0)
+               return slots_[i].value;
+         }
+      }
+
+      slots_[i].hash = hash;
+      slots_[i].value = std::string (s, len);
+      ++count_;
+
+      return slots_[i].value;
+   }
+
+
+
+   // - LuaStringPool::clear ---------------------------------------------------
+   void LuaStringPool::clear()
+   {
+      slots_.clear();
+      count_ = 0;
+   }
+
+
+
+   // - LuaStringPool::current -------------------------------------------------
+   LuaStringPool* LuaStringPool::current()
+   {
+      return TheCurrentPool;
+   }
+
+
+
+   // - LuaStringPool::grow ----------------------------------------------------
+   void LuaStringPool::grow()
+   {
+      std::vector<Slot> oldSlots;
+      oldSlots.swap (slots_);
+      slots_.resize (oldSlots.empty() ? 64 : oldSlots.size() * 2);
+
+      const std::size_t mask = slots_.size() - 1;
+      for (std::size_t i = 0; i < oldSlots.size(); ++i)
+      {
+         if (oldSlots[i].hash == 0)
+            continue;
+
+         std::size_t slot = oldSlots[i].hash & mask;
+         while (slots_[slot].hash != 0)
+            slot = (slot + 1) & mask;
+
+         slots_[slot].hash = oldSlots[i].hash;
+         slots_[slot].value = std::move (oldSlots[i].value);
+      }
+   }
+
+} // namespace Diluculum
@@ -0,0 +1,561 @@
+/******************************************************************************\
+* LuaTable.cpp                                                                 *
+* A C++ approximation of a Lua table, with array and hash parts.               *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <Diluculum/LuaTable.hpp>
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <utility>
+
+
+namespace Diluculum
+{
+   namespace
+   {
+      /** Checks whether \c key can be stored in the array part of a table
+       *  (that is, whether it is an integral number greater than or equal to
+       *  one). If so, stores the key in \c index.
+       */
+      bool IsArrayKey (const LuaValue& key, std::size_t& index)
+      {
+         if (key.type() != LUA_TNUMBER)
+            return false;
+
+         if (key.isInteger())
+         {
+            const lua_Integer i = key.asInteger();
+            if (i < 1 || static_cast<unsigned long long>(i)
+                > std::numeric_limits<std::size_t>::max() / 2)
+            {
+               return false;
+            }
+
+            index = static_cast<std::size_t>(i);
+            return true;
+         }
+
+         const lua_Number n = key.asNumber();
+
+         // (Comparisons with NaN are false)
+         if (!(n >= 1 && n <= std::numeric_limits<std::size_t>::max() / 2))
+            return false;
+
+         index = static_cast<std::size_t>(n);
+         return index == n;
+      }
+
+      /// Returns the key of the value at position \c i of an array part.
+      inline LuaValue ArrayKey (std::size_t i)
+      {
+         return LuaValue (static_cast<long long>(i + 1));
+      }
+
+      /** Returns the hash used in the hash part for \c key. Zero is used to
+       *  mark empty slots, so it is never returned.
+       */
+      inline std::size_t SlotHash (const LuaValue& key)
+      {
+         const std::size_t hash = key.hash();
+         return hash != 0 ? hash : 1;
+      }
+
+      /// An entry of a table, used when sorting the entries of a table.
+      struct SortableEntry
+      {
+         const LuaValue* key;
+         const LuaValue* value;
+
+         bool operator< (const SortableEntry& rhs) const
+         { return *key < *rhs.key; }
+      };
+
+      /** Fills \c entries with the entries of \c table, sorted by key.
+       *  Keys from the array part are created and stored in \c arrayKeys.
+       */
+      void GetSortedEntries (const LuaTable& table,
+                             std::vector<LuaValue>& arrayKeys,
+                             std::vector<SortableEntry>& entries)
+      {
+         const std::vector<LuaValue>& arrayPart = table.arrayPart();
+
+         arrayKeys.reserve (arrayPart.size());
+         for (std::size_t i = 0; i < arrayPart.size(); ++i)
+            arrayKeys.push_back (ArrayKey (i));
+
+         entries.reserve (table.size());
+         LuaTable::const_iterator p = table.begin();
+         for (std::size_t i = 0; i < arrayPart.size(); ++i, ++p)
+         {
+            SortableEntry e = { &arrayKeys[i], &arrayPart[i] };
+            entries.push_back (e);
+         }
+
+         const LuaTable::const_iterator end = table.end();
+         for (/* nothing */; p != end; ++p)
+         {
+            SortableEntry e = { &p.key(), &p.value() };
+            entries.push_back (e);
+         }
+
+         std::sort (entries.begin(), entries.end());
+      }
+
+   } // (anonymous) namespace
+
+
+
+   // - LuaTable::const_iterator::const_iterator -------------------------------
+   LuaTable::const_iterator::const_iterator (const LuaTable* table,
+                                             std::size_t pos)
+      : table_(table), pos_(pos)
+   {
+      skipEmptySlots();
+   }
+
+
+
+   // - LuaTable::const_iterator::key ------------------------------------------
+   const LuaValue& LuaTable::const_iterator::key() const
+   {
+      const std::size_t arraySize = table_->array_.size();
+      if (pos_ < arraySize)
+      {
+         arrayKey_ = ArrayKey (pos_);
+         return arrayKey_;
+      }
+      else
+         return table_->slots_[pos_ - arraySize].key;
+   }
+
+
+
+   // - LuaTable::const_iterator::value ----------------------------------------
+   const LuaValue& LuaTable::const_iterator::value() const
+   {
+      const std::size_t arraySize = table_->array_.size();
+      if (pos_ < arraySize)
+         return table_->array_[pos_];
+      else
+         return table_->slots_[pos_ - arraySize].value;
+   }
+
+
+
+   // - LuaTable::const_iterator::operator++ -----------------------------------
+   LuaTable::const_iterator& LuaTable::const_iterator::operator++()
+   {
+      ++pos_;
+      skipEmptySlots();
+      return *this;
+   }
+
+
+
+   // - LuaTable::const_iterator::skipEmptySlots -------------------------------
+   void LuaTable::const_iterator::skipEmptySlots()
+   {
+      const std::size_t arraySize = table_->array_.size();
+      const std::size_t end = arraySize + table_->slots_.size();
+
+      if (pos_ < arraySize)
+         return;
+
+      while (pos_ < end && table_->slots_[pos_ - arraySize].hash == 0)
+         ++pos_;
+   }
+
+
+
+   // - LuaTable::LuaTable -----------------------------------------------------
+   LuaTable::LuaTable()
+      : hashCount_(0)
+   { }
+
+
+   LuaTable::LuaTable (const LuaValueMap& map)
+      : hashCount_(0)
+   {
+      // Entries are sorted by key, so the integer keys come in increasing
+      // order, and will be appended to the array part as they come
+      typedef LuaValueMap::const_iterator iter_t;
+      const iter_t end = map.end();
+      for (iter_t p = map.begin(); p != end; ++p)
+         (*this)[p->first] = p->second;
+   }
+
+
+
+   // - LuaTable::toLuaValueMap ------------------------------------------------
+   LuaValueMap LuaTable::toLuaValueMap() const
+   {
+      LuaValueMap ret;
+
+      // The keys in the array part are the largest numbers in the map so far,
+      // so they are efficiently inserted with a hint
+      for (std::size_t i = 0; i < array_.size(); ++i)
+         ret.insert (ret.end(), std::make_pair (ArrayKey (i), array_[i]));
+
+      for (std::size_t i = 0; i < slots_.size(); ++i)
+      {
+         if (slots_[i].hash != 0)
+            ret.insert (std::make_pair (slots_[i].key, slots_[i].value));
+      }
+
+      return ret;
+   }
+
+
+
+   // - LuaTable::reserve ------------------------------------------------------
+   void LuaTable::reserve (std::size_t arraySize, std::size_t hashSize)
+   {
+      array_.reserve (arraySize);
+
+      // Keep the load factor below 3/4
+      while (slots_.size() * 3 < hashSize * 4)
+         growHashPart();
+   }
+
+
+
+   // - LuaTable::clear --------------------------------------------------------
+   void LuaTable::clear()
+   {
+      array_.clear();
+      slots_.clear();
+      hashCount_ = 0;
+   }
+
+
+
+   // - LuaTable::hashPartValue ------------------------------------------------
+   template <class KeyType>
+   LuaValue& LuaTable::hashPartValue (KeyType&& key)
+   {
+      const std::size_t hash = SlotHash (key);
+
+      std::size_t slot = findSlot (key, hash);
+      if (slot != slots_.size())
+         return slots_[slot].value;
+
+      // Not found; create a new entry, keeping the load factor below 3/4.
+      // 'key' may be stored in this very table (as in 't[t["k"]]'), so take
+      // it before growing the hash part, which moves (and frees) the slots.
+      LuaValue newKey (std::forward<KeyType>(key));
+      if ((hashCount_ + 1) * 4 > slots_.size() * 3)
+         growHashPart();
+
+      const std::size_t mask = slots_.size() - 1;
+      slot = hash & mask;
+      while (slots_[slot].hash != 0)
+         slot = (slot + 1) & mask;
+
+      slots_[slot].hash = hash;
+      slots_[slot].key = std::move (newKey);
+      ++hashCount_;
+
+      return slots_[slot].value;
+   }
+
+
+
+   // - LuaTable::operator[] ---------------------------------------------------
+   LuaValue& LuaTable::operator[] (const LuaValue& key)
+   {
+      std::size_t index;
+      if (IsArrayKey (key, index) && index <= array_.size() + 1)
+      {
+         if (index == array_.size() + 1)
+         {
+            array_.push_back (Nil);
+            migrateToArrayPart();
+         }
+         return array_[index - 1];
+      }
+
+      return hashPartValue (key);
+   }
+
+
+   LuaValue& LuaTable::operator[] (LuaValue&& key)
+   {
+      std::size_t index;
+      if (IsArrayKey (key, index) && index <= array_.size() + 1)
+      {
+         if (index == array_.size() + 1)
+         {
+            array_.push_back (Nil);
+            migrateToArrayPart();
+         }
+         return array_[index - 1];
+      }
+
+      return hashPartValue (std::move (key));
+   }
+
+
+
+   // - LuaTable::find ---------------------------------------------------------
+   const LuaValue* LuaTable::find (const LuaValue& key) const
+   {
+      std::size_t index;
+      if (IsArrayKey (key, index) && index <= array_.size())
+         return &array_[index - 1];
+
+      const std::size_t slot = findSlot (key, SlotHash (key));
+      if (slot == slots_.size())
+         return 0;
+
+      return &slots_[slot].value;
+   }
+
+
+
+   // - LuaTable::erase --------------------------------------------------------
+   std::size_t LuaTable::erase (const LuaValue& key)
+   {
+      std::size_t index;
+      if (IsArrayKey (key, index) && index <= array_.size())
+      {
+         // The keys after 'index' are no longer a part of the 1..n sequence,
+         // so they must be moved to the hash part
+         for (std::size_t i = index; i < array_.size(); ++i)
+            hashPartValue (ArrayKey (i)) = std::move (array_[i]);
+
+         array_.resize (index - 1);
+         return 1;
+      }
+
+      const std::size_t slot = findSlot (key, SlotHash (key));
+      if (slot == slots_.size())
+         return 0;
+
+      eraseSlot (slot);
+      return 1;
+   }
+
+
+
+   // - LuaTable::begin --------------------------------------------------------
+   LuaTable::const_iterator LuaTable::begin() const
+   {
+      return const_iterator (this, 0);
+   }
+
+
+
+   // - LuaTable::end ----------------------------------------------------------
+   LuaTable::const_iterator LuaTable::end() const
+   {
+      return const_iterator (this, array_.size() + slots_.size());
+   }
+
+
+
+   // - LuaTable::hashPartBegin ------------------------------------------------
+   LuaTable::const_iterator LuaTable::hashPartBegin() const
+   {
+      return const_iterator (this, array_.size());
+   }
+
+
+
+   // - LuaTable::compare ------------------------------------------------------
+   int LuaTable::compare (const LuaTable& rhs) const
+   {
+      if (size() != rhs.size())
+         return size() < rhs.size() ? -1 : 1;
+
+      // Tables are compared as if they were 'LuaValueMap's, that is, entry
+      // by entry, sorted by key
+      std::vector<LuaValue> lhsArrayKeys;
+      std::vector<SortableEntry> lhsEntries;
+      GetSortedEntries (*this, lhsArrayKeys, lhsEntries);
+
+      std::vector<LuaValue> rhsArrayKeys;
+      std::vector<SortableEntry> rhsEntries;
+      GetSortedEntries (rhs, rhsArrayKeys, rhsEntries);
+
+      for (std::size_t i = 0; i < lhsEntries.size(); ++i)
+      {
+         // check the key first, then the value
+         int res = lhsEntries[i].key->compare (*rhsEntries[i].key);
+         if (res == 0)
+            res = lhsEntries[i].value->compare (*rhsEntries[i].value);
+         if (res != 0)
+            return res;
+      }
+
+      return 0;
+   }
+
+
+
+   // - LuaTable::operator== ---------------------------------------------------
+   bool LuaTable::operator== (const LuaTable& rhs) const
+   {
+      // The array part contains exactly the keys 1..n, so equal tables have
+      // equal array parts
+      if (array_.size() != rhs.array_.size() || hashCount_ != rhs.hashCount_)
+         return false;
+
+      if (array_ != rhs.array_)
+         return false;
+
+      for (std::size_t i = 0; i < slots_.size(); ++i)
+      {
+         const HashSlot& slot = slots_[i];
+         if (slot.hash == 0)
+            continue;
+
+         const std::size_t rhsSlot = rhs.findSlot (slot.key, slot.hash);
+         if (rhsSlot == rhs.slots_.size()
+             || rhs.slots_[rhsSlot].value != slot.value)
+         {
+            return false;
+         }
+      }
+
+      return true;
+   }
+
+
+
+   // - LuaTable::hash ---------------------------------------------------------
+   std::size_t LuaTable::hash() const
+   {
+      // Sum the hashes of the entries, so that the order doesn't matter
+      std::size_t hash = size();
+
+      for (std::size_t i = 0; i < array_.size(); ++i)
+         hash += (SlotHash (ArrayKey (i)) * 31) ^ array_[i].hash();
+
+      for (std::size_t i = 0; i < slots_.size(); ++i)
+      {
+         if (slots_[i].hash != 0)
+            hash += (slots_[i].hash * 31) ^ slots_[i].value.hash();
+      }
+
+      return hash;
+   }
+
+
+
+   // - LuaTable::findSlot -----------------------------------------------------
+   std::size_t LuaTable::findSlot (const LuaValue& key, std::size_t hash) const
+   {
+      const std::size_t numSlots = slots_.size();
+      if (hashCount_ == 0)
+         return numSlots;
+
+      const std::size_t mask = numSlots - 1;
+
+      // Linear probing; there is always at least one empty slot
+      for (std::size_t i = hash & mask; /* nothing */; i = (i + 1) & mask)
+      {
+         const HashSlot& slot = slots_[i];
+         if (slot.hash == 0)
+            return numSlots;
+         if (slot.hash == hash && slot.key == key)
+            return i;
+      }
+   }
+
+
+
+   // - LuaTable::eraseSlot ----------------------------------------------------
+   void LuaTable::eraseSlot (std::size_t slot)
+   {
+      // Backward shift deletion: move back the entries that would not be
+      // found anymore after emptying the slot
+      const std::size_t mask = slots_.size() - 1;
+      std::size_t hole = slot;
+
+      for (std::size_t i = (slot + 1) & mask;
+           slots_[i].hash != 0;
+           i = (i + 1) & mask)
+      {
+         // The entry at 'i' can stay if its ideal slot is cyclically in
+         // the range (hole, i]
+         const std::size_t ideal = slots_[i].hash & mask;
+         const bool canStay = hole <= i
+            ? (hole < ideal && ideal <= i)
+            : (hole < ideal || ideal <= i);
+
+         if (!canStay)
+         {
+            slots_[hole] = std::move (slots_[i]);
+            hole = i;
+         }
+      }
+
+      slots_[hole].hash = 0;
+      slots_[hole].key = Nil;
+      slots_[hole].value = Nil;
+      --hashCount_;
+   }
+
+
+
+   // - LuaTable::growHashPart -------------------------------------------------
+   void LuaTable::growHashPart()
+   {
+      std::vector<HashSlot> oldSlots;
+      oldSlots.swap (slots_);
+      slots_.resize (oldSlots.empty() ? 4 : oldSlots.size() * 2);
+
+      const std::size_t mask = slots_.size() - 1;
+      for (std::size_t i = 0; i < oldSlots.size(); ++i)
+      {
+         if (oldSlots[i].hash == 0)
+            continue;
+
+         std::size_t slot = oldSlots[i].hash & mask;
+         while (slots_[slot].hash != 0)
+            slot = (slot + 1) & mask;
+
+         slots_[slot] = std::move (oldSlots[i]);
+      }
+   }
+
+
+
+   // - LuaTable::migrateToArrayPart -------------------------------------------
+   void LuaTable::migrateToArrayPart()
+   {
+      while (hashCount_ > 0)
+      {
+         const LuaValue key (ArrayKey (array_.size()));
+         const std::size_t slot = findSlot (key, SlotHash (key));
+         if (slot == slots_.size())
+            break;
+
+         array_.push_back (std::move (slots_[slot].value));
+         eraseSlot (slot);
+      }
+   }
+
+} // namespace Diluculum
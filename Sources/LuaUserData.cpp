@@ -43,6 +43,14 @@ namespace Diluculum
    }
 
 
+   LuaUserData::LuaUserData (LuaUserData&& other) noexcept
+      : size_(other.size_), data_()
+   {
+      data_.swap (other.data_);
+      other.size_ = 0;
+   }
+
+
 
    // - LuaUserData::operator= -------------------------------------------------
    const LuaUserData& LuaUserData::operator= (const LuaUserData& rhs)
@@ -54,6 +62,19 @@ namespace Diluculum
    }
 
 
+   const LuaUserData& LuaUserData::operator= (LuaUserData&& rhs) noexcept
+   {
+      if (this != &rhs)
+      {
+         size_ = rhs.size_;
+         data_.reset();
+         data_.swap (rhs.data_);
+         rhs.size_ = 0;
+      }
+      return *this;
+   }
+
+
 
    // - LuaUserData::operator> -------------------------------------------------
    bool LuaUserData::operator> (const LuaUserData& rhs) const
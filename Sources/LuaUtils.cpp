@@ -25,14 +25,146 @@
 \******************************************************************************/
 
 #include <cstring>
+#include <utility>
 #include <Diluculum/LuaUtils.hpp>
 #include <Diluculum/LuaExceptions.hpp>
+#include <Diluculum/LuaStringPool.hpp>
 #include <boost/lexical_cast.hpp>
 #include "InternalUtils.hpp"
 
 
 namespace Diluculum
 {
+   namespace
+   {
+      /// The address of this is the registry key of the function cache.
+      const char TheFunctionCacheKey = 0;
+
+      /** Pushes the cache of loaded Lua functions of \c state onto the stack
+       *  and returns a pointer to its statistics, creating both if necessary.
+       *  <p>The statistics are stored in a userdata kept in the registry. The
+       *  cache itself is the user value of this userdata: a table with weak
+       *  keys and values, mapping the bytecode hashes (as light userdata) to
+       *  the loaded functions, and the loaded functions to their bytecode
+       *  (as strings, to resolve hash collisions).
+       */
+      LuaFunctionCacheStats* PushFunctionCache (lua_State* state)
+      {
+         lua_rawgetp (state, LUA_REGISTRYINDEX, &TheFunctionCacheKey);
+         if (lua_isnil (state, -1))
+         {
+            lua_pop (state, 1);
+
+            void* stats = lua_newuserdata (state,
+                                           sizeof(LuaFunctionCacheStats));
+            *static_cast<LuaFunctionCacheStats*>(stats) =
+               LuaFunctionCacheStats();
+
+            lua_newtable (state);
+            lua_createtable (state, 0, 1);
+            lua_pushliteral (state, "kv");
+            lua_setfield (state, -2, "__mode");
+            lua_setmetatable (state, -2);
+            lua_setuservalue (state, -2);
+
+            lua_pushvalue (state, -1);
+            lua_rawsetp (state, LUA_REGISTRYINDEX, &TheFunctionCacheKey);
+         }
+
+         LuaFunctionCacheStats* stats =
+            static_cast<LuaFunctionCacheStats*>(lua_touserdata (state, -1));
+         lua_getuservalue (state, -1);
+         lua_remove (state, -2);
+
+         return stats;
+      }
+
+
+
+      /** Checks whether the Lua function at \c index can be cached, that is,
+       *  if it has no upvalues or if its only upvalue is \c _ENV (which
+       *  \c lua_load() sets to the globals table anyway).
+       */
+      bool IsCacheable (lua_State* state, int index)
+      {
+         lua_Debug ar;
+         lua_pushvalue (state, index);
+         lua_getinfo (state, ">u", &ar);
+
+         if (ar.nups == 0)
+            return true;
+         else if (ar.nups > 1)
+            return false;
+
+         const char* name = lua_getupvalue (state, index, 1);
+         if (name == 0)
+            return false;
+
+         lua_pop (state, 1);
+         return std::strcmp (name, "_ENV") == 0;
+      }
+
+
+
+      /** Pushes the Lua-implemented function \c f onto the stack, reusing a
+       *  function from the cache of \c state if possible.
+       */
+      void PushLuaFunction (lua_State* state, const LuaFunction& f)
+      {
+         LuaFunctionCacheStats* stats = PushFunctionCache (state);
+         const int cache = lua_gettop (state);
+         void* hashKey = reinterpret_cast<void*>(f.hash());
+
+         // Look for the function in the cache
+         lua_pushlightuserdata (state, hashKey);
+         lua_rawget (state, cache);
+         if (lua_isfunction (state, -1))
+         {
+            lua_pushvalue (state, -1);
+            lua_rawget (state, cache);
+
+            size_t size;
+            const char* bytecode = lua_tolstring (state, -1, &size);
+            lua_pop (state, 1);
+
+            if (bytecode != 0 && size == f.getSize()
+                && std::memcmp (bytecode, f.getData(), size) == 0)
+            {
+               ++stats->hits;
+               lua_remove (state, cache);
+               return;
+            }
+         }
+         lua_pop (state, 1);
+
+         // Not there; load it
+         ++stats->misses;
+
+         Impl::LuaFunctionReaderState readerState (f);
+         int status = lua_load (state, Impl::LuaFunctionReader, &readerState,
+                                "Diluculum Lua chunk", NULL);
+         lua_remove (state, cache);
+         Impl::ThrowOnLuaError (state, status);
+
+         // And add it to the cache
+         if (IsCacheable (state, -1))
+         {
+            PushFunctionCache (state);
+            lua_pushlightuserdata (state, hashKey);
+            lua_pushvalue (state, -3);
+            lua_rawset (state, -3);
+            lua_pushvalue (state, -2);
+            lua_pushlstring (state, static_cast<const char*>(f.getData()),
+                             f.getSize());
+            lua_rawset (state, -3);
+            lua_pop (state, 1);
+         }
+      }
+
+   } // (anonymous) namespace
+
+
+
    // - ToLuaValue -------------------------------------------------------------
    LuaValue ToLuaValue (lua_State* state, int index)
    {
@@ -42,6 +174,10 @@ namespace Diluculum
             return Nil;
 
          case LUA_TNUMBER:
+#if LUA_VERSION_NUM >= 503
+            if (lua_isinteger (state, index))
+               return static_cast<long long>(lua_tointeger (state, index));
+#endif
             return lua_tonumber (state, index);
 
          case LUA_TBOOLEAN:
@@ -49,8 +185,16 @@ namespace Diluculum
             return lua_toboolean (state, index) != 0;
 
          case LUA_TSTRING:
-            return std::string(lua_tostring (state, index),
-                               lua_rawlen(state, index));
+         {
+            size_t len;
+            const char* s = lua_tolstring (state, index, &len);
+
+            LuaStringPool* pool = LuaStringPool::current();
+            if (pool != 0)
+               return pool->intern (s, len);
+            else
+               return std::string (s, len);
+         }
 
          case LUA_TUSERDATA:
          {
@@ -58,7 +202,7 @@ namespace Diluculum
             size_t size = lua_rawlen (state, index);
             LuaUserData ud (size);
             memcpy (ud.getData(), addr, size);
-            return ud;
+            return std::move (ud);
          }
 
          case LUA_TTABLE:
@@ -69,18 +213,22 @@ namespace Diluculum
             if (index < 0)
                index = lua_gettop(state) + index + 1;
 
-            // Traverse the table adding the key/value pairs to 'ret'
-            LuaValueMap ret;
+            // Traverse the table adding the key/value pairs to 'ret'. The
+            // length of the table is a good guess for the size of the array
+            // part.
+            LuaTable ret;
+            ret.reserve (lua_rawlen (state, index), 0);
 
             lua_pushnil (state);
             while (lua_next (state, index) != 0)
             {
-               ret[ToLuaValue (state, -2)] = ToLuaValue (state, -1);
+               LuaValue key = ToLuaValue (state, -2);
+               ret[std::move (key)] = ToLuaValue (state, -1);
                lua_pop (state, 1);
             }
 
-            // Alright, return the result
-            return ret;
+            // Alright, return the result (moving it; no need to copy the tree)
+            return std::move (ret);
          }
 
          case LUA_TFUNCTION:
@@ -93,9 +241,13 @@ namespace Diluculum
             {
                LuaFunction func("", 0);
                lua_pushvalue (state, index);
+#if LUA_VERSION_NUM >= 503
+               lua_dump(state, Impl::LuaFunctionWriter, &func, 0);
+#else
                lua_dump(state, Impl::LuaFunctionWriter, &func);
+#endif
                lua_pop(state, 1);
-               return func;
+               return std::move (func);
             }
          }
 
@@ -122,7 +274,12 @@ namespace Diluculum
             break;
 
          case LUA_TNUMBER:
-            lua_pushnumber (state, value.asNumber());
+#if LUA_VERSION_NUM >= 503
+            if (value.isInteger())
+               lua_pushinteger (state, value.asInteger());
+            else
+#endif
+               lua_pushnumber (state, value.asNumber());
             break;
 
          case LUA_TSTRING:
@@ -146,17 +303,30 @@ namespace Diluculum
 
          case LUA_TTABLE:
          {
-            lua_newtable (state);
+            const LuaTable& table = value.asTableRef();
+            const std::vector<LuaValue>& arrayPart = table.arrayPart();
+
+            lua_createtable (state, static_cast<int>(arrayPart.size()),
+                             static_cast<int>(table.hashSize()));
+
+            // The array part (keys 1..n) maps directly to Lua's array part
+            for (size_t i = 0; i < arrayPart.size(); ++i)
+            {
+               PushLuaValue (state, arrayPart[i]);
+               lua_rawseti (state, -2, static_cast<int>(i + 1));
+            }
 
-            typedef LuaValueMap::const_iterator iter_t;
-            const LuaValueMap table = value.asTable();
-            for (iter_t p = table.begin(); p != table.end(); ++p)
+            // And then the hash part
+            const LuaTable::const_iterator end = table.end();
+            for (LuaTable::const_iterator p = table.hashPartBegin();
+                 p != end;
+                 ++p)
             {
-               if (p->first != Nil) // Ignore 'Nil'-indexed entries
+               if (p.key() != Nil) // Ignore 'Nil'-indexed entries
                {
-                  PushLuaValue (state, p->first);
-                  PushLuaValue (state, p->second);
-                  lua_settable (state, -3);
+                  PushLuaValue (state, p.key());
+                  PushLuaValue (state, p.value());
+                  lua_rawset (state, -3);
                }
             }
 
@@ -172,11 +342,7 @@ namespace Diluculum
             }
             else
             {
-               LuaFunction* pf = const_cast<LuaFunction*>(&f); // yikes!
-               pf->setReaderFlag (false);
-               int status = lua_load (state, Impl::LuaFunctionReader, pf,
-                                      "Diluculum Lua chunk", NULL);
-               Impl::ThrowOnLuaError (state, status);
+               PushLuaFunction (state, f);
             }
             break;
          }
@@ -191,4 +357,20 @@ namespace Diluculum
       }
    }
 
+
+
+   // - GetLuaFunctionCacheStats -----------------------------------------------
+   LuaFunctionCacheStats GetLuaFunctionCacheStats (lua_State* state)
+   {
+      LuaFunctionCacheStats stats = LuaFunctionCacheStats();
+
+      lua_rawgetp (state, LUA_REGISTRYINDEX, &TheFunctionCacheKey);
+      if (!lua_isnil (state, -1))
+         stats = *static_cast<LuaFunctionCacheStats*>(lua_touserdata (state,
+                                                                      -1));
+      lua_pop (state, 1);
+
+      return stats;
+   }
+
 } // namespace Diluculum
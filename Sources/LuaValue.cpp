@@ -24,13 +24,185 @@
 * IN THE SOFTWARE.                                                             *
 \******************************************************************************/
 
+#include <atomic>
+#include <cassert>
+#include <cmath>
 #include <cstring>
+#include <limits>
+#include <utility>
 #include <Diluculum/LuaValue.hpp>
 #include <Diluculum/LuaExceptions.hpp>
+#include "InternalUtils.hpp"
 
 
 namespace Diluculum
 {
+   namespace Impl
+   {
+      /** An object stored by a \c LuaValue (a string, table, function or
+       *  userdata), plus the number of <tt>LuaValue</tt>s sharing it. A
+       *  \c SharedObject is never modified while this count is greater than
+       *  one.
+       */
+      template <class T>
+      struct SharedObject
+      {
+         template <class... Args>
+         explicit SharedObject (Args&&... args)
+            : refCount (1), unshareable (false),
+              object (std::forward<Args>(args)...)
+         { }
+
+         /// The number of <tt>LuaValue</tt>s referencing this object.
+         std::atomic<long> refCount;
+
+         /** Is this object unshareable? This is set once a mutable reference
+          *  to (part of) \c object was handed out, since changes made through
+          *  that reference would otherwise be seen by every \c LuaValue
+          *  sharing it. Unshareable objects are copied instead of shared.
+          */
+         bool unshareable;
+
+         /// The object itself.
+         T object;
+      };
+
+      /** A shared string. Strings are immutable, so their hashes can be
+       *  computed only once.
+       */
+      template <>
+      struct SharedObject<std::string>
+      {
+         template <class... Args>
+         explicit SharedObject (Args&&... args)
+            : refCount (1), object (std::forward<Args>(args)...), hash (0)
+         { }
+
+         /// The number of <tt>LuaValue</tt>s referencing this string.
+         std::atomic<long> refCount;
+
+         /// The string itself.
+         std::string object;
+
+         /// The hash of \c object, or zero if it was not computed yet.
+         std::atomic<std::size_t> hash;
+      };
+
+      /** Returns the position of a given type (one of the <tt>LUA_T*</tt>
+       *  constants) in the ordering used to compare <tt>LuaValue</tt>s of
+       *  different types. This is the alphabetical order of the type names,
+       *  just like in earlier versions of Diluculum, which compared the
+       *  strings returned by \c LuaValue::typeName().
+       */
+      inline int TypeOrder (int type)
+      {
+         static const int order[] =
+         {
+            2, // LUA_TNIL
+            0, // LUA_TBOOLEAN
+            7, // LUA_TLIGHTUSERDATA (not supported by 'LuaValue')
+            3, // LUA_TNUMBER
+            4, // LUA_TSTRING
+            5, // LUA_TTABLE
+            1, // LUA_TFUNCTION
+            6, // LUA_TUSERDATA
+            8  // LUA_TTHREAD (not supported by 'LuaValue')
+         };
+
+         assert (type >= 0 && type < static_cast<int>(sizeof(order)/sizeof(int))
+                 && "Invalid type passed to 'TypeOrder()'");
+
+         return order[type];
+      }
+
+
+
+      /// Adds a reference to \c so.
+      template <class T>
+      inline void AddRef (SharedObject<T>* so)
+      {
+         so->refCount.fetch_add (1, std::memory_order_relaxed);
+      }
+
+      /// Removes a reference to \c so, deleting it if this was the last one.
+      template <class T>
+      inline void Release (SharedObject<T>* so)
+      {
+         if (so->refCount.fetch_sub (1, std::memory_order_acq_rel) == 1)
+            delete so;
+      }
+
+      /** Returns \c so for use by another \c LuaValue: either \c so itself,
+       *  with an added reference, or a copy of it, if it is unshareable.
+       */
+      template <class T>
+      inline SharedObject<T>* Share (SharedObject<T>* so)
+      {
+         if (so->unshareable)
+            return new SharedObject<T>(so->object);
+
+         AddRef (so);
+         return so;
+      }
+
+      /** Makes sure that \c so is not shared with anyone else, replacing it
+       *  with a copy if necessary, and marks it as unshareable, because the
+       *  caller is about to hand out a mutable reference into it. This is the
+       *  "copy" in copy-on-write.
+       */
+      template <class T>
+      inline void MakeUnique (SharedObject<T>*& so)
+      {
+         if (so->refCount.load (std::memory_order_acquire) > 1)
+         {
+            SharedObject<T>* copy = new SharedObject<T>(so->object);
+            Release (so);
+            so = copy;
+         }
+
+         so->unshareable = true;
+      }
+
+      /// Checks whether the unsigned integer \c n fits in a <tt>long long</tt>.
+      inline bool FitsInLongLong (unsigned long long n)
+      {
+         return n <= static_cast<unsigned long long>(
+            std::numeric_limits<long long>::max());
+      }
+
+      /** Compares the integer \c i with the float \c f, exactly (that is,
+       *  without converting \c i to a float, which may round it).
+       *  @return A negative number if \c i is less than \c f, a positive
+       *          number if it is greater than \c f and zero if both are
+       *          equal (or if \c f is a NaN).
+       */
+      inline int CompareIntegerWithFloat (long long i, lua_Number f)
+      {
+         // -2^63 and 2^63, both exactly representable as floats
+         const lua_Number minInt = -9223372036854775808.0;
+         const lua_Number maxIntPlusOne = 9223372036854775808.0;
+
+         if (f != f)
+            return 0;
+         else if (f >= maxIntPlusOne)
+            return -1;
+         else if (f < minInt)
+            return 1;
+
+         const lua_Number floorF = std::floor (f);
+         const long long intF = static_cast<long long>(floorF);
+         if (i < intF)
+            return -1;
+         else if (i > intF)
+            return 1;
+         else
+            return floorF < f ? -1 : 0;
+      }
+
+   } // namespace Impl
+
+
+
    // - LuaValue::LuaValue -----------------------------------------------------
    LuaValue::LuaValue()
       : dataType_(LUA_TNIL)
@@ -40,121 +212,178 @@ namespace Diluculum
    LuaValue::LuaValue (bool b)
       : dataType_(LUA_TBOOLEAN)
    {
-      memcpy (data_, &b, sizeof(bool));
+      data_.boolean = b;
    }
 
 
    LuaValue::LuaValue (float n)
       : dataType_(LUA_TNUMBER)
    {
-      lua_Number num = static_cast<lua_Number>(n);
-      memcpy (data_, &num, sizeof(lua_Number));
+      data_.number = static_cast<lua_Number>(n);
    }
 
 
    LuaValue::LuaValue (double n)
       : dataType_(LUA_TNUMBER)
    {
-      lua_Number num = static_cast<lua_Number>(n);
-      memcpy (data_, &num, sizeof(lua_Number));
+      data_.number = static_cast<lua_Number>(n);
    }
 
 
    LuaValue::LuaValue (long double n)
       : dataType_(LUA_TNUMBER)
    {
-      lua_Number num = static_cast<lua_Number>(n);
-      memcpy (data_, &num, sizeof(lua_Number));
+      data_.number = static_cast<lua_Number>(n);
    }
 
 
    LuaValue::LuaValue (short n)
-      : dataType_(LUA_TNUMBER)
+      : dataType_(LUA_TNUMBER), isInteger_(true)
    {
-      lua_Number num = static_cast<lua_Number>(n);
-      memcpy (data_, &num, sizeof(lua_Number));
+      data_.integer = n;
    }
 
 
    LuaValue::LuaValue (unsigned short n)
-      : dataType_(LUA_TNUMBER)
+      : dataType_(LUA_TNUMBER), isInteger_(true)
    {
-      lua_Number num = static_cast<lua_Number>(n);
-      memcpy (data_, &num, sizeof(lua_Number));
+      data_.integer = n;
    }
 
 
    LuaValue::LuaValue (int n)
-      : dataType_(LUA_TNUMBER)
+      : dataType_(LUA_TNUMBER), isInteger_(true)
    {
-      lua_Number num = static_cast<lua_Number>(n);
-      memcpy (data_, &num, sizeof(lua_Number));
+      data_.integer = n;
    }
 
 
    LuaValue::LuaValue (unsigned n)
-      : dataType_(LUA_TNUMBER)
+      : dataType_(LUA_TNUMBER), isInteger_(true)
    {
-      lua_Number num = static_cast<lua_Number>(n);
-      memcpy (data_, &num, sizeof(lua_Number));
+      data_.integer = n;
    }
 
 
    LuaValue::LuaValue (long n)
-      : dataType_(LUA_TNUMBER)
+      : dataType_(LUA_TNUMBER), isInteger_(true)
    {
-      lua_Number num = static_cast<lua_Number>(n);
-      memcpy (data_, &num, sizeof(lua_Number));
+      data_.integer = n;
    }
 
 
    LuaValue::LuaValue (unsigned long n)
-      : dataType_(LUA_TNUMBER)
+      : dataType_(LUA_TNUMBER), isInteger_(Impl::FitsInLongLong (n))
+   {
+      if (isInteger_)
+         data_.integer = static_cast<long long>(n);
+      else
+         data_.number = static_cast<lua_Number>(n);
+   }
+
+
+   LuaValue::LuaValue (long long n)
+      : dataType_(LUA_TNUMBER), isInteger_(true)
+   {
+      data_.integer = n;
+   }
+
+
+   LuaValue::LuaValue (unsigned long long n)
+      : dataType_(LUA_TNUMBER), isInteger_(Impl::FitsInLongLong (n))
    {
-      lua_Number num = static_cast<lua_Number>(n);
-      memcpy (data_, &num, sizeof(lua_Number));
+      if (isInteger_)
+         data_.integer = static_cast<long long>(n);
+      else
+         data_.number = static_cast<lua_Number>(n);
    }
 
 
    LuaValue::LuaValue (const std::string& s)
       : dataType_(LUA_TSTRING)
    {
-      new(data_) std::string(s);
+      data_.string = new Impl::SharedObject<std::string>(s);
+   }
+
+
+   LuaValue::LuaValue (std::string&& s)
+      : dataType_(LUA_TSTRING)
+   {
+      data_.string = new Impl::SharedObject<std::string>(std::move (s));
    }
 
 
    LuaValue::LuaValue (const char* s)
       : dataType_(LUA_TSTRING)
    {
-      new(data_) std::string(s);
+      data_.string = new Impl::SharedObject<std::string>(s);
+   }
+
+
+   LuaValue::LuaValue (const LuaTable& t)
+      : dataType_(LUA_TTABLE)
+   {
+      data_.table = new Impl::SharedObject<LuaTable>(t);
+   }
+
+
+   LuaValue::LuaValue (LuaTable&& t)
+      : dataType_(LUA_TTABLE)
+   {
+      data_.table = new Impl::SharedObject<LuaTable>(std::move (t));
    }
 
 
    LuaValue::LuaValue (const LuaValueMap& t)
       : dataType_(LUA_TTABLE)
    {
-      new(data_) LuaValueMap(t);
+      data_.table = new Impl::SharedObject<LuaTable>(t);
+   }
+
+
+   LuaValue::LuaValue (LuaValueMap&& t)
+      : dataType_(LUA_TTABLE)
+   {
+      LuaTable table;
+      for (LuaValueMap::iterator p = t.begin(); p != t.end(); ++p)
+         table[p->first] = std::move (p->second);
+
+      data_.table = new Impl::SharedObject<LuaTable>(std::move (table));
    }
 
 
    LuaValue::LuaValue (lua_CFunction f)
       : dataType_(LUA_TFUNCTION)
    {
-      new(data_) LuaFunction(f);
+      data_.function = new Impl::SharedObject<LuaFunction>(f);
    }
 
 
    LuaValue::LuaValue (const LuaFunction& f)
       : dataType_(LUA_TFUNCTION)
    {
-      new(data_) LuaFunction(f);
+      data_.function = new Impl::SharedObject<LuaFunction>(f);
+   }
+
+
+   LuaValue::LuaValue (LuaFunction&& f)
+      : dataType_(LUA_TFUNCTION)
+   {
+      data_.function = new Impl::SharedObject<LuaFunction>(std::move (f));
    }
 
 
    LuaValue::LuaValue (const LuaUserData& ud)
       : dataType_(LUA_TUSERDATA)
    {
-      new(data_) LuaUserData(ud);
+      data_.userData = new Impl::SharedObject<LuaUserData>(ud);
+   }
+
+
+   LuaValue::LuaValue (LuaUserData&& ud)
+      : dataType_(LUA_TUSERDATA)
+   {
+      data_.userData = new Impl::SharedObject<LuaUserData>(std::move (ud));
    }
 
 
@@ -169,65 +398,70 @@ namespace Diluculum
    }
 
 
+   LuaValue::LuaValue (LuaValueList&& v)
+      : dataType_(LUA_TNIL)
+   {
+      if (v.size() >= 1)
+         moveObjectToData (v[0]);
+   }
+
+
    LuaValue::LuaValue (const LuaValue& other)
-      : dataType_ (other.dataType_)
+      : data_(other.data_), dataType_(other.dataType_),
+        isInteger_(other.isInteger_)
    {
       switch (dataType_)
       {
          case LUA_TSTRING:
-            new(data_) std::string(other.asString());
+            Impl::AddRef (data_.string);
             break;
 
          case LUA_TTABLE:
-            new(data_) LuaValueMap (other.asTable());
+            data_.table = Impl::Share (data_.table);
             break;
 
          case LUA_TUSERDATA:
-            new(data_) LuaUserData (other.asUserData());
+            data_.userData = Impl::Share (data_.userData);
             break;
 
          case LUA_TFUNCTION:
-            new(data_) LuaFunction (other.asFunction());
+            Impl::AddRef (data_.function);
             break;
 
          default:
-            // no constructor needed.
-            memcpy (data_, other.data_, sizeof(PossibleTypes));
+            // nothing to share.
             break;
       }
    }
 
 
+   LuaValue::LuaValue (LuaValue&& other) noexcept
+      : dataType_(LUA_TNIL)
+   {
+      moveObjectToData (other);
+   }
+
+
 
    // - LuaValue::operator= ----------------------------------------------------
    LuaValue& LuaValue::operator= (const LuaValue& rhs)
    {
-      destroyObjectAtData();
+      // Copy first, and only then let go of the current value: 'rhs' may be
+      // stored inside the table currently held by 'this'
+      LuaValue copy (rhs);
+      return *this = std::move (copy);
+   }
 
-      dataType_ = rhs.dataType_;
 
-      switch (dataType_)
+   LuaValue& LuaValue::operator= (LuaValue&& rhs) noexcept
+   {
+      if (this != &rhs)
       {
-         case LUA_TSTRING:
-            new(data_) std::string (rhs.asString());
-            break;
-
-         case LUA_TTABLE:
-            new(data_) LuaValueMap (rhs.asTable());
-            break;
-
-         case LUA_TUSERDATA:
-            new(data_) LuaUserData (rhs.asUserData());
-            break;
-
-         case LUA_TFUNCTION:
-            new(data_) LuaFunction (rhs.asFunction());
-            break;
-
-         default:
-            // no constructor needed.
-            memcpy (data_, rhs.data_, sizeof(PossibleTypes));
-            break;
+         // Again, 'rhs' may live inside the table currently held by 'this'
+         LuaValue tmp (std::move (rhs));
+         destroyObjectAtData();
+         dataType_ = LUA_TNIL;
+         moveObjectToData (tmp);
       }
 
       return *this;
@@ -286,8 +520,10 @@ namespace Diluculum
    {
       if (dataType_ == LUA_TNUMBER)
       {
-         const lua_Number* pn = reinterpret_cast<const lua_Number*>(&data_);
-         return *pn;
+         if (isInteger_)
+            return static_cast<lua_Number>(data_.integer);
+         else
+            return data_.number;
       }
       else
       {
@@ -302,9 +538,10 @@ namespace Diluculum
    {
       if (dataType_ == LUA_TNUMBER)
       {
-         const lua_Number* num = reinterpret_cast<const lua_Number*>(&data_);
-         lua_Integer res = static_cast<lua_Integer>(*num);
-         return res;
+         if (isInteger_)
+            return static_cast<lua_Integer>(data_.integer);
+         else
+            return static_cast<lua_Integer>(data_.number);
       }
       else
       {
@@ -318,10 +555,7 @@ namespace Diluculum
    const std::string& LuaValue::asString() const
    {
       if (dataType_ == LUA_TSTRING)
-      {
-         const std::string* ps = reinterpret_cast<const std::string*>(&data_);
-         return *ps;
-      }
+         return data_.string->object;
       else
       {
          throw TypeMismatchError ("string", typeName());
@@ -334,10 +568,7 @@ namespace Diluculum
    bool LuaValue::asBoolean() const
    {
       if (dataType_ == LUA_TBOOLEAN)
-      {
-         const bool* pb = reinterpret_cast<const bool*>(&data_);
-         return *pb;
-      }
+         return data_.boolean;
       else
       {
          throw TypeMismatchError ("boolean", typeName());
@@ -348,16 +579,19 @@ namespace Diluculum
 
    // - LuaValue::asTable ------------------------------------------------------
    LuaValueMap LuaValue::asTable() const
+   {
+      return asTableRef().toLuaValueMap();
+   }
+
+
+
+   // - LuaValue::asTableRef ---------------------------------------------------
+   const LuaTable& LuaValue::asTableRef() const
    {
       if (dataType_ == LUA_TTABLE)
-      {
-         const LuaValueMap* pm = reinterpret_cast<const LuaValueMap*>(&data_);
-         return *pm;
-      }
+         return data_.table->object;
       else
-      {
          throw TypeMismatchError ("table", typeName());
-      }
    }
 
 
@@ -366,10 +600,7 @@ namespace Diluculum
    const LuaFunction& LuaValue::asFunction() const
    {
       if (dataType_ == LUA_TFUNCTION)
-      {
-         const LuaFunction* pf = reinterpret_cast<const LuaFunction*>(&data_);
-         return *pf;
-      }
+         return data_.function->object;
       else
       {
          throw TypeMismatchError ("function", typeName());
@@ -382,10 +613,7 @@ namespace Diluculum
    const LuaUserData& LuaValue::asUserData() const
    {
       if (dataType_ == LUA_TUSERDATA)
-      {
-         const LuaUserData* pd = reinterpret_cast<const LuaUserData*>(&data_);
-         return *pd;
-      }
+         return data_.userData->object;
       else
       {
          throw TypeMismatchError ("userdata", typeName());
@@ -396,8 +624,9 @@ namespace Diluculum
    {
       if (dataType_ == LUA_TUSERDATA)
       {
-         LuaUserData* pd = reinterpret_cast<LuaUserData*>(&data_);
-         return *pd;
+         // Copy-on-write: the caller may change the user data
+         Impl::MakeUnique (data_.userData);
+         return data_.userData->object;
       }
       else
       {
@@ -407,148 +636,88 @@ namespace Diluculum
 
 
 
-   // - LuaValue::operator< ----------------------------------------------------
-   bool LuaValue::operator< (const LuaValue& rhs) const
+   // - LuaValue::compare ------------------------------------------------------
+   int LuaValue::compare (const LuaValue& rhs) const
    {
-      std::string lhsTypeName = typeName();
-      std::string rhsTypeName = rhs.typeName();
+      if (dataType_ != rhs.dataType_)
+         return Impl::TypeOrder (dataType_) < Impl::TypeOrder (rhs.dataType_)
+            ? -1 : 1;
 
-      if (lhsTypeName < rhsTypeName)
-         return true;
-      else if (lhsTypeName > rhsTypeName)
-         return false;
-      else // lhsTypeName == rhsTypeName
+      switch (dataType_)
       {
-         if (lhsTypeName == "nil")
-            return false;
-         else if (lhsTypeName == "boolean")
-            return asBoolean() < rhs.asBoolean();
-         else if (lhsTypeName == "number")
-            return asNumber() < rhs.asNumber();
-         else if (lhsTypeName == "string")
-            return asString() < rhs.asString();
-         else if (lhsTypeName == "function")
-            return asFunction() < rhs.asFunction();
-         else if (lhsTypeName == "userdata")
-            return asUserData() < rhs.asUserData();
-         else if (lhsTypeName == "table")
+         case LUA_TNIL:
+            return 0;
+
+         case LUA_TBOOLEAN:
+            return static_cast<int>(data_.boolean)
+               - static_cast<int>(rhs.data_.boolean);
+
+         case LUA_TNUMBER:
+            return compareNumbers (rhs);
+
+         case LUA_TSTRING:
+            if (data_.string == rhs.data_.string)
+               return 0;
+
+            return data_.string->object.compare (rhs.data_.string->object);
+
+         case LUA_TFUNCTION:
+            return asFunction().compare (rhs.asFunction());
+
+         case LUA_TUSERDATA:
          {
-            const LuaValueMap lhsMap = asTable();
-            const LuaValueMap rhsMap = rhs.asTable();
-
-            if (lhsMap.size() < rhsMap.size())
-               return true;
-            else if (lhsMap.size() > rhsMap.size())
-               return false;
-            else // lhsMap.size() == rhsMap.size()
-            {
-               typedef LuaValueMap::const_iterator iter_t;
-
-               iter_t pLHS = lhsMap.begin();
-               iter_t pRHS = rhsMap.begin();
-               const iter_t end = lhsMap.end();
-
-               while (pLHS != end)
-               {
-                  // check the key first
-                  if (pLHS->first < pRHS->first)
-                     return true;
-                  else if (pLHS->first > pRHS->first)
-                     return false;
-
-                  // then check the value
-                  if (pLHS->second < pRHS->second)
-                     return true;
-                  else if (pLHS->second > pRHS->second)
-                     return false;
-
-                  // make the iterators iterate
-                  ++pRHS;
-                  ++pLHS;
-               }
-               return false;
-            }
+            const LuaUserData& lhsUD = asUserData();
+            const LuaUserData& rhsUD = rhs.asUserData();
+            return lhsUD < rhsUD ? -1 : (rhsUD < lhsUD ? 1 : 0);
          }
-         else
+
+         case LUA_TTABLE:
+         {
+            if (data_.table == rhs.data_.table)
+               return 0;
+
+            return asTableRef().compare (rhs.asTableRef());
+         }
+
+         default:
          {
             assert (false && "Unsupported type found at a call "
-                    "to 'LuaValue::operator<()'");
-            return false; // make the compiler happy.
+                    "to 'LuaValue::compare()'");
+            return 0; // make the compiler happy.
          }
       }
    }
 
 
 
-   // - LuaValue::operator> ----------------------------------------------------
-   bool LuaValue::operator> (const LuaValue& rhs) const
+   // - LuaValue::operator< ----------------------------------------------------
+   bool LuaValue::operator< (const LuaValue& rhs) const
    {
-      std::string lhsTypeName = typeName();
-      std::string rhsTypeName = rhs.typeName();
-
-      if (lhsTypeName > rhsTypeName)
-         return true;
-      else if (lhsTypeName < rhsTypeName)
-         return false;
-      else // lhsTypeName == rhsTypeName
+      // Fast paths for the most common keys
+      if (dataType_ == rhs.dataType_)
       {
-         if (lhsTypeName == "nil")
-            return false;
-         else if (lhsTypeName == "boolean")
-            return asBoolean() > rhs.asBoolean();
-         else if (lhsTypeName == "number")
-            return asNumber() > rhs.asNumber();
-         else if (lhsTypeName == "string")
-            return asString() > rhs.asString();
-         else if (lhsTypeName == "function")
-            return asFunction() > rhs.asFunction();
-         else if (lhsTypeName == "userdata")
-            return asUserData() > rhs.asUserData();
-         else if (lhsTypeName == "table")
-         {
-            const LuaValueMap lhsMap = asTable();
-            const LuaValueMap rhsMap = rhs.asTable();
-
-            if (lhsMap.size() > rhsMap.size())
-               return true;
-            else if (lhsMap.size() < rhsMap.size())
-               return false;
-            else // lhsMap.size() == rhsMap.size()
-            {
-               typedef LuaValueMap::const_iterator iter_t;
-
-               iter_t pLHS = lhsMap.begin();
-               iter_t pRHS = rhsMap.begin();
-               const iter_t end = lhsMap.end();
-
-               while (pLHS != end)
-               {
-                  // check the key first
-                  if (pLHS->first > pRHS->first)
-                     return true;
-                  else if (pLHS->first < pRHS->first)
-                     return false;
-
-                  // then check the value
-                  if (pLHS->second > pRHS->second)
-                     return true;
-                  else if (pLHS->second < pRHS->second)
-                     return false;
-
-                  // make the iterators iterate
-                  ++pRHS;
-                  ++pLHS;
-               }
-               return false;
-            }
-         }
-         else
+         if (dataType_ == LUA_TNUMBER)
          {
-            assert (false && "Unsupported type found at a call "
-                    "to 'LuaValue::operator>()'");
-            return false; // make the compiler happy.
+            if (isInteger_ && rhs.isInteger_)
+               return data_.integer < rhs.data_.integer;
+            else if (!isInteger_ && !rhs.isInteger_)
+               return data_.number < rhs.data_.number;
+            else
+               return compareNumbers (rhs) < 0;
          }
+         else if (dataType_ == LUA_TSTRING)
+            return data_.string->object < rhs.data_.string->object;
       }
+
+      return compare (rhs) < 0;
+   }
+
+
+
+   // - LuaValue::operator> ----------------------------------------------------
+   bool LuaValue::operator> (const LuaValue& rhs) const
+   {
+      return rhs < *this;
    }
 
 
@@ -556,33 +725,46 @@ namespace Diluculum
    // - LuaValue::operator== ---------------------------------------------------
    bool LuaValue::operator== (const LuaValue& rhs) const
    {
-      std::string lhsTypeName = typeName();
-      std::string rhsTypeName = rhs.typeName();
-
-      if (typeName() != rhs.typeName())
+      if (dataType_ != rhs.dataType_)
          return false;
-      else switch (type())
+
+      switch (dataType_)
       {
          case LUA_TNIL:
             return true;
 
          case LUA_TBOOLEAN:
-            return asBoolean() == rhs.asBoolean();
+            return data_.boolean == rhs.data_.boolean;
 
          case LUA_TNUMBER:
-            return asNumber() == rhs.asNumber();
+            if (isInteger_ && rhs.isInteger_)
+               return data_.integer == rhs.data_.integer;
+            else if (!isInteger_ && !rhs.isInteger_)
+               return data_.number == rhs.data_.number;
+            else
+            {
+               // (NaNs are not equal to anything)
+               const lua_Number f =
+                  isInteger_ ? rhs.data_.number : data_.number;
+               return f == f && compareNumbers (rhs) == 0;
+            }
 
+         // For the types stored in shared objects, sharing means equality
          case LUA_TSTRING:
-            return asString() == rhs.asString();
+            return data_.string == rhs.data_.string
+               || data_.string->object == rhs.data_.string->object;
 
          case LUA_TTABLE:
-            return asTable() == rhs.asTable();
+            return data_.table == rhs.data_.table
+               || data_.table->object == rhs.data_.table->object;
 
          case LUA_TFUNCTION:
-            return asFunction() == rhs.asFunction();
+            return data_.function == rhs.data_.function
+               || data_.function->object == rhs.data_.function->object;
 
          case LUA_TUSERDATA:
-            return asUserData() == rhs.asUserData();
+            return data_.userData == rhs.data_.userData
+               || data_.userData->object == rhs.data_.userData->object;
 
          default:
          {
@@ -596,15 +778,86 @@ namespace Diluculum
 
 
 
+   // - LuaValue::hash ---------------------------------------------------------
+   std::size_t LuaValue::hash() const
+   {
+      switch (dataType_)
+      {
+         case LUA_TNIL:
+            return 0;
+
+         case LUA_TBOOLEAN:
+            return data_.boolean ? 2 : 1;
+
+         case LUA_TNUMBER:
+         {
+            if (isInteger_)
+               return Impl::MixHash (data_.integer);
+
+            // Integral floats are hashed as integers, so that they have the
+            // same hash as the equal integers (this also makes 0.0 and -0.0,
+            // which are equal, have the same hash)
+            const lua_Number n = data_.number;
+            if (n == std::floor (n)
+                && n >= -9223372036854775808.0 && n < 9223372036854775808.0)
+            {
+               return Impl::MixHash (static_cast<long long>(n));
+            }
+            else
+            {
+               return Impl::HashBytes (&n, sizeof(n));
+            }
+         }
+
+         case LUA_TSTRING:
+         {
+            Impl::SharedObject<std::string>* str = data_.string;
+            std::size_t hash = str->hash.load (std::memory_order_relaxed);
+            if (hash == 0)
+            {
+               hash = Impl::HashBytes (str->object.data(), str->object.size());
+               str->hash.store (hash, std::memory_order_relaxed);
+            }
+            return hash;
+         }
+
+         case LUA_TTABLE:
+            return asTableRef().hash();
+
+         case LUA_TFUNCTION:
+            return asFunction().hash();
+
+         case LUA_TUSERDATA:
+         {
+            const LuaUserData& ud = asUserData();
+            return Impl::HashBytes (ud.getData(), ud.getSize());
+         }
+
+         default:
+         {
+            assert (false
+                    && "Invalid type found in a call to 'LuaValue::hash()'.");
+            return 0; // make compilers happy
+         }
+      }
+   }
+
+
+
    // - LuaValue::operator[] ---------------------------------------------------
    LuaValue& LuaValue::operator[] (const LuaValue& key)
    {
       if (type() != LUA_TTABLE)
          throw TypeMismatchError ("table", typeName());
 
-      LuaValueMap* pTable = reinterpret_cast<LuaValueMap*>(data_);
+      // Copy-on-write: detach from other 'LuaValue's sharing this table. This
+      // also makes the table unshareable, so that later copies of '*this'
+      // (including 'cls["__index"] = cls', which stores a copy of the table
+      // into itself) get a table of their own instead of a reference to the
+      // one the returned reference points into.
+      Impl::MakeUnique (data_.table);
 
-      return (*pTable)[key];
+      return data_.table->object[key];
    }
 
 
@@ -614,14 +867,47 @@ namespace Diluculum
       if (type() != LUA_TTABLE)
          throw TypeMismatchError ("table", typeName());
 
-      const LuaValueMap* pTable = reinterpret_cast<const LuaValueMap*>(data_);
+      const LuaValue* value = data_.table->object.find (key);
 
-      LuaValueMap::const_iterator it = (*pTable).find(key);
-
-      if (it == (*pTable).end())
+      if (value == 0)
          return Nil;
 
-      return it->second;
+      return *value;
+   }
+
+
+
+   // - LuaValue::compareNumbers -----------------------------------------------
+   int LuaValue::compareNumbers (const LuaValue& rhs) const
+   {
+      if (isInteger_)
+      {
+         if (rhs.isInteger_)
+         {
+            const long long lhsInt = data_.integer;
+            const long long rhsInt = rhs.data_.integer;
+            return lhsInt < rhsInt ? -1 : (rhsInt < lhsInt ? 1 : 0);
+         }
+         else
+         {
+            return Impl::CompareIntegerWithFloat (data_.integer,
+                                                  rhs.data_.number);
+         }
+      }
+      else
+      {
+         if (rhs.isInteger_)
+         {
+            return -Impl::CompareIntegerWithFloat (rhs.data_.integer,
+                                                   data_.number);
+         }
+         else
+         {
+            const lua_Number lhsNum = data_.number;
+            const lua_Number rhsNum = rhs.data_.number;
+            return lhsNum < rhsNum ? -1 : (rhsNum < lhsNum ? 1 : 0);
+         }
+      }
    }
 
 
@@ -632,32 +918,20 @@ namespace Diluculum
       switch (dataType_)
       {
          case LUA_TSTRING:
-         {
-            std::string* ps = reinterpret_cast<std::string*>(data_);
-            ps->~basic_string();
+            Impl::Release (data_.string);
             break;
-         }
 
          case LUA_TTABLE:
-         {
-            LuaValueMap* pm = reinterpret_cast<LuaValueMap*>(data_);
-            pm->~LuaValueMap();
+            Impl::Release (data_.table);
             break;
-         }
 
          case LUA_TUSERDATA:
-         {
-            LuaUserData* pd = reinterpret_cast<LuaUserData*>(data_);
-            pd->~LuaUserData();
+            Impl::Release (data_.userData);
             break;
-         }
 
          case LUA_TFUNCTION:
-         {
-            LuaFunction* pf = reinterpret_cast<LuaFunction*>(data_);
-            pf->~LuaFunction();
+            Impl::Release (data_.function);
             break;
-         }
 
          default:
             // no destructor needed.
@@ -665,4 +939,17 @@ namespace Diluculum
       }
    }
 
+
+
+   // - LuaValue::moveObjectToData ---------------------------------------------
+   void LuaValue::moveObjectToData (LuaValue& other) noexcept
+   {
+      // Just steal the data (and, so, the reference, if any)
+      data_ = other.data_;
+      dataType_ = other.dataType_;
+      isInteger_ = other.isInteger_;
+
+      other.dataType_ = LUA_TNIL;
+   }
+
 } // namespace Diluculum
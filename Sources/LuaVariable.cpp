@@ -147,6 +147,25 @@ namespace Diluculum
 
 
 
+   // - LuaVariable::callInto --------------------------------------------------
+   void LuaVariable::callInto (const LuaValueList& params,
+                               LuaValueList& results, int numResults)
+   {
+      pushTheReferencedValue();
+      Impl::CallFunctionOnTop (state_, params, numResults, &results);
+   }
+
+
+
+   // - LuaVariable::callAndDiscard --------------------------------------------
+   void LuaVariable::callAndDiscard (const LuaValueList& params)
+   {
+      pushTheReferencedValue();
+      Impl::CallFunctionOnTop (state_, params, 0, 0);
+   }
+
+
+
    // - LuaVariable::pushLastTable ---------------------------------------------
    void LuaVariable::pushLastTable()
    {
@@ -0,0 +1,345 @@
+/******************************************************************************\
+* TestLuaAllocator.cpp                                                         *
+* Unit tests for the Lua allocators.                                           *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#define BOOST_TEST_MODULE LuaAllocator
+
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaState.hpp>
+
+
+namespace
+{
+   /** Allocates, resizes and frees a bunch of blocks of various sizes with
+    *  \c allocator, checking that the data is preserved and that the
+    *  statistics are right.
+    */
+   void ExerciseAllocator (Diluculum::LuaAllocator& allocator)
+   {
+      using Diluculum::LuaAllocator;
+
+      const std::size_t sizes[] = { 1, 8, 16, 17, 100, 256, 257, 5000 };
+      const std::size_t numSizes = sizeof (sizes) / sizeof (sizes[0]);
+      const std::size_t allocationsBefore = allocator.stats().allocations;
+      std::vector<char*> blocks;
+
+      // Allocate (passing a type tag in 'oldSize', like Lua 5.2 does)
+      std::size_t expectedInUse = 0;
+      for (std::size_t i = 0; i < numSizes; ++i)
+      {
+         char* p = static_cast<char*>(
+            LuaAllocator::luaAlloc (&allocator, 0, LUA_TTABLE, sizes[i]));
+         BOOST_REQUIRE (p != 0);
+         std::memset (p, static_cast<int>('a' + i), sizes[i]);
+         blocks.push_back (p);
+         expectedInUse += sizes[i];
+      }
+
+      BOOST_CHECK_EQUAL (allocator.stats().bytesInUse, expectedInUse);
+      BOOST_CHECK_EQUAL (allocator.stats().allocations,
+                         allocationsBefore + numSizes);
+
+      // Grow each block to twice its size; data must be preserved
+      for (std::size_t i = 0; i < numSizes; ++i)
+      {
+         char* p = static_cast<char*>(
+            LuaAllocator::luaAlloc (&allocator, blocks[i], sizes[i],
+                                    2 * sizes[i]));
+         BOOST_REQUIRE (p != 0);
+         for (std::size_t j = 0; j < sizes[i]; ++j)
+            BOOST_REQUIRE_EQUAL (p[j], static_cast<char>('a' + i));
+         blocks[i] = p;
+      }
+
+      BOOST_CHECK_EQUAL (allocator.stats().bytesInUse, 2 * expectedInUse);
+      BOOST_CHECK_EQUAL (allocator.stats().peakBytes, 2 * expectedInUse);
+      BOOST_CHECK_EQUAL (allocator.stats().allocations,
+                         allocationsBefore + numSizes);
+
+      // Free everything
+      for (std::size_t i = 0; i < numSizes; ++i)
+         LuaAllocator::luaAlloc (&allocator, blocks[i], 2 * sizes[i], 0);
+
+      BOOST_CHECK_EQUAL (allocator.stats().bytesInUse, 0U);
+      BOOST_CHECK_EQUAL (allocator.stats().peakBytes, 2 * expectedInUse);
+   }
+
+
+
+   /// A \c LuaAllocationObserver that counts what it observes.
+   struct CountingObserver: public Diluculum::LuaAllocationObserver
+   {
+      CountingObserver()
+         : numAllocating(0), numAllocated(0), numFreed(0), bytes(0)
+      { }
+
+      virtual void allocating (std::size_t) { ++numAllocating; }
+
+      virtual void allocated (void*, std::size_t size)
+      {
+         ++numAllocated;
+         bytes += size;
+      }
+
+      virtual void freed (void*, std::size_t size)
+      {
+         ++numFreed;
+         bytes -= size;
+      }
+
+      int numAllocating;
+      int numAllocated;
+      int numFreed;
+      std::size_t bytes;
+   };
+
+
+
+   /** A \c PoolLuaAllocator whose allocations fail on demand, as if the
+    *  system was out of memory.
+    */
+   struct FailingPoolLuaAllocator: public Diluculum::PoolLuaAllocator
+   {
+      FailingPoolLuaAllocator() : fail(false) { }
+
+      virtual void* allocate (std::size_t size)
+      { return fail ? 0 : PoolLuaAllocator::allocate (size); }
+
+      bool fail;
+   };
+}
+
+
+// - TestLuaAllocatorPolicies --------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaAllocatorPolicies)
+{
+   using namespace Diluculum;
+
+   MallocLuaAllocator mallocAllocator;
+   ExerciseAllocator (mallocAllocator);
+
+   PoolLuaAllocator poolAllocator;
+   ExerciseAllocator (poolAllocator);
+   ExerciseAllocator (poolAllocator); // again, reusing the pooled blocks
+
+   ArenaLuaAllocator arenaAllocator (4096);
+   ExerciseAllocator (arenaAllocator);
+   BOOST_CHECK (arenaAllocator.reservedBytes() >= 4096);
+}
+
+
+
+// - TestLuaAllocatorLimit -----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaAllocatorLimit)
+{
+   using namespace Diluculum;
+
+   PoolLuaAllocator allocator;
+   allocator.setLimit (1000);
+   BOOST_CHECK_EQUAL (allocator.stats().limit, 1000U);
+
+   void* p = LuaAllocator::luaAlloc (&allocator, 0, 0, 600);
+   BOOST_REQUIRE (p != 0);
+
+   // Exceeding the limit fails, and leaves everything as it was
+   BOOST_CHECK (LuaAllocator::luaAlloc (&allocator, 0, 0, 500) == 0);
+   BOOST_CHECK (LuaAllocator::luaAlloc (&allocator, p, 600, 1200) == 0);
+   BOOST_CHECK_EQUAL (allocator.stats().bytesInUse, 600U);
+   BOOST_CHECK_EQUAL (allocator.stats().allocations, 1U);
+
+   // Shrinking and growing within the limit work
+   p = LuaAllocator::luaAlloc (&allocator, p, 600, 100);
+   BOOST_REQUIRE (p != 0);
+   void* q = LuaAllocator::luaAlloc (&allocator, 0, 0, 900);
+   BOOST_REQUIRE (q != 0);
+   BOOST_CHECK_EQUAL (allocator.stats().bytesInUse, 1000U);
+
+   LuaAllocator::luaAlloc (&allocator, p, 100, 0);
+   LuaAllocator::luaAlloc (&allocator, q, 900, 0);
+
+   // Removing the limit
+   allocator.setLimit (0);
+   p = LuaAllocator::luaAlloc (&allocator, 0, 0, 5000);
+   BOOST_REQUIRE (p != 0);
+   LuaAllocator::luaAlloc (&allocator, p, 5000, 0);
+}
+
+
+
+// - TestLuaAllocatorPoolShrink ------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaAllocatorPoolShrink)
+{
+   using namespace Diluculum;
+
+   FailingPoolLuaAllocator allocator;
+   char* large = static_cast<char*>(
+      LuaAllocator::luaAlloc (&allocator, 0, 0, 5000));
+   char* small = static_cast<char*>(
+      LuaAllocator::luaAlloc (&allocator, 0, 0, 200));
+   BOOST_REQUIRE (large != 0 && small != 0);
+   std::memset (large, 'x', 5000);
+   std::memset (small, 'y', 200);
+
+   // Shrinking doesn't fail, even if no smaller block can be allocated: the
+   // blocks just stay where they are
+   allocator.fail = true;
+   BOOST_CHECK (LuaAllocator::luaAlloc (&allocator, 0, 0, 10) == 0);
+
+   char* p = static_cast<char*>(
+      LuaAllocator::luaAlloc (&allocator, large, 5000, 100));
+   BOOST_CHECK (p == large);
+   BOOST_CHECK_EQUAL (p[99], 'x');
+
+   char* q = static_cast<char*>(
+      LuaAllocator::luaAlloc (&allocator, small, 200, 20));
+   BOOST_CHECK (q == small);
+   BOOST_CHECK_EQUAL (q[19], 'y');
+
+   BOOST_CHECK_EQUAL (allocator.stats().bytesInUse, 120U);
+
+   // Once freed, the blocks are reused for their new size classes (and the
+   // formerly large block is freed when the allocator is destroyed)
+   LuaAllocator::luaAlloc (&allocator, p, 100, 0);
+   LuaAllocator::luaAlloc (&allocator, q, 20, 0);
+   allocator.fail = false;
+   BOOST_CHECK (LuaAllocator::luaAlloc (&allocator, 0, 0, 100) == p);
+   BOOST_CHECK (LuaAllocator::luaAlloc (&allocator, 0, 0, 20) == q);
+}
+
+
+
+// - TestLuaAllocatorArena -----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaAllocatorArena)
+{
+   using namespace Diluculum;
+
+   ArenaLuaAllocator allocator (1024);
+   BOOST_CHECK_EQUAL (allocator.reservedBytes(), 0U);
+
+   // The last block is resized in place, and reused when freed
+   void* p = LuaAllocator::luaAlloc (&allocator, 0, 0, 32);
+   BOOST_CHECK (LuaAllocator::luaAlloc (&allocator, p, 32, 64) == p);
+   LuaAllocator::luaAlloc (&allocator, p, 64, 0);
+   BOOST_CHECK (LuaAllocator::luaAlloc (&allocator, 0, 0, 16) == p);
+   BOOST_CHECK_EQUAL (allocator.reservedBytes(), 1024U);
+
+   // Large blocks get their own chunks
+   void* big = LuaAllocator::luaAlloc (&allocator, 0, 0, 4000);
+   BOOST_REQUIRE (big != 0);
+   BOOST_CHECK_EQUAL (allocator.reservedBytes(), 1024U + 4000U);
+
+   // ...and the current chunk is still used for small ones
+   void* small = LuaAllocator::luaAlloc (&allocator, 0, 0, 16);
+   BOOST_CHECK_EQUAL (static_cast<char*>(small) - static_cast<char*>(p), 16);
+   BOOST_CHECK_EQUAL (allocator.reservedBytes(), 1024U + 4000U);
+}
+
+
+
+// - TestLuaAllocatorObserver --------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaAllocatorObserver)
+{
+   using namespace Diluculum;
+
+   CountingObserver observer;
+   MallocLuaAllocator allocator;
+   allocator.setObserver (&observer);
+   BOOST_CHECK (allocator.observer() == &observer);
+
+   void* p = LuaAllocator::luaAlloc (&allocator, 0, 0, 100);
+   p = LuaAllocator::luaAlloc (&allocator, p, 100, 300);
+   BOOST_CHECK_EQUAL (observer.numAllocating, 2);
+   BOOST_CHECK_EQUAL (observer.numAllocated, 2);
+   BOOST_CHECK_EQUAL (observer.numFreed, 1);
+   BOOST_CHECK_EQUAL (observer.bytes, 300U);
+
+   // Failed allocations are not reported as allocated
+   allocator.setLimit (500);
+   BOOST_CHECK (LuaAllocator::luaAlloc (&allocator, 0, 0, 1000) == 0);
+   BOOST_CHECK_EQUAL (observer.numAllocated, 2);
+
+   LuaAllocator::luaAlloc (&allocator, p, 300, 0);
+   BOOST_CHECK_EQUAL (observer.numFreed, 2);
+   BOOST_CHECK_EQUAL (observer.bytes, 0U);
+
+   allocator.setObserver (0);
+   p = LuaAllocator::luaAlloc (&allocator, 0, 0, 100);
+   LuaAllocator::luaAlloc (&allocator, p, 100, 0);
+   BOOST_CHECK_EQUAL (observer.numAllocating, 2);
+}
+
+
+
+// - TestLuaAllocatorLuaState --------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaAllocatorLuaState)
+{
+   using namespace Diluculum;
+
+   std::unique_ptr<LuaAllocator> allocators[] = {
+      std::unique_ptr<LuaAllocator> (new MallocLuaAllocator()),
+      std::unique_ptr<LuaAllocator> (new PoolLuaAllocator()),
+      std::unique_ptr<LuaAllocator> (new ArenaLuaAllocator()) };
+
+   for (std::size_t i = 0; i < sizeof (allocators) / sizeof (allocators[0]);
+        ++i)
+   {
+      LuaState ls (std::move (allocators[i]));
+      BOOST_REQUIRE (ls.allocator() != 0);
+
+      const LuaMemoryStats before = ls.memoryStats();
+      BOOST_CHECK (before.bytesInUse > 0);
+      BOOST_CHECK (before.allocations > 0);
+      BOOST_CHECK_EQUAL (before.limit, 0U);
+
+      ls.doString ("t = { } for i = 1, 1000 do t[i] = tostring(i) end");
+      BOOST_CHECK (ls.memoryStats().bytesInUse > before.bytesInUse);
+      BOOST_CHECK (ls["t"][1000].value() == "1000");
+
+      // A runaway script fails with 'LuaMemoryError'...
+      ls.setMemoryLimit (ls.memoryStats().bytesInUse + 256 * 1024);
+      BOOST_CHECK_THROW (
+         ls.doString ("local t = { } for i = 1, 1e8 do t[i] = i end"),
+         LuaMemoryError);
+      BOOST_CHECK (ls.memoryStats().bytesInUse <= ls.memoryStats().limit);
+
+      // ...but the state remains usable
+      ls.doString ("collectgarbage()");
+      BOOST_CHECK (ls.doString ("return #t")[0] == 1000);
+   }
+
+   // States without an allocator have no limits, but report the memory use
+   LuaState plain;
+   BOOST_CHECK (plain.allocator() == 0);
+   BOOST_CHECK (plain.memoryStats().bytesInUse > 0);
+   BOOST_CHECK_THROW (plain.setMemoryLimit (1024 * 1024), LuaError);
+
+   // A limit too small to even open the state
+   std::unique_ptr<LuaAllocator> tiny (new MallocLuaAllocator());
+   tiny->setLimit (1024);
+   BOOST_CHECK_THROW (LuaState tinyState (std::move (tiny)), LuaMemoryError);
+}
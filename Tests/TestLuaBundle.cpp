@@ -0,0 +1,181 @@
+/******************************************************************************\
+* TestLuaBundle.cpp                                                            *
+* Unit tests for things declared in 'LuaBundle.hpp'.                           *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#define BOOST_TEST_MODULE LuaBundle
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaBundle.hpp>
+#include <Diluculum/LuaExceptions.hpp>
+#include <Diluculum/LuaState.hpp>
+
+
+// - TestLuaBundleWriteAndFind -------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaBundleWriteAndFind)
+{
+   using namespace Diluculum;
+
+   std::map<std::string, std::string> modules;
+   modules["foo"] = "return 'foo'";
+   modules["foo.bar"] = "return 'foo.bar'";
+   modules["zzz"] = std::string ("\0\1\2", 3);
+   modules["empty"] = "";
+
+   LuaBundle::write ("TestLuaBundle.bundle", modules);
+
+   {
+      const LuaBundle bundle ("TestLuaBundle.bundle");
+      BOOST_CHECK_EQUAL (bundle.size(), 4U);
+      BOOST_CHECK_EQUAL (bundle.fileName(), "TestLuaBundle.bundle");
+
+      typedef std::map<std::string, std::string>::const_iterator iter_t;
+      for (iter_t p = modules.begin(); p != modules.end(); ++p)
+      {
+         const char* data = 0;
+         std::size_t size = 1234;
+         BOOST_REQUIRE (bundle.find (p->first, data, size));
+         BOOST_REQUIRE_EQUAL (size, p->second.size());
+         BOOST_CHECK (memcmp (data, p->second.data(), size) == 0);
+      }
+
+      const char* data;
+      std::size_t size;
+      BOOST_CHECK (!bundle.find ("fo", data, size));
+      BOOST_CHECK (!bundle.find ("foo.ba", data, size));
+      BOOST_CHECK (!bundle.find ("", data, size));
+      BOOST_CHECK (!bundle.find ("zzzz", data, size));
+   }
+
+   // An empty bundle is fine, too
+   LuaBundle::write ("TestLuaBundle.bundle",
+                     std::map<std::string, std::string>());
+   {
+      const LuaBundle bundle ("TestLuaBundle.bundle");
+      const char* data;
+      std::size_t size;
+      BOOST_CHECK_EQUAL (bundle.size(), 0U);
+      BOOST_CHECK (!bundle.find ("foo", data, size));
+   }
+
+   std::remove ("TestLuaBundle.bundle");
+}
+
+
+
+// - TestLuaBundleInvalidFiles -------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaBundleInvalidFiles)
+{
+   using namespace Diluculum;
+
+   BOOST_CHECK_THROW (LuaBundle ("ThisFileDoesNotExist.bundle"), LuaFileError);
+
+   // Not a bundle at all
+   {
+      std::ofstream file ("TestLuaBundle.bundle", std::ios::binary);
+      file << "print ('Hello, bundle!')";
+   }
+   BOOST_CHECK_THROW (LuaBundle ("TestLuaBundle.bundle"), LuaFileError);
+
+   // A truncated bundle
+   std::map<std::string, std::string> modules;
+   modules["foo"] = "return 'foo'";
+   LuaBundle::write ("TestLuaBundle.bundle", modules);
+
+   std::string contents;
+   {
+      std::ifstream file ("TestLuaBundle.bundle", std::ios::binary);
+      std::getline (file, contents, '\xFF');
+   }
+   {
+      std::ofstream file ("TestLuaBundle.bundle", std::ios::binary);
+      file << contents.substr (0, contents.size() - 1);
+   }
+   BOOST_CHECK_THROW (LuaBundle ("TestLuaBundle.bundle"), LuaFileError);
+
+   std::remove ("TestLuaBundle.bundle");
+}
+
+
+
+// - TestLuaBundleRequire ------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaBundleRequire)
+{
+   using namespace Diluculum;
+
+   // A bundle with a compiled module and a module in source form
+   {
+      std::ofstream script ("TestLuaBundleModule.lua");
+      script << "local M = { }\n"
+             << "function M.twice (x) return 2 * x end\n"
+             << "return M\n";
+   }
+
+   std::map<std::string, std::string> modules;
+   modules["compiled"] = LuaBundle::compile ("TestLuaBundleModule.lua");
+   modules["source.module"] = "return { name = ..., answer = 42 }";
+   LuaBundle::write ("TestLuaBundle.bundle", modules);
+   std::remove ("TestLuaBundleModule.lua");
+
+   LuaState ls;
+   ls.addBundle ("TestLuaBundle.bundle");
+
+   LuaValueList ret = ls.doString ("return require ('compiled').twice (21)");
+   BOOST_REQUIRE_EQUAL (ret.size(), 1U);
+   BOOST_CHECK (ret[0] == 42);
+
+   ret = ls.doString ("local m = require 'source.module'\n"
+                      "return m.name, m.answer, m == require 'source.module'");
+   BOOST_REQUIRE_EQUAL (ret.size(), 3U);
+   BOOST_CHECK (ret[0] == "source.module");
+   BOOST_CHECK (ret[1] == 42);
+   BOOST_CHECK (ret[2] == true);
+
+   // Modules not in the bundle are still searched elsewhere, and the error
+   // message mentions the bundle
+   try
+   {
+      ls.doString ("require 'not.in.the.bundle'");
+      BOOST_ERROR ("Expected an exception");
+   }
+   catch (const LuaRunTimeError& e)
+   {
+      BOOST_CHECK (std::strstr (e.what(), "TestLuaBundle.bundle") != 0);
+   }
+
+   // Invalid bundles are reported
+   BOOST_CHECK_THROW (ls.addBundle ("ThisFileDoesNotExist.bundle"),
+                      LuaFileError);
+
+   // And so are states without the package library
+   LuaState noLibs (false);
+   BOOST_CHECK_THROW (noLibs.addBundle ("TestLuaBundle.bundle"), LuaError);
+
+   std::remove ("TestLuaBundle.bundle");
+}
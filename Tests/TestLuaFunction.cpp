@@ -27,6 +27,7 @@
 #define BOOST_TEST_MODULE LuaFunction
 
 #include <cstring>
+#include <string>
 #include <boost/test/unit_test.hpp>
 #include <Diluculum/LuaState.hpp>
 #include <Diluculum/LuaFunction.hpp>
@@ -239,6 +240,176 @@ BOOST_AUTO_TEST_CASE(TestLuaFunctionCopies)
 
 
 
+// - TestLuaFunctionMoves ------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaFunctionMoves)
+{
+   using namespace Diluculum;
+
+   const char pseudoBytecode1[] = "1234567890";
+   const char pseudoBytecode2[] = "qazwsx";
+
+   LuaFunction lf1 (pseudoBytecode1, strlen(pseudoBytecode1));
+   LuaFunction lf2 (pseudoBytecode2, strlen(pseudoBytecode2));
+
+   // Moving must take over the very same memory block
+   const void* block = lf1.getData();
+   LuaFunction lf3 (std::move (lf1));
+
+   BOOST_CHECK_EQUAL (lf3.getData(), block);
+   BOOST_CHECK_EQUAL (lf3.getSize(), strlen(pseudoBytecode1));
+   BOOST_CHECK_EQUAL (lf1.getSize(), 0U);
+
+   // Same for move assignment
+   lf2 = std::move (lf3);
+
+   BOOST_CHECK_EQUAL (lf2.getData(), block);
+   BOOST_CHECK_EQUAL (memcmp (lf2.getData(), pseudoBytecode1,
+                              strlen(pseudoBytecode1)),
+                      0);
+   BOOST_CHECK_EQUAL (lf3.getSize(), 0U);
+}
+
+
+
+// - TestLuaFunctionAppendData -------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaFunctionAppendData)
+{
+   using namespace Diluculum;
+
+   LuaFunction lf ("", 0);
+   BOOST_CHECK_EQUAL (lf.getSize(), 0U);
+
+   // Append lots of small pieces, as 'lua_dump()' does
+   std::string expected;
+   for (int i = 0; i < 1000; ++i)
+   {
+      const char piece[] = "abc";
+      const size_t pieceSize = 1 + i % 3;
+      lf.appendData (piece, pieceSize);
+      expected.append (piece, pieceSize);
+      BOOST_CHECK_GE (lf.getCapacity(), lf.getSize());
+   }
+
+   BOOST_REQUIRE_EQUAL (lf.getSize(), expected.size());
+   BOOST_CHECK_EQUAL (memcmp (lf.getData(), expected.data(), lf.getSize()), 0);
+
+   // Growth is geometric, so there is never much more than twice the needed
+   BOOST_CHECK_LE (lf.getCapacity(), 2 * lf.getSize());
+
+   // Reserving doesn't change the contents
+   const LuaFunction copy (lf);
+   lf.reserve (10000);
+   BOOST_CHECK_EQUAL (lf.getCapacity(), 10000U);
+   BOOST_CHECK (copy == lf);
+}
+
+
+
+// - TestLuaFunctionSharing ----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaFunctionSharing)
+{
+   using namespace Diluculum;
+
+   const char pseudoBytecode[] = "1234567890";
+
+   LuaFunction lf1 (pseudoBytecode, strlen(pseudoBytecode));
+   const LuaFunction& constLF1 = lf1;
+
+   // Copies share the data
+   const LuaFunction lf2 (lf1);
+   LuaFunction lf3 ("", 0);
+   lf3 = lf1;
+
+   BOOST_CHECK_EQUAL (lf2.getData(), constLF1.getData());
+   BOOST_CHECK_EQUAL (static_cast<const LuaFunction&>(lf3).getData(),
+                      constLF1.getData());
+   BOOST_CHECK_EQUAL (lf2.hash(), lf1.hash());
+
+   // Modifying a copy doesn't affect the others
+   static_cast<char*>(lf3.getData())[0] = 'X';
+   BOOST_CHECK (lf3 != lf1);
+   BOOST_CHECK (lf2 == lf1);
+   BOOST_CHECK_EQUAL (memcmp (lf2.getData(), pseudoBytecode,
+                              strlen(pseudoBytecode)),
+                      0);
+
+   lf3.appendData ("!", 1);
+   BOOST_CHECK_EQUAL (lf3.getSize(), strlen(pseudoBytecode) + 1);
+   BOOST_CHECK_EQUAL (lf1.getSize(), strlen(pseudoBytecode));
+
+   // Functions with the same contents have the same hash, even if they were
+   // constructed independently
+   const LuaFunction lf4 (pseudoBytecode, strlen(pseudoBytecode));
+   BOOST_CHECK (lf4.getData() != constLF1.getData());
+   BOOST_CHECK_EQUAL (lf4.hash(), lf1.hash());
+   BOOST_CHECK (lf4 == lf1);
+
+   // After modifying the data, the hash is recomputed
+   const std::size_t oldHash = lf3.hash();
+   static_cast<char*>(lf3.getData())[0] = '1';
+   BOOST_CHECK (lf3.hash() != oldHash);
+
+   // Writes through a pointer don't reach copies made after taking it, and
+   // don't leave stale hashes behind
+   LuaFunction f ("abcd", 4);
+   char* p = static_cast<char*>(f.getData());
+   const LuaFunction g (f);
+   const std::size_t hashBefore = f.hash();
+   p[0] = 'X';
+   BOOST_CHECK (g == LuaFunction ("abcd", 4));
+   BOOST_CHECK (f == LuaFunction ("Xbcd", 4));
+   BOOST_CHECK (f.hash() != hashBefore);
+   BOOST_CHECK_EQUAL (f.hash(), LuaFunction ("Xbcd", 4).hash());
+
+   LuaFunction h ("", 0);
+   h = f;
+   p[1] = 'Y';
+   BOOST_CHECK (h == LuaFunction ("Xbcd", 4));
+   BOOST_CHECK (f == LuaFunction ("XYcd", 4));
+}
+
+
+
+// - TestLuaFunctionOrdering ---------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaFunctionOrdering)
+{
+   using namespace Diluculum;
+
+   const LuaFunction functions[] = {
+      LuaFunction (lua_CFunction (0)),
+      LuaFunction ("", 0),
+      LuaFunction ("a", 1),
+      LuaFunction ("b", 1),
+      LuaFunction ("1234567890", 10),
+      LuaFunction ("0987654321", 10),
+      LuaFunction ("a much longer sequence of bytes", 31),
+   };
+   const int n = sizeof(functions) / sizeof(functions[0]);
+
+   // The ordering must be consistent, in particular between C functions and
+   // (longer) Lua functions
+   for (int i = 0; i < n; ++i)
+   {
+      for (int j = 0; j < n; ++j)
+      {
+         const LuaFunction& a = functions[i];
+         const LuaFunction& b = functions[j];
+
+         BOOST_CHECK_EQUAL (a < b, b > a);
+         BOOST_CHECK_EQUAL (a == b, i == j);
+         BOOST_CHECK_EQUAL (a != b, i != j);
+         BOOST_CHECK (!(a < b && b < a));
+         BOOST_CHECK_EQUAL (a < b || b < a, i != j);
+      }
+   }
+
+   // C functions come first
+   for (int i = 1; i < n; ++i)
+      BOOST_CHECK (functions[0] < functions[i]);
+}
+
+
+
 // - TestLuaFunctionFromLuaCode ------------------------------------------------
 BOOST_AUTO_TEST_CASE(TestLuaFunctionFromLuaCode)
 {
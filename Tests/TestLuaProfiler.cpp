@@ -0,0 +1,229 @@
+/******************************************************************************\
+* TestLuaProfiler.cpp                                                          *
+* Unit tests for the sampling profiler.                                        *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#define BOOST_TEST_MODULE LuaProfiler
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaProfiler.hpp>
+
+
+// - TestLuaProfilerHotLoop ----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaProfilerHotLoop)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("function hot(n)\n"
+                "   local x = 0\n"
+                "   for i = 1, n do x = (x + i * i) % 1234567 end\n"
+                "   return x\n"
+                "end\n"
+                "function cold(n)\n"
+                "   local x = 0\n"
+                "   for i = 1, n do x = x + i end\n"
+                "   return x\n"
+                "end\n"
+                "function run()\n"
+                "   for i = 1, 20 do hot(100000) cold(5000) end\n"
+                "end");
+
+   LuaProfiler profiler (ls, std::chrono::microseconds (200));
+   BOOST_CHECK (!profiler.running());
+
+   // Nothing is sampled while stopped
+   ls["run"]();
+   BOOST_CHECK_EQUAL (profiler.sampleCount(), 0U);
+
+   profiler.start();
+   BOOST_CHECK (profiler.running());
+
+   // Only one profiler per state
+   LuaProfiler other (ls);
+   BOOST_CHECK_THROW (other.start(), LuaError);
+
+   while (profiler.sampleCount() < 200)
+      ls["run"]();
+
+   profiler.stop();
+   BOOST_CHECK (!profiler.running());
+
+   // The hot loop dominates
+   std::size_t inHot = 0;
+   std::size_t inCold = 0;
+   std::size_t total = 0;
+   const LuaFoldedStacks& stacks = profiler.stacks();
+   for (LuaFoldedStacks::const_iterator p = stacks.begin();
+        p != stacks.end(); ++p)
+   {
+      total += p->second;
+      if (p->first.find (":hot") != std::string::npos)
+         inHot += p->second;
+      if (p->first.find (":cold") != std::string::npos)
+         inCold += p->second;
+
+      // Stacks go from the outermost to the innermost frame (and 'hot()'
+      // calls no one)
+      const std::size_t hotPos = p->first.find (":hot");
+      BOOST_CHECK (hotPos == std::string::npos
+                   || hotPos + 4 == p->first.size());
+   }
+
+   BOOST_CHECK_EQUAL (total, profiler.sampleCount());
+   BOOST_CHECK (inHot > 0.8 * total);
+   BOOST_CHECK (inCold < inHot);
+
+   // The folded output has one line per stack
+   std::ostringstream folded;
+   profiler.writeFolded (folded);
+   std::istringstream lines (folded.str());
+   std::string line;
+   std::size_t numLines = 0;
+   while (std::getline (lines, line))
+   {
+      ++numLines;
+      BOOST_CHECK (line.find_last_of (' ') != std::string::npos);
+   }
+   BOOST_CHECK_EQUAL (numLines, stacks.size());
+
+   // Clearing; the other profiler can be used now
+   profiler.clear();
+   BOOST_CHECK_EQUAL (profiler.sampleCount(), 0U);
+   BOOST_CHECK (profiler.stacks().empty());
+   other.start();
+   other.stop();
+}
+
+
+
+// - TestLuaProfilerBorrowedState ----------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaProfilerBorrowedState)
+{
+   using namespace Diluculum;
+
+   // A borrowed state gets its control block from the profiler, and can
+   // then be cancelled
+   lua_State* rls = luaL_newstate();
+   {
+      LuaState ls (rls);
+      // (Long, but not infinite, so that the test fails instead of hanging
+      // if the request is ignored)
+      ls.doString ("function spin() for i = 1, 1e9 do end end");
+
+      LuaProfiler profiler (ls, std::chrono::microseconds (200));
+      profiler.start();
+
+      std::thread canceller ([&]() {
+         std::this_thread::sleep_for (std::chrono::milliseconds (50));
+         ls.requestCancel();
+      });
+      BOOST_CHECK_THROW (ls.doString ("spin()"), LuaCancelledError);
+      canceller.join();
+
+      profiler.stop();
+      BOOST_CHECK (profiler.sampleCount() > 0);
+   }
+   lua_close (rls);
+}
+
+
+
+// - TestLuaAllocationProfiler -------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaAllocationProfiler)
+{
+   using namespace Diluculum;
+
+   // Requires an allocator
+   LuaState plain;
+   BOOST_CHECK_THROW (LuaAllocationProfiler p (plain), LuaError);
+
+   LuaState ls (std::unique_ptr<LuaAllocator> (new PoolLuaAllocator()));
+   BOOST_CHECK_THROW (LuaAllocationProfiler p (ls, 0), LuaError);
+
+   ls.doString ("function makeStrings()\n"
+                "   local t = { }\n"
+                "   for i = 1, 10000 do\n"
+                "      t[i] = string.rep ('x', 100) .. i\n"
+                "   end\n"
+                "   return t\n"
+                "end\n"
+                "function makeGarbage()\n"
+                "   for i = 1, 10000 do local t = { i, i } end\n"
+                "end");
+
+   // Record every allocation
+   LuaAllocationProfiler profiler (ls, 1);
+   profiler.start();
+   BOOST_CHECK (profiler.running());
+
+   ls.doString ("kept = makeStrings() makeGarbage() collectgarbage()");
+   profiler.stop();
+
+   LuaAllocationSiteStats strings = { 0, 0, 0 };
+   LuaAllocationSiteStats garbage = { 0, 0, 0 };
+   const LuaAllocationSites& sites = profiler.sites();
+   for (LuaAllocationSites::const_iterator p = sites.begin();
+        p != sites.end(); ++p)
+   {
+      if (p->first.find (":makeStrings") != std::string::npos)
+         strings = p->second;
+      else if (p->first.find (":makeGarbage") != std::string::npos)
+         garbage = p->second;
+   }
+
+   // The strings are still there; the garbage isn't
+   BOOST_CHECK (strings.allocatedBytes > 10000 * 100);
+   BOOST_CHECK (strings.retainedBytes > 10000 * 100);
+   BOOST_CHECK (strings.samples >= 10000);
+   BOOST_CHECK (garbage.allocatedBytes > 0);
+   BOOST_CHECK (garbage.retainedBytes < garbage.allocatedBytes / 10);
+
+   std::ostringstream report;
+   profiler.writeReport (report);
+   BOOST_CHECK (report.str().find (":makeStrings") != std::string::npos);
+
+   // Only one observer at a time
+   LuaAllocationProfiler other (ls);
+   profiler.start();
+   BOOST_CHECK_THROW (other.start(), LuaError);
+   profiler.stop();
+
+   // With sampling, the estimates are in the right ballpark
+   other.start();
+   ls.doString ("kept = nil collectgarbage() kept = makeStrings()");
+   other.stop();
+
+   std::size_t total = 0;
+   for (LuaAllocationSites::const_iterator p = other.sites().begin();
+        p != other.sites().end(); ++p)
+   {
+      total += p->second.allocatedBytes;
+   }
+   BOOST_CHECK (total > strings.allocatedBytes / 3);
+   BOOST_CHECK (total < strings.allocatedBytes * 3);
+}
@@ -0,0 +1,138 @@
+/******************************************************************************\
+* TestLuaRef.cpp                                                               *
+* Tests for 'LuaRef'.                                                          *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#define BOOST_TEST_MODULE LuaRef
+
+#include <utility>
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaState.hpp>
+
+
+// - TestLuaRefBasics ----------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaRefBasics)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("t = { x = 171, inner = { y = 'foo' } }\n"
+                "function add (a, b) return a + b, a - b end");
+
+   // Empty references
+   LuaRef empty;
+   BOOST_CHECK (empty.empty());
+   BOOST_CHECK_EQUAL (empty.getRef(), LUA_NOREF);
+   BOOST_CHECK_THROW (empty.push(), LuaError);
+   BOOST_CHECK_THROW (empty.value(), LuaError);
+
+   // References to values
+   LuaRef t (ls["t"]);
+   BOOST_CHECK (!t.empty());
+   BOOST_CHECK (t.getState() == ls.getState());
+   BOOST_CHECK (t.value().asTable()["x"] == 171);
+   BOOST_CHECK (LuaRef (ls["t"]["inner"]["y"]).value() == "foo");
+   BOOST_CHECK (LuaRef (ls["nothing"]).value() == Nil);
+   const LuaVariable notATable = ls["t"]["x"]["y"];
+   BOOST_CHECK_THROW (LuaRef ref (notATable), TypeMismatchError);
+   lua_settop (ls.getState(), 0);
+
+   // References from the stack leave it unchanged
+   const int top = lua_gettop (ls.getState());
+   lua_pushnumber (ls.getState(), 3.5);
+   LuaRef number (ls.getState(), -1);
+   lua_pop (ls.getState(), 1);
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), top);
+   BOOST_CHECK (number.value() == 3.5);
+
+   number.push();
+   BOOST_CHECK_EQUAL (lua_tonumber (ls.getState(), -1), 3.5);
+   lua_pop (ls.getState(), 1);
+
+   // Calls
+   LuaRef add (ls["add"]);
+   LuaValueList ret = add (5, 3);
+   BOOST_REQUIRE_EQUAL (ret.size(), 2U);
+   BOOST_CHECK (ret[0] == 8);
+   BOOST_CHECK (ret[1] == 2);
+
+   LuaValueList params;
+   params.push_back (1);
+   params.push_back (2);
+   BOOST_CHECK (add (params)[0] == 3);
+   BOOST_CHECK_THROW (add(), LuaRunTimeError);
+   BOOST_CHECK_THROW (t (1), TypeMismatchError);
+}
+
+
+
+// - TestLuaRefLifetime --------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaRefLifetime)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("function f() return 'original' end");
+
+   // A 'LuaRef' refers to the value, not to the variable, and keeps it alive
+   LuaRef f (ls["f"]);
+   ls.doString ("f = nil");
+   ls.collectGarbage();
+   BOOST_CHECK (f()[0] == "original");
+
+   // Copies
+   LuaRef copy (f);
+   BOOST_CHECK (copy.getRef() != f.getRef());
+   f.reset();
+   BOOST_CHECK (f.empty());
+   BOOST_CHECK (copy()[0] == "original");
+
+   f = copy;
+   BOOST_CHECK (f()[0] == "original");
+   f = f;
+   BOOST_CHECK (f()[0] == "original");
+
+   // Moves
+   const int ref = copy.getRef();
+   LuaRef moved (std::move (copy));
+   BOOST_CHECK (copy.empty());
+   BOOST_CHECK_EQUAL (moved.getRef(), ref);
+   BOOST_CHECK (moved()[0] == "original");
+
+   copy = std::move (moved);
+   BOOST_CHECK (moved.empty());
+   BOOST_CHECK (copy()[0] == "original");
+
+   // References are released: creating and destroying many of them doesn't
+   // make the registry grow
+   lua_State* state = ls.getState();
+   const std::size_t registrySize = lua_rawlen (state, LUA_REGISTRYINDEX);
+   for (int i = 0; i < 1000; ++i)
+   {
+      LuaRef a (ls["print"]);
+      LuaRef b (a);
+      BOOST_CHECK (!b.empty());
+   }
+   BOOST_CHECK (lua_rawlen (state, LUA_REGISTRYINDEX) <= registrySize + 2);
+}
@@ -26,10 +26,46 @@
 
 #define BOOST_TEST_MODULE LuaState
 
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <thread>
 #include <boost/test/unit_test.hpp>
 #include <Diluculum/LuaState.hpp>
 
 
+// - Allocation counting -------------------------------------------------------
+// The global 'operator new' is replaced here, so that tests can check how many
+// allocations are done on the C++ side. (Lua itself allocates through its own
+// allocator, so it is not counted.)
+namespace
+{
+   std::size_t TheAllocationCount = 0;
+}
+
+void* operator new (std::size_t size)
+{
+   ++TheAllocationCount;
+   void* p = std::malloc (size > 0 ? size : 1);
+   if (p == 0)
+      throw std::bad_alloc();
+   return p;
+}
+
+void operator delete (void* p) noexcept
+{
+   std::free (p);
+}
+
+void operator delete (void* p, std::size_t) noexcept
+{
+   std::free (p);
+}
+
+
 // - TestLuaStateNotOwner ------------------------------------------------------
 BOOST_AUTO_TEST_CASE(TestLuaStateNotOwner)
 {
@@ -170,6 +206,44 @@ BOOST_AUTO_TEST_CASE(TestLuaStateDoString)
 
 
 
+// - TestLuaStateDoStringAllocations -------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStateDoStringAllocations)
+{
+   using namespace Diluculum;
+
+   // Build a chunk returning a big table (numbers and short strings only, so
+   // that no element needs more than one allocation)
+   const int numElements = 1000;
+   std::ostringstream chunk;
+   chunk << "return {";
+   for (int i = 0; i < numElements; ++i)
+      chunk << (i % 2 == 0 ? "1.5," : "'abc',");
+   chunk << "}";
+   const std::string code = chunk.str();
+
+   LuaState ls;
+
+   // Converting the table allocates one node per element, plus one block for
+   // the returned 'LuaValueList'. Anything beyond that would mean that some
+   // 'LuaValue' was deep-copied on the way back to us.
+   const std::size_t allocsBefore = TheAllocationCount;
+   LuaValueList ret = ls.doString (code);
+   const std::size_t allocs = TheAllocationCount - allocsBefore;
+
+   BOOST_REQUIRE_EQUAL (ret.size(), 1U);
+   BOOST_CHECK_EQUAL (ret[0].asTable().size(),
+                      static_cast<std::size_t>(numElements));
+   BOOST_CHECK_LE (allocs, static_cast<std::size_t>(numElements + 1));
+
+   // Taking the result out of the list must not allocate at all
+   const std::size_t allocsBeforeMove = TheAllocationCount;
+   LuaValue table (std::move (ret));
+   BOOST_CHECK_EQUAL (TheAllocationCount - allocsBeforeMove, 0U);
+   BOOST_CHECK (table[2] == "abc");
+}
+
+
+
 // - TestLuaStateDoExceptions --------------------------------------------------
 BOOST_AUTO_TEST_CASE(TestLuaStateDoExceptions)
 {
@@ -292,3 +366,491 @@ BOOST_AUTO_TEST_CASE(TestGlobalsTableAccess)
    globals = state.globals();
    BOOST_CHECK_EQUAL (globals["foo"].type(), LUA_TSTRING);
 }
+
+
+
+// - TestLuaStateFunctionCache -------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStateFunctionCache)
+{
+   using namespace Diluculum;
+
+   LuaState state;
+   state.doString ("collectgarbage ('stop')"); // keep the cache contents
+   state.doString ("function Square (n) return n * n end");
+
+   BOOST_CHECK_EQUAL (state.functionCacheStats().hits, 0U);
+   BOOST_CHECK_EQUAL (state.functionCacheStats().misses, 0U);
+
+   // Calling the same function repeatedly loads it only once
+   LuaFunction square = state["Square"].value().asFunction();
+   LuaValueList params;
+   params.push_back (3);
+
+   for (int i = 0; i < 10; ++i)
+   {
+      LuaValueList ret = state.call (square, params);
+      BOOST_REQUIRE_EQUAL (ret.size(), 1U);
+      BOOST_CHECK_EQUAL (ret[0].asInteger(), 9);
+   }
+
+   BOOST_CHECK_EQUAL (state.functionCacheStats().hits, 9U);
+   BOOST_CHECK_EQUAL (state.functionCacheStats().misses, 1U);
+
+   // Copies of the function, or functions with the same bytecode, hit too
+   LuaFunction sameSquare = state["Square"].value().asFunction();
+   state.call (sameSquare, params);
+   BOOST_CHECK_EQUAL (state.functionCacheStats().hits, 10U);
+
+   // Functions with upvalues are not cached, because sharing them would also
+   // share their upvalues. (When loaded, the first upvalue is set to the
+   // globals table, and the others to nil; that's why 'type' is used first.)
+   state.doString ("local n\n"
+                   "function Counter()\n"
+                   "   local type = type\n"
+                   "   n = (type (n) == 'number' and n or 0) + 1\n"
+                   "   return n\n"
+                   "end");
+   LuaFunction counter = state["Counter"].value().asFunction();
+
+   for (int i = 0; i < 2; ++i)
+   {
+      LuaValueList ret = state.call (counter, LuaValueList());
+      BOOST_REQUIRE_EQUAL (ret.size(), 1U);
+      BOOST_CHECK_EQUAL (ret[0].asInteger(), 1);
+   }
+
+   BOOST_CHECK_EQUAL (state.functionCacheStats().hits, 10U);
+   BOOST_CHECK_EQUAL (state.functionCacheStats().misses, 3U);
+
+   // Each state has its own cache
+   LuaState otherState;
+   otherState.call (square, params);
+   BOOST_CHECK_EQUAL (otherState.functionCacheStats().hits, 0U);
+   BOOST_CHECK_EQUAL (otherState.functionCacheStats().misses, 1U);
+}
+
+
+
+// - TestLuaStateChunkCache ----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStateChunkCache)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+
+   // Disabled by default
+   ls.doString ("return 1");
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().capacity, 0U);
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().misses, 0U);
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().size, 0U);
+
+   // Cached chunks are still run every time
+   ls.setChunkCacheCapacity (2);
+   for (int i = 0; i < 3; ++i)
+      ls.doString ("x = (x or 0) + 1");
+
+   BOOST_CHECK (ls["x"].value() == 3);
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().hits, 2U);
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().misses, 1U);
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().size, 1U);
+
+   // Results are the same with cached chunks
+   const LuaValueList ret1 = ls.doString ("return 'a', 2");
+   const LuaValueList ret2 = ls.doString ("return 'a', 2");
+   BOOST_CHECK (ret1 == ret2);
+   BOOST_REQUIRE_EQUAL (ret2.size(), 2U);
+   BOOST_CHECK (ret2[0] == "a");
+
+   // The least recently used chunk is evicted
+   ls.doString ("x = (x or 0) + 1");
+   ls.doString ("return 'b'");
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().evictions, 1U);
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().size, 2U);
+
+   ls.doString ("x = (x or 0) + 1");
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().hits, 5U);
+   BOOST_CHECK (ls["x"].value() == 5);
+
+   // Chunks with syntax errors are not cached
+   BOOST_CHECK_THROW (ls.doString ("x = = 1"), LuaSyntaxError);
+   BOOST_CHECK_THROW (ls.doString ("x = = 1"), LuaSyntaxError);
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().misses, 5U);
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().size, 2U);
+
+   // Files are cached, too
+   ls.doFile ("TestLuaStateDoFile.lua");
+   const LuaValue ret = ls.doFile ("TestLuaStateDoFile.lua");
+   BOOST_CHECK (ret == "foo");
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().hits, 6U);
+
+   // Missing files are reported as usual
+   BOOST_CHECK_THROW (ls.doFile ("ThisFileDoesNotExist.lua"), LuaFileError);
+
+   // Reducing the capacity evicts chunks; clearing doesn't count as evicting
+   ls.setChunkCacheCapacity (1);
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().size, 1U);
+   const std::size_t evictions = ls.chunkCacheStats().evictions;
+   ls.clearChunkCache();
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().size, 0U);
+   BOOST_CHECK_EQUAL (ls.chunkCacheStats().evictions, evictions);
+}
+
+
+
+// - TestLuaStateDoStream ------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStateDoStream)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+
+   std::istringstream small ("x = 1; return 'foo', x + 1");
+   LuaValueList ret = ls.doStream (small);
+   BOOST_REQUIRE_EQUAL (ret.size(), 2U);
+   BOOST_CHECK (ret[0] == "foo");
+   BOOST_CHECK (ret[1] == 2);
+
+   // A chunk much larger than the buffer used to read it
+   std::ostringstream code;
+   code << "local t = { }\n";
+   for (int i = 0; i < 20000; ++i)
+      code << "t[#t + 1] = " << i << " -- padding, padding, padding\n";
+   code << "return #t, t[#t]";
+
+   std::istringstream large (code.str());
+   ret = ls.doStream (large, "=large");
+   BOOST_REQUIRE_EQUAL (ret.size(), 2U);
+   BOOST_CHECK (ret[0] == 20000);
+   BOOST_CHECK (ret[1] == 19999);
+
+   // Errors
+   std::istringstream bad ("x = = 1");
+   BOOST_CHECK_THROW (ls.doStream (bad), LuaSyntaxError);
+
+   std::istringstream failed;
+   failed.setstate (std::ios::failbit);
+   BOOST_CHECK_THROW (ls.doStream (failed), LuaFileError);
+}
+
+
+
+// - TestLuaStateDoFileStreamed ------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStateDoFileStreamed)
+{
+   using namespace Diluculum;
+
+   for (int allowMmap = 0; allowMmap < 2; ++allowMmap)
+   {
+      LuaState ls;
+
+      const LuaValueList ret1 = ls.doFile ("TestLuaStateDoFile.lua");
+      const LuaValueList ret2 = ls.doFileStreamed ("TestLuaStateDoFile.lua",
+                                                   allowMmap != 0);
+      BOOST_CHECK (ret1 == ret2);
+
+      BOOST_CHECK_THROW (ls.doFileStreamed ("ThisFileDoesNotExist.lua",
+                                            allowMmap != 0),
+                         LuaFileError);
+      BOOST_CHECK_THROW (ls.doFileStreamed ("SyntaxError.lua",
+                                            allowMmap != 0),
+                         LuaSyntaxError);
+
+      // "Shebang" lines are skipped, like in 'doFile()'
+      {
+         std::ofstream script ("TestLuaStateShebang.lua");
+         script << "#!/usr/bin/env lua\nreturn 171";
+      }
+      const LuaValueList ret3 = ls.doFileStreamed ("TestLuaStateShebang.lua",
+                                                   allowMmap != 0);
+      BOOST_REQUIRE_EQUAL (ret3.size(), 1U);
+      BOOST_CHECK (ret3[0] == 171);
+      std::remove ("TestLuaStateShebang.lua");
+   }
+}
+
+
+
+// - TestLuaStateLimits --------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStateLimits)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("function spin() while true do end end\n"
+                "function count(n) local x = 0 "
+                "for i = 1, n do x = x + i end return x end");
+
+   // Instruction limit: enforced per call, in all ways of calling Lua code
+   ls.setInstructionLimit (100000);
+   BOOST_CHECK_THROW (ls.doString ("spin()"), LuaInstructionLimitError);
+   BOOST_CHECK_THROW (ls["spin"](), LuaInstructionLimitError);
+   LuaFunction spin = ls["spin"].value().asFunction();
+   BOOST_CHECK_THROW (ls.call (spin, LuaValueList()),
+                      LuaInstructionLimitError);
+
+   for (int i = 0; i < 10; ++i)
+      BOOST_CHECK (ls["count"](1000)[0] == 500500);
+
+   // Catching the error in Lua doesn't escape the limit
+   BOOST_CHECK_THROW (
+      ls.doString ("while true do pcall (spin) end"), LuaLimitError);
+
+   // Removing the limit
+   ls.setInstructionLimit (0);
+   BOOST_CHECK (ls["count"](100000)[0] == 5000050000.0);
+
+   // Time limit
+   ls.setTimeLimit (std::chrono::milliseconds (50));
+   ls.setLimitCheckInterval (100);
+
+   const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+   BOOST_CHECK_THROW (ls.doString ("spin()"), LuaTimeLimitError);
+   BOOST_CHECK (std::chrono::steady_clock::now() - start
+                < std::chrono::seconds (5));
+
+   // The state remains usable, and the errors are 'LuaRunTimeError's
+   BOOST_CHECK (ls.doString ("return 1 + 1")[0] == 2);
+   try
+   {
+      ls.doString ("spin()");
+      BOOST_ERROR ("'LuaTimeLimitError' expected.");
+   }
+   catch (const LuaRunTimeError& e)
+   {
+      BOOST_CHECK (std::string (e.what()).find ("time limit") !=
+                   std::string::npos);
+   }
+
+   BOOST_CHECK_THROW (ls.setTimeLimit (std::chrono::microseconds (-1)),
+                      LuaError);
+   BOOST_CHECK_THROW (ls.setLimitCheckInterval (0), LuaError);
+}
+
+
+
+// - TestLuaStateLimitsAndUserHooks --------------------------------------------
+namespace
+{
+   /// A hook set by "the user", which just counts the times it runs.
+   int TheUserHookCount = 0;
+
+   void UserHook (lua_State*, lua_Debug*)
+   {
+      ++TheUserHookCount;
+   }
+}
+
+BOOST_AUTO_TEST_CASE(TestLuaStateLimitsAndUserHooks)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   lua_State* rls = ls.getState();
+   ls.doString ("function spin() while true do end end");
+   lua_sethook (rls, UserHook, LUA_MASKCOUNT | LUA_MASKLINE, 77);
+
+   // The user's hook is replaced during limited calls, and restored after
+   // them, even when they are aborted
+   ls.setInstructionLimit (100000);
+   BOOST_CHECK (ls.doString ("return 1 + 1")[0] == 2);
+   BOOST_CHECK_THROW (ls.doString ("spin()"), LuaInstructionLimitError);
+   BOOST_CHECK (lua_gethook (rls) == UserHook);
+   BOOST_CHECK_EQUAL (lua_gethookmask (rls), LUA_MASKCOUNT | LUA_MASKLINE);
+   BOOST_CHECK_EQUAL (lua_gethookcount (rls), 77);
+
+   // Same after cancel requests made when nothing was running
+   ls.setInstructionLimit (0);
+   ls.requestCancel();
+   BOOST_CHECK (ls.doString ("return 2 + 2")[0] == 4);
+   BOOST_CHECK (lua_gethook (rls) == UserHook);
+   BOOST_CHECK_EQUAL (lua_gethookcount (rls), 77);
+
+   // The restored hook works
+   TheUserHookCount = 0;
+   ls.doString ("local x = 0 for i = 1, 1000 do x = x + i end");
+   BOOST_CHECK (TheUserHookCount > 0);
+
+   lua_sethook (rls, 0, 0, 0);
+}
+
+
+
+// - TestLuaStateRequestCancel -------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStateRequestCancel)
+{
+   using namespace Diluculum;
+   typedef std::chrono::steady_clock Clock;
+
+   LuaState ls;
+   ls.doString ("function spin() while true do end end");
+
+   // Requests made while nothing is running are ignored
+   ls.requestCancel();
+   BOOST_CHECK (ls.doString ("return 1 + 1")[0] == 2);
+
+   // Cancelling from another thread, with and without limits
+   for (int withLimits = 0; withLimits < 2; ++withLimits)
+   {
+      if (withLimits)
+         ls.setTimeLimit (std::chrono::seconds (60));
+
+      Clock::time_point requestTime;
+      std::thread canceller ([&]() {
+         std::this_thread::sleep_for (std::chrono::milliseconds (50));
+         requestTime = Clock::now();
+         ls.requestCancel();
+      });
+
+      BOOST_CHECK_THROW (ls.doString ("while true do pcall (spin) end"),
+                         LuaCancelledError);
+      const Clock::time_point cancelTime = Clock::now();
+      canceller.join();
+
+      BOOST_CHECK (cancelTime - requestTime < std::chrono::seconds (1));
+
+      // The state remains usable
+      BOOST_CHECK (ls.doString ("return 2 + 2")[0] == 4);
+   }
+}
+
+
+
+// - TestLuaStateGC ------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStateGC)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+
+   // Statistics
+   LuaGCStats stats = ls.gcStats();
+   BOOST_CHECK (stats.running);
+   BOOST_CHECK (stats.kilobytesInUse > 0);
+   BOOST_CHECK (stats.bytesInUse >= stats.kilobytesInUse * 1024);
+   BOOST_CHECK (stats.bytesInUse < (stats.kilobytesInUse + 1) * 1024);
+
+   const std::size_t cycles = stats.cycles;
+   ls.collectGarbage();
+   ls.collectGarbage();
+   BOOST_CHECK (ls.gcStats().cycles >= cycles + 2);
+
+   // Tuning parameters return their previous values
+   const int pause = ls.setGCPause (150);
+   BOOST_CHECK_EQUAL (ls.setGCPause (pause), 150);
+   const int stepMul = ls.setGCStepMultiplier (300);
+   BOOST_CHECK_EQUAL (ls.setGCStepMultiplier (stepMul), 300);
+
+   // Stopping and restarting
+   ls.stopGC();
+   BOOST_CHECK (!ls.gcStats().running);
+   ls.doString ("t = { } for i = 1, 10000 do t[i] = { i } end t = nil");
+
+   // Idle-time collection completes a cycle eventually, and doesn't restart
+   // a stopped collector
+   const std::size_t kilobytes = ls.gcStats().kilobytesInUse;
+   bool completed = false;
+   for (int i = 0; i < 100000 && !completed; ++i)
+      completed = ls.collectFor (std::chrono::microseconds (100));
+   BOOST_CHECK (completed);
+   BOOST_CHECK (!ls.gcStats().running);
+   BOOST_CHECK (ls.gcStats().kilobytesInUse < kilobytes);
+
+   ls.restartGC();
+   BOOST_CHECK (ls.gcStats().running);
+
+   // Modes: incremental is always supported
+   BOOST_CHECK (ls.setGCMode (GC_INCREMENTAL));
+   if (ls.setGCMode (GC_GENERATIONAL))
+   {
+      ls.doString ("for i = 1, 10000 do local t = { i } end");
+      BOOST_CHECK (ls.setGCMode (GC_INCREMENTAL));
+   }
+   BOOST_CHECK (ls.doString ("return 1 + 1")[0] == 2);
+
+   // Borrowed states only start counting cycles when asked for statistics
+   lua_State* rls = luaL_newstate();
+   {
+      LuaState borrowed (rls);
+      borrowed.doString ("x = 1");
+      luaL_getmetatable (rls, "Diluculum.GCCanary");
+      BOOST_CHECK (lua_isnil (rls, -1));
+      lua_pop (rls, 1);
+
+      const std::size_t borrowedCycles = borrowed.gcStats().cycles;
+      borrowed.collectGarbage();
+      BOOST_CHECK (borrowed.gcStats().cycles > borrowedCycles);
+   }
+   lua_close (rls);
+}
+
+
+
+// - TestLuaStateCallModes -----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStateCallModes)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("count = 0\n"
+                "function onEvent (n) count = count + n return 'ignored' end\n"
+                "function three (x) return x, x + 1, x + 2 end");
+
+   lua_State* state = ls.getState();
+   const int top = lua_gettop (state);
+
+   // Discarding the results
+   LuaValueList params;
+   params.push_back (5);
+   ls["onEvent"].callAndDiscard (params);
+   LuaRef onEvent (ls["onEvent"]);
+   onEvent.callAndDiscard (params);
+   BOOST_CHECK (ls["count"] == 10);
+   BOOST_CHECK_EQUAL (lua_gettop (state), top);
+
+   // Exactly N results
+   LuaValueList results;
+   ls["three"].callInto (params, results, 2);
+   BOOST_REQUIRE_EQUAL (results.size(), 2U);
+   BOOST_CHECK (results[0] == 5);
+   BOOST_CHECK (results[1] == 6);
+
+   onEvent.callInto (params, results, 3);
+   BOOST_REQUIRE_EQUAL (results.size(), 3U);
+   BOOST_CHECK (results[0] == "ignored");
+   BOOST_CHECK (results[1] == Nil);
+   BOOST_CHECK (results[2] == Nil);
+
+   ls["three"].callInto (params, results);
+   BOOST_REQUIRE_EQUAL (results.size(), 3U);
+   BOOST_CHECK (results[2] == 7);
+   BOOST_CHECK_EQUAL (lua_gettop (state), top);
+
+   // The same list for parameters and results
+   LuaValueList inOut;
+   inOut.push_back (1);
+   onEvent.callInto (inOut, inOut, 1);
+   BOOST_REQUIRE_EQUAL (inOut.size(), 1U);
+   BOOST_CHECK (inOut[0] == "ignored");
+
+   // In steady state, calling into a reused list doesn't allocate
+   LuaValueList numbers;
+   numbers.reserve (3);
+   onEvent.callAndDiscard (params);
+   ls["three"].callInto (params, numbers, 3);
+
+   LuaRef three (ls["three"]);
+   const std::size_t allocsBefore = TheAllocationCount;
+   for (int i = 0; i < 100; ++i)
+   {
+      three.callInto (params, numbers, 3);
+      onEvent.callAndDiscard (params);
+   }
+   BOOST_CHECK_EQUAL (TheAllocationCount - allocsBefore, 0U);
+   BOOST_CHECK (numbers[1] == 6);
+
+   // Errors
+   BOOST_CHECK_THROW (ls["three"].callInto (LuaValueList(), results),
+                      LuaRunTimeError);
+   BOOST_CHECK_THROW (LuaRef().callAndDiscard(), LuaError);
+}
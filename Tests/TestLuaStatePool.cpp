@@ -0,0 +1,174 @@
+/******************************************************************************\
+* TestLuaStatePool.cpp                                                         *
+* Unit tests for the pool of Lua states.                                       *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#define BOOST_TEST_MODULE LuaStatePool
+
+#include <thread>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaStatePool.hpp>
+
+
+namespace
+{
+   /// Initializes the states used in the tests.
+   void InitState (Diluculum::LuaState& ls)
+   {
+      ls.doString ("counter = 0\n"
+                   "config = { name = 'test' }\n"
+                   "function bump() counter = counter + 1 return counter end");
+   }
+}
+
+
+// - TestLuaStatePoolLeases ----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStatePoolLeases)
+{
+   using namespace Diluculum;
+
+   LuaStatePool pool (2, InitState);
+   BOOST_CHECK_EQUAL (pool.size(), 2U);
+
+   {
+      LuaStatePool::Lease a = pool.acquire();
+      LuaStatePool::Lease b = pool.tryAcquire();
+      BOOST_REQUIRE (a);
+      BOOST_REQUIRE (b);
+      BOOST_CHECK (&*a != &*b);
+      BOOST_CHECK ((*a)["config"]["name"].value() == "test");
+
+      // The pool is exhausted
+      BOOST_CHECK (!pool.tryAcquire());
+      BOOST_CHECK (!pool.acquire (std::chrono::microseconds (1000)));
+      BOOST_CHECK_EQUAL (pool.stats().inUse, 2U);
+
+      // Leases can be moved
+      LuaStatePool::Lease c (std::move (a));
+      BOOST_CHECK (!a);
+      BOOST_REQUIRE (c);
+      BOOST_CHECK (c->doString ("return bump()")[0] == 1);
+
+      // Releasing explicitly makes the state available at once
+      c.release();
+      BOOST_CHECK (!c);
+      BOOST_CHECK_EQUAL (pool.stats().inUse, 1U);
+      c = pool.tryAcquire();
+      BOOST_CHECK (c);
+   }
+
+   const LuaStatePoolStats stats = pool.stats();
+   BOOST_CHECK_EQUAL (stats.size, 2U);
+   BOOST_CHECK_EQUAL (stats.inUse, 0U);
+   BOOST_CHECK_EQUAL (stats.acquisitions, 3U);
+   BOOST_CHECK_EQUAL (stats.waits, 0U);
+   BOOST_CHECK (stats.utilization > 0.0 && stats.utilization <= 1.0);
+}
+
+
+
+// - TestLuaStatePoolResetGlobals ----------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStatePoolResetGlobals)
+{
+   using namespace Diluculum;
+
+   LuaStatePool pool (1, InitState);
+
+   {
+      LuaStatePool::Lease lease = pool.acquire();
+      lease->doString ("bump() bump()\n"
+                       "newGlobal = 'oops'\n"
+                       "config.name = 'changed'\n"
+                       "print = nil");
+   }
+
+   {
+      LuaStatePool::Lease lease = pool.acquire();
+      BOOST_CHECK ((*lease)["counter"].value() == 0);
+      BOOST_CHECK ((*lease)["newGlobal"].value() == Nil);
+      BOOST_CHECK ((*lease)["print"].value().type() == LUA_TFUNCTION);
+
+      // The reset is shallow
+      BOOST_CHECK ((*lease)["config"]["name"].value() == "changed");
+   }
+
+   // Without resetting, globals persist across leases
+   LuaStatePool persistentPool (1, InitState, false);
+   persistentPool.acquire()->doString ("bump()");
+   BOOST_CHECK (persistentPool.acquire()->doString ("return counter")[0] == 1);
+}
+
+
+
+// - TestLuaStatePoolThreads ---------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStatePoolThreads)
+{
+   using namespace Diluculum;
+
+   const int numThreads = 8;
+   const int callsPerThread = 500;
+
+   // Create the states with a custom function, too
+   LuaStatePool pool (
+      3,
+      []() { return std::unique_ptr<LuaState> (
+                new LuaState (std::unique_ptr<LuaAllocator> (
+                                 new PoolLuaAllocator()))); },
+      InitState,
+      false);
+
+   std::vector<std::thread> threads;
+   for (int i = 0; i < numThreads; ++i)
+   {
+      threads.push_back (std::thread ([&]() {
+         for (int j = 0; j < callsPerThread; ++j)
+            pool.acquire()->doString ("bump()");
+      }));
+   }
+
+   for (std::size_t i = 0; i < threads.size(); ++i)
+      threads[i].join();
+
+   // Every call was made, each one by a single thread
+   std::vector<LuaStatePool::Lease> leases;
+   double total = 0;
+   for (std::size_t i = 0; i < pool.size(); ++i)
+   {
+      leases.push_back (pool.acquire());
+      total += (*leases.back())["counter"].value().asNumber();
+   }
+
+   leases.clear();
+
+   BOOST_CHECK_EQUAL (total, numThreads * callsPerThread);
+
+   const LuaStatePoolStats stats = pool.stats();
+   BOOST_CHECK_EQUAL (stats.inUse, 0U);
+   BOOST_CHECK_EQUAL (stats.acquisitions,
+                      static_cast<std::size_t>(numThreads * callsPerThread)
+                      + pool.size());
+   BOOST_CHECK (stats.totalWaitTime >= 0.0);
+   BOOST_CHECK (stats.maxWaitTime <= stats.totalWaitTime);
+}
@@ -0,0 +1,111 @@
+/******************************************************************************\
+* TestLuaStringPool.cpp                                                        *
+* Unit tests for things declared in 'LuaStringPool.hpp'.                       *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#define BOOST_TEST_MODULE LuaStringPool
+
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaStringPool.hpp>
+
+
+// - TestLuaStringPoolIntern ---------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStringPoolIntern)
+{
+   using namespace Diluculum;
+
+   LuaStringPool pool (20);
+   BOOST_CHECK_EQUAL (pool.size(), 0U);
+   BOOST_CHECK_EQUAL (pool.maxLength(), 20U);
+
+   // Equal strings share the same 'std::string'
+   const LuaValue name1 = pool.intern ("name");
+   const LuaValue name2 = pool.intern (std::string ("name"));
+   const LuaValue id = pool.intern ("id", 2);
+
+   BOOST_CHECK (name1 == "name");
+   BOOST_CHECK (id == "id");
+   BOOST_CHECK (&name1.asString() == &name2.asString());
+   BOOST_CHECK (&name1.asString() != &id.asString());
+   BOOST_CHECK_EQUAL (pool.size(), 2U);
+
+   // Embedded zeros are fine
+   const LuaValue withZero1 = pool.intern ("a\0b", 3);
+   const LuaValue withZero2 = pool.intern ("a\0c", 3);
+   BOOST_CHECK (withZero1 != withZero2);
+   BOOST_CHECK_EQUAL (withZero1.asString().size(), 3U);
+
+   // Long strings are not pooled
+   const std::string longString (21, 'x');
+   const LuaValue long1 = pool.intern (longString);
+   const LuaValue long2 = pool.intern (longString);
+   BOOST_CHECK (long1 == long2);
+   BOOST_CHECK (&long1.asString() != &long2.asString());
+   BOOST_CHECK_EQUAL (pool.size(), 4U);
+
+   // Lots of strings, to make the pool grow
+   for (int i = 0; i < 1000; ++i)
+      pool.intern ("str" + std::to_string (i));
+   BOOST_CHECK_EQUAL (pool.size(), 1004U);
+   BOOST_CHECK (&pool.intern ("name").asString() == &name1.asString());
+   BOOST_CHECK (pool.intern ("str999") == "str999");
+   BOOST_CHECK_EQUAL (pool.size(), 1004U);
+
+   // Interned strings behave like any other string
+   BOOST_CHECK_EQUAL (name1.hash(), LuaValue ("name").hash());
+
+   // Clearing the pool doesn't affect the values already returned
+   pool.clear();
+   BOOST_CHECK_EQUAL (pool.size(), 0U);
+   BOOST_CHECK (name1 == "name");
+   BOOST_CHECK (&pool.intern ("name").asString() != &name1.asString());
+}
+
+
+
+// - TestLuaStringPoolUse ------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStringPoolUse)
+{
+   using namespace Diluculum;
+
+   LuaStringPool pool1;
+   LuaStringPool pool2;
+
+   BOOST_CHECK (LuaStringPool::current() == 0);
+
+   {
+      LuaStringPool::Use use1 (pool1);
+      BOOST_CHECK (LuaStringPool::current() == &pool1);
+
+      {
+         LuaStringPool::Use use2 (pool2);
+         BOOST_CHECK (LuaStringPool::current() == &pool2);
+      }
+
+      BOOST_CHECK (LuaStringPool::current() == &pool1);
+   }
+
+   BOOST_CHECK (LuaStringPool::current() == 0);
+}
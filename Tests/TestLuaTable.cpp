@@ -0,0 +1,240 @@
+/******************************************************************************\
+* TestLuaTable.cpp                                                             *
+* Unit tests for things declared in 'LuaTable.hpp'.                            *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#define BOOST_TEST_MODULE LuaTable
+
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaTable.hpp>
+
+
+// - TestLuaTableArrayPart -----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaTableArrayPart)
+{
+   using namespace Diluculum;
+
+   LuaTable t;
+   BOOST_CHECK (t.empty());
+
+   // Consecutive integer keys go to the array part
+   t[1] = "one";
+   t[2] = "two";
+   t[3.0] = "three";
+
+   BOOST_CHECK_EQUAL (t.size(), 3U);
+   BOOST_CHECK_EQUAL (t.arraySize(), 3U);
+   BOOST_CHECK_EQUAL (t.hashSize(), 0U);
+   BOOST_CHECK (t.arrayPart()[1] == "two");
+
+   // Other keys go to the hash part
+   t[5] = "five";
+   t[0] = "zero";
+   t[-1] = "minus one";
+   t[1.5] = "one and a half";
+   t["1"] = "string one";
+
+   BOOST_CHECK_EQUAL (t.size(), 8U);
+   BOOST_CHECK_EQUAL (t.arraySize(), 3U);
+   BOOST_CHECK_EQUAL (t.hashSize(), 5U);
+
+   // Filling the gap moves '5' to the array part
+   t[4] = "four";
+   BOOST_CHECK_EQUAL (t.arraySize(), 5U);
+   BOOST_CHECK_EQUAL (t.hashSize(), 4U);
+
+   BOOST_CHECK (*t.find (5) == "five");
+   BOOST_CHECK (*t.find (0) == "zero");
+   BOOST_CHECK (*t.find ("1") == "string one");
+   BOOST_CHECK (t.find (6) == 0);
+   BOOST_CHECK (t.find ("2") == 0);
+
+   // Erasing from the middle of the array part moves the tail to the hash part
+   BOOST_CHECK_EQUAL (t.erase (2), 1U);
+   BOOST_CHECK_EQUAL (t.erase (2), 0U);
+   BOOST_CHECK_EQUAL (t.size(), 8U);
+   BOOST_CHECK_EQUAL (t.arraySize(), 1U);
+   BOOST_CHECK (*t.find (4) == "four");
+   BOOST_CHECK (t.find (2) == 0);
+
+   // ...and putting it back moves it back
+   t[2] = 2;
+   BOOST_CHECK_EQUAL (t.arraySize(), 5U);
+}
+
+
+
+// - TestLuaTableIteration -----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaTableIteration)
+{
+   using namespace Diluculum;
+
+   LuaTable t;
+   for (int i = 10; i >= 1; --i)
+      t[i] = i * 10;
+   t["foo"] = "bar";
+   t[true] = false;
+
+   // The array part comes first, in order; then the hash part
+   int count = 0;
+   const LuaTable::const_iterator end = t.end();
+   for (LuaTable::const_iterator p = t.begin(); p != end; ++p, ++count)
+   {
+      if (count < 10)
+      {
+         BOOST_CHECK (p.key() == count + 1);
+         BOOST_CHECK (p.value() == (count + 1) * 10);
+      }
+      else
+      {
+         BOOST_CHECK (p.key() == "foo" || p.key() == true);
+         BOOST_CHECK (p.value() == t.find (p.key())[0]);
+      }
+   }
+
+   BOOST_CHECK_EQUAL (count, 12);
+
+   // Empty table
+   const LuaTable empty;
+   BOOST_CHECK (empty.begin() == empty.end());
+}
+
+
+
+// - TestLuaTableHashPart ------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaTableHashPart)
+{
+   using namespace Diluculum;
+
+   // Enough keys to make the hash part grow a few times
+   LuaTable t;
+   const int n = 1000;
+   for (int i = 0; i < n; ++i)
+      t["key" + std::to_string (i)] = i;
+
+   BOOST_CHECK_EQUAL (t.size(), static_cast<std::size_t>(n));
+
+   // Remove every other key, and check that all the others are still found
+   for (int i = 0; i < n; i += 2)
+      BOOST_CHECK_EQUAL (t.erase ("key" + std::to_string (i)), 1U);
+
+   BOOST_CHECK_EQUAL (t.size(), static_cast<std::size_t>(n / 2));
+
+   for (int i = 0; i < n; ++i)
+   {
+      const LuaValue* v = t.find ("key" + std::to_string (i));
+      if (i % 2 == 0)
+         BOOST_CHECK (v == 0);
+      else
+         BOOST_CHECK (v != 0 && *v == i);
+   }
+
+   // Numerically equal keys are the same key
+   t[-0.0] = "zero";
+   BOOST_CHECK (*t.find (0) == "zero");
+
+   t.clear();
+   BOOST_CHECK (t.empty());
+   BOOST_CHECK (t.find ("key1") == 0);
+
+   // Using as key a value stored in the table itself, when the insertion
+   // makes the hash part grow
+   LuaValue v = EmptyLuaValueMap;
+   v["a"] = "zzz";
+   v["ka"] = 0;
+   v["kb"] = 1;
+   v[v["a"]] = 1;
+   BOOST_CHECK (v["zzz"] == 1);
+   BOOST_CHECK (v["a"] == "zzz");
+   BOOST_CHECK_EQUAL (v.asTableRef().size(), 4U);
+}
+
+
+
+// - TestLuaTableConversions ---------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaTableConversions)
+{
+   using namespace Diluculum;
+
+   LuaValueMap map;
+   map[1] = "one";
+   map[2] = "two";
+   map[4] = "four";
+   map["x"] = 1.5;
+   map[false] = Nil;
+
+   const LuaTable t (map);
+   BOOST_CHECK_EQUAL (t.size(), 5U);
+   BOOST_CHECK_EQUAL (t.arraySize(), 2U);
+   BOOST_CHECK (t.find (false) != 0 && *t.find (false) == Nil);
+
+   BOOST_CHECK (t.toLuaValueMap() == map);
+
+   // The same goes for table-typed 'LuaValue's
+   const LuaValue v (map);
+   BOOST_CHECK (v.asTable() == map);
+   BOOST_CHECK (v.asTableRef() == t);
+}
+
+
+
+// - TestLuaTableEquality ------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaTableEquality)
+{
+   using namespace Diluculum;
+
+   // Same entries, inserted in different orders (so that the entries are
+   // split differently among the parts while the tables are built)
+   LuaTable t1;
+   t1[1] = "a";
+   t1[2] = "b";
+   t1[3] = "c";
+   t1["x"] = "y";
+
+   LuaTable t2;
+   t2["x"] = "y";
+   t2[3] = "c";
+   t2[2] = "b";
+   t2[1] = "a";
+
+   BOOST_CHECK (t1 == t2);
+   BOOST_CHECK_EQUAL (t1.compare (t2), 0);
+   BOOST_CHECK_EQUAL (t1.hash(), t2.hash());
+   BOOST_CHECK_EQUAL (LuaValue (t1).hash(), LuaValue (t2).hash());
+
+   t2[3] = "d";
+   BOOST_CHECK (t1 != t2);
+   BOOST_CHECK (t1.compare (t2) < 0);
+   BOOST_CHECK (t2.compare (t1) > 0);
+
+   // Entries are compared in key order, as in a 'LuaValueMap': the
+   // difference at '0.5' decides, even though the one at "x" is in the
+   // opposite direction
+   t2[3] = "c";
+   t1[0.5] = "half";
+   t2[0.5] = "zzz";
+   t2["x"] = "a";
+   BOOST_CHECK (t1.compare (t2) < 0);
+   BOOST_CHECK (t2.compare (t1) > 0);
+}
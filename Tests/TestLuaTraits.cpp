@@ -0,0 +1,246 @@
+/******************************************************************************\
+* TestLuaTraits.cpp                                                            *
+* Tests for 'LuaTraits'.                                                       *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#define BOOST_TEST_MODULE LuaTraits
+
+#include <limits>
+#include <map>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <boost/optional.hpp>
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaState.hpp>
+#include <Diluculum/LuaTraits.hpp>
+
+
+namespace
+{
+   /** Pushes \c value with \c LuaTraits, reads it back and returns it,
+    *  checking that the stack is left as it was.
+    */
+   template <class T>
+   T RoundTrip (lua_State* ls, const T& value)
+   {
+      using Diluculum::LuaTraits;
+
+      const int top = lua_gettop (ls);
+      LuaTraits<T>::push (ls, value);
+      BOOST_CHECK (LuaTraits<T>::check (ls, -1));
+      T ret = LuaTraits<T>::get (ls, -1);
+      lua_pop (ls, 1);
+      BOOST_CHECK_EQUAL (lua_gettop (ls), top);
+      return ret;
+   }
+}
+
+
+// - TestLuaTraitsScalars ------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaTraitsScalars)
+{
+   using namespace Diluculum;
+
+   LuaState state;
+   lua_State* ls = state.getState();
+
+   BOOST_CHECK_EQUAL (RoundTrip (ls, true), true);
+   BOOST_CHECK_EQUAL (RoundTrip (ls, false), false);
+   BOOST_CHECK_EQUAL (RoundTrip (ls, 171), 171);
+   BOOST_CHECK_EQUAL (RoundTrip (ls, -5L), -5L);
+   BOOST_CHECK_EQUAL (RoundTrip (ls, 42U), 42U);
+   BOOST_CHECK_EQUAL (RoundTrip (ls, 2.5), 2.5);
+   BOOST_CHECK_EQUAL (RoundTrip (ls, 0.25f), 0.25f);
+   BOOST_CHECK_EQUAL (RoundTrip (ls, std::string ("foo")), "foo");
+   BOOST_CHECK_EQUAL (RoundTrip (ls, std::string ("a\0b", 3)),
+                      std::string ("a\0b", 3));
+   BOOST_CHECK (RoundTrip (ls, LuaValue ("bar")) == "bar");
+
+   // Type mismatches
+   lua_pushstring (ls, "not a number");
+   BOOST_CHECK (!LuaTraits<int>::check (ls, -1));
+   BOOST_CHECK (!LuaTraits<bool>::check (ls, -1));
+   BOOST_CHECK (LuaTraits<std::string>::check (ls, -1));
+   BOOST_CHECK (LuaTraits<LuaValue>::check (ls, -1));
+   BOOST_CHECK_THROW (LuaTraits<double>::get (ls, -1), TypeMismatchError);
+   lua_pop (ls, 1);
+
+   lua_pushnumber (ls, 10);
+   BOOST_CHECK (!LuaTraits<std::string>::check (ls, -1));
+   BOOST_CHECK_THROW (LuaTraits<std::string>::get (ls, -1),
+                      TypeMismatchError);
+   lua_pop (ls, 1);
+
+   // Integers must be integral and in range; nothing is truncated
+   const double notInts[] = { 1.5, 1e300, -1e300, 2147483648.0,
+                              std::numeric_limits<double>::quiet_NaN() };
+   for (std::size_t i = 0; i < sizeof (notInts) / sizeof (notInts[0]); ++i)
+   {
+      lua_pushnumber (ls, notInts[i]);
+      BOOST_CHECK (!LuaTraits<int>::check (ls, -1));
+      BOOST_CHECK_THROW (LuaTraits<int>::get (ls, -1), TypeMismatchError);
+      BOOST_CHECK (LuaTraits<double>::check (ls, -1));
+      lua_pop (ls, 1);
+   }
+
+   lua_pushnumber (ls, -1);
+   BOOST_CHECK (!LuaTraits<unsigned>::check (ls, -1));
+   BOOST_CHECK_THROW (LuaTraits<unsigned char>::get (ls, -1),
+                      TypeMismatchError);
+   BOOST_CHECK_EQUAL (LuaTraits<signed char>::get (ls, -1), -1);
+   lua_pop (ls, 1);
+
+   lua_pushnumber (ls, 256.0);
+   BOOST_CHECK (!LuaTraits<unsigned char>::check (ls, -1));
+   BOOST_CHECK_EQUAL (LuaTraits<short>::get (ls, -1), 256);
+   lua_pop (ls, 1);
+
+   LuaTraits<long long>::push (ls, 1LL << 40);
+   BOOST_CHECK (!LuaTraits<int>::check (ls, -1));
+   BOOST_CHECK_EQUAL (LuaTraits<long long>::get (ls, -1), 1LL << 40);
+   lua_pop (ls, 1);
+
+   LuaTraits<std::vector<double> >::push (ls, std::vector<double> (3, 0.5));
+   BOOST_CHECK (!LuaTraits<std::vector<int> >::check (ls, -1));
+   lua_pop (ls, 1);
+}
+
+
+
+// - TestLuaTraitsContainers ---------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaTraitsContainers)
+{
+   using namespace Diluculum;
+
+   LuaState state;
+   lua_State* ls = state.getState();
+
+   // Vectors
+   std::vector<double> numbers;
+   numbers.push_back (1.5);
+   numbers.push_back (-3.0);
+   numbers.push_back (171.0);
+   BOOST_CHECK (RoundTrip (ls, numbers) == numbers);
+   BOOST_CHECK (RoundTrip (ls, std::vector<int>()).empty());
+
+   std::vector<std::vector<std::string> > nested (2);
+   nested[0].push_back ("a");
+   nested[1].push_back ("b");
+   nested[1].push_back ("c");
+   BOOST_CHECK (RoundTrip (ls, nested) == nested);
+
+   // Maps
+   std::map<std::string, int> map;
+   map["one"] = 1;
+   map["two"] = 2;
+   BOOST_CHECK (RoundTrip (ls, map) == map);
+
+   std::unordered_map<int, std::vector<bool> > unorderedMap;
+   unorderedMap[10].push_back (true);
+   unorderedMap[20].push_back (false);
+   unorderedMap[20].push_back (true);
+   BOOST_CHECK (RoundTrip (ls, unorderedMap) == unorderedMap);
+
+   // Optionals
+   BOOST_CHECK (!RoundTrip (ls, boost::optional<int>()));
+   BOOST_CHECK (RoundTrip (ls, boost::optional<int> (3)) == 3);
+
+   // Tuples
+   typedef std::tuple<int, std::string, bool> Record;
+   const Record record (1, "x", true);
+   BOOST_CHECK (RoundTrip (ls, record) == record);
+   BOOST_CHECK (RoundTrip (ls, std::tuple<>()) == std::tuple<>());
+
+   // Reading what Lua created, and type mismatches deep inside containers
+   state.doString ("array = { 1, 2, 3, 'four' }\n"
+                   "record = { 10, 'name' }\n"
+                   "dict = { a = 1, b = 2, [3] = 3 }");
+
+   const int top = lua_gettop (ls);
+   lua_getglobal (ls, "array");
+   BOOST_CHECK (!LuaTraits<std::vector<int> >::check (ls, -1));
+   BOOST_CHECK_THROW (LuaTraits<std::vector<int> >::get (ls, -1),
+                      TypeMismatchError);
+   BOOST_CHECK (LuaTraits<std::vector<LuaValue> >::check (ls, -1));
+   BOOST_CHECK_EQUAL (LuaTraits<std::vector<LuaValue> >::get (ls, -1).size(),
+                      4U);
+   lua_pop (ls, 1);
+
+   lua_getglobal (ls, "record");
+   typedef std::tuple<int, std::string> Pair;
+   BOOST_CHECK (LuaTraits<Pair>::check (ls, -1));
+   BOOST_CHECK (LuaTraits<Pair>::get (ls, -1) == Pair (10, "name"));
+   BOOST_CHECK (!(LuaTraits<std::tuple<int, int> >::check (ls, -1)));
+   lua_pop (ls, 1);
+
+   lua_getglobal (ls, "dict");
+   typedef std::map<std::string, int> Dict;
+   BOOST_CHECK (!LuaTraits<Dict>::check (ls, -1));
+   BOOST_CHECK_THROW (LuaTraits<Dict>::get (ls, -1), TypeMismatchError);
+   BOOST_CHECK_EQUAL ((LuaTraits<std::map<LuaValue, int> >::get (ls, -1)
+                       .size()), 3U);
+   lua_pop (ls, 1);
+
+   BOOST_CHECK_EQUAL (lua_gettop (ls), top);
+}
+
+
+
+// - TestLuaTraitsVariables ----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaTraitsVariables)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("config = { sizes = { 8, 16, 32 }, name = 'test' }\n"
+                "function sum (t) local s = 0 "
+                "for _, v in ipairs (t) do s = s + v end return s end");
+
+   // Getting
+   const std::vector<int> sizes =
+      ls["config"]["sizes"].get<std::vector<int> >();
+   BOOST_REQUIRE_EQUAL (sizes.size(), 3U);
+   BOOST_CHECK_EQUAL (sizes[2], 32);
+   BOOST_CHECK_EQUAL (ls["config"]["name"].get<std::string>(), "test");
+   BOOST_CHECK (!ls["config"]["missing"].get<boost::optional<int> >());
+   BOOST_CHECK_THROW (ls["config"]["name"].get<int>(), TypeMismatchError);
+
+   // Setting
+   std::map<std::string, double> weights;
+   weights["a"] = 0.5;
+   weights["b"] = 1.5;
+   ls["weights"].set (weights);
+   BOOST_CHECK (ls["weights"]["b"] == 1.5);
+
+   ls["config"]["name"].set ("other");
+   BOOST_CHECK (ls["config"]["name"] == "other");
+
+   ls["config"]["sizes"].set (std::vector<int> (4, 2));
+   BOOST_CHECK (ls["sum"](ls["config"]["sizes"].value())[0] == 8);
+
+   // Containers as call arguments
+   BOOST_CHECK_EQUAL (ls.call<int> ("sum", std::vector<int> (5, 3)), 15);
+}
@@ -177,3 +177,36 @@ BOOST_AUTO_TEST_CASE(TestUserDataCopies)
    BOOST_ASSERT (memcmp (ud4.getData(), data4, sizeof(data4)) == 0);
    BOOST_ASSERT (ud5 == ud4);
 }
+
+
+
+// - TestUserDataMoves ---------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestUserDataMoves)
+{
+   using namespace Diluculum;
+
+   CREATE_USERDATA (ud1, 10, 3, 4, 5);
+   unsigned char data1[10] = { 3, 4, 5 };
+   CREATE_USERDATA (ud2, 11, 3, 4, 5);
+
+   // Moving must take over the very same memory block
+   const void* block = ud1.getData();
+   LuaUserData ud3 (std::move (ud1));
+
+   BOOST_CHECK (ud3.getData() == block);
+   BOOST_CHECK_EQUAL (ud3.getSize(), 10U);
+   BOOST_CHECK (memcmp (ud3.getData(), data1, sizeof(data1)) == 0);
+   BOOST_CHECK_EQUAL (ud1.getSize(), 0U);
+
+   // Same for move assignment
+   ud2 = std::move (ud3);
+
+   BOOST_CHECK (ud2.getData() == block);
+   BOOST_CHECK_EQUAL (ud2.getSize(), 10U);
+   BOOST_CHECK_EQUAL (ud3.getSize(), 0U);
+
+   // Moved-from objects can be assigned to again
+   ud3 = ud2;
+   BOOST_CHECK (ud3 == ud2);
+   BOOST_CHECK (ud3.getData() != ud2.getData());
+}
@@ -30,6 +30,7 @@
 #include <cstring>
 #include <Diluculum/LuaExceptions.hpp>
 #include <Diluculum/LuaState.hpp>
+#include <Diluculum/LuaStringPool.hpp>
 #include <Diluculum/LuaUserData.hpp>
 #include <Diluculum/LuaUtils.hpp>
 
@@ -142,6 +143,63 @@ BOOST_AUTO_TEST_CASE(TestPushLuaValue)
 
 
 
+// - TestLuaValueIntegerRoundTrip ---------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaValueIntegerRoundTrip)
+{
+   using namespace Diluculum;
+
+   lua_State* ls = luaL_newstate();
+
+   const long long big = 9007199254740993LL; // 2^53 + 1, not a double
+   PushLuaValue (ls, big);
+   PushLuaValue (ls, 1.0);
+
+   const LuaValue readBig = ToLuaValue (ls, 1);
+   const LuaValue readOne = ToLuaValue (ls, 2);
+
+   BOOST_CHECK (readOne == 1);
+   BOOST_CHECK (!readOne.isInteger());
+
+#if LUA_VERSION_NUM >= 503
+   // Lua has integers, so they must survive the round trip
+   BOOST_CHECK (lua_isinteger (ls, 1));
+   BOOST_CHECK (readBig.isInteger());
+   BOOST_CHECK (readBig.asInteger() == big);
+#else
+   // Lua numbers are floats, so we get the closest float
+   BOOST_CHECK (!readBig.isInteger());
+   BOOST_CHECK (readBig == static_cast<lua_Number>(big));
+#endif
+
+   lua_close (ls);
+}
+
+
+
+// - TestToLuaValueStringPool -------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestToLuaValueStringPool)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("t = { { name = 'Z', x = 1 }, { name = 'Z', x = 2 } }");
+
+   // Without a pool, each string is a separate copy
+   const LuaValue noPool = ls["t"].value();
+   BOOST_CHECK (&noPool[1]["name"].asString() != &noPool[2]["name"].asString());
+
+   // With a pool, equal keys and values share their storage
+   LuaStringPool pool;
+   LuaStringPool::Use usePool (pool);
+
+   const LuaValue pooled = ls["t"].value();
+   BOOST_CHECK (pooled == noPool);
+   BOOST_CHECK (&pooled[1]["name"].asString() == &pooled[2]["name"].asString());
+   BOOST_CHECK_EQUAL (pool.size(), 3U); // "name", "x" and "Z"
+}
+
+
+
 // - TestPushLuaValueLuaFunction -----------------------------------------------
 BOOST_AUTO_TEST_CASE(TestPushLuaValueLuaFunction)
 {
@@ -27,6 +27,7 @@
 #define BOOST_TEST_MODULE LuaValue
 
 #include <cstring>
+#include <limits>
 #include <boost/test/unit_test.hpp>
 #include <Diluculum/LuaExceptions.hpp>
 #include <Diluculum/LuaValue.hpp>
@@ -136,6 +137,173 @@ BOOST_AUTO_TEST_CASE(TestLuaValueAssignmentOperator)
 
 
 
+// - TestLuaValueMoves ---------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaValueMoves)
+{
+   using namespace Diluculum;
+
+   // A long string, so that its buffer is not stored inline
+   const std::string longString (100, 'x');
+   LuaValue aStringValue (longString);
+   const char* buffer = aStringValue.asString().data();
+
+   LuaValue anotherValue (std::move (aStringValue));
+   BOOST_CHECK (anotherValue == longString);
+   BOOST_CHECK (anotherValue.asString().data() == buffer);
+   BOOST_CHECK (aStringValue == Nil);
+
+   // Move assignment of a table doesn't touch its elements
+   LuaValueMap aLuaValueMap;
+   aLuaValueMap[1] = "one";
+   aLuaValueMap["two"] = 2;
+   LuaValue aTableValue (aLuaValueMap);
+   const LuaValue* pOne = &aTableValue[1];
+
+   anotherValue = std::move (aTableValue);
+   BOOST_CHECK (anotherValue == aLuaValueMap);
+   BOOST_CHECK (&anotherValue[1] == pOne);
+   BOOST_CHECK (aTableValue == Nil);
+
+   // Scalars are simply moved over
+   LuaValue aNumberValue (1.5);
+   anotherValue = std::move (aNumberValue);
+   BOOST_CHECK (anotherValue == 1.5);
+   BOOST_CHECK (aNumberValue == Nil);
+
+   // Functions and user data
+   LuaValue aFunctionValue (CLuaFunctionExample);
+   LuaValue movedFunctionValue (std::move (aFunctionValue));
+   BOOST_CHECK (movedFunctionValue == LuaValue (CLuaFunctionExample));
+   BOOST_CHECK (aFunctionValue == Nil);
+
+   LuaUserData ud (64);
+   const void* udBlock = ud.getData();
+   LuaValue anUserDataValue (std::move (ud));
+   BOOST_CHECK (anUserDataValue.asUserData().getData() == udBlock);
+
+   // Constructing from a temporary 'LuaValueList' moves its first element
+   LuaValueList valueList;
+   valueList.push_back (longString);
+   const char* listBuffer = valueList[0].asString().data();
+   LuaValue fromList (std::move (valueList));
+   BOOST_CHECK (fromList.asString().data() == listBuffer);
+}
+
+
+
+// - TestLuaValueTableSharing --------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaValueTableSharing)
+{
+   using namespace Diluculum;
+
+   LuaValueMap aLuaValueMap;
+   aLuaValueMap[1] = "one";
+   aLuaValueMap["two"] = 2;
+
+   // Copies share the same table...
+   LuaValue original (aLuaValueMap);
+   LuaValue copy (original);
+   LuaValue anotherCopy;
+   anotherCopy = copy;
+
+   BOOST_CHECK (&copy.asTableRef() == &original.asTableRef());
+   BOOST_CHECK (&anotherCopy.asTableRef() == &original.asTableRef());
+
+   // ...and so do const accesses
+   const LuaValue& constCopy = copy;
+   BOOST_CHECK (&constCopy[1] == original.asTableRef().find(1));
+
+   // But writing to a copy must not affect the others
+   copy["two"] = 22;
+   copy[3] = "three";
+
+   BOOST_CHECK (&copy.asTableRef() != &original.asTableRef());
+   BOOST_CHECK (original == aLuaValueMap);
+   BOOST_CHECK (anotherCopy == aLuaValueMap);
+   BOOST_CHECK (copy["two"] == 22);
+   BOOST_CHECK (copy[3] == "three");
+   BOOST_CHECK (original.asTableRef().size() == 2);
+
+   // Once unshared, writing happens in place
+   const LuaTable* copysTable = &copy.asTableRef();
+   copy[4] = "four";
+   BOOST_CHECK (&copy.asTableRef() == copysTable);
+
+   // Assigning a table to one of its own elements
+   LuaValueMap inner;
+   inner["x"] = "inner value";
+   LuaValue outer (EmptyLuaValueMap);
+   outer["inner"] = inner;
+   outer = outer["inner"];
+   BOOST_CHECK (outer == inner);
+
+   // Writes through a reference don't reach copies made after taking it
+   LuaValue a (EmptyLuaValueMap);
+   LuaValue& r = a["k"];
+   const LuaValue b = a;
+   r = 1;
+   BOOST_CHECK (a["k"] == 1);
+   BOOST_CHECK (b["k"] == Nil);
+   BOOST_CHECK (&b.asTableRef() != &a.asTableRef());
+
+   // Copies of that copy share it again
+   const LuaValue c = b;
+   BOOST_CHECK (&c.asTableRef() == &b.asTableRef());
+
+   // Storing a table into itself stores a copy, not a cycle (which would
+   // keep the reference counted table alive forever)
+   LuaValue cls (EmptyLuaValueMap);
+   cls["name"] = "cls";
+   cls["__index"] = cls;
+   BOOST_CHECK (cls["__index"].type() == LUA_TTABLE);
+   BOOST_CHECK (&cls["__index"].asTableRef() != &cls.asTableRef());
+   BOOST_CHECK (cls["__index"]["name"] == "cls");
+   BOOST_CHECK (cls["__index"]["__index"] == Nil);
+
+   // 'asTableRef()' is strict about types
+   BOOST_CHECK_THROW (LuaValue(1).asTableRef(), TypeMismatchError);
+}
+
+
+
+// - TestLuaValueObjectSharing -------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaValueObjectSharing)
+{
+   using namespace Diluculum;
+
+   // Simple values are stored inline, everything else is behind a pointer,
+   // so a 'LuaValue' is small
+   BOOST_CHECK (sizeof(LuaValue) <= 16);
+
+   // Copies of strings share the string
+   const LuaValue str ("A string long enough to be allocated in the heap");
+   const LuaValue strCopy (str);
+   BOOST_CHECK (&strCopy.asString() == &str.asString());
+
+   // Copies of userdata share the data, until written to
+   LuaUserData data (8);
+   memset (data.getData(), 1, 8);
+   LuaValue ud (data);
+   const LuaValue constUDCopy (ud);
+   const LuaValue& constUD = ud;
+   BOOST_CHECK (&constUDCopy.asUserData() == &constUD.asUserData());
+
+   LuaValue udCopy (ud);
+   memset (udCopy.asUserData().getData(), 2, 8);
+   BOOST_CHECK (udCopy != ud);
+   BOOST_CHECK (static_cast<const char*>(ud.asUserData().getData())[7] == 1);
+   BOOST_CHECK (constUDCopy == ud);
+
+   // Once a mutable reference was handed out, copies don't share the data
+   LuaUserData& udRef = ud.asUserData();
+   const LuaValue lateUDCopy (ud);
+   memset (udRef.getData(), 3, 8);
+   BOOST_CHECK (lateUDCopy == constUDCopy);
+   BOOST_CHECK (lateUDCopy != ud);
+}
+
+
+
 // - TestLuaValueAndValueLists -------------------------------------------------
 BOOST_AUTO_TEST_CASE(TestLuaValueAndValueLists)
 {
@@ -673,6 +841,114 @@ BOOST_AUTO_TEST_CASE(TestLuaValueRelationalOperators)
 
 
 
+// - TestLuaValueCompare -------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaValueCompare)
+{
+   using namespace Diluculum;
+
+   char fbc[] = "fake bytecode";
+   LuaValueMap aLuaValueMap;
+   aLuaValueMap[1] = "one";
+   LuaValueMap anotherLuaValueMap;
+   anotherLuaValueMap[1] = "uno";
+
+   // One value of each type, in the expected order
+   LuaValueList values;
+   values.push_back (false);
+   values.push_back (true);
+   values.push_back (CLuaFunctionExample);
+   values.push_back (LuaFunction (fbc, strlen(fbc)));
+   values.push_back (Nil);
+   values.push_back (-1.5);
+   values.push_back (3);
+   values.push_back ("");
+   values.push_back ("bar");
+   values.push_back ("foo");
+   values.push_back (EmptyLuaValueMap);
+   values.push_back (aLuaValueMap);
+   values.push_back (anotherLuaValueMap);
+   values.push_back (LuaUserData (16));
+
+   // 'compare()' and the relational operators must agree for every pair
+   for (std::size_t i = 0; i < values.size(); ++i)
+   {
+      for (std::size_t j = 0; j < values.size(); ++j)
+      {
+         const int res = values[i].compare (values[j]);
+
+         BOOST_CHECK_EQUAL (res < 0, i < j);
+         BOOST_CHECK_EQUAL (res > 0, i > j);
+         BOOST_CHECK_EQUAL (res < 0, values[i] < values[j]);
+         BOOST_CHECK_EQUAL (res > 0, values[i] > values[j]);
+         BOOST_CHECK_EQUAL (res == 0, values[i] == values[j]);
+      }
+   }
+}
+
+
+
+// - TestLuaValueIntegers ------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaValueIntegers)
+{
+   using namespace Diluculum;
+
+   // Subtypes are set according to the C++ type used
+   BOOST_CHECK (LuaValue (3).isInteger());
+   BOOST_CHECK (LuaValue (3L).isInteger());
+   BOOST_CHECK (LuaValue (3ULL).isInteger());
+   BOOST_CHECK (!LuaValue (3.0).isInteger());
+   BOOST_CHECK (!LuaValue (3.0f).isInteger());
+   BOOST_CHECK (!LuaValue ("3").isInteger());
+   BOOST_CHECK (!LuaValue (18446744073709551615ULL).isInteger());
+   BOOST_CHECK (LuaValue (3).type() == LUA_TNUMBER);
+
+   // Large integers are stored exactly
+   const long long big = 9007199254740993LL; // 2^53 + 1
+   const LuaValue bigValue (big);
+   BOOST_CHECK (bigValue.asInteger() == big);
+   BOOST_CHECK (bigValue != 9007199254740992.0);
+   BOOST_CHECK (bigValue > 9007199254740992.0);
+   BOOST_CHECK (LuaValue (big - 1) == 9007199254740992.0);
+
+   // Integers and floats with the same value are equal, and have the same
+   // hash
+   BOOST_CHECK (LuaValue (3) == 3.0);
+   BOOST_CHECK (LuaValue (3.0) == 3);
+   BOOST_CHECK_EQUAL (LuaValue (3).hash(), LuaValue (3.0).hash());
+   BOOST_CHECK_EQUAL (LuaValue (0).hash(), LuaValue (-0.0).hash());
+   BOOST_CHECK (LuaValue (3) != 3.5);
+   BOOST_CHECK (LuaValue (3) < 3.5);
+   BOOST_CHECK (LuaValue (4) > 3.5);
+   BOOST_CHECK (LuaValue (-4) < -3.5);
+   BOOST_CHECK (!(LuaValue (3) < 3.0));
+   BOOST_CHECK (!(LuaValue (3.0) < 3));
+
+   const double nan = std::numeric_limits<double>::quiet_NaN();
+   BOOST_CHECK (LuaValue (3) != nan);
+   BOOST_CHECK (LuaValue (nan) != 3);
+
+   // ...so they are the same key in a table
+   LuaValue table (EmptyTable);
+   table[1] = "one";
+   table[2.0] = "two";
+   BOOST_CHECK (table[1.0] == "one");
+   BOOST_CHECK (table[2] == "two");
+   BOOST_CHECK_EQUAL (table.asTableRef().size(), 2U);
+   BOOST_CHECK_EQUAL (table.asTableRef().arraySize(), 2U);
+
+   LuaValueMap map;
+   map[1] = "one";
+   map[1.0] = "uno";
+   BOOST_CHECK_EQUAL (map.size(), 1U);
+   BOOST_CHECK (map[1] == "uno");
+
+   // Conversions to other types
+   BOOST_CHECK_EQUAL (LuaValue (7).asNumber(), 7.0);
+   BOOST_CHECK_EQUAL (LuaValue (7.9).asInteger(), 7);
+}
+
+
+
 // - TestLuaValueSubscriptOperator ---------------------------------------------
 BOOST_AUTO_TEST_CASE(TestLuaValueSubscriptOperator)
 {
@@ -715,6 +991,24 @@ BOOST_AUTO_TEST_CASE(TestLuaValueSubscriptOperator)
    tableValue["nested"][7.8] = 1.23;
    BOOST_CHECK (tableValue["nested"][7.8] == 1.23);
 
+   // Inserting may move values around, so 't[1] = t[2]' needs both keys to
+   // exist already...
+   LuaValue t (EmptyLuaValueMap);
+   t[1] = "one";
+   t[2] = "two";
+   t[1] = t[2];
+   BOOST_CHECK (t[1] == "two");
+   BOOST_CHECK (t[2] == "two");
+
+   // ...otherwise, the value must be copied first. (Here, 't[4]' goes to the
+   // hash part, and is migrated to the array part when 't[3]' is created.)
+   t[4] = "four";
+   LuaValue v = t[4];
+   t[3] = v;
+   BOOST_CHECK (t[3] == "four");
+   BOOST_CHECK (t[4] == "four");
+   BOOST_CHECK (t.asTableRef().arrayPart().size() == 4);
+
    // Try to subscript non-table values
    LuaValue nilValue;
    BOOST_CHECK_THROW (nilValue[1.0], TypeMismatchError);
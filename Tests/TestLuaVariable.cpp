@@ -26,6 +26,8 @@
 
 #define BOOST_TEST_MODULE LuaVariable
 
+#include <string>
+#include <tuple>
 #include <boost/test/unit_test.hpp>
 #include <Diluculum/LuaState.hpp>
 #include "WrappedFunctions.hpp"
@@ -612,3 +614,61 @@ BOOST_AUTO_TEST_CASE(TestLuaVariablePushLastTable)
    BOOST_REQUIRE (lua_isnumber (rawState, -1));
    BOOST_CHECK (lua_tonumber (rawState, -1) == 171);
 }
+
+
+
+// - TestLuaVariableTypedCall --------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaVariableTypedCall)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("function add (a, b) return a + b end\n"
+                "function divMod (a, b) return math.floor (a / b), a % b end\n"
+                "function describe (n, s, b) "
+                "return s .. ':' .. tostring (n) .. ':' .. tostring (b) end\n"
+                "function nothing() end\n"
+                "t = { f = function (x) return x * 2, 'extra' end }");
+
+   // One result
+   BOOST_CHECK_EQUAL (ls["add"].call<int> (2, 3), 5);
+   BOOST_CHECK_EQUAL (ls["add"].call<double> (0.5, 0.25), 0.75);
+   BOOST_CHECK_EQUAL (ls["t"]["f"].call<long> (21L), 42L);
+   BOOST_CHECK_EQUAL (ls["describe"].call<std::string> (1, "x", true),
+                      "x:1:true");
+   BOOST_CHECK_EQUAL (
+      ls["describe"].call<std::string> (7, std::string ("y"), false),
+      "y:7:false");
+
+   // Several results, and missing ones
+   std::tuple<int, int> qr = ls["divMod"].call<int, int> (17, 5);
+   BOOST_CHECK_EQUAL (std::get<0>(qr), 3);
+   BOOST_CHECK_EQUAL (std::get<1>(qr), 2);
+
+   std::tuple<int, LuaValue> r = ls["add"].call<int, LuaValue> (1, 1);
+   BOOST_CHECK_EQUAL (std::get<0>(r), 2);
+   BOOST_CHECK (std::get<1>(r) == Nil);
+
+   // No results
+   ls["nothing"].call();
+   ls["nothing"].call<> (1, 2, 3);
+
+   // Mixing with 'LuaValue's
+   BOOST_CHECK (ls["add"].call<LuaValue> (LuaValue (1), 2) == 3);
+
+   // Through the 'LuaState' and a 'LuaRef'
+   BOOST_CHECK_EQUAL (ls.call<int> ("add", 10, 20), 30);
+   LuaRef add (ls["add"]);
+   BOOST_CHECK_EQUAL (add.call<int> (100, 200), 300);
+   BOOST_CHECK_EQUAL (ls.call<int> ("add", add.call<int> (1, 2), 3), 6);
+
+   // Errors leave the stack clean
+   lua_State* state = ls.getState();
+   const int top = lua_gettop (state);
+   BOOST_CHECK_THROW (ls["t"].call<int>(), TypeMismatchError);
+   BOOST_CHECK_THROW (ls["add"].call<std::string> (1, 2), TypeMismatchError);
+   BOOST_CHECK_THROW ((ls["add"].call<int, int> (1, 2)), TypeMismatchError);
+   BOOST_CHECK_THROW (ls["add"].call<int> (1), LuaRunTimeError);
+   BOOST_CHECK_THROW (ls.call<int> ("undefined"), TypeMismatchError);
+   BOOST_CHECK_EQUAL (lua_gettop (state), top);
+}
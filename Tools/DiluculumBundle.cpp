@@ -0,0 +1,139 @@
+/******************************************************************************\
+* DiluculumBundle.cpp                                                          *
+* Precompiles Lua scripts into a bundle (see 'LuaBundle').                     *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <Diluculum/LuaBundle.hpp>
+#include <Diluculum/LuaExceptions.hpp>
+
+
+namespace
+{
+   /// Prints the usage instructions.
+   void PrintUsage (const char* programName)
+   {
+      std::cerr << "Usage: " << programName
+                << " [--no-strip] OUTPUT BASE_DIR SCRIPT...\n\n"
+                << "Precompiles the Lua scripts into the bundle OUTPUT. "
+                << "Module names are taken\nfrom the script paths relative "
+                << "to BASE_DIR: 'BASE_DIR/foo/bar.lua' becomes\n"
+                << "'foo.bar', and 'BASE_DIR/foo/init.lua' becomes 'foo'.\n";
+   }
+
+
+
+   /** Returns the name of the module implemented in \c script, or an empty
+    *  string if \c script is not under \c baseDir.
+    */
+   std::string ModuleName (const std::string& baseDir,
+                           const std::string& script)
+   {
+      std::string dir = baseDir;
+      const char last = dir.empty() ? '/' : dir[dir.size() - 1];
+      if (last != '/' && last != '\\')
+         dir += '/';
+
+      if (script.compare (0, dir.size(), dir) != 0)
+         return "";
+
+      std::string name = script.substr (dir.size());
+
+      const std::string extension = ".lua";
+      if (name.size() > extension.size()
+          && name.compare (name.size() - extension.size(), extension.size(),
+                           extension) == 0)
+      {
+         name.erase (name.size() - extension.size());
+      }
+
+      for (std::size_t i = 0; i < name.size(); ++i)
+      {
+         if (name[i] == '/' || name[i] == '\\')
+            name[i] = '.';
+      }
+
+      const std::string init = ".init";
+      if (name.size() > init.size()
+          && name.compare (name.size() - init.size(), init.size(), init) == 0)
+      {
+         name.erase (name.size() - init.size());
+      }
+
+      return name;
+   }
+
+} // (anonymous) namespace
+
+
+
+// - main ----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+   int arg = 1;
+   bool strip = true;
+   if (arg < argc && std::strcmp (argv[arg], "--no-strip") == 0)
+   {
+      strip = false;
+      ++arg;
+   }
+
+   if (argc - arg < 3)
+   {
+      PrintUsage (argv[0]);
+      return 1;
+   }
+
+   const std::string output = argv[arg++];
+   const std::string baseDir = argv[arg++];
+
+   try
+   {
+      std::map<std::string, std::string> modules;
+      for (; arg < argc; ++arg)
+      {
+         const std::string name = ModuleName (baseDir, argv[arg]);
+         if (name.empty())
+         {
+            std::cerr << argv[0] << ": '" << argv[arg] << "' is not under '"
+                      << baseDir << "'\n";
+            return 1;
+         }
+
+         modules[name] = Diluculum::LuaBundle::compile (argv[arg], strip);
+      }
+
+      Diluculum::LuaBundle::write (output, modules);
+   }
+   catch (const Diluculum::LuaError& e)
+   {
+      std::cerr << argv[0] << ": " << e.what() << '\n';
+      return 1;
+   }
+
+   return 0;
+}
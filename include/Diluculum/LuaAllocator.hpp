@@ -0,0 +1,325 @@
+/******************************************************************************\
+* LuaAllocator.hpp                                                             *
+* Memory allocators for Lua states.                                            *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#ifndef _DILUCULUM_LUA_ALLOCATOR_HPP_
+#define _DILUCULUM_LUA_ALLOCATOR_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+
+namespace Diluculum
+{
+   /// Statistics about the memory allocated by a \c LuaAllocator.
+   struct LuaMemoryStats
+   {
+      /// The number of bytes currently in use.
+      std::size_t bytesInUse;
+
+      /// The largest value of \c bytesInUse so far.
+      std::size_t peakBytes;
+
+      /// The number of memory blocks allocated so far.
+      std::size_t allocations;
+
+      /// The maximum number of bytes in use (zero means "no limit").
+      std::size_t limit;
+   };
+
+
+
+   /** An object notified of the allocations done by a \c LuaAllocator (see
+    *  \c LuaAllocator::setObserver()). This is used by profilers. The
+    *  functions are called by the thread running the Lua state, in the middle
+    *  of the Lua operation that allocates memory, so they must not throw, nor
+    *  call the Lua API (except for the debug functions that don't allocate,
+    *  and only from \c allocating()).
+    */
+   class LuaAllocationObserver
+   {
+      public:
+         /// Destroys the observer.
+         virtual ~LuaAllocationObserver() { }
+
+         /** Called before allocating a block (or resizing one) with \c size
+          *  bytes. At this point, the Lua state is consistent.
+          */
+         virtual void allocating (std::size_t size) = 0;
+
+         /** Called after successfully allocating the block \c ptr, with
+          *  \c size bytes. For reallocations, called after \c freed() is
+          *  called for the old block.
+          */
+         virtual void allocated (void* ptr, std::size_t size) = 0;
+
+         /// Called when the block \c ptr, with \c size bytes, is freed.
+         virtual void freed (void* ptr, std::size_t size) = 0;
+   };
+
+
+
+   /** The base class for memory allocators used by Lua states (see
+    *  <tt>LuaState::LuaState(std::unique_ptr<LuaAllocator>, bool)</tt>).
+    *  Besides allocating memory, using the strategy implemented by the
+    *  subclass, this keeps track of the memory in use and enforces a limit on
+    *  it: allocations that would exceed the limit fail, which Lua reports as
+    *  a memory error (thrown as \c LuaMemoryError by Diluculum).
+    *  <p>An allocator must be used by a single Lua state. Its statistics,
+    *  however, can be read from any thread.
+    *  @note Diluculum runs Lua code in protected mode, so running out of
+    *        memory there is handled gracefully. Allocations done by
+    *        unprotected calls to the Lua API (like those done when pushing
+    *        values from C++ to Lua) cause a call to the Lua panic function
+    *        if they fail. So, don't set limits too close to the memory
+    *        actually used.
+    */
+   class LuaAllocator
+   {
+      public:
+         /// Constructs the allocator, with no memory limit.
+         LuaAllocator();
+
+         /// Destroys the allocator.
+         virtual ~LuaAllocator();
+
+         /** A \c lua_Alloc function that uses a \c LuaAllocator, passed as
+          *  the \c ud parameter. This is what is passed to \c lua_newstate().
+          */
+         static void* luaAlloc (void* ud, void* ptr, std::size_t oldSize,
+                                std::size_t newSize);
+
+         /// Returns the memory usage statistics.
+         LuaMemoryStats stats() const;
+
+         /** Sets the maximum number of bytes that can be in use. If this is
+          *  already exceeded, nothing is freed, but further allocations fail.
+          *  @param limit The limit, in bytes. Zero means "no limit".
+          */
+         void setLimit (std::size_t limit) { limit_ = limit; }
+
+         /** Sets the object notified of the allocations, or removes it (if
+          *  \c observer is a null pointer). Must be called from the thread
+          *  running the Lua state.
+          */
+         void setObserver (LuaAllocationObserver* observer)
+         { observer_ = observer; }
+
+         /// Returns the object notified of the allocations, if any.
+         LuaAllocationObserver* observer() const { return observer_; }
+
+      protected:
+         /** Allocates a block with \c size bytes (\c size is never zero),
+          *  aligned for any type. Returns a null pointer on failure.
+          */
+         virtual void* allocate (std::size_t size) = 0;
+
+         /** Frees the block \c ptr, which was allocated with \c size bytes.
+          */
+         virtual void deallocate (void* ptr, std::size_t size) = 0;
+
+         /** Changes the size of the block \c ptr from \c oldSize to
+          *  \c newSize bytes (neither is zero), preserving its contents.
+          *  Returns the (possibly moved) block, or a null pointer on failure
+          *  (in which case the block is unchanged). Lua assumes that
+          *  shrinking a block never fails, so implementations should avoid
+          *  failing when \c newSize is not larger than \c oldSize. The
+          *  default implementation allocates a new block, copies the data and
+          *  deallocates the old block.
+          */
+         virtual void* reallocate (void* ptr, std::size_t oldSize,
+                                   std::size_t newSize);
+
+      private:
+         // Not copyable
+         LuaAllocator (const LuaAllocator&);
+         LuaAllocator& operator= (const LuaAllocator&);
+
+         /// The number of bytes currently in use.
+         std::atomic<std::size_t> bytesInUse_;
+
+         /// The largest value of \c bytesInUse_ so far.
+         std::atomic<std::size_t> peakBytes_;
+
+         /// The number of memory blocks allocated so far.
+         std::atomic<std::size_t> allocations_;
+
+         /// The maximum number of bytes that can be in use (zero: no limit).
+         std::atomic<std::size_t> limit_;
+
+         /// The object notified of the allocations, if any.
+         LuaAllocationObserver* observer_;
+   };
+
+
+
+   /** A \c LuaAllocator that uses \c std::realloc() and \c std::free(), just
+    *  like the allocator used by \c luaL_newstate().
+    */
+   class MallocLuaAllocator: public LuaAllocator
+   {
+      protected:
+         virtual void* allocate (std::size_t size);
+         virtual void deallocate (void* ptr, std::size_t size);
+         virtual void* reallocate (void* ptr, std::size_t oldSize,
+                                   std::size_t newSize);
+   };
+
+
+
+   /** A \c LuaAllocator that serves small blocks (which are the vast majority
+    *  of blocks allocated by Lua) from pools of fixed-size blocks, one for
+    *  each size class. This is usually faster than \c malloc() and has less
+    *  overhead per block. Larger blocks are allocated with \c malloc(). The
+    *  memory used by the pools is only given back to the system when the
+    *  allocator is destroyed.
+    *  <p>Shrinking a block never fails: if no smaller block is available,
+    *  the block stays where it is, and is reused as a block of the smaller
+    *  size class once freed. (So, a large block shrunk this way is kept by
+    *  the pools until the allocator is destroyed.)
+    */
+   class PoolLuaAllocator: public LuaAllocator
+   {
+      public:
+         /// Constructs the allocator, with empty pools.
+         PoolLuaAllocator();
+
+         /// Destroys the allocator, freeing all the pools.
+         virtual ~PoolLuaAllocator();
+
+      protected:
+         virtual void* allocate (std::size_t size);
+         virtual void deallocate (void* ptr, std::size_t size);
+         virtual void* reallocate (void* ptr, std::size_t oldSize,
+                                   std::size_t newSize);
+
+      private:
+         /// The granularity of the size classes, in bytes.
+         static const std::size_t Granularity = 16;
+
+         /// The number of size classes (larger blocks use \c malloc()).
+         static const std::size_t NumClasses = 16;
+
+         /// The size of each slab of memory carved into blocks.
+         static const std::size_t SlabSize = 64 * 1024;
+
+         /// Returns the size class for blocks of \c size bytes.
+         static std::size_t sizeClass (std::size_t size)
+         { return (size - 1) / Granularity; }
+
+         /** Makes sure that \c slabs_ can take one more element, besides
+          *  the ones reserved for the large blocks, without allocating
+          *  memory. Returns \c false if out of memory.
+          */
+         bool reserveSlabEntry();
+
+         /// A free block, linked to the next free block of its size class.
+         struct FreeBlock
+         {
+            /// The next free block.
+            FreeBlock* next;
+         };
+
+         /// The free blocks of each size class.
+         FreeBlock* freeLists_[NumClasses];
+
+         /** The slabs allocated so far, plus the large blocks which became
+          *  pooled blocks (see \c reallocate()).
+          */
+         std::vector<void*> slabs_;
+
+         /** The number of large blocks (allocated with \c malloc()) in use.
+          *  Room for this many more elements is always reserved in
+          *  \c slabs_, so that any of them can be added to it without
+          *  allocating memory.
+          */
+         std::size_t largeBlocks_;
+   };
+
+
+
+   /** A \c LuaAllocator that allocates blocks sequentially from large chunks
+    *  of memory, and frees nothing until it is destroyed. (Blocks are reused
+    *  only if freed or resized right after being allocated.) Allocating is
+    *  extremely cheap, but memory use grows all the time, so this is meant
+    *  for short-lived Lua states, like those used to process a single
+    *  request. A memory limit is recommended.
+    *  @note The statistics count the bytes in use by Lua, not the bytes
+    *        reserved by the arena. See \c reservedBytes() for the latter.
+    */
+   class ArenaLuaAllocator: public LuaAllocator
+   {
+      public:
+         /** Constructs the allocator.
+          *  @param chunkSize The size of the chunks of memory requested to
+          *         the system. (Larger blocks get their own chunks.)
+          */
+         explicit ArenaLuaAllocator (std::size_t chunkSize = 1024 * 1024);
+
+         /// Destroys the allocator, freeing all the memory it allocated.
+         virtual ~ArenaLuaAllocator();
+
+         /// Returns the number of bytes reserved from the system.
+         std::size_t reservedBytes() const { return reservedBytes_; }
+
+      protected:
+         virtual void* allocate (std::size_t size);
+         virtual void deallocate (void* ptr, std::size_t size);
+         virtual void* reallocate (void* ptr, std::size_t oldSize,
+                                   std::size_t newSize);
+
+      private:
+         /// The alignment of all blocks.
+         static const std::size_t Alignment = 16;
+
+         /// Rounds \c size up to a multiple of \c Alignment.
+         static std::size_t roundUp (std::size_t size)
+         { return (size + Alignment - 1) & ~(Alignment - 1); }
+
+         /// The size of the chunks requested to the system.
+         const std::size_t chunkSize_;
+
+         /// The chunks allocated so far.
+         std::vector<void*> chunks_;
+
+         /// The next free byte in the current chunk.
+         char* next_;
+
+         /// The end of the current chunk.
+         char* end_;
+
+         /** The last block allocated from the current chunk (which can be
+          *  freed or resized in place), or a null pointer if none.
+          */
+         char* last_;
+
+         /// The number of bytes reserved from the system.
+         std::atomic<std::size_t> reservedBytes_;
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_ALLOCATOR_HPP_
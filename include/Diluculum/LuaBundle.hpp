@@ -0,0 +1,145 @@
+/******************************************************************************\
+* LuaBundle.hpp                                                                *
+* A bundle of precompiled Lua modules.                                         *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#ifndef _DILUCULUM_LUA_BUNDLE_HPP_
+#define _DILUCULUM_LUA_BUNDLE_HPP_
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <lua.hpp>
+
+
+namespace Diluculum
+{
+   namespace Impl
+   {
+      class MappedFile;
+   }
+
+   /** A bundle of precompiled Lua modules: a single file containing the
+    *  bytecode of several modules, plus an index to find them by name. The
+    *  bundle is memory-mapped, so opening it is cheap and only the modules
+    *  actually loaded are read from the disk.
+    *  <p>Bundles are normally created at build time, with the
+    *  \c DiluculumBundle tool (see the \c AddLuaBundle() CMake function),
+    *  and used through \c LuaState::addBundle(), which lets \c require()
+    *  find the modules in the bundle without parsing any Lua source.
+    *  <p>Lua bytecode is not portable, so a bundle must be loaded by the same
+    *  Lua version (and on the same kind of platform) that created it.
+    *  <p>The file format is simple. All integers are unsigned, little-endian.
+    *  - A header: the eight bytes <tt>"DLBUNDL1"</tt>, then the number of
+    *    modules as a 64-bit integer.
+    *  - The index: for each module, sorted by name, four 64-bit integers
+    *    (the offset and size of the name, and the offset and size of the
+    *    bytecode). Offsets are relative to the beginning of the file.
+    *  - The names and the bytecode of the modules.
+    */
+   class LuaBundle
+   {
+      public:
+         /** Opens (memory-maps) the bundle file \c fileName.
+          *  @throw LuaFileError If the file cannot be opened or if it is not a
+          *         valid bundle.
+          */
+         explicit LuaBundle (const std::string& fileName);
+
+         /// Closes (unmaps) the bundle.
+         ~LuaBundle();
+
+         /// Returns the name of the bundle file.
+         const std::string& fileName() const { return fileName_; }
+
+         /// Returns the number of modules in the bundle.
+         std::size_t size() const { return numModules_; }
+
+         /** Looks for the module named \c moduleName.
+          *  @param moduleName The module name, as passed to \c require().
+          *  @param data If the module is found, is set to point to its
+          *         bytecode. The pointer is valid while the bundle is open.
+          *  @param size If the module is found, is set to the bytecode size.
+          *  @return \c true if the module was found; \c false otherwise.
+          */
+         bool find (const std::string& moduleName, const char*& data,
+                    std::size_t& size) const;
+
+         /** Writes a bundle file.
+          *  @param fileName The name of the file to write.
+          *  @param modules The modules to include, mapping module names to
+          *         their bytecode (or, actually, any chunk that \c lua_load()
+          *         accepts, including source code).
+          *  @throw LuaFileError If the file cannot be written.
+          */
+         static void write (const std::string& fileName,
+                            const std::map<std::string, std::string>& modules);
+
+         /** Compiles the Lua source file \c scriptFile and returns its
+          *  bytecode, suitable for inclusion in a bundle.
+          *  @param scriptFile The file to compile.
+          *  @param strip Strip debug information from the bytecode? This
+          *         makes the bytecode smaller, but error messages will not
+          *         contain line numbers. (Only Lua 5.3 and later support
+          *         stripping; this is ignored for older versions.)
+          *  @throw LuaError (or a subclass) If the file cannot be compiled.
+          */
+         static std::string compile (const std::string& scriptFile,
+                                     bool strip = true);
+
+      private:
+         // Not copyable
+         LuaBundle (const LuaBundle&);
+         LuaBundle& operator= (const LuaBundle&);
+
+         /// Returns the 64-bit integer stored at \c offset in the file.
+         unsigned long long readInteger (std::size_t offset) const;
+
+         /// The name of the bundle file.
+         std::string fileName_;
+
+         /// The bundle file, in memory.
+         std::unique_ptr<Impl::MappedFile> file_;
+
+         /// The number of modules in the bundle.
+         std::size_t numModules_;
+   };
+
+
+
+   /** Makes the modules in the bundle \c fileName available to \c require()
+    *  in \c state. This adds a searcher to \c package.searchers, right after
+    *  the one for \c package.preload, so modules in the bundle take
+    *  precedence over Lua files and C libraries. The bundle stays open until
+    *  \c state is closed.
+    *  @throw LuaFileError If the bundle cannot be opened.
+    *  @throw LuaError If the \c package library is not loaded in \c state.
+    *  @see LuaState::addBundle()
+    */
+   void AddLuaBundle (lua_State* state, const std::string& fileName);
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_BUNDLE_HPP_
@@ -63,6 +63,67 @@ namespace Diluculum
 
 
 
+   /** A Lua call aborted because it exceeded one of the execution limits of
+    *  its Lua state.
+    *  @see LuaState::setInstructionLimit(), LuaState::setTimeLimit()
+    */
+   class LuaLimitError: public LuaRunTimeError
+   {
+      public:
+         /** Constructs a \c LuaLimitError object.
+          *  @param what The message associated with the error.
+          */
+         LuaLimitError (const char* what)
+            : LuaRunTimeError (what)
+         { }
+   };
+
+
+
+   /// A Lua call aborted because it executed too many instructions.
+   class LuaInstructionLimitError: public LuaLimitError
+   {
+      public:
+         /** Constructs a \c LuaInstructionLimitError object.
+          *  @param what The message associated with the error.
+          */
+         LuaInstructionLimitError (const char* what)
+            : LuaLimitError (what)
+         { }
+   };
+
+
+
+   /// A Lua call aborted because it ran for too long.
+   class LuaTimeLimitError: public LuaLimitError
+   {
+      public:
+         /** Constructs a \c LuaTimeLimitError object.
+          *  @param what The message associated with the error.
+          */
+         LuaTimeLimitError (const char* what)
+            : LuaLimitError (what)
+         { }
+   };
+
+
+
+   /** A Lua call aborted because its cancellation was requested.
+    *  @see LuaState::requestCancel()
+    */
+   class LuaCancelledError: public LuaRunTimeError
+   {
+      public:
+         /** Constructs a \c LuaCancelledError object.
+          *  @param what The message associated with the error.
+          */
+         LuaCancelledError (const char* what)
+            : LuaRunTimeError (what)
+         { }
+   };
+
+
+
    /// A Lua file-related error.
    class LuaFileError: public LuaError
    {
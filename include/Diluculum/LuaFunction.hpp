@@ -27,14 +27,21 @@
 #ifndef _DILUCULUM_LUA_FUNCTION_HPP_
 #define _DILUCULUM_LUA_FUNCTION_HPP_
 
+#include <cstddef>
+#include <memory>
 #include <string>
-#include <boost/scoped_array.hpp>
 #include <lua.hpp>
 #include <Diluculum/Types.hpp>
 
 
 namespace Diluculum
 {
+   namespace Impl
+   {
+      // The data shared among copies of a 'LuaFunction' (defined in the .cpp).
+      struct LuaFunctionData;
+   }
+
    /** A C++ equivalent of a Lua function. This can store both C functions
     *  exported (or exportable) to Lua and pure Lua functions. In the first
     *  case, it stores a \c lua_CFunction. In the second case it stores data
@@ -45,6 +52,11 @@ namespace Diluculum
     *  @note A \c LuaFunction does not have any reference to a Lua
     *        interpreter. Thus, it does not make sense to call a \c LuaFunction
     *        object directly. To call a \c LuaFunction, use \c LuaState::call().
+    *  @note The data is shared among copies of a \c LuaFunction, and is
+    *        copied only when one of the copies is modified (copy-on-write).
+    *        Copying a \c LuaFunction is therefore cheap, regardless of the
+    *        size of its bytecode. Distinct \c LuaFunction objects can be
+    *        used from different threads, even if they share their data.
     */
    class LuaFunction
    {
@@ -78,19 +90,31 @@ namespace Diluculum
           */
          LuaFunction (lua_CFunction func);
 
-         /** The copy constructor. The newly constructed \c LuaFunction will
-          *  have its own block of memory, with the same contents as the \c
-          *  other. In other words, this constructor allocates and copies
-          *  memory.
+         /** The copy constructor. The newly constructed \c LuaFunction
+          *  shares the block of memory of \c other, so nothing is allocated
+          *  or copied (unless \c other handed out a pointer to its data
+          *  through the non-\c const \c getData(); see there).
           */
          LuaFunction (const LuaFunction& other);
 
-         /** Assigns a \c LuaFunction to this one. The memory currently
-          *  allocated for \c this will be freed, new memory will be allocated,
-          *  and the data stored in \c rhs will be copied to \c this.
+         /** The move constructor. The newly constructed \c LuaFunction takes
+          *  over the block of memory owned by \c other, so nothing is allocated
+          *  or copied. \c other is left empty (with size zero).
+          */
+         LuaFunction (LuaFunction&& other) noexcept;
+
+         /** Assigns a \c LuaFunction to this one. After the assignment, both
+          *  objects share the same block of memory; nothing is copied (with
+          *  the same exception as in the copy constructor).
           */
          const LuaFunction& operator= (const LuaFunction& rhs);
 
+         /** Move-assigns a \c LuaFunction to this one. The memory currently
+          *  allocated for \c this is freed and the memory owned by \c rhs is
+          *  taken over. \c rhs is left empty (with size zero).
+          */
+         const LuaFunction& operator= (LuaFunction&& rhs) noexcept;
+
          /**
           * Checks if this \c LuaFunction holds a C function (instead of a
           * "pure" Lua function).
@@ -107,43 +131,75 @@ namespace Diluculum
          /** Returns the size, in bytes, of the data stored in this
           *  \c LuaFunction.
           */
-         size_t getSize() const { return size_; }
-
-         /// Returns a pointer to the data stored in this \c LuaFunction.
-         void* getData() { return data_.get(); }
+         size_t getSize() const;
+
+         /** Returns a pointer to the data stored in this \c LuaFunction. If
+          *  the data is shared with other <tt>LuaFunction</tt>s, it is copied
+          *  first, so that writing through the returned pointer doesn't
+          *  affect them. From then on, copies of this \c LuaFunction get
+          *  copies of the data, and its hash is no longer cached, since the
+          *  data may change at any time.
+          */
+         void* getData();
 
          /** Returns a \c const pointer to the data stored in this
-          *  \c LuaFunction.
+          *  \c LuaFunction. This never copies anything.
           */
-         const void* getData() const { return data_.get(); }
+         const void* getData() const;
 
          /// Sets the data stored in this \c LuaFunction.
          void setData(void* data, size_t size);
 
-         /// Gets the "reader flag".
-         bool getReaderFlag() const { return readerFlag_; }
+         /** Appends \c size bytes to the data stored in this \c LuaFunction.
+          *  Memory is allocated in geometrically growing blocks, so that
+          *  appending many small pieces (as \c lua_dump() does) takes time
+          *  proportional to the total size.
+          */
+         void appendData(const void* data, size_t size);
 
-         /// Sets the "reader flag" to a given value.
-         void setReaderFlag(bool f) { readerFlag_ = f; }
+         /** Makes sure that at least \c capacity bytes can be stored in this
+          *  \c LuaFunction without further allocations.
+          */
+         void reserve(size_t capacity);
 
-         /** The "greater than" operator for \c LuaFunction.
+         /** Returns the number of bytes that can be stored in this
+          *  \c LuaFunction without further allocations.
+          */
+         size_t getCapacity() const;
+
+         /** Returns a hash of the data stored in this \c LuaFunction. It is
+          *  computed once and shared by all copies of this \c LuaFunction
+          *  (except after the non-\c const \c getData() was called, when it
+          *  is recomputed every time).
+          */
+         std::size_t hash() const;
+
+         /** Compares this \c LuaFunction with \c rhs. Returns a negative
+          *  number, zero or a positive number if \c this is, respectively,
+          *  less than, equal to or greater than \c rhs.
           *  @note Given two <tt>LuaFunction</tt>s, the decision on which one is
-          *        greater is somewhat arbitrary. Here, the function with larger
-          *        size is considered greater. If both are equal, the decision
-          *        is based on the contents of the stored data.
+          *        greater is somewhat arbitrary. Here, C functions come before
+          *        functions implemented in Lua, and then the function with
+          *        larger size is considered greater. If both are equal, the
+          *        decision is based on the hashes of the stored data, and
+          *        finally on the contents of the data.
+          */
+         int compare (const LuaFunction& rhs) const;
+
+         /** The "greater than" operator for \c LuaFunction.
+          *  @see compare()
           */
          bool operator> (const LuaFunction& rhs) const;
 
          /** The "less than" operator for \c LuaFunction.
-          *  @note Given two <tt>LuaFunction</tt>s, the decision on which one is
-          *        lesser is somewhat arbitrary. The criterion is similar to the
-          *        described for the "greater than" operator.
+          *  @see compare()
           */
          bool operator< (const LuaFunction& rhs) const;
 
          /** The "equal to" operator for \c LuaFunction.
           *  @note Two <tt>LuaFunctions</tt>s are considered equal if the data
-          *        they store have the same size and the same contents.
+          *        they store have the same size and the same contents. The
+          *        contents are compared only if the hashes are equal.
           *  @todo In Lua, a function is considered equal only to itself. Things
           *        are different here. Does this have a reason to not be like in
           *        Lua?
@@ -166,23 +222,21 @@ namespace Diluculum
             LUA_LUA_FUNCTION
          };
 
+         /** Makes sure that \c data_ is not shared with any other
+          *  \c LuaFunction and that it can hold at least \c capacity bytes.
+          *  Also forgets the cached hash, since the data is about to change.
+          */
+         void makeUnique (size_t capacity);
+
          /// The type of function stored in this \c LuaFunction.
          TypeOfFunction functionType_;
 
-         /// The number of bytes stored "in" \c data_.
-         size_t size_;
-
-         /** A (smart) pointer to the data owned by this
-          * \c LuaFunction. Depending on \c functionType_, the data pointed to
-          * by \c data may store a pointer to a \c lua_CFunction or Lua
-          * bytecode.
-          */
-         boost::scoped_array<char> data_;
-
-         /** A flag used when reading the bytecode data, in calls to \c
-          *  lua_load() and its \c lua_Reader.
+         /** The data stored by this \c LuaFunction, possibly shared with
+          *  other <tt>LuaFunction</tt>s. Depending on \c functionType_, it may
+          *  store a pointer to a \c lua_CFunction or Lua bytecode. May be
+          *  null, meaning "no data".
           */
-         bool readerFlag_;
+         std::shared_ptr<Impl::LuaFunctionData> data_;
    };
 
 } // namespace Diluculum
@@ -0,0 +1,291 @@
+/******************************************************************************\
+* LuaProfiler.hpp                                                              *
+* Profilers for Lua code.                                                      *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#ifndef _DILUCULUM_LUA_PROFILER_HPP_
+#define _DILUCULUM_LUA_PROFILER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <Diluculum/LuaState.hpp>
+
+
+namespace Diluculum
+{
+   /** The call stacks sampled by a profiler, in "folded" form, mapped to the
+    *  number of samples in which they appeared. A folded stack lists its
+    *  frames from the outermost to the innermost, separated by semicolons.
+    *  Each frame is written as <tt>source:line:function</tt>, where
+    *  \c line is the line being executed in that frame (for the frames of C
+    *  functions, just <tt>[C]:function</tt>).
+    */
+   typedef std::map<std::string, std::size_t> LuaFoldedStacks;
+
+
+
+   /** A sampling profiler for the Lua code run by a \c LuaState. While
+    *  running, a timer thread periodically flags that a sample is due; the
+    *  next time the Lua hook runs (every \c LuaState::setLimitCheckInterval()
+    *  instructions), the Lua call stack is sampled. The samples are
+    *  aggregated as folded stacks, which can be fed directly to
+    *  \c flamegraph.pl and similar tools.
+    *  <p>Only code run through Diluculum (\c LuaState::doString(),
+    *  \c LuaState::call(), calling a \c LuaVariable and so on) is profiled.
+    *  Time spent in C functions is attributed to the Lua code that runs
+    *  right after them.
+    *  <p>Except when said otherwise, the member functions must be called
+    *  from the thread using the \c LuaState, and not while it runs Lua code.
+    */
+   class LuaProfiler
+   {
+      public:
+         /** Constructs a profiler for \c ls, which must outlive it. The
+          *  profiler is initially stopped.
+          *  @param ls The \c LuaState to profile.
+          *  @param period The time between samples.
+          */
+         explicit LuaProfiler (LuaState& ls,
+                               std::chrono::microseconds period =
+                                  std::chrono::milliseconds (1));
+
+         /// Stops and destroys the profiler.
+         ~LuaProfiler();
+
+         /** Starts sampling.
+          *  @throw LuaError If another profiler is running on the same Lua
+          *         state.
+          */
+         void start();
+
+         /// Stops sampling. The samples taken so far are kept.
+         void stop();
+
+         /// Is the profiler sampling?
+         bool running() const { return running_; }
+
+         /// Discards all the samples taken so far.
+         void clear();
+
+         /// Returns the number of samples taken so far.
+         std::size_t sampleCount() const { return sampleCount_; }
+
+         /// Returns the samples taken so far.
+         const LuaFoldedStacks& stacks() const { return stacks_; }
+
+         /** Writes the samples taken so far to \c os, in the format expected
+          *  by \c flamegraph.pl: one line per stack, with the stack and the
+          *  number of samples separated by a space.
+          */
+         void writeFolded (std::ostream& os) const;
+
+      private:
+         // Not copyable
+         LuaProfiler (const LuaProfiler&);
+         LuaProfiler& operator= (const LuaProfiler&);
+
+         /// Called by the hook of the profiled state. Takes a sample if due.
+         static void sample (lua_State* ls, void* data);
+
+         /// The body of the timer thread.
+         void timer();
+
+         /// The state being profiled.
+         LuaState& state_;
+
+         /// The time between samples.
+         const std::chrono::microseconds period_;
+
+         /// Is the profiler running?
+         bool running_;
+
+         /// Set by the timer thread when it is time to take a sample.
+         std::atomic<bool> sampleDue_;
+
+         /// The number of samples taken.
+         std::size_t sampleCount_;
+
+         /// The samples taken.
+         LuaFoldedStacks stacks_;
+
+         /// The timer thread.
+         std::thread timer_;
+
+         /// Protects \c stopTimer_.
+         std::mutex timerMutex_;
+
+         /// Signaled to stop the timer thread.
+         std::condition_variable timerStopped_;
+
+         /// Must the timer thread stop?
+         bool stopTimer_;
+   };
+
+
+
+
+   /** The memory allocated from a given call site, as estimated by a
+    *  \c LuaAllocationProfiler.
+    */
+   struct LuaAllocationSiteStats
+   {
+      /// The number of sampled allocations.
+      std::size_t samples;
+
+      /// The (estimated) number of bytes allocated.
+      std::size_t allocatedBytes;
+
+      /// The (estimated) number of bytes allocated and not freed yet.
+      std::size_t retainedBytes;
+   };
+
+   /** The allocations sampled by a \c LuaAllocationProfiler, grouped by call
+    *  site. Call sites are written as <tt>source:line:function</tt>, like
+    *  the frames in \c LuaFoldedStacks, and refer to the innermost Lua
+    *  function (the one that called the C function that allocated memory,
+    *  if that was the case).
+    */
+   typedef std::map<std::string, LuaAllocationSiteStats> LuaAllocationSites;
+
+
+
+   /** A profiler that attributes the memory allocated by a Lua state to the
+    *  Lua code that allocated it. Works with Lua states created with a
+    *  \c LuaAllocator, without any changes to the scripts.
+    *  <p>Allocations are sampled: on average, one allocation every
+    *  \c sampleInterval bytes is recorded, and accounts for
+    *  \c sampleInterval bytes (or its actual size, if larger). The sampled
+    *  blocks are followed until freed, to estimate the memory retained by
+    *  each call site.
+    *  <p>Allocations done inside coroutines are attributed to the code that
+    *  resumed the coroutine. The member functions must be called from the
+    *  thread using the \c LuaState, and not while it runs Lua code. The
+    *  profiler must be destroyed before the \c LuaState.
+    */
+   class LuaAllocationProfiler: private LuaAllocationObserver
+   {
+      public:
+         /** Constructs an allocation profiler for \c ls. The profiler is
+          *  initially stopped.
+          *  @param ls The \c LuaState to profile.
+          *  @param sampleInterval The average number of bytes between
+          *         sampled allocations. Use 1 to record all allocations.
+          *  @throw LuaError If \c ls was not created with a
+          *         \c LuaAllocator, or \c sampleInterval is zero.
+          */
+         explicit LuaAllocationProfiler (LuaState& ls,
+                                         std::size_t sampleInterval =
+                                            64 * 1024);
+
+         /// Stops and destroys the profiler.
+         ~LuaAllocationProfiler();
+
+         /** Starts sampling.
+          *  @throw LuaError If the allocator is already observed by someone
+          *         else (like another profiler).
+          */
+         void start();
+
+         /** Stops sampling. Blocks freed after this are not accounted for
+          *  in \c LuaAllocationSiteStats::retainedBytes.
+          */
+         void stop();
+
+         /// Is the profiler sampling?
+         bool running() const { return running_; }
+
+         /// Discards all the samples taken so far.
+         void clear();
+
+         /// Returns the sampling interval, in bytes.
+         std::size_t sampleInterval() const { return sampleInterval_; }
+
+         /// Returns the samples taken so far, by call site.
+         const LuaAllocationSites& sites() const { return sites_; }
+
+         /** Writes a report of the samples taken so far to \c os: one line
+          *  per call site, with the estimated bytes allocated and retained,
+          *  from the call site that allocated most to the one that
+          *  allocated least.
+          */
+         void writeReport (std::ostream& os) const;
+
+      private:
+         // Not copyable
+         LuaAllocationProfiler (const LuaAllocationProfiler&);
+         LuaAllocationProfiler& operator= (const LuaAllocationProfiler&);
+
+         // 'LuaAllocationObserver' interface
+         virtual void allocating (std::size_t size);
+         virtual void allocated (void* ptr, std::size_t size);
+         virtual void freed (void* ptr, std::size_t size);
+
+         /// A sampled block, still allocated.
+         struct LiveBlock
+         {
+            /// The statistics of the call site that allocated the block.
+            LuaAllocationSiteStats* site;
+
+            /// The number of bytes the block accounts for.
+            std::size_t weight;
+         };
+
+         /// The state being profiled.
+         LuaState& state_;
+
+         /// The average number of bytes between samples.
+         const std::size_t sampleInterval_;
+
+         /// Is the profiler running?
+         bool running_;
+
+         /// The number of bytes to allocate before taking the next sample.
+         std::size_t bytesUntilSample_;
+
+         /** The call site of the allocation being sampled (between
+          *  \c allocating() and \c allocated()), or a null pointer.
+          */
+         LuaAllocationSiteStats* pendingSite_;
+
+         /// The weight of the allocation being sampled.
+         std::size_t pendingWeight_;
+
+         /// The samples taken.
+         LuaAllocationSites sites_;
+
+         /// The sampled blocks that are still allocated.
+         std::unordered_map<void*, LiveBlock> liveBlocks_;
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_PROFILER_HPP_
@@ -0,0 +1,203 @@
+/******************************************************************************\
+* LuaRef.hpp                                                                   *
+* A reference to a value living in a Lua state.                                *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#ifndef _DILUCULUM_LUA_REF_HPP_
+#define _DILUCULUM_LUA_REF_HPP_
+
+#include <lua.hpp>
+#include <Diluculum/LuaTraits.hpp>
+#include <Diluculum/LuaValue.hpp>
+#include <Diluculum/LuaVariable.hpp>
+
+
+namespace Diluculum
+{
+   /** A reference to a value living in a Lua state (a function, a table, a
+    *  userdata, or anything else). Unlike a \c LuaVariable, which finds its
+    *  value again every time it is used (by walking its keys from the table
+    *  of globals), a \c LuaRef keeps the value itself in the registry (with
+    *  \c luaL_ref()), so that it can be pushed in constant time. This also
+    *  keeps the value alive while the \c LuaRef exists, even if it is no
+    *  longer reachable from Lua.
+    *  <p>Since a \c LuaRef refers to a value, not to a variable, assigning
+    *  something else to the variable it was created from doesn't affect it.
+    *  @note A \c LuaRef must not outlive the Lua state it refers to.
+    */
+   class LuaRef
+   {
+      public:
+         /// Constructs an empty \c LuaRef, which refers to nothing.
+         LuaRef();
+
+         /** Constructs a \c LuaRef referring to the value at the index
+          *  \c index of the stack of \c ls. The stack is not changed.
+          */
+         LuaRef (lua_State* ls, int index);
+
+         /** Constructs a \c LuaRef referring to the current value of \c var.
+          *  @throw TypeMismatchError If \c var tries to subscript something
+          *         that is not a table.
+          */
+         explicit LuaRef (const LuaVariable& var);
+
+         /** The copy constructor. The new \c LuaRef refers to the same value
+          *  as \c other, with a reference of its own.
+          */
+         LuaRef (const LuaRef& other);
+
+         /** The move constructor. The new \c LuaRef takes over the reference
+          *  of \c other, which is left empty.
+          */
+         LuaRef (LuaRef&& other) noexcept;
+
+         /// The destructor. Releases the reference.
+         ~LuaRef();
+
+         /// The assignment operator. See the copy constructor.
+         LuaRef& operator= (const LuaRef& rhs);
+
+         /// The move assignment operator. See the move constructor.
+         LuaRef& operator= (LuaRef&& rhs) noexcept;
+
+         /// Releases the reference, leaving this \c LuaRef empty.
+         void reset();
+
+         /// Is this \c LuaRef empty?
+         bool empty() const { return state_ == 0; }
+
+         /** Pushes the referenced value onto the stack of the Lua state.
+          *  @throw LuaError If this \c LuaRef is empty.
+          */
+         void push() const;
+
+         /** Returns the referenced value.
+          *  @throw LuaError If this \c LuaRef is empty.
+          */
+         LuaValue value() const;
+
+         /** Assuming that the referenced value is a function, calls it and
+          *  returns its return values.
+          *  @param params The parameters to be passed to the function.
+          *  @throw LuaError If this \c LuaRef is empty.
+          *  @throw TypeMismatchError If the referenced value is not a function.
+          *  @throw LuaRunTimeError If something bad happens while executing the
+          *         function.
+          */
+         LuaValueList operator() (const LuaValueList& params) const;
+
+         /** Assuming that the referenced value is a function, calls it and
+          *  stores its return values in \c results, requesting exactly
+          *  \c numResults of them (see \c LuaVariable::callInto()).
+          *  @throw LuaError If this \c LuaRef is empty.
+          *  @throw TypeMismatchError If the referenced value is not a function.
+          *  @throw LuaRunTimeError If something bad happens while executing the
+          *         function.
+          */
+         void callInto (const LuaValueList& params, LuaValueList& results,
+                        int numResults = LUA_MULTRET) const;
+
+         /** Assuming that the referenced value is a function, calls it,
+          *  discarding its return values (see
+          *  \c LuaVariable::callAndDiscard()).
+          *  @throw LuaError If this \c LuaRef is empty.
+          *  @throw TypeMismatchError If the referenced value is not a function.
+          *  @throw LuaRunTimeError If something bad happens while executing the
+          *         function.
+          */
+         void callAndDiscard (const LuaValueList& params = LuaValueList())
+            const;
+
+         /** Assuming that the referenced value is a function, calls it with
+          *  the given parameters (each converted to a \c LuaValue) and returns
+          *  its return values. See the other <tt>operator()</tt>.
+          */
+         template <class... Params>
+         LuaValueList operator() (const Params&... params) const
+         {
+            return (*this)(LuaValueList { LuaValue (params)... });
+         }
+
+         /** Assuming that the referenced value is a function, calls it with
+          *  typed arguments and results. See \c LuaVariable::call().
+          *  @throw LuaError If this \c LuaRef is empty.
+          *  @throw TypeMismatchError If the referenced value is not a
+          *         function, or if a result doesn't have the expected type.
+          *  @throw LuaRunTimeError If something bad happens while executing the
+          *         function.
+          */
+         template <class... R, class... Args>
+         typename Impl::CallResults<R...>::type call (const Args&... args) const
+         {
+            push();
+            return Impl::CallWithTraits<R...> (state_, args...);
+         }
+
+         /// Returns the Lua state where the referenced value lives.
+         lua_State* getState() const { return state_; }
+
+         /** Returns the reference itself, as returned by \c luaL_ref() (or
+          *  \c LUA_NOREF if this \c LuaRef is empty).
+          */
+         int getRef() const { return ref_; }
+
+      private:
+         /// Pins the value on the top of the stack of \c ls, popping it.
+         void pinTop (lua_State* ls);
+
+         /// The Lua state where the referenced value lives.
+         lua_State* state_;
+
+         /// The reference, in the registry of \c state_.
+         int ref_;
+   };
+
+
+
+   /** \c LuaTraits for \c LuaRef. Getting a \c LuaRef creates a new
+    *  reference; pushing an empty one pushes \c nil.
+    */
+   template<>
+   struct LuaTraits<LuaRef>
+   {
+      static void push (lua_State* ls, const LuaRef& value)
+      {
+         lua_rawgeti (ls, LUA_REGISTRYINDEX, value.getRef());
+      }
+
+      static LuaRef get (lua_State* ls, int index)
+      {
+         return LuaRef (ls, index);
+      }
+
+      static bool check (lua_State* ls, int index)
+      {
+         return lua_type (ls, index) != LUA_TNONE;
+      }
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_REF_HPP_
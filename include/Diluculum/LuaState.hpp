@@ -29,9 +29,20 @@
 #define _DILUCULUM_LUA_STATE_HPP_
 
 #include <lua.hpp>
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+#include <istream>
+#include <list>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
+#include <Diluculum/LuaAllocator.hpp>
+#include <Diluculum/LuaBundle.hpp>
 #include <Diluculum/LuaExceptions.hpp>
+#include <Diluculum/LuaRef.hpp>
+#include <Diluculum/LuaUtils.hpp>
 #include <Diluculum/LuaValue.hpp>
 #include <Diluculum/LuaVariable.hpp>
 #include <Diluculum/Types.hpp>
@@ -39,6 +50,70 @@
 
 namespace Diluculum
 {
+   namespace Impl
+   {
+      // The limits and cancellation requests of a Lua state (see the .cpp).
+      struct ExecutionControl;
+   }
+
+   class LuaProfiler;
+
+   /// Statistics about the cache of compiled chunks of a \c LuaState.
+   struct LuaChunkCacheStats
+   {
+      /// The number of chunks run without compiling them.
+      std::size_t hits;
+
+      /// The number of chunks that had to be compiled.
+      std::size_t misses;
+
+      /// The number of chunks removed from the cache to make room for others.
+      std::size_t evictions;
+
+      /// The number of chunks currently in the cache.
+      std::size_t size;
+
+      /// The maximum number of chunks the cache can hold.
+      std::size_t capacity;
+   };
+
+
+
+   /// Statistics about the garbage collector of a \c LuaState.
+   struct LuaGCStats
+   {
+      /// The memory in use by Lua, in kilobytes (rounded down).
+      std::size_t kilobytesInUse;
+
+      /// The memory in use by Lua, in bytes.
+      std::size_t bytesInUse;
+
+      /** The number of garbage collection cycles completed since the
+       *  \c LuaState was created (in generational mode, this includes the
+       *  minor collections). A \c LuaState that doesn't own its
+       *  \c lua_State only starts counting at its first call to
+       *  \c LuaState::gcStats() (unless the \c lua_State is also used by a
+       *  \c LuaState that owns it).
+       */
+      std::size_t cycles;
+
+      /// Is the garbage collector running (that is, not stopped)?
+      bool running;
+   };
+
+
+
+   /// The modes of operation of the Lua garbage collector.
+   enum LuaGCMode
+   {
+      /// The incremental mode, the default.
+      GC_INCREMENTAL,
+
+      /// The generational mode (not available in Lua 5.3).
+      GC_GENERATIONAL
+   };
+
+
 
    /** \c LuaState: The Next Generation. The pleasant way to do perform relevant
     *  operations on a Lua state.
@@ -49,6 +124,9 @@ namespace Diluculum
     */
    class LuaState
    {
+      // Needs 'executionControl()', to install its sampler
+      friend class LuaProfiler;
+
       public:
          /** Constructs a \c LuaState that owns a <tt>lua_State*</tt>. In other
           *  words, this will create the underlying Lua state on construction
@@ -59,9 +137,26 @@ namespace Diluculum
           */
          explicit LuaState (bool loadStdLib = true);
 
+         /** Constructs a \c LuaState that owns a <tt>lua_State*</tt> whose
+          *  memory is managed by a given allocator. This allows to choose the
+          *  allocation strategy, to measure the memory used by the state (see
+          *  \c memoryStats()) and to limit it (see \c setMemoryLimit()).
+          *  @param allocator The allocator. It is owned by the \c LuaState,
+          *         and is destroyed after the underlying Lua state.
+          *  @param loadStdLib If \c true (the default), makes all
+          *         the Lua standard libraries available.
+          *  @throw LuaMemoryError If the allocator cannot provide the memory
+          *         needed to create the state.
+          *  @throw LuaError If something else goes wrong.
+          */
+         explicit LuaState (std::unique_ptr<LuaAllocator> allocator,
+                            bool loadStdLib = true);
+
          /** Constructs a \c LuaState that doesn't own the underlying Lua state.
           *  In other words, this \c LuaState will use a user-supplied
           *  <tt>lua_State*</tt> and its destructor will not \c lua_close() it.
+          *  Nothing is stored in the registry of \c state until it is needed
+          *  (for instance, by \c setInstructionLimit() or \c gcStats()).
           *  @param state The <tt>lua_State*</tt> that will be used by this
           *         \c LuaState.
           *  @param loadStdLib If \c true, makes all the Lua standard libraries
@@ -107,6 +202,73 @@ namespace Diluculum
          LuaValueList doString (const std::string& what)
          { return doStringOrFile (true, what); }
 
+         /** Executes the Lua chunk (source code or bytecode) read from
+          *  \c stream, and returns all the values returned by this execution.
+          *  The stream is read in blocks, using a fixed-size buffer, so the
+          *  memory used for reading doesn't depend on the size of the chunk
+          *  (which is not the case with \c doString()). This is meant for
+          *  large chunks, like data description files.
+          *  @param stream The stream to read the chunk from. Should be opened
+          *         in binary mode if it may contain bytecode.
+          *  @param chunkName The chunk name, used in error messages (see
+          *         \c lua_load()).
+          *  @return All the values returned by the execution of the chunk.
+          *  @throw LuaError \c LuaError or any of its subclasses can be thrown.
+          *         In particular, \c LuaFileError is thrown if the stream
+          *         cannot be read.
+          */
+         LuaValueList doStream (std::istream& stream,
+                                const std::string& chunkName = "=stream");
+
+         /** Executes the file passed as parameter, like \c doFile(), but
+          *  reading it with bounded memory usage. If \c allowMmap is \c true
+          *  and the platform supports it, the file is memory-mapped (so it is
+          *  paged in and out by the operating system as needed); otherwise,
+          *  the file is read like in \c doStream(). This is meant for large
+          *  files, so the cache of compiled chunks is not used.
+          *  @param fileName The file to be executed.
+          *  @param allowMmap Use memory-mapping, if possible?
+          *  @return All the values returned by the file execution.
+          *  @throw LuaError \c LuaError or any of its subclasses can be thrown.
+          *         In particular, \c LuaFileError is thrown if the file cannot
+          *         be read.
+          */
+         LuaValueList doFileStreamed (const std::string& fileName,
+                                      bool allowMmap = true);
+
+         /** Sets the capacity of the cache of compiled chunks. When this
+          *  cache is enabled, \c doString() and \c doFile() keep the last
+          *  \c capacity chunks they compiled (in the Lua registry), and run
+          *  them again without compiling when asked to run the same string or
+          *  file. Strings are identified by their contents, and files by their
+          *  names, modification times and sizes. When the cache is full, the
+          *  least recently used chunk is evicted.
+          *  @param capacity The maximum number of chunks to keep. The default
+          *         is zero, which disables the cache. Reducing the capacity
+          *         evicts chunks as necessary.
+          *  @note This is meant for code that runs the same small snippets
+          *        many times. Chunks are run again from scratch, so they
+          *        behave just like if they were compiled again, unless they
+          *        change their own \c _ENV upvalue.
+          */
+         void setChunkCacheCapacity (std::size_t capacity);
+
+         /// Removes all chunks from the cache of compiled chunks.
+         void clearChunkCache();
+
+         /// Returns the statistics of the cache of compiled chunks.
+         LuaChunkCacheStats chunkCacheStats() const;
+
+         /** Makes the modules in the bundle of precompiled modules
+          *  \c fileName available to \c require(). Loading modules from a
+          *  bundle skips the Lua compiler, which makes starting up faster.
+          *  @throw LuaFileError If the bundle cannot be opened.
+          *  @throw LuaError If the \c package library is not loaded.
+          *  @see LuaBundle, AddLuaBundle()
+          */
+         void addBundle (const std::string& fileName)
+         { AddLuaBundle (state_, fileName); }
+
          /** Calls a given Lua function on this Lua state.
           *  @param func The function to be called.
           *  @param params the list of parameters to pass to the function.
@@ -120,6 +282,20 @@ namespace Diluculum
                             const LuaValueList& params,
                             const std::string& chunkName = "Diluculum chunk");
 
+         /** Calls the global function named \c function, with typed
+          *  arguments and results. This is equivalent to
+          *  <tt>(*this)[function].call<R...>(args...)</tt> (see
+          *  \c LuaVariable::call()), but doesn't even create a
+          *  \c LuaVariable.
+          */
+         template <class... R, class... Args>
+         typename Impl::CallResults<R...>::type call (const char* function,
+                                                      const Args&... args)
+         {
+            lua_getglobal (state_, function);
+            return Impl::CallWithTraits<R...> (state_, args...);
+         }
+
          /** Returns a \c LuaVariable representing the global variable named
           *  \c variable. Since the returned value also has a subscript
           *  operator, this is a handy way to access variables stored in tables.
@@ -149,6 +325,139 @@ namespace Diluculum
          /// Returns the encapsulated <tt>lua_State*</tt>.
          lua_State* getState() { return state_; }
 
+         /** Returns the statistics of the cache of loaded Lua functions of
+          *  this Lua state. This cache makes repeated calls to \c call() (and
+          *  other pushes of the same \c LuaFunction) cheaper.
+          *  @see PushLuaValue()
+          */
+         LuaFunctionCacheStats functionCacheStats()
+         { return GetLuaFunctionCacheStats (state_); }
+
+         /** Returns the memory usage statistics of this Lua state. If the
+          *  state wasn't created with a \c LuaAllocator, only
+          *  \c bytesInUse is available (as reported by Lua); the other
+          *  fields are zero.
+          */
+         LuaMemoryStats memoryStats() const;
+
+         /** Sets the maximum number of bytes this Lua state can use. When an
+          *  allocation would exceed it, Lua runs a full garbage collection
+          *  and, if still not enough, the running code fails with a memory
+          *  error (thrown as \c LuaMemoryError).
+          *  @param limit The limit, in bytes. Zero means "no limit".
+          *  @throw LuaError If the state wasn't created with a
+          *         \c LuaAllocator.
+          */
+         void setMemoryLimit (std::size_t limit);
+
+         /** Returns the allocator used by this Lua state, or a null pointer if
+          *  it wasn't created with a \c LuaAllocator.
+          */
+         LuaAllocator* allocator() { return allocator_.get(); }
+
+         /** Sets the maximum number of Lua virtual machine instructions each
+          *  call can execute. This applies to every call that runs Lua code
+          *  through Diluculum (\c doString(), \c doFile(), \c call(),
+          *  calling a \c LuaVariable and so on); calls made from C++ code
+          *  called by Lua count against the outer call. A call exceeding the
+          *  limit is aborted with a \c LuaInstructionLimitError.
+          *  <p>The limits are enforced by a Lua count hook, which runs every
+          *  \c setLimitCheckInterval() instructions. It replaces any hook set
+          *  by the user (a debugger, say) during the call only: the user's
+          *  hook is restored when the call ends. When there are no limits,
+          *  there is no hook and no overhead.
+          *  @param maxInstructions The limit. Zero means "no limit".
+          *  @note Coroutines created before the call are not limited.
+          */
+         void setInstructionLimit (std::size_t maxInstructions);
+
+         /** Sets the maximum time each call can run. A call exceeding the
+          *  limit is aborted with a \c LuaTimeLimitError. Time spent in C
+          *  functions is counted, but they are not interrupted: the limit is
+          *  only checked while running Lua code, every
+          *  \c setLimitCheckInterval() instructions. See
+          *  \c setInstructionLimit() for details.
+          *  @param maxTime The limit. Zero means "no limit".
+          *  @throw LuaError If \c maxTime is negative.
+          */
+         void setTimeLimit (std::chrono::microseconds maxTime);
+
+         /** Sets the number of instructions between checks of the limits
+          *  set by \c setInstructionLimit() and \c setTimeLimit() (the
+          *  default is 1000). Smaller intervals make the time limit more
+          *  precise, at the cost of more overhead.
+          *  @throw LuaError If \c instructions is not positive.
+          */
+         void setLimitCheckInterval (int instructions);
+
+         /** Requests the call currently running in this Lua state to be
+          *  cancelled. The call is aborted with a \c LuaCancelledError as
+          *  soon as it executes its next Lua instruction (so, a call blocked
+          *  in a C function is only aborted when it returns to Lua). If no
+          *  call is running, the request is ignored.
+          *  <p>Unlike all other member functions, this can be called from any
+          *  thread. This uses a Lua hook, which is only set when a
+          *  cancellation is requested (or while a call has limits, see
+          *  \c setInstructionLimit()), and which replaces the user's hook
+          *  until the call ends. (A request made when no call is running
+          *  replaces the user's hook until the next call, or until Lua runs
+          *  again.)
+          *  @note Code running in a coroutine only notices the request when
+          *        the coroutine yields, unless the call has limits.
+          *  @note A \c LuaState that doesn't own its \c lua_State (see
+          *        <tt>LuaState(lua_State*, bool)</tt>) leaves no bookkeeping
+          *        in it until needed, so there, cancellation works only after
+          *        a limit was set (for instance, with
+          *        \c setLimitCheckInterval(), from the thread using the
+          *        state), or if the \c lua_State is also used by a
+          *        \c LuaState that owns it. Otherwise, requests are ignored.
+          */
+         void requestCancel();
+
+         /** Returns statistics about the garbage collector. Cycles are
+          *  counted by an object with a finalizer kept in the registry; in a
+          *  borrowed \c lua_State, this is only installed by the first call
+          *  to this function (see \c LuaGCStats::cycles).
+          */
+         LuaGCStats gcStats();
+
+         /** Sets the pause of the garbage collector: how much memory use
+          *  must grow (in percent) after a collection, before a new cycle
+          *  starts. Returns the previous value.
+          */
+         int setGCPause (int percent);
+
+         /** Sets the step multiplier of the garbage collector: how much work
+          *  it does (relative to the memory allocated) in each incremental
+          *  step. Returns the previous value.
+          */
+         int setGCStepMultiplier (int percent);
+
+         /** Sets the mode of operation of the garbage collector. Returns
+          *  \c false if the mode is not supported by this version of Lua (in
+          *  which case nothing changes).
+          */
+         bool setGCMode (LuaGCMode mode);
+
+         /// Stops the garbage collector (until \c restartGC() is called).
+         void stopGC() { lua_gc (state_, LUA_GCSTOP, 0); }
+
+         /// Restarts the garbage collector, after a \c stopGC().
+         void restartGC() { lua_gc (state_, LUA_GCRESTART, 0); }
+
+         /// Performs a full garbage collection cycle.
+         void collectGarbage() { lua_gc (state_, LUA_GCCOLLECT, 0); }
+
+         /** Performs incremental garbage collection steps for up to
+          *  \c budget, stopping earlier if a collection cycle completes. This
+          *  is meant to be called when the program is idle (for example,
+          *  between requests), so that less garbage collection work is left
+          *  to be done while running scripts. At least one step is always
+          *  performed. Works even if the garbage collector is stopped.
+          *  @return \c true if a collection cycle was completed.
+          */
+         bool collectFor (std::chrono::microseconds budget);
+
       private:
          /** Since The implementation of \c doString and \c doFile() are quite
           *  similar, it looked like a good idea to use the same function to
@@ -166,6 +475,30 @@ namespace Diluculum
           */
          LuaValueList doStringOrFile (bool isString, const std::string& str);
 
+         /** Runs the compiled chunk on the top of the stack, returning its
+          *  results. Everything above \c stackSizeAtBeginning is removed from
+          *  the stack.
+          */
+         LuaValueList runChunk (int stackSizeAtBeginning);
+
+         /** Pushes the compiled chunk corresponding to \c str onto the stack,
+          *  compiling it or taking it from the cache of compiled chunks.
+          *  Parameters are like in \c doStringOrFile().
+          *  @throw LuaError If the chunk cannot be compiled.
+          */
+         void loadChunk (bool isString, const std::string& str);
+
+         /** Returns the execution control block of \c state_, creating it
+          *  if necessary. Anything needing the block must get it through
+          *  this, so that \c control_ gets set (see \c requestCancel()).
+          */
+         Impl::ExecutionControl* executionControl();
+
+         /** Removes the least recently used chunks from the cache of compiled
+          *  chunks, until there are no more than \c maxSize chunks in it.
+          */
+         void shrinkChunkCache (std::size_t maxSize);
+
          /// The underlying \c lua_State*.
          lua_State* state_;
 
@@ -173,6 +506,55 @@ namespace Diluculum
           *  to decide whether it has to \c lua_close() it or not.)
           */
          const bool ownsState_;
+
+         /// An entry in the cache of compiled chunks.
+         struct ChunkCacheEntry
+         {
+            /// The key of this entry in \c stringChunks_ or \c fileChunks_.
+            const std::string* key;
+
+            /// Is this a file (instead of a string)?
+            bool isFile;
+
+            /// For files, the modification time of the file when compiled.
+            std::time_t mtime;
+
+            /// For files, the size of the file when compiled.
+            long long size;
+
+            /// The reference (in the registry) to the compiled chunk.
+            int ref;
+         };
+
+         /// The type used to store the cached chunks, in LRU order.
+         typedef std::list<ChunkCacheEntry> ChunkCacheList;
+
+         /// The type used to look up the cached chunks.
+         typedef std::unordered_map<std::string, ChunkCacheList::iterator>
+            ChunkCacheIndex;
+
+         /// The cached chunks, the most recently used first.
+         ChunkCacheList chunkCache_;
+
+         /// The cached chunks compiled from strings, indexed by the strings.
+         ChunkCacheIndex stringChunks_;
+
+         /// The cached chunks compiled from files, indexed by the file names.
+         ChunkCacheIndex fileChunks_;
+
+         /// The statistics of the cache of compiled chunks.
+         LuaChunkCacheStats chunkCacheStats_;
+
+         /// The allocator used by \c state_, if any.
+         std::unique_ptr<LuaAllocator> allocator_;
+
+         /** The execution limits and cancellation requests of \c state_.
+          *  (This lives in \c state_, so that \c LuaVariable and others can
+          *  find it.) Created by the constructors that create \c state_, but
+          *  only on demand (by \c executionControl()) in borrowed states; so,
+          *  this may be null.
+          */
+         Impl::ExecutionControl* control_;
    };
 
 } // namespace Diluculum
@@ -0,0 +1,247 @@
+/******************************************************************************\
+* LuaStatePool.hpp                                                             *
+* A thread-safe pool of Lua states.                                            *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#ifndef _DILUCULUM_LUA_STATE_POOL_HPP_
+#define _DILUCULUM_LUA_STATE_POOL_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <Diluculum/LuaState.hpp>
+
+
+namespace Diluculum
+{
+   /// Statistics about the use of a \c LuaStatePool.
+   struct LuaStatePoolStats
+   {
+      /// The number of states in the pool.
+      std::size_t size;
+
+      /// The number of states currently leased.
+      std::size_t inUse;
+
+      /// The number of leases granted so far.
+      std::size_t acquisitions;
+
+      /// How many of the \c acquisitions had to wait for a free state.
+      std::size_t waits;
+
+      /// The total time spent waiting for free states, in seconds.
+      double totalWaitTime;
+
+      /// The longest time spent waiting for a free state, in seconds.
+      double maxWaitTime;
+
+      /** The fraction of the state-time (since the pool was created) during
+       *  which states were leased, between zero and one.
+       */
+      double utilization;
+   };
+
+
+
+   /** A pool of pre-initialized Lua states, which threads can borrow (through
+    *  a \c LuaStatePool::Lease) and give back. All states are created and
+    *  initialized upfront, so that running scripts in a thread pool doesn't
+    *  require creating states or running initialization scripts on demand.
+    *  <p>All member functions of this class can be called concurrently. The
+    *  leased states, however, must not be used by more than one thread at a
+    *  time (which is exactly what the pool guarantees, as long as the
+    *  \c LuaState is not used after the lease is gone).
+    */
+   class LuaStatePool
+   {
+      public:
+         /// The type of functions used to initialize the states.
+         typedef std::function<void (LuaState&)> InitFunction;
+
+         /// The type of functions used to create the states.
+         typedef std::function<std::unique_ptr<LuaState>()> CreateFunction;
+
+         /** A lease of a \c LuaState from a \c LuaStatePool. The state is
+          *  returned to the pool when the lease is destroyed (or when
+          *  \c release() is called). Leases can be moved, but not copied.
+          */
+         class Lease
+         {
+            public:
+               /// Constructs an empty lease, not associated with any state.
+               Lease();
+
+               /// Move-constructs a lease, leaving \c other empty.
+               Lease (Lease&& other);
+
+               /// Move-assigns a lease, leaving \c other empty.
+               Lease& operator= (Lease&& other);
+
+               /// Destroys the lease, returning the state to the pool.
+               ~Lease() { release(); }
+
+               /** Returns the state to the pool now, leaving the lease
+                *  empty. Does nothing if the lease is already empty.
+                */
+               void release();
+
+               /// Is this lease associated with a state?
+               explicit operator bool() const { return state_ != 0; }
+
+               /// Returns the leased state. The lease must not be empty.
+               LuaState& operator*() const { return *state_; }
+
+               /// Returns the leased state. The lease must not be empty.
+               LuaState* operator->() const { return state_; }
+
+            private:
+               friend class LuaStatePool;
+
+               /// Constructs a lease of \c state from \c pool.
+               Lease (LuaStatePool* pool, LuaState* state)
+                  : pool_(pool), state_(state)
+               { }
+
+               // Not copyable
+               Lease (const Lease&);
+               Lease& operator= (const Lease&);
+
+               /// The pool that owns the state.
+               LuaStatePool* pool_;
+
+               /// The leased state.
+               LuaState* state_;
+         };
+
+         /** Constructs the pool, creating \c size states (with the standard
+          *  library loaded) and calling \c init on each one of them.
+          *  @param size The number of states in the pool.
+          *  @param init The function used to initialize each state, for
+          *         example, running the scripts that define the functions
+          *         that will be called later.
+          *  @param resetGlobals If \c true, every time a state is returned to
+          *         the pool, its global variables are reset to what they
+          *         were after \c init was called: new globals are removed,
+          *         and globals assigned to are restored. This is a shallow
+          *         reset: changes made inside tables (like \c string or
+          *         tables created by \c init) are not undone.
+          *  @throw LuaError Or anything else thrown by \c init.
+          */
+         LuaStatePool (std::size_t size, const InitFunction& init,
+                       bool resetGlobals = true);
+
+         /** Constructs the pool, creating \c size states with \c create and
+          *  calling \c init on each one of them. This allows, for example,
+          *  to create states with a given \c LuaAllocator.
+          *  @see LuaStatePool(std::size_t, const InitFunction&, bool)
+          */
+         LuaStatePool (std::size_t size, const CreateFunction& create,
+                       const InitFunction& init, bool resetGlobals = true);
+
+         /** Destroys the pool and all its states. All leases must have been
+          *  released before this.
+          */
+         ~LuaStatePool();
+
+         /// Leases a state, waiting until one is available if necessary.
+         Lease acquire();
+
+         /** Leases a state, waiting at most \c timeout for one to be
+          *  available. Returns an empty lease on timeout.
+          */
+         Lease acquire (std::chrono::microseconds timeout);
+
+         /** Leases a state if one is available right now. Otherwise, returns
+          *  an empty lease.
+          */
+         Lease tryAcquire();
+
+         /// Returns the number of states in the pool.
+         std::size_t size() const { return states_.size(); }
+
+         /// Returns the usage statistics of the pool.
+         LuaStatePoolStats stats() const;
+
+      private:
+         // Not copyable
+         LuaStatePool (const LuaStatePool&);
+         LuaStatePool& operator= (const LuaStatePool&);
+
+         /// The clock used for the statistics.
+         typedef std::chrono::steady_clock Clock;
+
+         /// Creates and initializes the states.
+         void createStates (std::size_t size, const CreateFunction& create,
+                            const InitFunction& init);
+
+         /** Takes a free state, updating the statistics. \c mutex_ must be
+          *  locked, and there must be free states.
+          *  @param start When the caller started trying to get a state.
+          *  @param waited Did the caller have to wait for a free state?
+          */
+         Lease take (Clock::time_point start, bool waited);
+
+         /// Returns \c state to the pool. Called by \c Lease::release().
+         void giveBack (LuaState* state);
+
+         /** Accumulates the state-time spent in use up to \c now. \c mutex_
+          *  must be locked.
+          */
+         void updateBusyTime (Clock::time_point now) const;
+
+         /// Reset the globals of the states when they are given back?
+         const bool resetGlobals_;
+
+         /// All the states in the pool.
+         std::vector<std::unique_ptr<LuaState> > states_;
+
+         /// The states that are not leased.
+         std::vector<LuaState*> freeStates_;
+
+         /// Protects \c freeStates_ and the statistics.
+         mutable std::mutex mutex_;
+
+         /// Signaled when a state is given back.
+         std::condition_variable stateFreed_;
+
+         /// When the pool was created.
+         Clock::time_point creationTime_;
+
+         /// The statistics (except for the ones computed on demand).
+         LuaStatePoolStats stats_;
+
+         /// The state-time spent in use, up to \c lastChange_, in seconds.
+         mutable double busyTime_;
+
+         /// The time of the last update of \c busyTime_.
+         mutable Clock::time_point lastChange_;
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_STATE_POOL_HPP_
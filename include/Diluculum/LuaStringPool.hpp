@@ -0,0 +1,145 @@
+/******************************************************************************\
+* LuaStringPool.hpp                                                            *
+* A pool of interned strings.                                                  *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#ifndef _DILUCULUM_LUA_STRING_POOL_HPP_
+#define _DILUCULUM_LUA_STRING_POOL_HPP_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <Diluculum/LuaValue.hpp>
+
+
+namespace Diluculum
+{
+   /** A pool of interned strings. Interning a string returns a string-typed
+    *  \c LuaValue that shares its (immutable) string with every other
+    *  \c LuaValue interned from an equal string. Besides saving memory and
+    *  allocations, this makes comparisons between interned strings faster,
+    *  since <tt>LuaValue</tt>s sharing the same string are known to be equal
+    *  without looking at the characters.
+    *  <p>This is especially useful when converting lots of similar tables
+    *  from Lua, like an array of records, all with the same field names. This
+    *  is why interning is done by \c ToLuaValue() whenever a pool is in use
+    *  in the current thread (see \c LuaStringPool::Use). Only strings up to
+    *  a maximum length are interned; longer strings are less likely to be
+    *  repeated.
+    *  <p>The pool keeps a reference to every string interned in it, until
+    *  \c clear() is called or the pool is destroyed. A \c LuaStringPool is
+    *  not thread-safe (but the <tt>LuaValue</tt>s it returns can be used in
+    *  any thread, just like any other \c LuaValue).
+    */
+   class LuaStringPool
+   {
+      public:
+         /** Makes a pool the current one for the calling thread, during the
+          *  lifetime of the \c Use object. (The previously current pool, if
+          *  any, is restored then.)
+          */
+         class Use
+         {
+            public:
+               /// Makes \c pool the current one for the calling thread.
+               explicit Use (LuaStringPool& pool);
+
+               /// Restores the previously current pool.
+               ~Use();
+
+            private:
+               // Not copyable
+               Use (const Use&);
+               Use& operator= (const Use&);
+
+               /// The pool that was current when this object was created.
+               LuaStringPool* previous_;
+         };
+
+         /** Constructs an empty pool.
+          *  @param maxLength The maximum length (in bytes) of the strings that
+          *         are interned. Longer strings are not added to the pool.
+          */
+         explicit LuaStringPool (std::size_t maxLength = 40);
+
+         /** Returns a string-typed \c LuaValue with the \c len bytes starting
+          *  at \c s. If a string with this contents is already in the pool,
+          *  the returned \c LuaValue shares it. Otherwise, the string is added
+          *  to the pool (unless it is longer than the maximum length).
+          */
+         LuaValue intern (const char* s, std::size_t len);
+
+         /// Like the other \c intern(), but taking an \c std::string.
+         LuaValue intern (const std::string& s)
+         { return intern (s.data(), s.size()); }
+
+         /// Returns the number of strings in the pool.
+         std::size_t size() const { return count_; }
+
+         /// Returns the maximum length of the strings that are interned.
+         std::size_t maxLength() const { return maxLength_; }
+
+         /** Removes all strings from the pool. <tt>LuaValue</tt>s previously
+          *  returned are not affected.
+          */
+         void clear();
+
+         /** Returns the current pool for the calling thread, or a null
+          *  pointer if there is none.
+          */
+         static LuaStringPool* current();
+
+      private:
+         // Not copyable
+         LuaStringPool (const LuaStringPool&);
+         LuaStringPool& operator= (const LuaStringPool&);
+
+         /// Doubles the number of slots (or creates the first ones).
+         void grow();
+
+         /// An entry of the (open addressing) hash table.
+         struct Slot
+         {
+            Slot() : hash(0) { }
+
+            /// The hash of \c value. Zero marks an empty slot.
+            std::size_t hash;
+
+            /// The interned string.
+            LuaValue value;
+         };
+
+         /// The hash table. Its size is zero or a power of two.
+         std::vector<Slot> slots_;
+
+         /// The number of strings in the pool.
+         std::size_t count_;
+
+         /// The maximum length of the strings that are interned.
+         std::size_t maxLength_;
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_STRING_POOL_HPP_
@@ -0,0 +1,262 @@
+/******************************************************************************\
+* LuaTable.hpp                                                                 *
+* A C++ approximation of a Lua table, with array and hash parts.               *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#ifndef _DILUCULUM_LUA_TABLE_HPP_
+#define _DILUCULUM_LUA_TABLE_HPP_
+
+#include <cstddef>
+#include <vector>
+#include <Diluculum/LuaValue.hpp>
+#include <Diluculum/Types.hpp>
+
+
+namespace Diluculum
+{
+   /** The table stored by a table-typed \c LuaValue. Like tables in Lua, a
+    *  \c LuaTable has two parts:
+    *  - An array part, storing the values associated with the consecutive
+    *    integer keys 1, 2, ..., n in a contiguous block of memory (the keys
+    *    themselves are not stored).
+    *  - A hash part, which is an open addressing hash table storing all the
+    *    other keys and their values.
+    *  <p>The split between the two parts is completely transparent for users:
+    *  any key can be used with any method, and keys are moved from the hash
+    *  part to the array part whenever they become part of the 1..n sequence.
+    *  <p>Iteration order: the array part is traversed first, in increasing
+    *  key order (1, 2, ..., n); then the hash part is traversed, in an order
+    *  that depends on the keys and on the history of insertions, and which
+    *  should be regarded as arbitrary. (If a sorted traversal is needed, use
+    *  \c toLuaValueMap().) Any insertion or removal may invalidate iterators
+    *  and references to the values stored in the table.
+    *  <p>As in a \c LuaValueMap (but unlike in Lua), a key can be associated
+    *  with a \c nil value, and still be counted as an entry of the table.
+    */
+   class LuaTable
+   {
+      public:
+         /** An iterator for traversing the entries of a \c LuaTable. Instead
+          *  of the usual \c first and \c second members, it provides the
+          *  \c key() and \c value() methods. (Since the keys in the array part
+          *  are not stored anywhere, there is no pair to point to.)
+          */
+         class const_iterator
+         {
+            friend class LuaTable;
+
+            public:
+               /// Returns the key of the current entry.
+               const LuaValue& key() const;
+
+               /// Returns the value of the current entry.
+               const LuaValue& value() const;
+
+               /// Moves to the next entry.
+               const_iterator& operator++();
+
+               /// Checks whether two iterators point to the same entry.
+               bool operator== (const const_iterator& rhs) const
+               { return pos_ == rhs.pos_; }
+
+               /// Checks whether two iterators point to different entries.
+               bool operator!= (const const_iterator& rhs) const
+               { return pos_ != rhs.pos_; }
+
+            private:
+               /** Constructs an iterator pointing to the position \c pos of
+                *  \c table (see \c pos_ for what this means).
+                */
+               const_iterator (const LuaTable* table, std::size_t pos);
+
+               /// Skips empty slots of the hash part, if in the hash part.
+               void skipEmptySlots();
+
+               /// The table being traversed.
+               const LuaTable* table_;
+
+               /** The current position. Positions less than the array part
+                *  size are indices in the array part; the others are indices
+                *  in the hash part (after subtracting the array part size).
+                */
+               std::size_t pos_;
+
+               /** The key of the current entry, if it is in the array part.
+                *  This is created only when \c key() is called.
+                */
+               mutable LuaValue arrayKey_;
+         };
+
+         /// Constructs an empty \c LuaTable.
+         LuaTable();
+
+         /** Constructs a \c LuaTable with the same contents as a
+          *  \c LuaValueMap.
+          */
+         explicit LuaTable (const LuaValueMap& map);
+
+         /** Returns a \c LuaValueMap with the same contents as this
+          *  \c LuaTable.
+          */
+         LuaValueMap toLuaValueMap() const;
+
+         /// Returns the number of entries in the table.
+         std::size_t size() const { return array_.size() + hashCount_; }
+
+         /// Checks whether the table is empty.
+         bool empty() const { return size() == 0; }
+
+         /** Returns the number of entries in the array part (that is, the
+          *  largest \c n such that all keys from 1 to \c n are present).
+          */
+         std::size_t arraySize() const { return array_.size(); }
+
+         /// Returns the number of entries in the hash part.
+         std::size_t hashSize() const { return hashCount_; }
+
+         /** Preallocates memory for a given number of entries in each part.
+          *  This is just an optimization: no entries are created.
+          */
+         void reserve (std::size_t arraySize, std::size_t hashSize);
+
+         /// Removes all the entries of the table.
+         void clear();
+
+         /** Returns a reference to the value associated with \c key. If
+          *  there is no such value, a new entry (with a \c nil value) is
+          *  created, and a reference to its value is returned.
+          *  @warning Creating a new entry invalidates all references to the
+          *           values in the table, including the ones returned by
+          *           earlier calls to this operator. See
+          *           \c LuaValue::operator[]().
+          */
+         LuaValue& operator[] (const LuaValue& key);
+
+         /** Like the version taking a \c const reference, but moves \c key
+          *  into the table if a new entry is created.
+          */
+         LuaValue& operator[] (LuaValue&& key);
+
+         /** Returns a pointer to the value associated with \c key, or a null
+          *  pointer if there is no such value.
+          */
+         const LuaValue* find (const LuaValue& key) const;
+
+         /** Removes the entry whose key is \c key, if any.
+          *  @return The number of removed entries (either 0 or 1).
+          */
+         std::size_t erase (const LuaValue& key);
+
+         /// Returns an iterator pointing to the first entry.
+         const_iterator begin() const;
+
+         /// Returns an iterator pointing past the last entry.
+         const_iterator end() const;
+
+         /** Returns an iterator pointing to the first entry of the hash part
+          *  (that is, skipping the entries of the array part).
+          */
+         const_iterator hashPartBegin() const;
+
+         /** Returns the array part of this table. The element at index \c i
+          *  is the value whose key is <tt>i+1</tt>.
+          */
+         const std::vector<LuaValue>& arrayPart() const { return array_; }
+
+         /** Compares this table with another one. See \c LuaValue::compare()
+          *  for the rules, which are independent of the way the entries are
+          *  split among the array and the hash parts.
+          *  @return A negative number if <tt>*this</tt> is "less than" \c rhs,
+          *          a positive number if it is "greater than" \c rhs and zero
+          *          if both are equal.
+          */
+         int compare (const LuaTable& rhs) const;
+
+         /** Checks whether two tables have the same entries. This is faster
+          *  than <tt>compare(rhs) == 0</tt>.
+          */
+         bool operator== (const LuaTable& rhs) const;
+
+         /// Checks whether two tables have different entries.
+         bool operator!= (const LuaTable& rhs) const
+         { return !(*this == rhs); }
+
+         /** Returns a hash for this table. Equal tables have equal hashes, no
+          *  matter how their entries are stored.
+          */
+         std::size_t hash() const;
+
+      private:
+         /// An entry in the hash part.
+         struct HashSlot
+         {
+            HashSlot() : hash(0) { }
+
+            /// The (nonzero) hash of \c key. Zero marks an empty slot.
+            std::size_t hash;
+
+            /// The key.
+            LuaValue key;
+
+            /// The value.
+            LuaValue value;
+         };
+
+         /** Returns the index of the slot storing \c key (whose hash is
+          *  \c hash), or the number of slots if there is no such slot.
+          */
+         std::size_t findSlot (const LuaValue& key, std::size_t hash) const;
+
+         /** Returns a reference to the value associated with \c key in the
+          *  hash part, creating a new entry if necessary.
+          */
+         template <class KeyType>
+         LuaValue& hashPartValue (KeyType&& key);
+
+         /// Removes the entry stored in the hash part at the slot \c slot.
+         void eraseSlot (std::size_t slot);
+
+         /// Doubles the capacity of the hash part (or creates it).
+         void growHashPart();
+
+         /** Moves from the hash part to the end of the array part the keys
+          *  that can be appended to the array part.
+          */
+         void migrateToArrayPart();
+
+         /// The array part.
+         std::vector<LuaValue> array_;
+
+         /** The hash part. The number of slots is either zero or a power of
+          *  two.
+          */
+         std::vector<HashSlot> slots_;
+
+         /// The number of entries in the hash part.
+         std::size_t hashCount_;
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_TABLE_HPP_
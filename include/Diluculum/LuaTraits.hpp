@@ -0,0 +1,666 @@
+/******************************************************************************\
+* LuaTraits.hpp                                                                *
+* Conversions between C++ types and values on the Lua stack.                   *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2005-2013 by Leandro Motta Barros.                             *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#ifndef _DILUCULUM_LUA_TRAITS_HPP_
+#define _DILUCULUM_LUA_TRAITS_HPP_
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <optional>
+#endif
+#include <lua.hpp>
+#include <boost/optional.hpp>
+#include <Diluculum/LuaExceptions.hpp>
+#include <Diluculum/LuaUtils.hpp>
+#include <Diluculum/LuaValue.hpp>
+
+
+namespace Diluculum
+{
+   namespace Impl
+   {
+      /// A sequence of indices, used to expand the elements of a tuple.
+      template <int... I>
+      struct Indices { };
+
+      /// Makes the sequence <tt>Indices<0, 1, ..., N-1></tt>.
+      template <int N, int... I>
+      struct MakeIndices: MakeIndices<N-1, N-1, I...> { };
+
+      template <int... I>
+      struct MakeIndices<0, I...>
+      {
+         typedef Indices<I...> type;
+      };
+
+      /** Reads the number at \c index into \c value, if it is an integral
+       *  value in the range of the integer type \c T. Returns \c false (and
+       *  leaves \c value alone) if it is not a number, has a fractional part
+       *  (or is a NaN) or is out of range.
+       */
+      template <class T>
+      bool ToIntegral (lua_State* ls, int index, T& value)
+      {
+         typedef std::numeric_limits<T> Limits;
+
+         if (lua_type (ls, index) != LUA_TNUMBER)
+            return false;
+
+#if LUA_VERSION_NUM >= 503
+         if (lua_isinteger (ls, index))
+         {
+            const lua_Integer i = lua_tointeger (ls, index);
+            if (Limits::is_signed
+                ? (i < static_cast<lua_Integer>(Limits::min())
+                   || i > static_cast<lua_Integer>(Limits::max()))
+                : (i < 0
+                   || static_cast<unsigned long long>(i) > Limits::max()))
+            {
+               return false;
+            }
+            value = static_cast<T>(i);
+            return true;
+         }
+#endif
+
+         // T's range is [-2^digits, 2^digits) or [0, 2^digits), and powers
+         // of two are exact in floating point
+         const lua_Number n = lua_tonumber (ls, index);
+         const lua_Number bound = std::ldexp (lua_Number (1), Limits::digits);
+         if (n != std::floor (n) || n >= bound
+             || n < (Limits::is_signed ? -bound : 0))
+         {
+            return false;
+         }
+         value = static_cast<T>(n);
+         return true;
+      }
+
+   } // namespace Impl
+
+
+
+   /** Converts values of type \c T directly to and from values on the Lua
+    *  stack, without going through a \c LuaValue. Each specialization has
+    *  these static members (except that types that can only be passed to
+    *  Lua have just \c push()):
+    *  - <tt>void push (lua_State* ls, const T& value)</tt>, which pushes
+    *    \c value onto the stack of \c ls;
+    *  - <tt>T get (lua_State* ls, int index)</tt>, which returns the value
+    *    at \c index, and throws a \c TypeMismatchError if that value (or,
+    *    for containers, any of its elements) doesn't have the expected type
+    *    (for integer types, this means an integral number in their range);
+    *  - <tt>bool check (lua_State* ls, int index)</tt>, which tells whether
+    *    \c get() would succeed.
+    *
+    *  None of them leaves anything else on the stack, even when throwing.
+    *  <p>Specializations are provided for \c bool, the arithmetic types,
+    *  \c std::string, <tt>const char*</tt> (push only), \c LuaValue,
+    *  \c LuaRef, \c std::vector (Lua arrays), \c std::map and
+    *  \c std::unordered_map (Lua tables), \c boost::optional and, in C++17,
+    *  \c std::optional (\c nil when empty), and \c std::tuple (Lua arrays,
+    *  with one element of each type). Users can add specializations for
+    *  their own types.
+    *  @note The second template parameter exists only to allow
+    *        specializations for families of types (with
+    *        \c std::enable_if), and must be left alone.
+    */
+   template <class T, class Enable = void>
+   struct LuaTraits;
+
+   /// \c LuaTraits for \c bool.
+   template<>
+   struct LuaTraits<bool>
+   {
+      static void push (lua_State* ls, bool value)
+      {
+         lua_pushboolean (ls, value);
+      }
+
+      static bool get (lua_State* ls, int index)
+      {
+         if (lua_type (ls, index) != LUA_TBOOLEAN)
+            throw TypeMismatchError ("boolean", luaL_typename (ls, index));
+         return lua_toboolean (ls, index) != 0;
+      }
+
+      static bool check (lua_State* ls, int index)
+      {
+         return lua_type (ls, index) == LUA_TBOOLEAN;
+      }
+   };
+
+   /// \c LuaTraits for the integer types (other than \c bool).
+   template <class T>
+   struct LuaTraits<T, typename std::enable_if<
+                          std::is_integral<T>::value
+                          && !std::is_same<T, bool>::value>::type>
+   {
+      static void push (lua_State* ls, T value)
+      {
+#if LUA_VERSION_NUM >= 503
+         lua_pushinteger (ls, static_cast<lua_Integer>(value));
+#else
+         lua_pushnumber (ls, static_cast<lua_Number>(value));
+#endif
+      }
+
+      /** Throws a \c TypeMismatchError if the value is not a number, or if
+       *  it is not an integer in the range of \c T (so, <tt>1.5</tt> and
+       *  <tt>1e300</tt> are not silently converted).
+       */
+      static T get (lua_State* ls, int index)
+      {
+         T value;
+         if (!Impl::ToIntegral (ls, index, value))
+         {
+            if (lua_type (ls, index) != LUA_TNUMBER)
+               throw TypeMismatchError ("number", luaL_typename (ls, index));
+            throw TypeMismatchError ("integer", "number");
+         }
+         return value;
+      }
+
+      static bool check (lua_State* ls, int index)
+      {
+         T value;
+         return Impl::ToIntegral (ls, index, value);
+      }
+   };
+
+   /// \c LuaTraits for the floating point types.
+   template <class T>
+   struct LuaTraits<T, typename std::enable_if<
+                          std::is_floating_point<T>::value>::type>
+   {
+      static void push (lua_State* ls, T value)
+      {
+         lua_pushnumber (ls, static_cast<lua_Number>(value));
+      }
+
+      static T get (lua_State* ls, int index)
+      {
+         if (lua_type (ls, index) != LUA_TNUMBER)
+            throw TypeMismatchError ("number", luaL_typename (ls, index));
+         return static_cast<T>(lua_tonumber (ls, index));
+      }
+
+      static bool check (lua_State* ls, int index)
+      {
+         return lua_type (ls, index) == LUA_TNUMBER;
+      }
+   };
+
+   /// \c LuaTraits for \c std::string.
+   template<>
+   struct LuaTraits<std::string>
+   {
+      static void push (lua_State* ls, const std::string& value)
+      {
+         lua_pushlstring (ls, value.c_str(), value.length());
+      }
+
+      static std::string get (lua_State* ls, int index)
+      {
+         if (lua_type (ls, index) != LUA_TSTRING)
+            throw TypeMismatchError ("string", luaL_typename (ls, index));
+         std::size_t len;
+         const char* s = lua_tolstring (ls, index, &len);
+         return std::string (s, len);
+      }
+
+      static bool check (lua_State* ls, int index)
+      {
+         return lua_type (ls, index) == LUA_TSTRING;
+      }
+   };
+
+   /** \c LuaTraits for C strings. These can only be pushed (reading a
+    *  <tt>const char*</tt> from Lua would return a pointer that becomes
+    *  invalid as soon as the value is popped); use \c std::string instead.
+    */
+   template<>
+   struct LuaTraits<const char*>
+   {
+      static void push (lua_State* ls, const char* value)
+      {
+         lua_pushstring (ls, value);
+      }
+   };
+
+   /// \c LuaTraits for non-const C strings (and string literals).
+   template<>
+   struct LuaTraits<char*>: LuaTraits<const char*>
+   { };
+
+   /** \c LuaTraits for \c LuaValue, using \c PushLuaValue() and
+    *  \c ToLuaValue().
+    */
+   template<>
+   struct LuaTraits<LuaValue>
+   {
+      static void push (lua_State* ls, const LuaValue& value)
+      {
+         PushLuaValue (ls, value);
+      }
+
+      static LuaValue get (lua_State* ls, int index)
+      {
+         return ToLuaValue (ls, index);
+      }
+
+      static bool check (lua_State* ls, int index)
+      {
+         switch (lua_type (ls, index))
+         {
+            case LUA_TNIL: case LUA_TNUMBER: case LUA_TBOOLEAN:
+            case LUA_TSTRING: case LUA_TUSERDATA: case LUA_TTABLE:
+            case LUA_TFUNCTION:
+               return true;
+
+            default:
+               return false;
+         }
+      }
+   };
+
+   /** \c LuaTraits for \c std::vector: a Lua array (the elements from 1 to
+    *  the length of the table; the others are ignored).
+    */
+   template <class T, class A>
+   struct LuaTraits<std::vector<T, A> >
+   {
+      static void push (lua_State* ls, const std::vector<T, A>& value)
+      {
+         lua_createtable (ls, static_cast<int>(value.size()), 0);
+         for (std::size_t i = 0; i < value.size(); ++i)
+         {
+            LuaTraits<T>::push (ls, value[i]);
+            lua_rawseti (ls, -2, static_cast<int>(i + 1));
+         }
+      }
+
+      static std::vector<T, A> get (lua_State* ls, int index)
+      {
+         if (lua_type (ls, index) != LUA_TTABLE)
+            throw TypeMismatchError ("table", luaL_typename (ls, index));
+
+         index = lua_absindex (ls, index);
+         const std::size_t size = lua_rawlen (ls, index);
+
+         std::vector<T, A> ret;
+         ret.reserve (size);
+         for (std::size_t i = 1; i <= size; ++i)
+         {
+            lua_rawgeti (ls, index, static_cast<int>(i));
+            Impl::PopOnExit popElement (ls, 1);
+            ret.push_back (LuaTraits<T>::get (ls, -1));
+         }
+
+         return ret;
+      }
+
+      static bool check (lua_State* ls, int index)
+      {
+         if (lua_type (ls, index) != LUA_TTABLE)
+            return false;
+
+         index = lua_absindex (ls, index);
+         const std::size_t size = lua_rawlen (ls, index);
+
+         for (std::size_t i = 1; i <= size; ++i)
+         {
+            lua_rawgeti (ls, index, static_cast<int>(i));
+            const bool ok = LuaTraits<T>::check (ls, -1);
+            lua_pop (ls, 1);
+            if (!ok)
+               return false;
+         }
+
+         return true;
+      }
+   };
+
+
+
+   namespace Impl
+   {
+      /// The implementation of the \c LuaTraits for map types.
+      template <class Map>
+      struct LuaMapTraits
+      {
+         typedef typename Map::key_type Key;
+         typedef typename Map::mapped_type Value;
+
+         static void push (lua_State* ls, const Map& value)
+         {
+            lua_createtable (ls, 0, static_cast<int>(value.size()));
+            typedef typename Map::const_iterator iter_t;
+            for (iter_t p = value.begin(); p != value.end(); ++p)
+            {
+               LuaTraits<Key>::push (ls, p->first);
+               LuaTraits<Value>::push (ls, p->second);
+               lua_rawset (ls, -3);
+            }
+         }
+
+         static Map get (lua_State* ls, int index)
+         {
+            if (lua_type (ls, index) != LUA_TTABLE)
+               throw TypeMismatchError ("table", luaL_typename (ls, index));
+
+            index = lua_absindex (ls, index);
+
+            Map ret;
+            lua_pushnil (ls);
+            while (lua_next (ls, index) != 0)
+            {
+               try
+               {
+                  ret.insert (std::make_pair (LuaTraits<Key>::get (ls, -2),
+                                              LuaTraits<Value>::get (ls, -1)));
+               }
+               catch (...)
+               {
+                  lua_pop (ls, 2);
+                  throw;
+               }
+               lua_pop (ls, 1);
+            }
+
+            return ret;
+         }
+
+         static bool check (lua_State* ls, int index)
+         {
+            if (lua_type (ls, index) != LUA_TTABLE)
+               return false;
+
+            index = lua_absindex (ls, index);
+
+            lua_pushnil (ls);
+            while (lua_next (ls, index) != 0)
+            {
+               if (!LuaTraits<Key>::check (ls, -2)
+                   || !LuaTraits<Value>::check (ls, -1))
+               {
+                  lua_pop (ls, 2);
+                  return false;
+               }
+               lua_pop (ls, 1);
+            }
+
+            return true;
+         }
+      };
+
+      /// The implementation of the \c LuaTraits for optional types.
+      template <class Optional>
+      struct LuaOptionalTraits
+      {
+         typedef typename Optional::value_type Value;
+
+         static void push (lua_State* ls, const Optional& value)
+         {
+            if (value)
+               LuaTraits<Value>::push (ls, *value);
+            else
+               lua_pushnil (ls);
+         }
+
+         static Optional get (lua_State* ls, int index)
+         {
+            if (lua_isnoneornil (ls, index))
+               return Optional();
+            else
+               return Optional (LuaTraits<Value>::get (ls, index));
+         }
+
+         static bool check (lua_State* ls, int index)
+         {
+            return lua_isnoneornil (ls, index)
+               || LuaTraits<Value>::check (ls, index);
+         }
+      };
+
+      /// Pushes the \c I-th element of \c t and stores it in the table below.
+      template <class Tuple, int I>
+      void PushTupleElement (lua_State* ls, const Tuple& t)
+      {
+         typedef typename std::tuple_element<I, Tuple>::type Element;
+         LuaTraits<Element>::push (ls, std::get<I>(t));
+         lua_rawseti (ls, -2, I + 1);
+      }
+
+      /// Returns the \c I-th element of the tuple stored at \c table.
+      template <class Element, int I>
+      Element GetTupleElement (lua_State* ls, int table)
+      {
+         lua_rawgeti (ls, table, I + 1);
+         PopOnExit popElement (ls, 1);
+         return LuaTraits<Element>::get (ls, -1);
+      }
+
+      /// Checks the \c I-th element of the tuple stored at \c table.
+      template <class Element, int I>
+      bool CheckTupleElement (lua_State* ls, int table)
+      {
+         lua_rawgeti (ls, table, I + 1);
+         const bool ok = LuaTraits<Element>::check (ls, -1);
+         lua_pop (ls, 1);
+         return ok;
+      }
+
+   } // namespace Impl
+
+   /// \c LuaTraits for \c std::map: a Lua table.
+   template <class K, class V, class C, class A>
+   struct LuaTraits<std::map<K, V, C, A> >
+      : Impl::LuaMapTraits<std::map<K, V, C, A> >
+   { };
+
+   /// \c LuaTraits for \c std::unordered_map: a Lua table.
+   template <class K, class V, class H, class E, class A>
+   struct LuaTraits<std::unordered_map<K, V, H, E, A> >
+      : Impl::LuaMapTraits<std::unordered_map<K, V, H, E, A> >
+   { };
+
+   /// \c LuaTraits for \c boost::optional: the value, or \c nil if empty.
+   template <class T>
+   struct LuaTraits<boost::optional<T> >
+      : Impl::LuaOptionalTraits<boost::optional<T> >
+   { };
+
+#if __cplusplus >= 201703L
+   /// \c LuaTraits for \c std::optional: the value, or \c nil if empty.
+   template <class T>
+   struct LuaTraits<std::optional<T> >
+      : Impl::LuaOptionalTraits<std::optional<T> >
+   { };
+#endif
+
+   /** \c LuaTraits for \c std::tuple: a Lua array with one element of each
+    *  type.
+    */
+   template <class... T>
+   struct LuaTraits<std::tuple<T...> >
+   {
+      typedef std::tuple<T...> Tuple;
+      typedef typename Impl::MakeIndices<sizeof... (T)>::type Indices;
+
+      static void push (lua_State* ls, const Tuple& value)
+      {
+         lua_createtable (ls, sizeof... (T), 0);
+         push (ls, value, Indices());
+      }
+
+      static Tuple get (lua_State* ls, int index)
+      {
+         if (lua_type (ls, index) != LUA_TTABLE)
+            throw TypeMismatchError ("table", luaL_typename (ls, index));
+         return get (ls, lua_absindex (ls, index), Indices());
+      }
+
+      static bool check (lua_State* ls, int index)
+      {
+         return lua_type (ls, index) == LUA_TTABLE
+            && check (ls, lua_absindex (ls, index), Indices());
+      }
+
+   private:
+      template <int... I>
+      static void push (lua_State* ls, const Tuple& value, Impl::Indices<I...>)
+      {
+         const int expand[] = {
+            0, (Impl::PushTupleElement<Tuple, I> (ls, value), 0)... };
+         (void)expand;
+      }
+
+      template <int... I>
+      static Tuple get (lua_State* ls, int table, Impl::Indices<I...>)
+      {
+         return Tuple (Impl::GetTupleElement<T, I> (ls, table)...);
+      }
+
+      template <int... I>
+      static bool check (lua_State* ls, int table, Impl::Indices<I...>)
+      {
+         const bool ok[] = {
+            true, Impl::CheckTupleElement<T, I> (ls, table)... };
+
+         for (std::size_t i = 0; i < sizeof (ok) / sizeof (bool); ++i)
+         {
+            if (!ok[i])
+               return false;
+         }
+
+         return true;
+      }
+   };
+
+
+
+   namespace Impl
+   {
+      /// Pushes nothing; ends the recursion of the other \c PushArgs().
+      inline void PushArgs (lua_State*)
+      { }
+
+      /// Pushes \c first, then \c rest, using the appropriate \c LuaTraits.
+      template <class T, class... Rest>
+      void PushArgs (lua_State* ls, const T& first, const Rest&... rest)
+      {
+         LuaTraits<typename std::decay<T>::type>::push (ls, first);
+         PushArgs (ls, rest...);
+      }
+
+      /** Reads the results of a call from the Lua stack, using the
+       *  appropriate \c LuaTraits. \c type is what a call expecting results
+       *  of types \c R returns: \c void if \c R is empty, the single result
+       *  if there is only one, and a \c std::tuple of all of them otherwise.
+       *  \c get() reads the results starting at index \c first.
+       */
+      template <class... R>
+      struct CallResults
+      {
+         typedef std::tuple<R...> type;
+
+         static type get (lua_State* ls, int first)
+         {
+            return get (ls, first,
+                        typename MakeIndices<sizeof... (R)>::type());
+         }
+
+         template <int... I>
+         static type get (lua_State* ls, int first, Indices<I...>)
+         {
+            return type (LuaTraits<R>::get (ls, first + I)...);
+         }
+      };
+
+      template <class R>
+      struct CallResults<R>
+      {
+         typedef R type;
+
+         static type get (lua_State* ls, int first)
+         {
+            return LuaTraits<R>::get (ls, first);
+         }
+      };
+
+      template <>
+      struct CallResults<>
+      {
+         typedef void type;
+
+         static void get (lua_State*, int)
+         { }
+      };
+
+      /** Calls the function on the top of the stack of \c ls, passing
+       *  \c args and expecting results of the types \c R, all converted
+       *  with \c LuaTraits (so that no \c LuaValue is created). See
+       *  \c CallResults for what is returned. The function is popped.
+       *  @throw TypeMismatchError If the value on the top of the stack is not
+       *         a function, or if a result doesn't have the expected type.
+       *  @throw LuaError Or any of its subclasses, as in \c CallProtected().
+       */
+      template <class... R, class... Args>
+      typename CallResults<R...>::type CallWithTraits (lua_State* ls,
+                                                        const Args&... args)
+      {
+         const int numArgs = sizeof... (Args);
+         const int numResults = sizeof... (R);
+
+         if (lua_type (ls, -1) != LUA_TFUNCTION)
+         {
+            const std::string found = luaL_typename (ls, -1);
+            lua_pop (ls, 1);
+            throw TypeMismatchError ("function", found);
+         }
+
+         PushArgs (ls, args...);
+         CallProtected (ls, numArgs, numResults);
+
+         PopOnExit popResults (ls, numResults);
+         return CallResults<R...>::get (ls, lua_gettop (ls) - numResults + 1);
+      }
+
+   } // namespace Impl
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_TRAITS_HPP_
@@ -59,12 +59,24 @@ namespace Diluculum
           */
          LuaUserData (const LuaUserData& other);
 
+         /** The move constructor. The newly constructed \c LuaUserData takes
+          *  over the block of memory owned by \c other, so nothing is allocated
+          *  or copied. \c other is left empty (with size zero).
+          */
+         LuaUserData (LuaUserData&& other) noexcept;
+
          /** Assigns a \c LuaUserData to this one. The memory currently
           *  allocated for \c this will be freed, new memory will be allocated,
           *  and the data stored in \c rhs will be copied to \c this.
           */
          const LuaUserData& operator= (const LuaUserData& rhs);
 
+         /** Move-assigns a \c LuaUserData to this one. The memory currently
+          *  allocated for \c this is freed and the memory owned by \c rhs is
+          *  taken over. \c rhs is left empty (with size zero).
+          */
+         const LuaUserData& operator= (LuaUserData&& rhs) noexcept;
+
          /** Returns the size, in bytes, of the data stored in this
           *  \c LuaUserData.
           */
@@ -27,15 +27,59 @@
 #ifndef _DILUCULUM_LUA_UTILS_HPP_
 #define _DILUCULUM_LUA_UTILS_HPP_
 
+#include <cstddef>
+#include <lua.hpp>
 #include <Diluculum/LuaValue.hpp>
 
 namespace Diluculum
 {
+   namespace Impl
+   {
+      /// Pops \c n values from the Lua stack when destroyed.
+      struct PopOnExit
+      {
+         PopOnExit (lua_State* ls, int n) : ls(ls), n(n) { }
+         ~PopOnExit() { lua_pop (ls, n); }
+         lua_State* ls;
+         int n;
+      };
+
+      /** Does a <tt>lua_pcall (ls, nargs, nresults, 0)</tt>, enforcing the
+       *  execution limits of \c ls (if this is not a nested call, in which
+       *  case the limits of the outer call apply) and throwing on errors.
+       *  This is used by the templates that call Lua functions; it is not
+       *  meant to be called directly.
+       *  @throw LuaInstructionLimitError If the call executed too many
+       *         instructions.
+       *  @throw LuaTimeLimitError If the call ran for too long.
+       *  @throw LuaCancelledError If the call was cancelled.
+       *  @throw LuaError Or any of its subclasses, if the call fails.
+       */
+      void CallProtected (lua_State* ls, int nargs, int nresults);
+
+   } // namespace Impl
+
+
+
+   /** Statistics about the cache of loaded Lua functions kept by each Lua
+    *  state. See \c PushLuaValue() for details on this cache.
+    */
+   struct LuaFunctionCacheStats
+   {
+      /// The number of pushes that reused an already loaded function.
+      std::size_t hits;
+
+      /// The number of pushes that had to load the function bytecode.
+      std::size_t misses;
+   };
+
 
    /** Converts and returns the element at index \c index on the stack to a
     *  \c LuaValue. This keeps the Lua stack untouched. Oh, yes, and it accepts
     *  both positive and negative indices, just like the standard functions on
     *  the Lua C API.
+    *  @note If a \c LuaStringPool is in use in the calling thread (see
+    *        \c LuaStringPool::Use), short strings are interned in it.
     *  @throw LuaTypeError If the element at \c index cannot be converted to a
     *         \c LuaValue. This can happen if the value at that position is, for
     *         example, a "Lua Thread" that is not supported by \c LuaValue.
@@ -49,9 +93,22 @@ namespace Diluculum
     *  @note If \c value holds a table, then any entry that happens to have
     *        \c Nil as key will be ignored. (Since Lua does not support \c nil
     *        as a table index.)
+    *  @note Functions implemented in Lua are loaded with \c lua_load(), which
+    *        is relatively expensive. So, each Lua state keeps a cache of the
+    *        functions already loaded, and pushing a \c LuaFunction whose
+    *        bytecode is in the cache just pushes the cached function. Only
+    *        functions without upvalues other than \c _ENV are cached (for
+    *        the others, sharing the function would also share the
+    *        upvalues). The cache doesn't keep the functions alive: it is a
+    *        weak table, cleaned by the garbage collector.
     */
    void PushLuaValue (lua_State* state, const LuaValue& value);
 
+   /** Returns the statistics of the cache of loaded Lua functions of
+    *  \c state. See \c PushLuaValue() for details on this cache.
+    */
+   LuaFunctionCacheStats GetLuaFunctionCacheStats (lua_State* state);
+
 } // namespace Diluculum
 
 #endif // _DILUCULUM_LUA_UTILS_HPP_
@@ -39,6 +39,12 @@
 
 namespace Diluculum
 {
+   namespace Impl
+   {
+      // Defined in 'LuaValue.cpp'
+      template <class T> struct SharedObject;
+   }
+
    /** A class that somewhat mimics a Lua value. Notice that a \c LuaValue is
     *  a C++-side thing. There is absolutely no relationship between a
     *  \c LuaValue and a Lua state. This is particularly important for tables
@@ -47,6 +53,24 @@ namespace Diluculum
     *  represents the value (hence the name!). So, if a \c LuaValue holds a
     *  table, then it contains a collection of keys and values. Similarly, if it
     *  holds a userdata, it actually contains a block of memory with some data.
+    *  <p>Strings, tables (stored as <tt>LuaTable</tt>s), functions and
+    *  userdata are stored in a reference-counted, copy-on-write way, though:
+    *  copying a \c LuaValue just makes both copies share the same object,
+    *  which is only duplicated when one of them is modified (through the
+    *  non-\c const subscript operator or the non-\c const \c asUserData()).
+    *  This is invisible to the user: once one of these non-\c const methods
+    *  hands out a reference into an object, that object is no longer shared,
+    *  and copies of its \c LuaValue get copies of it. (So, copying a table
+    *  that was filled through the subscript operator copies it; copies of
+    *  that copy share it again.)
+    *  <p>This keeps a \c LuaValue small (16 bytes on common platforms), which
+    *  matters when storing lots of them, as in big tables.
+    *  <p>Like in Lua 5.3, numbers have two subtypes: integers (64-bit, so that
+    *  large integral values are stored exactly) and floats (stored as
+    *  \c lua_Number). Both have type \c LUA_TNUMBER, and an integer is equal
+    *  to a float representing the same mathematical value (so, for example,
+    *  \c 1 and \c 1.0 are the same key in a table). Use \c isInteger() to
+    *  tell them apart.
     */
    class LuaValue
    {
@@ -57,51 +81,114 @@ namespace Diluculum
          /// Constructs a \c LuaValue with boolean type and \c b value.
          LuaValue (bool b);
 
-         /// Constructs a \c LuaValue with number type and \c n value.
+         /** Constructs a \c LuaValue with number type (float subtype) and
+          *  \c n value.
+          */
          LuaValue (float n);
 
-         /// Constructs a \c LuaValue with number type and \c n value.
+         /** Constructs a \c LuaValue with number type (float subtype) and
+          *  \c n value.
+          */
          LuaValue (double n);
 
-         /// Constructs a \c LuaValue with number type and \c n value.
+         /** Constructs a \c LuaValue with number type (float subtype) and
+          *  \c n value.
+          */
          LuaValue (long double n);
 
-         /// Constructs a \c LuaValue with number type and \c n value.
+         /** Constructs a \c LuaValue with number type (integer subtype)
+          *  and \c n value.
+          */
          LuaValue (short n);
 
-         /// Constructs a \c LuaValue with number type and \c n value.
+         /** Constructs a \c LuaValue with number type (integer subtype)
+          *  and \c n value.
+          */
          LuaValue (unsigned short n);
 
-         /// Constructs a \c LuaValue with number type and \c n value.
+         /** Constructs a \c LuaValue with number type (integer subtype)
+          *  and \c n value.
+          */
          LuaValue (int n);
 
-         /// Constructs a \c LuaValue with number type and \c n value.
+         /** Constructs a \c LuaValue with number type (integer subtype)
+          *  and \c n value.
+          */
          LuaValue (unsigned n);
 
-         /// Constructs a \c LuaValue with number type and \c n value.
+         /** Constructs a \c LuaValue with number type (integer subtype)
+          *  and \c n value.
+          */
          LuaValue (long n);
 
-         /// Constructs a \c LuaValue with number type and \c n value.
+         /** Constructs a \c LuaValue with number type (integer subtype)
+          *  and \c n value. (As for <tt>unsigned long long</tt>, the
+          *  subtype is float if \c n doesn't fit in a <tt>long long</tt>.)
+          */
          LuaValue (unsigned long n);
 
+         /** Constructs a \c LuaValue with number type (integer subtype)
+          *  and \c n value.
+          */
+         LuaValue (long long n);
+
+         /** Constructs a \c LuaValue with number type and \c n value. The
+          *  subtype is integer if \c n fits in a <tt>long long</tt>, and
+          *  float otherwise.
+          */
+         LuaValue (unsigned long long n);
+
          /// Constructs a \c LuaValue with string type and \c s value.
          LuaValue (const std::string& s);
 
+         /** Constructs a \c LuaValue with string type and \c s value. The
+          *  contents of \c s are moved into the \c LuaValue.
+          */
+         LuaValue (std::string&& s);
+
          /// Constructs a \c LuaValue with string type and \c s value.
          LuaValue (const char* s);
 
          /// Constructs a \c LuaValue with table type and \c t value.
+         LuaValue (const LuaTable& t);
+
+         /** Constructs a \c LuaValue with table type and \c t value. The
+          *  contents of \c t are moved into the \c LuaValue, so this doesn't
+          *  copy any key or value.
+          */
+         LuaValue (LuaTable&& t);
+
+         /** Constructs a \c LuaValue with table type and \c t value. The
+          *  \c LuaValueMap is converted to a \c LuaTable.
+          */
          LuaValue (const LuaValueMap& t);
 
+         /** Constructs a \c LuaValue with table type and \c t value. The
+          *  \c LuaValueMap is converted to a \c LuaTable, with the values
+          *  (but not the keys, which are \c const in a \c LuaValueMap) moved
+          *  from \c t.
+          */
+         LuaValue (LuaValueMap&& t);
+
          /// Constructs a \c LuaValue with function type and \c f value.
          LuaValue (lua_CFunction f);
 
          /// Constructs a \c LuaValue with function type and \c f value.
          LuaValue (const LuaFunction& f);
 
+         /** Constructs a \c LuaValue with function type and \c f value. The
+          *  bytecode owned by \c f is moved into the \c LuaValue.
+          */
+         LuaValue (LuaFunction&& f);
+
          /// Constructs a \c LuaValue with "user data" type and \c ud value.
          LuaValue (const LuaUserData& ud);
 
+         /** Constructs a \c LuaValue with "user data" type and \c ud value.
+          *  The memory block owned by \c ud is moved into the \c LuaValue.
+          */
+         LuaValue (LuaUserData&& ud);
+
          /** Constructs a \c LuaValue from a \c LuaValueList. The first value on
           *  the list is used to initialize the \c LuaValue. If the
           *  \c LuaValueList is empty, initializes the constructed \c LuaValue
@@ -109,15 +196,32 @@ namespace Diluculum
           */
          LuaValue (const LuaValueList& v);
 
+         /** Constructs a \c LuaValue from a \c LuaValueList that is about to
+          *  be destroyed. Like the version taking a \c const reference, but
+          *  the first value on the list is moved instead of copied.
+          */
+         LuaValue (LuaValueList&& v);
+
          /// Copy constructor.
          LuaValue (const LuaValue& other);
 
+         /** Move constructor. Takes over whatever is stored in \c other
+          *  (strings, tables, functions and user data are not copied), and
+          *  leaves \c other with a \c nil value.
+          */
+         LuaValue (LuaValue&& other) noexcept;
+
          /// Destroys the \c LuaValue, freeing all the resources owned by it.
          ~LuaValue() { destroyObjectAtData(); }
 
          /// Assignment operator.
          LuaValue& operator= (const LuaValue& rhs);
 
+         /** Move assignment operator. Takes over whatever is stored in \c rhs
+          *  and leaves \c rhs with a \c nil value.
+          */
+         LuaValue& operator= (LuaValue&& rhs) noexcept;
+
          /** Assigns a \c LuaValueList to a \c LuaValue. The first value on
           *  the list is used to initialize the \c LuaValue. If the
           *  \c LuaValueList is empty, sets the \c LuaValue to \c Nil.
@@ -129,6 +233,13 @@ namespace Diluculum
           */
          int type() const { return dataType_; }
 
+         /** Checks whether this \c LuaValue holds a number with the integer
+          *  subtype. (For anything else, including numbers with the float
+          *  subtype, returns \c false.)
+          */
+         bool isInteger() const
+         { return dataType_ == LUA_TNUMBER && isInteger_; }
+
          /** Returns the type of this \c LuaValue as a string, just like the Lua
           *  built-in function \c type().
           *  @return One of the following strings: <tt>"nil"</tt>,
@@ -137,13 +248,15 @@ namespace Diluculum
           */
          std::string typeName() const;
 
-         /** Return the value as a number.
+         /** Return the value as a number. (Integers are converted to
+          *  \c lua_Number.)
           *  @throw TypeMismatchError If the value is not a number (this is a
           *         strict check; no type conversion is performed).
           */
          lua_Number asNumber() const;
 
-         /** Return the value as an integer.
+         /** Return the value as an integer. Integers are returned exactly
+          *  (as long as they fit in a \c lua_Integer); floats are truncated.
           *  @throw TypeMismatchError If the value is not a number (this is a
           *         strict check; no type conversion is performed -- no other
           *         than the conversion from \c lua_Number to \c lua_Integer,
@@ -164,15 +277,26 @@ namespace Diluculum
          bool asBoolean() const;
 
          /** Returns the value as a table (\c LuaValueMap).
-          *  @note Notice that the table is returned by value. You may strongly
+          *  @note Notice that the table is returned by value, and converted
+          *        from the \c LuaTable actually stored. You may strongly
           *        consider using the subscript operator (that returns a
-          *        reference) for accessing the values stored in a table-typed
-          *        \c LuaValue.
+          *        reference) or \c asTableRef() for accessing the values
+          *        stored in a table-typed \c LuaValue.
           *  @throw TypeMismatchError If the value is not a table (this is a
           *         strict check; no type conversion is performed).
           */
          LuaValueMap asTable() const;
 
+         /** Returns a \c const reference to the table (\c LuaTable) stored
+          *  in this \c LuaValue. Unlike \c asTable(), this doesn't copy
+          *  anything, so it is the way to go for iterating over a table.
+          *  @note The returned reference is valid as long as this \c LuaValue
+          *        isn't modified or destroyed.
+          *  @throw TypeMismatchError If the value is not a table (this is a
+          *         strict check; no type conversion is performed).
+          */
+         const LuaTable& asTableRef() const;
+
          /** Return the value as a \c const Lua function.
           *  @throw TypeMismatchError If the value is not a Lua function.
           *         (this is a strict check; no type conversion is performed).
@@ -188,7 +312,11 @@ namespace Diluculum
          /** Return the value as a (full) user data.
           *  @note Since this is returned as a non-\c const reference, the
           *        \c LuaUserData::getData() method can be used to get
-          *        read/write access to the raw user data.
+          *        read/write access to the raw user data. If the user data is
+          *        shared with other <tt>LuaValue</tt>s, it is copied before
+          *        returning, so that changes affect only this \c LuaValue.
+          *        Later copies of this \c LuaValue get copies of the user
+          *        data, too.
           *  @throw TypeMismatchError If the value is not a (full) user data
           *         (this is a strict check; no type conversion is performed).
           */
@@ -215,36 +343,46 @@ namespace Diluculum
                static_cast<Impl::CppObject*>(asUserData().getData())->ptr);
          }
 
-         /** "Less than" operator for <tt>LuaValue</tt>s.
-          *  @return The order relationship is quite arbitrary for
-          *          <tt>LuaValue</tt>s, but this has to be defined in order to
-          *          \c LuaValueMap work nicely. Anyway, here are the rules used
-          *          to determine who is less than who:
-          *          - First, \c typeName() is called for both
-          *            <tt>LuaValue</tt>s and they are compared with the usual
-          *            "less than" operator for strings.
-          *          - If both type names are equal, but something different
+         /** Compares this \c LuaValue with another one. This is the single
+          *  comparison on which the relational operators are based.
+          *  @return A negative number if <tt>*this</tt> is "less than" \c rhs,
+          *          a positive number if it is "greater than" \c rhs and zero
+          *          if both are equal. The order relationship is quite
+          *          arbitrary for <tt>LuaValue</tt>s, but this has to be
+          *          defined in order to \c LuaValueMap work nicely. Anyway,
+          *          here are the rules used to determine who is less than who:
+          *          - First, the types are compared. The order of types is
+          *            the alphabetical order of their names (as returned by
+          *            \c typeName()): <tt>"boolean"</tt>, <tt>"function"</tt>,
+          *            <tt>"nil"</tt>, <tt>"number"</tt>, <tt>"string"</tt>,
+          *            <tt>"table"</tt>, <tt>"userdata"</tt>.
+          *          - If both types are equal, but something different
           *            than <tt>"nil"</tt> and <tt>"table"</tt>, then the values
           *            contained in the <tt>LuaValue</tt>s are compared using
           *            the "less than" operator for that type.
-          *          - If both type names are <tt>"nil"</tt>, the function
-          *            returns \c false.
-          *          - If both type names are <tt>"table"</tt>, then the number
-          *            of elements in each table are compared. The shorter table
-          *            is "less than" the larger table.
+          *          - Two \c nil values are equal.
+          *          - If both values are tables, then the number of elements
+          *            in each table are compared. The shorter table is "less
+          *            than" the larger table.
           *          - If both tables have the same size, then each entry is
           *            recursively compared (that is, using the rules described
-          *            here). For each entry, the key is compared first, than
-          *            the value. This is done until finding something "less
-          *            than" the other thing.
-          *          - If no differences are found, \c false is obviously
-          *            returned.
+          *            here), in increasing key order (regardless of how the
+          *            tables store their entries). For each entry, the key is
+          *            compared first, than the value. This is done until
+          *            finding something "less than" the other thing.
+          *          - If no differences are found, the values are equal.
+          */
+         int compare (const LuaValue& rhs) const;
+
+         /** "Less than" operator for <tt>LuaValue</tt>s.
+          *  @return <tt>compare(rhs) < 0</tt>. (But numbers and strings, which
+          *          are the most common keys in a \c LuaValueMap, are compared
+          *          directly.)
           */
          bool operator< (const LuaValue& rhs) const;
 
          /** "Greater than" operator for <tt>LuaValue</tt>s.
-          *  @return The rules for determining who is greater than who are
-          *          similar to the ones described in \c operator<.
+          *  @return <tt>rhs < *this</tt>. See \c compare() for the rules.
           */
          bool operator> (const LuaValue& rhs) const;
 
@@ -261,10 +399,31 @@ namespace Diluculum
          bool operator!= (const LuaValue& rhs) const
          { return !(*this == rhs); }
 
+         /** Returns a hash for this \c LuaValue, used by \c LuaTable. Values
+          *  that are equal (according to \c operator==()) have equal hashes.
+          */
+         std::size_t hash() const;
+
          /** Returns a reference to a field of this \c LuaValue (assuming it is
           *  a table). If there is no value associated with the key passed as
           *  parameter, inserts a new value (\c nil) and returns a reference to
           *  it.
+          *  @note If the table is shared with other <tt>LuaValue</tt>s, it is
+          *        copied before returning, so that changes made through the
+          *        returned reference affect only this \c LuaValue. From then
+          *        on, copies of this \c LuaValue get copies of the table
+          *        instead of sharing it, so changes made through the returned
+          *        reference never show up in them either (and storing this
+          *        \c LuaValue into its own table stores a copy of it).
+          *  @warning The returned reference is invalidated by any insertion
+          *           of a new key into the table (the table may move its
+          *           values around, just like a \c std::vector). So,
+          *           <tt>t[1] = t[2]</tt> is only safe when both keys already
+          *           exist; otherwise, copy the value in a separate
+          *           statement first, as in <tt>LuaValue v = t[2];
+          *           t[1] = v;</tt>. Likewise, a reference kept as in
+          *           <tt>LuaValue& x = t["x"]</tt> must not be used after
+          *           something like <tt>t["y"] = 1</tt>.
           *  @throw TypeMismatchError If this \c LuaValue does not hold a table.
           */
          LuaValue& operator[] (const LuaValue& key);
@@ -278,33 +437,54 @@ namespace Diluculum
 
       private:
 
-         /** Destroys the object allocated at the \c data_ member, freeing its
-          *  resources.
+         /** Releases the object referenced by the \c data_ member (if any),
+          *  destroying it if this was the last reference to it.
           */
          void destroyObjectAtData();
 
-         /// This is used just to know the size of the \c data_ member.
-         union PossibleTypes
+         /** Moves the data stored at the \c data_ member of \c other to the
+          *  \c data_ member of \c this, and sets \c other to \c nil.
+          *  @note This assumes that there is no object referenced by
+          *        <tt>this->data_</tt> (in other words,
+          *        \c destroyObjectAtData() must be called before, if
+          *        necessary).
+          */
+         void moveObjectToData (LuaValue& other) noexcept;
+
+         /** Compares two numbers (of any subtype), like \c compare().
+          *  @note This assumes that both <tt>*this</tt> and \c rhs hold
+          *        numbers.
+          */
+         int compareNumbers (const LuaValue& rhs) const;
+
+         /** The actual data of a \c LuaValue. Types that fit in 64 bits are
+          *  stored directly; all others are stored in reference-counted
+          *  objects allocated in the heap.
+          */
+         union Data
          {
-               lua_Number typeNumber;
-               char typeString[sizeof(std::string)];
-               bool typeBool;
-               char typeLuaValueMap[sizeof(LuaValueMap)];
-               char typeFunction[sizeof(LuaFunction)];
-               char typeUserData[sizeof(LuaUserData)];
+            lua_Number number;
+            long long integer;
+            bool boolean;
+            Impl::SharedObject<std::string>* string;
+            Impl::SharedObject<LuaTable>* table;
+            Impl::SharedObject<LuaFunction>* function;
+            Impl::SharedObject<LuaUserData>* userData;
          };
 
-         /** This stores the actual data of this \c LuaValue.
-          *  <p>Implementation details: This member is large enough to store the
-          *  largest value. The values are allocated here using placement new,
-          *  with destructors explicitly called whenever necessary.
-          */
-         char data_[sizeof(PossibleTypes)];
+         /// This stores the actual data of this \c LuaValue.
+         Data data_;
 
          /** The actual type stored in this \c LuaValue. The values here are the
           *  type constants defined by Lua, like \c LUA_TNUMBER and \c LUA_TNIL.
           */
          int dataType_;
+
+         /** If \c dataType_ is \c LUA_TNUMBER, tells whether the number is
+          *  an integer (stored as a <tt>long long</tt>) or a float (stored as
+          *  a \c lua_Number). Meaningless for other types.
+          */
+         bool isInteger_ = false;
    };
 
 
@@ -321,4 +501,7 @@ namespace Diluculum
 } // namespace Diluculum
 
 
+// Users of 'LuaValue' typically need the complete 'LuaTable', too
+#include <Diluculum/LuaTable.hpp>
+
 #endif // _DILUCULUM_LUA_VALUE_HPP_
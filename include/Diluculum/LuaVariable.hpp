@@ -28,6 +28,7 @@
 #define _DILUCULUM_LUA_VARIABLE_HPP_
 
 #include <vector>
+#include <Diluculum/LuaTraits.hpp>
 #include <Diluculum/LuaValue.hpp>
 
 
@@ -43,6 +44,7 @@ namespace Diluculum
    class LuaVariable
    {
       friend class LuaState;
+      friend class LuaRef;
 
       public:
          /** Assigns a new value to this \c LuaVariable. The corresponding
@@ -75,6 +77,38 @@ namespace Diluculum
           */
          LuaValue value() const;
 
+         /** Returns the value associated with this variable, converted
+          *  directly from Lua to a \c T with \c LuaTraits (so that no
+          *  \c LuaValue is created). For example,
+          *  <tt>ls["config"]["sizes"].get<std::vector<int>>()</tt>.
+          *  @throw TypeMismatchError If this \c LuaVariable tries to subscript
+          *         something that is not a table, or if the value cannot be
+          *         converted to a \c T.
+          */
+         template <class T>
+         T get() const
+         {
+            pushTheReferencedValue();
+            Impl::PopOnExit popValue (state_, 1);
+            return LuaTraits<T>::get (state_, -1);
+         }
+
+         /** Assigns a new value to this variable, converted directly to Lua
+          *  with \c LuaTraits (so that no \c LuaValue is created). This is
+          *  otherwise like the assignment operator.
+          *  @throw TypeMismatchError If this \c LuaVariable tries to subscript
+          *         something that is not a table.
+          */
+         template <class T>
+         void set (const T& value)
+         {
+            pushLastTable();
+            PushLuaValue (state_, keys_.back());
+            LuaTraits<typename std::decay<T>::type>::push (state_, value);
+            lua_settable (state_, -3);
+            lua_pop (state_, 1);
+         }
+
          /** Assuming that this \c LuaVariable holds a table, returns the value
           *  whose index is \c key.
           *  @param key The key whose value is desired.
@@ -214,6 +248,62 @@ namespace Diluculum
                                   const LuaValue& param4,
                                   const LuaValue& param5);
 
+         /** Assuming that this \c LuaVariable holds a function, calls this
+          *  function and stores its return values in \c results. Exactly
+          *  \c numResults values are requested from Lua (missing ones are
+          *  \c Nil, extra ones are discarded without being converted), or
+          *  all of them if \c numResults is \c LUA_MULTRET.
+          *  <p>The previous contents of \c results are discarded, but its
+          *  capacity is reused. So, when the same \c results is passed
+          *  repeatedly, the list itself is not reallocated.
+          *  @param params The parameters to be passed to the function.
+          *  @param results Where the values returned by the function are
+          *         stored. This can be the same list as \c params.
+          *  @param numResults The number of results wanted.
+          *  @throw TypeMismatchError If this \c LuaVariable tries to subscript
+          *         something that is not a table.
+          *  @throw LuaRunTimeError If something bad happens while executing the
+          *         function.
+          */
+         void callInto (const LuaValueList& params, LuaValueList& results,
+                        int numResults = LUA_MULTRET);
+
+         /** Assuming that this \c LuaVariable holds a function, calls this
+          *  function, discarding its return values. Lua is asked for no
+          *  results at all, so nothing is converted or allocated for them.
+          *  This is the cheapest way to call functions whose results are
+          *  not needed (like event handlers).
+          *  @param params The parameters to be passed to the function.
+          *  @throw TypeMismatchError If this \c LuaVariable tries to subscript
+          *         something that is not a table.
+          *  @throw LuaRunTimeError If something bad happens while executing the
+          *         function.
+          */
+         void callAndDiscard (const LuaValueList& params = LuaValueList());
+
+         /** Assuming that this \c LuaVariable holds a function, calls this
+          *  function, passing \c args and expecting results of the types
+          *  \c R. Unlike the other ways to call functions, the arguments and
+          *  results are converted directly to and from the Lua stack with
+          *  \c LuaTraits, without creating any \c LuaValue, and exactly
+          *  <tt>sizeof...(R)</tt> results are requested from Lua (missing
+          *  results are \c nil, extra ones are discarded). For example,
+          *  <tt>int s = ls["add"].call<int>(1, 2);</tt>.
+          *  @return Nothing if \c R is empty, the result if there is just
+          *          one, or a \c std::tuple of the results otherwise.
+          *  @throw TypeMismatchError If this \c LuaVariable tries to subscript
+          *         something that is not a table, if it doesn't hold a
+          *         function, or if a result doesn't have the expected type.
+          *  @throw LuaRunTimeError If something bad happens while executing the
+          *         function.
+          */
+         template <class... R, class... Args>
+         typename Impl::CallResults<R...>::type call (const Args&... args)
+         {
+            pushTheReferencedValue();
+            return Impl::CallWithTraits<R...> (state_, args...);
+         }
+
          /** Checks whether the value stored in this variable is equal to the
           *  value at \c rhs.
           *  @param rhs The value against which the comparison will be done.
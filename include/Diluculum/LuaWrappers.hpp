@@ -122,6 +122,7 @@ int DILUCULUM_WRAPPER_FUNCTION(FUNC) (lua_State* ls)                          \
       /* Read parameters and empty the stack */                               \
       const int numParams = lua_gettop (ls);                                  \
       Diluculum::LuaValueList params;                                         \
+      params.reserve (numParams);                                             \
       for (int i = 1; i <= numParams; ++i)                                    \
          params.push_back (Diluculum::ToLuaValue (ls, i));                    \
       lua_pop (ls, numParams);                                                \
@@ -180,6 +181,7 @@ int Diluculum__ ## CLASS ## __Constructor_Wrapper_Function (lua_State* ls)    \
       /* Read parameters and empty the stack */                               \
       const int numParams = lua_gettop (ls);                                  \
       Diluculum::LuaValueList params;                                         \
+      params.reserve (numParams);                                             \
       for (int i = 1; i <= numParams; ++i)                                    \
          params.push_back (Diluculum::ToLuaValue (ls, i));                    \
       lua_pop (ls, numParams);                                                \
@@ -258,6 +260,7 @@ int DILUCULUM_METHOD_WRAPPER(CLASS, METHOD) (lua_State* ls)                   \
       const int numParams = lua_gettop (ls);                                  \
       Diluculum::LuaValue ud = Diluculum::ToLuaValue (ls, 1);                 \
       Diluculum::LuaValueList params;                                         \
+      params.reserve (numParams);                                             \
       for (int i = 2; i <= numParams; ++i)                                    \
          params.push_back (Diluculum::ToLuaValue (ls, i));                    \
       lua_pop (ls, numParams);                                                \
@@ -28,22 +28,30 @@
 #define _DILUCULUM_TYPES_HPP_
 
 #include <map>
-#include <vector>
+#include <boost/container/small_vector.hpp>
 
 
 namespace Diluculum
 {
    class LuaValue;
+   class LuaTable;
 
    /** A list of <tt>LuaValue</tt>s. Used, for example, to represent the return
     *  value of a Lua function call. In this case, the first return value is
     *  stored at the 0th \c vector position, the second return value at the 1st
     *  \c vector position and so on.
+    *  <p>This is a vector with room for a few values inside the list object
+    *  itself, so that the typical lists of parameters and return values
+    *  don't need any heap allocation. Its interface is that of
+    *  \c std::vector.
     */
-   typedef std::vector<LuaValue> LuaValueList;
+   typedef boost::container::small_vector<LuaValue, 4> LuaValueList;
 
-   /** Type mapping from <tt>LuaValue</tt>s to <tt>LuaValue</tt>s. Think of it
-    *  as a C++ approximation of a Lua table.
+   /** Type mapping from <tt>LuaValue</tt>s to <tt>LuaValue</tt>s, sorted by
+    *  key. Think of it as a C++ approximation of a Lua table. (Tables are
+    *  actually stored as <tt>LuaTable</tt>s, which are faster; conversions
+    *  from and to \c LuaValueMap are provided for convenience and
+    *  compatibility.)
     */
    typedef std::map<LuaValue, LuaValue> LuaValueMap;
 